@@ -1,16 +1,52 @@
 #include "../lib/app.hpp"
+#ifdef TCP_LIBUV_COROUTINES
+#include "coro_client.hpp"
+#endif
 
+#include <algorithm>
 #include <iostream>
+#include <string>
 
 using namespace sample;
 using namespace std;
 
-int main()
+int main(int argn, char ** argc)
 {
     cout << "TCP LibUV Client" << endl;
 
+    AppParams appParams(5000, 5);
+    bool coro = false;
+    for (int i = 0; i < argn; ++i)
+    {
+        if (string(argc[i]) == "-pipeline")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.pipelineDepth = std::max(std::stoi(argc[i]), 1);
+        }
+        else if (string(argc[i]) == "-coro")
+        {
+            coro = true;
+        }
+    }
+
+#ifdef TCP_LIBUV_COROUTINES
+    if (coro)
+    {
+        CoClientApp app;
+        app.start(appParams);
+        cout << "Done." << endl;
+        return 0;
+    }
+#else
+    if (coro)
+    {
+        cerr << "Coroutine client not built, see TCP_LIBUV_COROUTINES" << endl;
+    }
+#endif
+
     ClientApp app;
-    app.start(AppParams(5000, 5));
+    app.start(appParams);
 
     //cout << "Press Enter to exit ...";
     //cin.get();
@@ -0,0 +1,61 @@
+#include "coro_client.hpp"
+
+#include "../lib/net_handler.hpp"
+
+#include <iostream>
+
+using namespace sample;
+using namespace std;
+
+
+CoClientApp::CoClientApp() :
+BaseApp()
+{
+}
+
+void CoClientApp::start(AppParams const & appParams_in)
+{
+    int n = 3;
+    for (int i = 0; i < n; ++i)
+    {
+        auto conn = make_shared<CoConnection>(this, "localhost", appParams_in.listenPort + i);
+        myClients.push_back(conn);
+        runClient(conn, 3 + i);
+    }
+
+    // run the loop, until all are done
+    NetHandler::runLoop();
+    myClients.clear();
+}
+
+CoTask CoClientApp::runClient(shared_ptr<CoConnection> conn_in, int pingToSend_in)
+{
+    int res = co_await conn_in->connect();
+    if (res)
+    {
+        co_return;
+    }
+    co_await conn_in->send(HandshakeMessage("V01", conn_in->getPeerAddr(), getName()));
+    auto resp = co_await conn_in->read_message();
+    if (resp == nullptr)
+    {
+        co_return;
+    }
+    cout << "App: Received: from " << conn_in->getPeerAddr() << " '" << resp->toString() << "'" << endl;
+    for (int i = 0; i < pingToSend_in; ++i)
+    {
+        res = co_await conn_in->send(PingMessage("Ping_from_" + getName() + "_to_" + conn_in->getPeerAddr() + "_" + to_string(i + 1)));
+        if (res)
+        {
+            break;
+        }
+        resp = co_await conn_in->read_message();
+        if (resp == nullptr)
+        {
+            break;
+        }
+        cout << "App: Received: from " << conn_in->getPeerAddr() << " '" << resp->toString() << "'" << endl;
+        co_await sample::sleep(100);
+    }
+    conn_in->close();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../lib/app.hpp"
+#include "../lib/coro.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace sample
+{
+    /**
+     * Client app with the connection logic written as coroutines (see lib/coro.hpp).
+     */
+    class CoClientApp: public BaseApp
+    {
+    public:
+        CoClientApp();
+        /// Start the clients, connect, process events
+        virtual void start(AppParams const & appParams_in);
+        void inConnectionReceived(std::shared_ptr<NetClientBase>& client_in) { }
+        void connectionClosed(NetClientBase* client_in) { }
+        void messageReceived(NetClientBase & client_in, BaseMessage const & msg_in) { }
+
+    private:
+        /// Handshake, then Pings one after the other
+        CoTask runClient(std::shared_ptr<CoConnection> conn_in, int pingToSend_in);
+
+    private:
+        std::vector<std::shared_ptr<CoConnection>> myClients;
+    };
+}
@@ -0,0 +1,317 @@
+#include "discovery_sim.hpp"
+
+#include "../lib/net_client.hpp"
+
+#include <uv.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <set>
+#include <thread>
+
+using namespace sample;
+using namespace std;
+
+
+DiscoverySim::DiscoverySim(DiscoveryParams const & params_in) :
+myParams(params_in),
+myRandom(params_in.seed)
+{
+    if (myParams.transport == "sim")
+    {
+        myNetwork.reset(new SimNetwork(myParams.seed));
+        myNetwork->setDefaultLinkParams(myParams.link);
+    }
+}
+
+DiscoverySim::~DiscoverySim()
+{
+    if (isSimulated())
+    {
+        // nothing runs once the network is gone
+        for (auto i = myNodes.begin(); i != myNodes.end(); ++i)
+        {
+            (*i)->stop();
+        }
+        myNodes.clear();
+        return;
+    }
+    // all at once, a busy node would delay the others
+    vector<thread> stoppers;
+    for (auto i = myNodes.begin(); i != myNodes.end(); ++i)
+    {
+        NodeApp* node = *i;
+        stoppers.push_back(thread([node]() { node->stop(); }));
+    }
+    for (auto i = stoppers.begin(); i != stoppers.end(); ++i)
+    {
+        i->join();
+    }
+    // not deleted: closed handles still refer to them
+    myNodes.clear();
+}
+
+int DiscoverySim::getPartialDiscoveryTarget() const
+{
+    int others = myParams.nodes - 1;
+    if (myParams.activeViewSize == 0)
+    {
+        return others;
+    }
+    // shuffles keep replacing passive entries, the views are not all filled up, with any number of nodes
+    int active = std::min(others, myParams.activeViewSize);
+    int passive = std::min(others - active, std::max(myParams.passiveViewSize, myParams.activeViewSize));
+    return active + passive * MinPassiveFillPercent / 100;
+}
+
+int DiscoverySim::getViewCapacity() const
+{
+    int others = myParams.nodes - 1;
+    if (myParams.activeViewSize == 0)
+    {
+        return others;
+    }
+    return std::min(others, myParams.activeViewSize + std::max(myParams.passiveViewSize, myParams.activeViewSize));
+}
+
+string DiscoverySim::getNodeHost(int node_in) const
+{
+    if (!isSimulated())
+    {
+        return "localhost";
+    }
+    int host = node_in + 1;
+    return "10." + to_string((host >> 16) & 255) + "." + to_string((host >> 8) & 255) + "." + to_string(host & 255);
+}
+
+string DiscoverySim::getNodeEndpoint(int node_in) const
+{
+    return getNodeHost(node_in) + ":" + to_string(isSimulated() ? myParams.basePort : myParams.basePort + node_in);
+}
+
+vector<string> DiscoverySim::getInitialPeers(int node_in)
+{
+    vector<string> peers;
+    if (node_in == 0)
+    {
+        return peers;
+    }
+    int peer = node_in - 1;
+    if (myParams.topology == "star")
+    {
+        peer = 0;
+    }
+    else if (myParams.topology == "random")
+    {
+        uniform_int_distribution<int> pick(0, node_in - 1);
+        peer = pick(myRandom);
+    }
+    peers.push_back(getNodeEndpoint(peer));
+    return peers;
+}
+
+int DiscoverySim::getNodeIndex(string const & endpoint_in) const
+{
+    size_t sep = endpoint_in.rfind(':');
+    if (sep == string::npos)
+    {
+        return -1;
+    }
+    int port = std::atoi(endpoint_in.c_str() + sep + 1);
+    int idx = port - myParams.basePort;
+    if (isSimulated())
+    {
+        int a = 0, b = 0, c = 0, d = 0;
+        if (port != myParams.basePort || std::sscanf(endpoint_in.c_str(), "%d.%d.%d.%d:", &a, &b, &c, &d) != 4 || a != 10)
+        {
+            return -1;
+        }
+        idx = ((b << 16) | (c << 8) | d) - 1;
+    }
+    if (idx < 0 || idx >= myParams.nodes)
+    {
+        return -1;
+    }
+    return idx;
+}
+
+int DiscoverySim::countSimPeers(int node_in, vector<string> const & peers_in) const
+{
+    set<int> found;
+    for (auto i = peers_in.begin(); i != peers_in.end(); ++i)
+    {
+        int idx = getNodeIndex(*i);
+        if (idx >= 0 && idx != node_in)
+        {
+            found.insert(idx);
+        }
+    }
+    return (int)found.size();
+}
+
+bool DiscoverySim::isOverlayConnected(vector<NodeStatus> const & status_in) const
+{
+    // links of connections or active views, either direction
+    int n = (int)status_in.size();
+    vector<vector<int>> links(n);
+    for (int i = 0; i < n; ++i)
+    {
+        vector<string> const & peers = myParams.activeViewSize > 0 ? status_in[i].activePeers : status_in[i].connectedPeers;
+        for (auto p = peers.begin(); p != peers.end(); ++p)
+        {
+            int idx = getNodeIndex(*p);
+            if (idx >= 0 && idx != i)
+            {
+                links[i].push_back(idx);
+                links[idx].push_back(i);
+            }
+        }
+    }
+    vector<bool> reached(n, false);
+    deque<int> toVisit;
+    toVisit.push_back(0);
+    reached[0] = true;
+    int reachedCount = 1;
+    while (!toVisit.empty())
+    {
+        int node = toVisit.front();
+        toVisit.pop_front();
+        for (auto i = links[node].begin(); i != links[node].end(); ++i)
+        {
+            if (!reached[*i])
+            {
+                reached[*i] = true;
+                ++reachedCount;
+                toVisit.push_back(*i);
+            }
+        }
+    }
+    return reachedCount == n;
+}
+
+int64_t DiscoverySim::runFor(int durationMs_in, uint64_t start_in)
+{
+    if (isSimulated())
+    {
+        myNetwork->runFor(durationMs_in);
+    }
+    else
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(durationMs_in));
+    }
+    return getElapsedMs(start_in);
+}
+
+int64_t DiscoverySim::getElapsedMs(uint64_t start_in) const
+{
+    if (isSimulated())
+    {
+        return (int64_t)myNetwork->getNowMs();
+    }
+    return (int64_t)((::uv_hrtime() - start_in) / 1000000);
+}
+
+DiscoveryResult DiscoverySim::run()
+{
+    DiscoveryResult result;
+    result.nodes = myParams.nodes;
+    int target = getViewCapacity();
+    int partialTarget = getPartialDiscoveryTarget();
+    uint64_t messagesBefore = NetClientBase::getSentMessageCount();
+    uint64_t bytesBefore = NetClientBase::getSentByteCount();
+    uint64_t start = ::uv_hrtime();
+
+    for (int i = 0; i < myParams.nodes; ++i)
+    {
+        AppParams appParams(getInitialPeers(i), isSimulated() ? myParams.basePort : myParams.basePort + i, 1);
+        appParams.activeViewSize = myParams.activeViewSize;
+        appParams.passiveViewSize = myParams.passiveViewSize;
+        appParams.randomSeed = myParams.seed * 1000003 + (uint32_t)i + 1;
+        NodeApp* node = new NodeApp();
+        if (isSimulated())
+        {
+            node->useSimulation(*myNetwork, getNodeHost(i));
+        }
+        else
+        {
+            node->useOwnLoop();
+        }
+        node->start(appParams);
+        myNodes.push_back(node);
+    }
+
+    vector<NodeStatus> status(myParams.nodes);
+    while (true)
+    {
+        int64_t elapsedMs = runFor(myParams.pollMs, start);
+        // a busy node may answer late: wait until the end of the run, but a poll period at least
+        int64_t pollDeadlineMs = std::max((int64_t)myParams.timeoutMs, getElapsedMs(start) + myParams.pollMs);
+        bool discovered = true;
+        bool partlyDiscovered = true;
+        for (int i = 0; i < myParams.nodes; ++i)
+        {
+            int waitMs = (int)std::max(pollDeadlineMs - getElapsedMs(start), (int64_t)0);
+            if (myNodes[i]->getStatus(status[i], waitMs) != 0)
+            {
+                // no answer, the previous status is kept
+                ++result.statusTimeouts;
+                discovered = false;
+                partlyDiscovered = false;
+                continue;
+            }
+            int known = countSimPeers(i, status[i].knownPeers);
+            if (known < target)
+            {
+                discovered = false;
+            }
+            if (known < partialTarget)
+            {
+                partlyDiscovered = false;
+            }
+        }
+        result.overlayConnected = isOverlayConnected(status);
+        if (result.overlayConnected && result.connectedMs < 0)
+        {
+            result.connectedMs = elapsedMs;
+        }
+        if (discovered && result.discoveryMs < 0)
+        {
+            result.discoveryMs = elapsedMs;
+        }
+        if (partlyDiscovered && result.partialDiscoveryMs < 0)
+        {
+            result.partialDiscoveryMs = elapsedMs;
+        }
+        bool done = result.discoveryMs >= 0 && result.connectedMs >= 0;
+        if (done || getElapsedMs(start) >= myParams.timeoutMs)
+        {
+            result.converged = done;
+            break;
+        }
+    }
+
+    result.wallMs = (int64_t)((::uv_hrtime() - start) / 1000000);
+    result.messages = NetClientBase::getSentMessageCount() - messagesBefore;
+    result.bytes = NetClientBase::getSentByteCount() - bytesBefore;
+    result.connMin = myParams.nodes > 0 ? (int)status[0].connectedPeers.size() : 0;
+    int connSum = 0;
+    for (auto i = status.begin(); i != status.end(); ++i)
+    {
+        int conns = (int)i->connectedPeers.size();
+        result.connMin = std::min(result.connMin, conns);
+        result.connMax = std::max(result.connMax, conns);
+        connSum += conns;
+    }
+    result.connAvg = myParams.nodes > 0 ? (double)connSum / myParams.nodes : 0;
+    int capacity = getViewCapacity();
+    double fillSum = 0;
+    for (int i = 0; i < myParams.nodes; ++i)
+    {
+        fillSum += capacity > 0 ? 100.0 * std::min(countSimPeers(i, status[i].knownPeers), capacity) / capacity : 100.0;
+    }
+    result.viewFill = myParams.nodes > 0 ? fillSum / myParams.nodes : 0;
+    return result;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "../node/node.hpp"
+#include "../lib/sim_network.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace sample
+{
+    /// Parameters of one discovery simulation run
+    struct DiscoveryParams
+    {
+    public:
+        DiscoveryParams() : nodes(16), basePort(6000), activeViewSize(0), passiveViewSize(30), topology("chain"), seed(1), timeoutMs(60000), pollMs(100), transport("tcp") { }
+        int nodes;
+        /// tcp: nodes listen on loopback, on basePort .. basePort + nodes - 1; sim: each node is a host 10.x.y.z, all on basePort
+        int basePort;
+        /// 0: every node connects to every known peer; otherwise membership (HyParView) view sizes
+        int activeViewSize;
+        int passiveViewSize;
+        /// Initial peers: chain (each to the previous), star (each to the first), random (each to a random earlier one)
+        std::string topology;
+        uint32_t seed;
+        /// Times are simulated with the sim transport
+        int timeoutMs;
+        int pollMs;
+        /// tcp: real connections, a loop thread per node; sim: in-memory network (SimNetwork), simulated time, on one thread
+        std::string transport;
+        /// Links of the sim transport
+        SimLinkParams link;
+    };
+
+    /// Outcome of a run; times are -1 if not reached before the timeout
+    struct DiscoveryResult
+    {
+    public:
+        DiscoveryResult() : nodes(0), converged(false), discoveryMs(-1), partialDiscoveryMs(-1), connectedMs(-1), messages(0), bytes(0), connMin(0), connAvg(0), connMax(0), overlayConnected(false), viewFill(0), statusTimeouts(0), wallMs(0) { }
+        int nodes;
+        /// Full discovery and a connected overlay, before the timeout
+        bool converged;
+        /// Time until every node knows as many peers as it can (see DiscoverySim::getViewCapacity): full discovery
+        int64_t discoveryMs;
+        /// Time until every node knows its active view and a part of its passive view (see DiscoverySim::getPartialDiscoveryTarget);
+        /// with membership, shuffles keep replacing passive entries, full discovery may not be reached at all
+        int64_t partialDiscoveryMs;
+        /// Time until the overlay (peer connections, or active views) is connected
+        int64_t connectedMs;
+        /// Sent by all nodes, until convergence (or timeout)
+        uint64_t messages;
+        uint64_t bytes;
+        int connMin;
+        double connAvg;
+        int connMax;
+        bool overlayConnected;
+        /// Known peers of a node at the end, in % of all others, or of what its views can hold; average of the nodes
+        double viewFill;
+        /// Status polls not answered in time by a node (tcp)
+        int statusTimeouts;
+        /// Real duration of the run
+        int64_t wallMs;
+    };
+
+    /**
+     * Runs many NodeApp instances in one process: each on its own loop and thread, on loopback ports (tcp),
+     * or all of them on a simulated network, in simulated time (sim).
+     * Nodes are started one by one, with initial peers from a seeded topology; their status is polled
+     * until every node has discovered as many peers as it can know, or the timeout.
+     * A node that does not answer a poll in time counts as not discovered.
+     */
+    class DiscoverySim
+    {
+    public:
+        /// With membership, partial discovery: a node knows its active view and this share of its passive view
+        static const int MinPassiveFillPercent = 50;
+
+        DiscoverySim(DiscoveryParams const & params_in);
+        /// Stops the nodes
+        ~DiscoverySim();
+        DiscoveryResult run();
+        /// Number of peers a node can know, for full discovery: all others, or as many as its views can hold
+        int getViewCapacity() const;
+        /// Number of peers a node has to know, for partial discovery: all others; with membership, its active view and a part of its passive view
+        int getPartialDiscoveryTarget() const;
+
+    private:
+        bool isSimulated() const { return myNetwork != nullptr; }
+        std::string getNodeHost(int node_in) const;
+        std::string getNodeEndpoint(int node_in) const;
+        std::vector<std::string> getInitialPeers(int node_in);
+        /// Let the nodes run for a while, return the elapsed time of the run
+        int64_t runFor(int durationMs_in, uint64_t start_in);
+        /// Time since the start of the run (sim: simulated)
+        int64_t getElapsedMs(uint64_t start_in) const;
+        /// Number of distinct other simulated nodes in the list
+        int countSimPeers(int node_in, std::vector<std::string> const & peers_in) const;
+        /// Simulated node index of an endpoint, -1 if not one of them
+        int getNodeIndex(std::string const & endpoint_in) const;
+        bool isOverlayConnected(std::vector<NodeStatus> const & status_in) const;
+
+    private:
+        DiscoveryParams myParams;
+        std::vector<NodeApp*> myNodes;
+        std::mt19937 myRandom;
+        // the sim transport only
+        std::unique_ptr<SimNetwork> myNetwork;
+    };
+}
@@ -0,0 +1,168 @@
+#include "discovery_sim.hpp"
+
+#include <algorithm>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace sample;
+using namespace std;
+
+
+void usage()
+{
+    cout << "TCP LibUV Discovery Simulation" << endl;
+    cout << "Usage:  tcp-libuv-discovery-sim [options]" << endl;
+    cout << "  -nodes [n,n,..]    Numbers of nodes, one run for each.  Default: 8,16,32,64" << endl;
+    cout << "  -transport [name]  tcp: loopback connections, a thread per node; sim: simulated network and time, one thread.  Default: tcp" << endl;
+    cout << "  -baseport [port]   Listening port of the first node, following runs use the next free ones (sim: of all nodes).  Default: 6000" << endl;
+    cout << "  -topology [name]   Initial peers: chain, star or random.  Default: chain" << endl;
+    cout << "  -activeview [n]    Membership active view size, 0 to connect to every known peer.  Default: 0" << endl;
+    cout << "  -passiveview [n]   Membership passive view size.  Default: 30" << endl;
+    cout << "  -timeout [ms]      Max. time of a run (sim: simulated).  Default: 60000" << endl;
+    cout << "  -latency [ms]      Sim: one-way link latency.  Default: 5" << endl;
+    cout << "  -jitter [ms]       Sim: max. random extra latency.  Default: 0" << endl;
+    cout << "  -bandwidth [B/s]   Sim: link bandwidth in bytes per second, 0 for unlimited.  Default: 0" << endl;
+    cout << "  -loss [rate]       Sim: probability of a lost (retransmitted) write, 0 .. 1.  Default: 0" << endl;
+    cout << "  -seed [n]          Random seed.  Default: 1" << endl;
+    cout << "  -out [file]        Write CSV results to this file (otherwise stdout).  Optional." << endl;
+    cout << "  -verbose           Keep the output of the nodes." << endl;
+    cout << "  -h                 Print this help and exit." << endl;
+    cout << "Simple example:" << endl;
+    cout << "  tcp-libuv-discovery-sim -nodes 16,64,256 -activeview 5 -topology random -out discovery.csv" << endl;
+    cout << "  tcp-libuv-discovery-sim -transport sim -nodes 1000,5000 -activeview 5 -topology random -latency 20 -jitter 10" << endl;
+    cout << endl;
+}
+
+vector<int> parseNodeCounts(string const & list_in)
+{
+    vector<int> counts;
+    stringstream ss(list_in);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        if (item.length() > 0)
+        {
+            counts.push_back(std::max(std::stoi(item), 2));
+        }
+    }
+    return counts;
+}
+
+void printCsvHeader(ostream & out_in)
+{
+    out_in << "nodes,transport,topology,active_view,converged,time_to_discovery_ms,time_to_partial_discovery_ms,time_to_connected_ms,messages,bytes,"
+        << "messages_per_node,bytes_per_node,conn_min,conn_avg,conn_max,overlay_connected,view_fill_pct,status_timeouts,wall_ms" << endl;
+}
+
+void printCsvLine(ostream & out_in, DiscoveryParams const & params_in, DiscoveryResult const & result_in)
+{
+    out_in << result_in.nodes << "," << params_in.transport << "," << params_in.topology << "," << params_in.activeViewSize << ","
+        << (result_in.converged ? 1 : 0) << "," << result_in.discoveryMs << "," << result_in.partialDiscoveryMs << "," << result_in.connectedMs << ","
+        << result_in.messages << "," << result_in.bytes << ","
+        << result_in.messages / std::max(result_in.nodes, 1) << "," << result_in.bytes / std::max(result_in.nodes, 1) << ","
+        << result_in.connMin << "," << result_in.connAvg << "," << result_in.connMax << ","
+        << (result_in.overlayConnected ? 1 : 0) << "," << result_in.viewFill << "," << result_in.statusTimeouts << "," << result_in.wallMs << endl;
+}
+
+int main(int argn, char ** argc)
+{
+    usage();
+#ifndef _WIN32
+    // nodes are stopped with connections open, writes to closed peers must not end the process
+    ::signal(SIGPIPE, SIG_IGN);
+#endif
+    DiscoveryParams params;
+    vector<int> nodeCounts = parseNodeCounts("8,16,32,64");
+    string outFile;
+    bool verbose = false;
+    for (int i = 1; i < argn; ++i)
+    {
+        string arg = argc[i];
+        if (arg == "-verbose")
+        {
+            verbose = true;
+            continue;
+        }
+        if (arg == "-h" || arg == "-help")
+        {
+            // usage is printed already
+            return 0;
+        }
+        if (i + 1 >= argn) break;
+        if (arg == "-nodes") nodeCounts = parseNodeCounts(argc[++i]);
+        else if (arg == "-transport") params.transport = argc[++i];
+        else if (arg == "-baseport") params.basePort = std::stoi(argc[++i]);
+        else if (arg == "-topology") params.topology = argc[++i];
+        else if (arg == "-activeview") params.activeViewSize = std::max(std::stoi(argc[++i]), 0);
+        else if (arg == "-passiveview") params.passiveViewSize = std::max(std::stoi(argc[++i]), 1);
+        else if (arg == "-timeout") params.timeoutMs = std::stoi(argc[++i]);
+        else if (arg == "-seed") params.seed = (uint32_t)std::stoul(argc[++i]);
+        else if (arg == "-latency") params.link.latencyMs = (uint32_t)std::stoul(argc[++i]);
+        else if (arg == "-jitter") params.link.jitterMs = (uint32_t)std::stoul(argc[++i]);
+        else if (arg == "-bandwidth") params.link.bandwidth = std::stoull(argc[++i]);
+        else if (arg == "-loss") params.link.lossRate = std::min(std::max(std::stod(argc[++i]), 0.0), 0.99);
+        else if (arg == "-out") outFile = argc[++i];
+    }
+
+    ofstream outStream;
+    if (outFile.length() > 0)
+    {
+        outStream.open(outFile);
+        if (!outStream)
+        {
+            cerr << "Could not open " << outFile << endl;
+            return 1;
+        }
+    }
+    // results and progress are kept, the logs of the nodes are dropped
+    ostream csv(outFile.length() > 0 ? outStream.rdbuf() : cout.rdbuf());
+    ostream progress(cerr.rdbuf());
+    streambuf* coutBuf = cout.rdbuf();
+    streambuf* cerrBuf = cerr.rdbuf();
+    ofstream devNull;
+    if (!verbose)
+    {
+        cout.rdbuf(devNull.rdbuf());
+        cerr.rdbuf(devNull.rdbuf());
+    }
+
+    printCsvHeader(csv);
+    // the same connection settings for all nodes, set before their loops run
+    ServerApp::applyConnectionParams(AppParams(params.basePort, 1));
+    int port = params.basePort;
+    for (auto n = nodeCounts.begin(); n != nodeCounts.end(); ++n)
+    {
+        DiscoveryParams runParams = params;
+        runParams.nodes = *n;
+        if (params.transport == "sim")
+        {
+            progress << "Running " << runParams.nodes << " simulated nodes, port " << runParams.basePort << " ..." << endl;
+        }
+        else
+        {
+            // fresh ports for each run
+            runParams.basePort = port;
+            port += *n;
+            progress << "Running " << runParams.nodes << " nodes, ports " << runParams.basePort << " -- " << port - 1 << " ..." << endl;
+        }
+        DiscoveryResult result;
+        {
+            DiscoverySim sim(runParams);
+            result = sim.run();
+        }
+        progress << "  " << (result.converged ? "converged" : "not converged") << ", discovery " << result.discoveryMs << " ms, partial "
+            << result.partialDiscoveryMs << " ms, connected " << result.connectedMs << " ms, messages " << result.messages << ", connections " << result.connMin << " / " << result.connAvg
+            << " / " << result.connMax << ", views " << result.viewFill << "% filled, " << result.wallMs << " ms wall" << endl;
+        printCsvLine(csv, runParams, result);
+    }
+
+    cout.rdbuf(coutBuf);
+    cerr.rdbuf(cerrBuf);
+    cout.clear();
+    cerr.clear();
+    return 0;
+}
@@ -1,10 +1,19 @@
 #include "app.hpp"
 
+#include "capture.hpp"
+#include "io_backend.hpp"
+#include "loop_monitor.hpp"
 #include "net_handler.hpp"
 #include "net_client.hpp"
 #include "message.hpp"
+#include "stage_stats.hpp"
+#include "thread_placement.hpp"
+#include "trace.hpp"
 #include "uv_socket.hpp"
 
+#include <uv.h>
+
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <memory>
@@ -18,15 +27,43 @@ void BaseApp::listenStarted(int port)
     cout << "App: Listening on port " << port << endl;
 }
 
+BulkTarget BaseApp::bulkReceiveStarted(NetClientBase & client_in, BulkMessage const & msg_in)
+{
+    // discard
+    return BulkTarget();
+}
+
+void BaseApp::bulkReceived(NetClientBase & client_in, BulkMessage const & msg_in, int status_in)
+{
+    if (status_in != 0)
+    {
+        cerr << "App: Bulk receive failed " << msg_in.getName() << " " << status_in << " " << ::uv_err_name(status_in) << endl;
+        return;
+    }
+    cout << "App: Bulk received " << msg_in.getName() << " " << msg_in.getLength() << " from " << client_in.getNicePeerAddr() << endl;
+}
+
 
 ServerApp::ServerApp() :
 BaseApp()
 {
     myNetHandler = new NetHandler(this);
+    myMessageHandlers.add<HandshakeMessage>(MessageType::Handshake, this, &ServerApp::handleMessage);
+    myMessageHandlers.add<PingMessage>(MessageType::Ping, this, &ServerApp::handleMessage);
+    myMessageHandlers.setDefault([this](NetClientBase & client_in, BaseMessage const & msg_in) { handleMessage(client_in, msg_in); });
 }
 
 void ServerApp::start(AppParams const & appParams_in)
 {
+    applyThreadPlacement(appParams_in, myNetHandler);
+    applyIoBackend(appParams_in, myNetHandler);
+    applyLoopMonitor(appParams_in, myNetHandler);
+    applyTrace(appParams_in);
+    myTraceFile = appParams_in.traceFile;
+    if (appParams_in.captureFile.length() > 0)
+    {
+        CaptureFile::open(appParams_in.captureFile, appParams_in.captureSampleEvery, appParams_in.captureMaxSize);
+    }
     int actualPort = myNetHandler->startWithListen(appParams_in.listenPort, appParams_in.listenPortRange);
     if (actualPort <= 0)
     {
@@ -38,26 +75,235 @@ void ServerApp::start(AppParams const & appParams_in)
 void ServerApp::stop()
 {
     myNetHandler->stop();
+    CaptureFile::close();
+    if (myTraceFile.length() > 0)
+    {
+        writeTrace(myTraceFile);
+    }
+}
+
+int ServerApp::writeTrace(string const & path_in)
+{
+    if (!Trace::isEnabled())
+    {
+        Trace::enable();
+        cout << "Tracing started" << endl;
+        return 0;
+    }
+    return Trace::writeJson(path_in);
+}
+
+void ServerApp::printStats()
+{
+    myNetHandler->post([this]()
+    {
+        vector<NetClientBase*> clients;
+        for(auto i = myClients.begin(); i != myClients.end(); ++i)
+        {
+            clients.push_back(i->second.get());
+        }
+        printConnectionStats(clients);
+        printIoBackendStats(myNetHandler);
+        printThreadStats();
+        printLoopStats(myNetHandler);
+        printStageStats();
+    });
+}
+
+void ServerApp::applyConnectionParams(AppParams const & appParams_in)
+{
+    ConnectionLimits limits;
+    limits.maxFrameSize = appParams_in.maxFrameSize;
+    limits.maxBufferedBytes = appParams_in.maxConnBufferedBytes;
+    limits.memoryBudget = appParams_in.memoryBudget;
+    NetClientBase::setLimits(limits);
+
+    ReadBufferSizing readBuffer;
+    readBuffer.minSize = std::max(appParams_in.readBufferMin, (size_t)64);
+    readBuffer.maxSize = std::max(appParams_in.readBufferMax, readBuffer.minSize);
+    NetClientBase::setReadBufferSizing(readBuffer);
+
+    RequestPolicy requestPolicy(std::max(appParams_in.requestTimeoutMs, 1), std::max(appParams_in.requestRetries, 0));
+    NetClientBase::setRequestPolicy(requestPolicy, std::max(appParams_in.requestCloseAfter, 0));
+
+    RateLimitParams rateLimits;
+    rateLimits.total.messagesPerSec = appParams_in.rateLimitMessages;
+    rateLimits.total.bytesPerSec = appParams_in.rateLimitBytes;
+    rateLimits.burstMs = (uint32_t)std::max(appParams_in.rateLimitBurstMs, 1);
+    if (rateLimits.setClassLimits(appParams_in.rateLimitClasses) != 0)
+    {
+        cerr << "Invalid rate limits " << appParams_in.rateLimitClasses << ", ignored" << endl;
+        for (int i = 0; i < MessageClass::MessageClassCount; ++i)
+        {
+            rateLimits.perClass[i] = RateLimit();
+        }
+    }
+    if (rateLimits.setAction(appParams_in.rateLimitAction) != 0)
+    {
+        cerr << "Invalid rate limit action " << appParams_in.rateLimitAction << ", using delay" << endl;
+    }
+    NetClientBase::setRateLimits(rateLimits);
+
+    SendScheduling scheduling;
+    if (scheduling.parse(appParams_in.sendScheduling) != 0)
+    {
+        cerr << "Invalid send scheduling " << appParams_in.sendScheduling << ", using strict" << endl;
+    }
+    scheduling.windowBytes = appParams_in.sendWindowBytes;
+    NetClientBase::setSendScheduling(scheduling);
+}
+
+void ServerApp::applyIoBackend(AppParams const & appParams_in, NetHandler* netHandler_in)
+{
+    if (appParams_in.ioBackend.length() == 0 || appParams_in.ioBackend == "uv")
+    {
+        return;
+    }
+    IoBackend* backend = IoBackend::create(appParams_in.ioBackend);
+    if (backend == nullptr)
+    {
+        cerr << "I/O backend " << appParams_in.ioBackend << " is not available, using libuv" << endl;
+        return;
+    }
+    netHandler_in->setIoBackend(backend);
+}
+
+void ServerApp::applyLoopMonitor(AppParams const & appParams_in, NetHandler* netHandler_in)
+{
+    LoopMonitorParams params;
+    params.stallMs = (uint32_t)std::max(appParams_in.loopStallMs, 0);
+    netHandler_in->setLoopMonitor(params);
+}
+
+void ServerApp::printLoopStats(NetHandler* netHandler_in)
+{
+    if (netHandler_in->getLoopMonitor() != nullptr)
+    {
+        netHandler_in->getLoopMonitor()->print(cout);
+    }
+}
+
+void ServerApp::applyTrace(AppParams const & appParams_in)
+{
+    if (appParams_in.traceFile.length() > 0)
+    {
+        Trace::enable(appParams_in.traceEvents);
+    }
+}
+
+void ServerApp::applyThreadPlacement(AppParams const & appParams_in, NetHandler* netHandler_in)
+{
+    if (appParams_in.threadpoolSize > 0)
+    {
+        ThreadPlacement::setThreadpoolSize(appParams_in.threadpoolSize);
+    }
+    vector<int> loopCpus = ThreadPlacement::parseCpuList(appParams_in.loopCpus);
+    if (appParams_in.loopCpus.length() > 0 && loopCpus.empty())
+    {
+        cerr << "Invalid loop CPU list " << appParams_in.loopCpus << ", not pinned" << endl;
+    }
+    netHandler_in->setLoopPlacement(loopCpus, "");
+    vector<int> workerCpus = ThreadPlacement::parseCpuList(appParams_in.workerCpus);
+    if (appParams_in.workerCpus.length() > 0 && workerCpus.empty())
+    {
+        cerr << "Invalid worker CPU list " << appParams_in.workerCpus << ", not pinned" << endl;
+    }
+    if (!workerCpus.empty() || appParams_in.threadpoolSize > 0)
+    {
+        // also names them, for profiling
+        ThreadPlacement::placeThreadpool(netHandler_in->getLoop(), workerCpus);
+    }
+}
+
+void ServerApp::printThreadStats()
+{
+    vector<ThreadPlacementInfo> threads = ThreadPlacement::getThreads();
+    cout << "  threads: threadpool " << ThreadPlacement::getThreadpoolSize();
+    for (auto i = threads.begin(); i != threads.end(); ++i)
+    {
+        cout << "  [" << i->name << " cpus " << ThreadPlacement::formatCpuList(i->cpus) << " on " << i->lastCpu << "]";
+    }
+    cout << endl;
+}
+
+void ServerApp::printStageStats()
+{
+#ifdef TCP_LIBUV_STAGE_STATS
+    StageStats::print(cout);
+#endif
+}
+
+void ServerApp::printIoBackendStats(NetHandler* netHandler_in)
+{
+    if (netHandler_in->getIoBackend() != nullptr)
+    {
+        netHandler_in->getIoBackend()->printStats();
+    }
+}
+
+void ServerApp::printConnectionStats(vector<NetClientBase*> const & clients_in)
+{
+    ConnectionLimits limits = NetClientBase::getLimits();
+    cout << "Stats: connections " << clients_in.size()
+        << "  buffered " << NetClientBase::getTotalBufferedBytes() << " / " << limits.memoryBudget
+        << "  paused " << NetClientBase::getPausedCount()
+        << "  closed-over-limit " << NetClientBase::getLimitCloseCount()
+        << "  unparseable " << NetClientBase::getUnparseableCount()
+        << "  read-buffer " << NetClientBase::getReadBufferSizing().minSize << "-" << NetClientBase::getReadBufferSizing().maxSize
+        << " grown " << NetClientBase::getReadBufferGrowCount() << " shrunk " << NetClientBase::getReadBufferShrinkCount()
+        << "  send " << NetClientBase::getSendScheduling().toString() << endl;
+    cout << "  writes: try " << NetClientBase::getTryWriteCount() << " full " << NetClientBase::getTryWriteFullCount()
+        << " partial " << NetClientBase::getTryWritePartialCount() << "  async " << NetClientBase::getAsyncWriteCount() << endl;
+    DurationHistogram const & latency = NetClientBase::getRequestLatency();
+    cout << "  requests: sent " << NetClientBase::getRequestCount() << " answered " << NetClientBase::getRequestResponseCount()
+        << " retried " << NetClientBase::getRequestRetryCount() << " timed-out " << NetClientBase::getRequestTimeoutTotal()
+        << " cancelled " << NetClientBase::getRequestCancelCount() << " closed-conns " << NetClientBase::getRequestCloseCount()
+        << "  latency (us) avg " << (latency.getCount() > 0 ? latency.getSumUs() / latency.getCount() : 0)
+        << " p50 " << latency.getPercentileUs(50) << " p99 " << latency.getPercentileUs(99) << " max " << latency.getMaxUs() << endl;
+    if (NetClientBase::getRateLimits().isEnabled())
+    {
+        cout << "  rate-limited: delayed " << NetClientBase::getRateDelayCount() << "  dropped " << NetClientBase::getRateDropCount()
+            << "  closed " << NetClientBase::getRateCloseCount() << endl;
+    }
+    for(auto i = clients_in.begin(); i != clients_in.end(); ++i)
+    {
+        if (*i == nullptr) continue;
+        ConnectionMemoryUsage mem = (*i)->getMemoryUsage();
+        RateLimitStats const & rate = (*i)->getRateLimitStats();
+        cout << "  [" << (*i)->getConnId() << " " << (*i)->getNicePeerAddr() << "]"
+            << " mem " << mem.total() << " recv " << mem.receiveBuffer << " rbuf " << (*i)->getReadBufferSize()
+            << " wq " << mem.writeQueue << " writes " << mem.pendingWrites
+            << " queued " << (*i)->getQueuedBytes(MessageClass::ControlClass) << "/" << (*i)->getQueuedBytes(MessageClass::LatencyClass)
+            << "/" << (*i)->getQueuedBytes(MessageClass::BulkClass)
+            << (((*i)->isReadPaused()) ? " PAUSED" : "");
+        if ((*i)->getPendingRequestCount() > 0 || (*i)->getRequestTimeoutCount() > 0)
+        {
+            cout << " requests " << (*i)->getPendingRequestCount() << " timed-out " << (*i)->getRequestTimeoutCount();
+        }
+        if (rate.delayed > 0 || rate.dropped > 0)
+        {
+            cout << " rate-delayed " << rate.delayed << " rate-dropped " << rate.dropped << (((*i)->isRateDelayed()) ? " DELAYED" : "");
+        }
+        cout << endl;
+    }
 }
 
 void ServerApp::inConnectionReceived(shared_ptr<NetClientBase>& client_in)
 {
     assert(client_in != nullptr);
-    string cliaddr = client_in->getNicePeerAddr();
-    cout << "App: New incoming connection: " << cliaddr << endl;
-    myClients[cliaddr] = client_in;
+    cout << "App: New incoming connection: " << client_in->getNicePeerAddr() << endl;
+    myClients[client_in->getNicePeerId()] = client_in;
 }
 
 void ServerApp::connectionClosed(NetClientBase* client_in)
 {
     assert(client_in != nullptr);
-    string cliaddr = client_in->getPeerAddr();
-    cout << "App: Connection done: " << cliaddr << endl;
+    cout << "App: Connection done: " << client_in->getPeerAddr() << endl;
     for(auto i = myClients.begin(); i != myClients.end(); ++i)
     {
         if (i->second.get() == client_in)
         {
-            myClients.erase(i->first);
+            myClients.erase(i);
             break;
         }
     }
@@ -66,35 +312,34 @@ void ServerApp::connectionClosed(NetClientBase* client_in)
 void ServerApp::messageReceived(NetClientBase & client_in, BaseMessage const & msg_in)
 {
     cout << "App: Received: from " << client_in.getNicePeerAddr() << " '" << msg_in.toString() << "'" << endl;
-    switch (msg_in.getType())
-    {
-        case MessageType::Handshake:
-            {
-                HandshakeMessage const & hsMsg = dynamic_cast<HandshakeMessage const &>(msg_in);
-                //cout << "Handshake message received, '" << hsMsg.getMyAddr() << "'" << endl;
-                if (hsMsg.getMyVersion() != "V01")
-                {
-                    cerr << "Wrong version ''" << hsMsg.getMyVersion() << "'" << endl;
-                    client_in.close();
-                    return;
-                }
-                HandshakeResponseMessage resp("V01", myName, client_in.getPeerAddr());
-                client_in.sendMessage(resp);
-            }
-            break;
-
-        case MessageType::Ping:
-            {
-                PingMessage const & pingMsg = dynamic_cast<PingMessage const &>(msg_in);
-                //cout << "Ping message received, '" << pingMsg.getText() << "'" << endl;
-                PingResponseMessage resp("Resp_from_" + myName + "_to_" + pingMsg.getText());
-                client_in.sendMessage(resp);
-            }
-            break;
+    myMessageHandlers.dispatch(client_in, msg_in);
+}
 
-        default:
-            assert(false);
+void ServerApp::handleMessage(NetClientBase & client_in, HandshakeMessage const & msg_in)
+{
+    //cout << "Handshake message received, '" << msg_in.getMyAddr() << "'" << endl;
+    if (msg_in.getMyVersion() != "V01")
+    {
+        cerr << "Wrong version ''" << msg_in.getMyVersion() << "'" << endl;
+        client_in.close();
+        return;
     }
+    HandshakeResponseMessage resp("V01", myName, client_in.getPeerAddr());
+    resp.setRequestId(msg_in.getRequestId());
+    client_in.sendMessage(resp);
+}
+
+void ServerApp::handleMessage(NetClientBase & client_in, PingMessage const & msg_in)
+{
+    //cout << "Ping message received, '" << msg_in.getText() << "'" << endl;
+    PingResponseMessage resp("Resp_from_" + myName + "_to_" + msg_in.getText());
+    resp.setRequestId(msg_in.getRequestId());
+    client_in.sendMessage(resp);
+}
+
+void ServerApp::handleMessage(NetClientBase & client_in, BaseMessage const & msg_in)
+{
+    cerr << "Unexpected message type " << (int)msg_in.getType() << " from " << client_in.getNicePeerAddr() << ", ignored" << endl;
 }
 
 
@@ -110,7 +355,7 @@ void ClientApp::start(AppParams const & appParams_in)
     auto clis = new NetClientBase*[n];
     for (int i = 0; i < n; ++i)
     {
-        auto nc = new NetClientOut(this, "localhost", appParams_in.listenPort + i, 3 + i);
+        auto nc = new NetClientOut(this, "localhost", appParams_in.listenPort + i, 3 + i, appParams_in.pipelineDepth);
         clis[i] = nc;
         int res = nc->connect();
         if (res)
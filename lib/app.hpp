@@ -1,5 +1,9 @@
 #pragma once
 
+#include "bulk.hpp"
+#include "endpoint_table.hpp"
+#include "message_handlers.hpp"
+
 #include <map>
 #include <memory>
 #include <string>
@@ -8,6 +12,9 @@
 namespace sample
 {
     class BaseMessage; // forward
+    class BulkMessage; // forward
+    class HandshakeMessage; // forward
+    class PingMessage; // forward
     class NetClientBase; // forward
     class NetHandler; // forward
 
@@ -21,17 +28,119 @@ namespace sample
         {
             listenPort = listenPort_in;
             listenPortRange = listenPortRange_in;
+            pipelineDepth = 1;
+            captureSampleEvery = 1;
+            captureMaxSize = 256 << 20;
+            peerStoreCapacity = 1024;
+            maxFrameSize = 64 << 10;
+            maxConnBufferedBytes = 4 << 20;
+            memoryBudget = 512 << 20;
+            readBufferMin = 1024;
+            readBufferMax = 64 << 10;
+            requestTimeoutMs = 10000;
+            requestRetries = 1;
+            requestCloseAfter = 3;
+            ioBackend = "uv";
+            activeViewSize = 5;
+            passiveViewSize = 30;
+            randomSeed = 0;
+            threadpoolSize = 0;
+            rateLimitMessages = 0;
+            rateLimitBytes = 0;
+            rateLimitAction = "delay";
+            rateLimitBurstMs = 1000;
+            sendScheduling = "strict";
+            sendWindowBytes = 64 << 10;
+            traceEvents = 1 << 16;
+            loopStallMs = 250;
         }
         AppParams(std::vector<std::string> extraPeers_in, int listenPort_in, int listenPortRange_in)
         {
             extraPeers = extraPeers_in;
             listenPort = listenPort_in;
             listenPortRange = listenPortRange_in;
+            pipelineDepth = 1;
+            captureSampleEvery = 1;
+            captureMaxSize = 256 << 20;
+            peerStoreCapacity = 1024;
+            maxFrameSize = 64 << 10;
+            maxConnBufferedBytes = 4 << 20;
+            memoryBudget = 512 << 20;
+            readBufferMin = 1024;
+            readBufferMax = 64 << 10;
+            requestTimeoutMs = 10000;
+            requestRetries = 1;
+            requestCloseAfter = 3;
+            ioBackend = "uv";
+            activeViewSize = 5;
+            passiveViewSize = 30;
+            randomSeed = 0;
+            threadpoolSize = 0;
+            rateLimitMessages = 0;
+            rateLimitBytes = 0;
+            rateLimitAction = "delay";
+            rateLimitBurstMs = 1000;
+            sendScheduling = "strict";
+            sendWindowBytes = 64 << 10;
+            traceEvents = 1 << 16;
+            loopStallMs = 250;
         }
 
         std::vector<std::string> extraPeers;
         int listenPort;
         int listenPortRange;
+        /// Max. number of outstanding requests per client connection (1: send after response only)
+        int pipelineDepth;
+        /// If set, frames of sampled connections are captured into this file
+        std::string captureFile;
+        /// Capture every n-th connection
+        int captureSampleEvery;
+        size_t captureMaxSize;
+        /// If set, known peers are persisted in this file, and reloaded at start
+        std::string peerStoreFile;
+        int peerStoreCapacity;
+        /// Connection memory limits, see ConnectionLimits
+        size_t maxFrameSize;
+        size_t maxConnBufferedBytes;
+        size_t memoryBudget;
+        /// Bounds of the adaptive read buffer of connections, see ReadBufferSizing
+        size_t readBufferMin;
+        size_t readBufferMax;
+        /// Deadline of requests (Ping, Handshake), retries of idempotent ones after a timeout (with backoff), connection closed after this many
+        /// requests timed out in a row (0: never); see RequestPolicy
+        int requestTimeoutMs;
+        int requestRetries;
+        int requestCloseAfter;
+        /// Socket I/O of listening and incoming connections: "uv" (libuv, default) or "uring" (io_uring, if built in)
+        std::string ioBackend;
+        /// If set, incoming bulk payloads are stored in this directory, otherwise discarded
+        std::string bulkDir;
+        /// Membership (node): max. connected peers (HyParView active view), 0 to connect to every known peer; max. known, not connected peers
+        int activeViewSize;
+        int passiveViewSize;
+        /// Seed of the random choices of the node (membership, pub/sub node ID), 0 for a random seed; for reproducible simulations
+        uint32_t randomSeed;
+        /// CPUs of the loop threads (list such as "0-3,8"; each loop thread is pinned to one, round-robin), empty for no pinning
+        std::string loopCpus;
+        /// CPUs of the libuv threadpool threads, same; empty for no pinning
+        std::string workerCpus;
+        /// Number of libuv threadpool threads (UV_THREADPOOL_SIZE), 0 for the libuv default
+        int threadpoolSize;
+        /// Rate limits of incoming messages per connection, see RateLimitParams: messages/s and bytes/s of all messages (0: no limit),
+        /// per message class (list such as "latency=100/0,bulk=1000/1000000"), action when exceeded (delay, drop, close), burst
+        double rateLimitMessages;
+        double rateLimitBytes;
+        std::string rateLimitClasses;
+        std::string rateLimitAction;
+        int rateLimitBurstMs;
+        /// Order of outgoing messages by class, see SendScheduling: "strict" or "weighted[:c,l,b]"; bytes in progress on the socket, 0 for no queuing
+        std::string sendScheduling;
+        size_t sendWindowBytes;
+        /// If set, loop and connection events are traced, and written to this file (Chrome trace JSON) at stop; events kept per thread
+        std::string traceFile;
+        size_t traceEvents;
+        /// Loop iterations busy longer than this are reported by the loop watchdog, 0 for no watchdog; see LoopMonitor
+        int loopStallMs;
 
         void print();
     };
@@ -52,7 +161,16 @@ namespace sample
         virtual void connectionClosed(NetClientBase* client_in) = 0;
         /// Called when an incoming message is received
         virtual void messageReceived(NetClientBase & client_in, BaseMessage const & msg_in) = 0;
+        /// Called when an incoming bulk payload starts (its header is received); returns where to put it, by default it is discarded
+        virtual BulkTarget bulkReceiveStarted(NetClientBase & client_in, BulkMessage const & msg_in);
+        /// Called when an incoming bulk payload is complete (status 0), or has failed
+        virtual void bulkReceived(NetClientBase & client_in, BulkMessage const & msg_in, int status_in);
         virtual std::string getName() { return "_NONE_"; }
+        /// Handlers of incoming messages by type, used by messageReceived of the apps; handlers (also of types added by the application) can be added or replaced before start
+        MessageHandlers<NetClientBase> & getMessageHandlers() { return myMessageHandlers; }
+
+    protected:
+        MessageHandlers<NetClientBase> myMessageHandlers;
     };
 
     class ServerApp: public BaseApp
@@ -63,6 +181,10 @@ namespace sample
         virtual void start(AppParams const & appParams_in);
         /// Stop the background thread loop, stop listening
         void stop();
+        /// Print statistics (on the loop thread), can be called from any thread
+        virtual void printStats();
+        /// Write the traced events to a file (Chrome trace JSON); if tracing is off, it is started.  Can be called from any thread.
+        static int writeTrace(std::string const & path_in);
         /// Called when a new incoming connection is received
         void inConnectionReceived(std::shared_ptr<NetClientBase>& client_in);
         /// Called when an incoming connection has finished
@@ -70,11 +192,42 @@ namespace sample
         /// Called when an incoming message is received
         void messageReceived(NetClientBase & client_in, BaseMessage const & msg_in);
         virtual std::string getName() { return myName; }
+        /// Typed message handlers, registered in the constructor, see MessageHandlers
+        void handleMessage(NetClientBase & client_in, HandshakeMessage const & msg_in);
+        void handleMessage(NetClientBase & client_in, PingMessage const & msg_in);
+        /// Any other message type, not expected; the default handler
+        void handleMessage(NetClientBase & client_in, BaseMessage const & msg_in);
+
+        /// Set the process-wide connection settings from the params: limits, read buffers, request policy, rate limits,
+        /// send scheduling.  Call once, before any app is started: all loop threads read them.
+        static void applyConnectionParams(AppParams const & appParams_in);
+
+    protected:
+        /// Monitor the loop of the handler, with the stall threshold of the params
+        static void applyLoopMonitor(AppParams const & appParams_in, NetHandler* netHandler_in);
+        /// Print the loop health (iteration durations, lag, stalls) of the handler, if monitored
+        static void printLoopStats(NetHandler* netHandler_in);
+        /// Start tracing, if a trace file is set in the params
+        static void applyTrace(AppParams const & appParams_in);
+        /// Set the I/O backend of the handler from the params (nothing for libuv)
+        static void applyIoBackend(AppParams const & appParams_in, NetHandler* netHandler_in);
+        /// Set the threadpool size, and the CPUs and names of the loop and threadpool threads, from the params.  Call before start.
+        static void applyThreadPlacement(AppParams const & appParams_in, NetHandler* netHandler_in);
+        /// Print the placement of the named threads, and the threadpool size
+        static void printThreadStats();
+        /// Print statistics of the I/O backend, if any.  Call on the loop thread.
+        static void printIoBackendStats(NetHandler* netHandler_in);
+        /// Print statistics of the given connections, and global ones.  Call on the loop thread.
+        static void printConnectionStats(std::vector<NetClientBase*> const & clients_in);
+        /// Stage durations of the hot path, if built with TCP_LIBUV_STAGE_STATS
+        static void printStageStats();
 
     protected:
         NetHandler* myNetHandler;
         std::string myName;
-        std::map<std::string, std::shared_ptr<NetClientBase>> myClients;
+        std::string myTraceFile;
+        // by peer endpoint
+        std::map<EndpointId, std::shared_ptr<NetClientBase>> myClients;
     };
 
     class ClientApp: public BaseApp
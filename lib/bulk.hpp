@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace sample
+{
+    /**
+     * Destination of an incoming bulk payload, chosen by the app when the BULK header arrives.
+     * With a buffer, data is read from the socket right into it; with a file, data is written to the file;
+     * with neither, the payload is discarded.
+     */
+    struct BulkTarget
+    {
+    public:
+        BulkTarget() : buffer(nullptr), bufferSize(0), fd(-1) { }
+        /// Caller-provided memory, must be large enough for the whole payload, and stay valid until bulkReceived
+        char* buffer;
+        size_t bufferSize;
+        /// Open file descriptor, written at its current position; not closed
+        int fd;
+    };
+
+    /// Progress of an outgoing bulk payload: bytes sent so far, total; status is nonzero on failure.
+    /// Called after each chunk, and at the end (sent == total, or failure).
+    typedef std::function<void(uint64_t sent_in, uint64_t total_in, int status_in)> BulkProgressCallback;
+}
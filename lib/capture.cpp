@@ -0,0 +1,154 @@
+#include "capture.hpp"
+
+#include <uv.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using namespace sample;
+using namespace std;
+
+
+static const char CaptureMagic[8] = { 'T', 'L', 'U', 'V', 'C', 'A', 'P', '1' };
+
+static size_t recordSize(size_t len_in)
+{
+    return sizeof(CaptureRecordHeader) + ((len_in + 7) & ~((size_t)7));
+}
+
+CaptureFile* CaptureFile::ourCapture = nullptr;
+
+CaptureFile::CaptureFile(int sampleEvery_in, size_t maxSize_in) :
+mySampleEvery(sampleEvery_in),
+myMaxSize(maxSize_in),
+myDroppedCount(0)
+{
+}
+
+int CaptureFile::open(string const & path_in, int sampleEvery_in, size_t maxSize_in)
+{
+    close();
+    CaptureFile* capture = new CaptureFile(sampleEvery_in, maxSize_in);
+    size_t initSize = std::max(std::min((size_t)InitialSize, maxSize_in), sizeof(CaptureFileHeader));
+    int res = capture->myFile.open(path_in, initSize);
+    if (res)
+    {
+        cerr << "Could not open capture file " << path_in << " " << res << endl;
+        delete capture;
+        return res;
+    }
+    // always start a new capture
+    CaptureFileHeader* hdr = capture->header();
+    ::memcpy(hdr->magic, CaptureMagic, sizeof(CaptureMagic));
+    hdr->endOffset = sizeof(CaptureFileHeader);
+    hdr->startTimeNs = ::uv_hrtime();
+    hdr->recordCount = 0;
+    ourCapture = capture;
+    cout << "Capturing every " << sampleEvery_in << ". connection into " << path_in << endl;
+    return 0;
+}
+
+void CaptureFile::close()
+{
+    CaptureFile* capture = ourCapture;
+    ourCapture = nullptr;
+    if (capture == nullptr)
+    {
+        return;
+    }
+    cout << "Capture closed, " << capture->getRecordCount() << " records, " << capture->getDroppedCount() << " dropped" << endl;
+    capture->myFile.sync();
+    delete capture;
+}
+
+uint64_t CaptureFile::getRecordCount() const
+{
+    return myFile.isOpen() ? header()->recordCount : 0;
+}
+
+void CaptureFile::append(uint32_t connId_in, Direction dir_in, const char* data_in, size_t len_in)
+{
+    if (!myFile.isOpen())
+    {
+        return;
+    }
+    uint64_t offset = header()->endOffset;
+    size_t size = recordSize(len_in);
+    if (offset + size > myFile.size())
+    {
+        size_t newSize = myFile.size();
+        while (newSize < offset + size) newSize *= 2;
+        // the last growth step may take less than double, up to the max. size
+        newSize = std::min(newSize, myMaxSize);
+        if (newSize < offset + size || myFile.grow(newSize) != 0)
+        {
+            ++myDroppedCount;
+            return;
+        }
+    }
+    CaptureRecordHeader* rec = (CaptureRecordHeader*)(myFile.data() + offset);
+    ::memset(rec, 0, sizeof(CaptureRecordHeader));
+    rec->timeNs = ::uv_hrtime();
+    rec->connId = connId_in;
+    rec->length = (uint32_t)len_in;
+    rec->direction = (uint8_t)dir_in;
+    ::memcpy(myFile.data() + offset + sizeof(CaptureRecordHeader), data_in, len_in);
+    // commit the record
+    header()->endOffset = offset + size;
+    ++header()->recordCount;
+}
+
+
+CaptureReader::CaptureReader() :
+myOffset(0),
+myEndOffset(0)
+{
+}
+
+int CaptureReader::open(string const & path_in)
+{
+    int res = myFile.openReadOnly(path_in);
+    if (res)
+    {
+        return res;
+    }
+    CaptureFileHeader const * hdr = (CaptureFileHeader const *)myFile.data();
+    if (myFile.size() < sizeof(CaptureFileHeader) || ::memcmp(hdr->magic, CaptureMagic, sizeof(CaptureMagic)) != 0)
+    {
+        myFile.close();
+        return -EINVAL;
+    }
+    myOffset = sizeof(CaptureFileHeader);
+    myEndOffset = std::min((uint64_t)hdr->endOffset, (uint64_t)myFile.size());
+    return 0;
+}
+
+bool CaptureReader::next(CaptureRecordHeader const * & header_out, const char * & data_out)
+{
+    if (myOffset + sizeof(CaptureRecordHeader) > myEndOffset)
+    {
+        return false;
+    }
+    CaptureRecordHeader const * rec = (CaptureRecordHeader const *)(myFile.data() + myOffset);
+    size_t size = recordSize(rec->length);
+    if (myOffset + size > myEndOffset)
+    {
+        return false;
+    }
+    header_out = rec;
+    data_out = (const char*)(myFile.data() + myOffset + sizeof(CaptureRecordHeader));
+    myOffset += size;
+    return true;
+}
+
+uint64_t CaptureReader::getStartTimeNs() const
+{
+    return myFile.isOpen() ? ((CaptureFileHeader const *)myFile.data())->startTimeNs : 0;
+}
+
+uint64_t CaptureReader::getRecordCount() const
+{
+    return myFile.isOpen() ? ((CaptureFileHeader const *)myFile.data())->recordCount : 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "mapped_file.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace sample
+{
+    /**
+     * Capture file format: a FileHeader, then records, each a RecordHeader followed by the frame
+     * (message without terminator), padded to 8 bytes.
+     */
+    struct CaptureFileHeader
+    {
+        char magic[8];
+        uint64_t endOffset; // end of the last complete record
+        uint64_t startTimeNs;
+        uint64_t recordCount;
+    };
+
+    struct CaptureRecordHeader
+    {
+        uint64_t timeNs;
+        uint32_t connId;
+        uint32_t length;
+        uint8_t direction;
+        uint8_t reserved[7];
+    };
+
+    /**
+     * Captures the message frames of sampled connections into a memory-mapped, append-only file,
+     * for later replay (see tcp-libuv-replay).
+     * Appending is a memcpy into the mapping; the file is grown by doubling, up to a max size.
+     * Used from the loop thread only.
+     */
+    class CaptureFile
+    {
+    public:
+        enum Direction
+        {
+            In = 0,
+            Out = 1
+        };
+
+        static const size_t InitialSize = 1 << 20;
+
+    public:
+        /// Start the global capture.  Every sampleEvery_in-th connection is captured.
+        static int open(std::string const & path_in, int sampleEvery_in, size_t maxSize_in);
+        static void close();
+        /// The global capture, or nullptr if capturing is off
+        static CaptureFile* get() { return ourCapture; }
+        bool isSampled(uint32_t connId_in) const { return mySampleEvery > 0 && (connId_in % mySampleEvery) == 0; }
+        void append(uint32_t connId_in, Direction dir_in, const char* data_in, size_t len_in);
+        uint64_t getRecordCount() const;
+        uint64_t getDroppedCount() const { return myDroppedCount; }
+
+    private:
+        CaptureFile(int sampleEvery_in, size_t maxSize_in);
+        CaptureFileHeader* header() const { return (CaptureFileHeader*)myFile.data(); }
+
+    private:
+        static CaptureFile* ourCapture;
+        MappedFile myFile;
+        int mySampleEvery;
+        size_t myMaxSize;
+        uint64_t myDroppedCount;
+    };
+
+    /**
+     * Reads records from a capture file, mapped read-only.
+     */
+    class CaptureReader
+    {
+    public:
+        CaptureReader();
+        int open(std::string const & path_in);
+        /// Obtain the next record; return false at the end
+        bool next(CaptureRecordHeader const * & header_out, const char * & data_out);
+        uint64_t getStartTimeNs() const;
+        uint64_t getRecordCount() const;
+
+    private:
+        MappedFile myFile;
+        uint64_t myOffset;
+        uint64_t myEndOffset;
+    };
+}
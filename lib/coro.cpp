@@ -0,0 +1,196 @@
+#include "coro.hpp"
+
+#include "net_handler.hpp"
+
+#include <exception>
+#include <iostream>
+#include <new>
+#include <vector>
+
+using namespace sample;
+using namespace std;
+
+
+thread_local vector<void*> CoFramePool::ourFreeFrames[CoFramePool::NumClasses];
+
+void* CoFramePool::allocate(size_t size_in)
+{
+    size_t cls = (size_in + ClassSize - 1) / ClassSize;
+    if (cls == 0 || cls > NumClasses)
+    {
+        return ::operator new(size_in);
+    }
+    vector<void*> & freeList = ourFreeFrames[cls - 1];
+    if (!freeList.empty())
+    {
+        void* ptr = freeList.back();
+        freeList.pop_back();
+        return ptr;
+    }
+    return ::operator new(cls * ClassSize);
+}
+
+void CoFramePool::deallocate(void* ptr_in, size_t size_in)
+{
+    size_t cls = (size_in + ClassSize - 1) / ClassSize;
+    if (cls == 0 || cls > NumClasses)
+    {
+        ::operator delete(ptr_in);
+        return;
+    }
+    vector<void*> & freeList = ourFreeFrames[cls - 1];
+    if (freeList.size() >= MaxFreePerClass)
+    {
+        ::operator delete(ptr_in);
+        return;
+    }
+    freeList.push_back(ptr_in);
+}
+
+
+void CoTask::promise_type::unhandled_exception()
+{
+    cerr << "Fatal error: unhandled exception in coroutine" << endl;
+    std::terminate();
+}
+
+
+bool CoConnection::ConnectAwaiter::await_suspend(coroutine_handle<> handle_in)
+{
+    myConn.myConnecter = handle_in;
+    int res = myConn.NetClientOut::connect();
+    if (res)
+    {
+        // failed right away, do not suspend
+        myConn.myConnecter = nullptr;
+        myConn.myConnectStatus = res;
+        return false;
+    }
+    return true;
+}
+
+bool CoConnection::SendAwaiter::await_suspend(coroutine_handle<> handle_in)
+{
+    if (myConn.myClosedFlag || !myConn.isConnected())
+    {
+        myStatus = UV_ENOTCONN;
+        return false;
+    }
+    int res = myConn.sendBuffer(myBuf);
+    if (res)
+    {
+        myStatus = res;
+        return false;
+    }
+    // resumed when the write completes
+    myConn.myWriters.push_back(make_pair(handle_in, &myStatus));
+    return true;
+}
+
+int CoConnection::SendAwaiter::await_resume()
+{
+    return myStatus;
+}
+
+unique_ptr<BaseMessage> CoConnection::ReadAwaiter::await_resume()
+{
+    if (myConn.myInbox.empty())
+    {
+        return nullptr;
+    }
+    unique_ptr<BaseMessage> msg = move(myConn.myInbox.front());
+    myConn.myInbox.pop_front();
+    return msg;
+}
+
+
+CoConnection::CoConnection(BaseApp* app_in, string const & host_in, int port_in) :
+NetClientOut(app_in, host_in, port_in, 0),
+myConnectStatus(0),
+myClosedFlag(false)
+{
+}
+
+void CoConnection::onConnect(uv_connect_t* req, int status)
+{
+    NetClientOut::onConnect(req, status);
+    myConnectStatus = status;
+    if (status == 0)
+    {
+        // reading is started once, and kept running
+        doRead();
+    }
+    if (myConnecter)
+    {
+        auto h = myConnecter;
+        myConnecter = nullptr;
+        h.resume();
+    }
+}
+
+void CoConnection::onWriteDone(int status_in)
+{
+    NetClientOut::onWriteDone(status_in);
+    if (myWriters.empty())
+    {
+        return;
+    }
+    // writes on a stream complete in order
+    auto writer = myWriters.front();
+    myWriters.pop_front();
+    *(writer.second) = status_in;
+    writer.first.resume();
+}
+
+void CoConnection::onClose(uv_handle_t* handle)
+{
+    // the app (in the base) and the resumed coroutines may release this connection: no member is used after the base call
+    myClosedFlag = true;
+    std::deque<std::pair<std::coroutine_handle<>, int*>> writers;
+    writers.swap(myWriters);
+    auto reader = myReader;
+    myReader = nullptr;
+    NetClientBase::onClose(handle);
+    for (auto i = writers.begin(); i != writers.end(); ++i)
+    {
+        // the status is in the awaiter, in the frame of the coroutine
+        *(i->second) = UV_ECANCELED;
+        i->first.resume();
+    }
+    if (reader)
+    {
+        reader.resume();
+    }
+}
+
+void CoConnection::onMessage(BaseMessage* msg_in)
+{
+    myInbox.push_back(unique_ptr<BaseMessage>(msg_in));
+    resumeReader();
+}
+
+void CoConnection::resumeReader()
+{
+    if (myReader)
+    {
+        auto h = myReader;
+        myReader = nullptr;
+        h.resume();
+    }
+}
+
+
+void SleepAwaiter::await_suspend(coroutine_handle<> handle_in)
+{
+    uv_timer_t* timer = new uv_timer_t();
+    ::uv_timer_init(NetHandler::getUvLoop(), timer);
+    timer->data = handle_in.address();
+    ::uv_timer_start(timer, SleepAwaiter::on_timer, myMs, 0);
+}
+
+void SleepAwaiter::on_timer(uv_timer_t* handle)
+{
+    auto h = coroutine_handle<>::from_address(handle->data);
+    ::uv_close((uv_handle_t*)handle, [](uv_handle_t* timer) { delete (uv_timer_t*)timer; });
+    h.resume();
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+// C++20 coroutine API for connections; built with the TCP_LIBUV_COROUTINES CMake option.
+
+#include "net_client.hpp"
+
+#include <uv.h>
+
+#include <coroutine>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sample
+{
+    /**
+     * Pool for coroutine frames, per loop thread.  Frames are recycled by size class, instead of heap allocation.
+     */
+    class CoFramePool
+    {
+    public:
+        static void* allocate(size_t size_in);
+        static void deallocate(void* ptr_in, size_t size_in);
+
+    private:
+        static const size_t ClassSize = 128;
+        static const size_t NumClasses = 16;
+        static const size_t MaxFreePerClass = 256;
+        // free frames, by size class
+        static thread_local std::vector<void*> ourFreeFrames[NumClasses];
+    };
+
+    /**
+     * A coroutine started right away, running detached (nobody awaits it).  The frame is freed when it finishes.
+     */
+    class CoTask
+    {
+    public:
+        class promise_type
+        {
+        public:
+            CoTask get_return_object() { return CoTask(); }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() { }
+            void unhandled_exception();
+            static void* operator new(size_t size_in) { return CoFramePool::allocate(size_in); }
+            static void operator delete(void* ptr_in, size_t size_in) { CoFramePool::deallocate(ptr_in, size_in); }
+        };
+    };
+
+    /**
+     * An outgoing connection, driven by a coroutine:
+     * co_await conn->connect(), co_await conn->send(msg), co_await conn->read_message().
+     * Reading is started once after connect, and kept running; messages are queued until read.
+     */
+    class CoConnection: public NetClientOut
+    {
+    public:
+        class ConnectAwaiter
+        {
+        public:
+            ConnectAwaiter(CoConnection & conn_in) : myConn(conn_in) { }
+            bool await_ready() const { return false; }
+            bool await_suspend(std::coroutine_handle<> handle_in);
+            int await_resume() const { return myConn.myConnectStatus; }
+        private:
+            CoConnection & myConn;
+        };
+
+        class SendAwaiter
+        {
+        public:
+            SendAwaiter(CoConnection & conn_in, SharedBuffer buf_in) : myConn(conn_in), myBuf(buf_in), myStatus(0) { }
+            bool await_ready() const { return false; }
+            bool await_suspend(std::coroutine_handle<> handle_in);
+            int await_resume();
+        private:
+            CoConnection & myConn;
+            SharedBuffer myBuf;
+            int myStatus;
+        };
+
+        class ReadAwaiter
+        {
+        public:
+            ReadAwaiter(CoConnection & conn_in) : myConn(conn_in) { }
+            bool await_ready() const { return !myConn.myInbox.empty() || myConn.myClosedFlag; }
+            void await_suspend(std::coroutine_handle<> handle_in) { myConn.myReader = handle_in; }
+            /// The next message, or nullptr if the connection is closed
+            std::unique_ptr<BaseMessage> await_resume();
+        private:
+            CoConnection & myConn;
+        };
+
+    public:
+        CoConnection(BaseApp* app_in, std::string const & host_in, int port_in);
+        /// Connect; result is 0 or error code
+        ConnectAwaiter connect() { return ConnectAwaiter(*this); }
+        /// Send a message; result is the write status
+        SendAwaiter send(BaseMessage const & msg_in) { return SendAwaiter(*this, serializeMessage(msg_in)); }
+        /// Wait for the next message; result is nullptr if closed
+        ReadAwaiter read_message() { return ReadAwaiter(*this); }
+        virtual void process(Event event_in) { }
+        void onConnect(uv_connect_t* req, int status);
+        void onClose(uv_handle_t* handle);
+
+    protected:
+        virtual void onMessage(BaseMessage* msg_in);
+        virtual void onWriteDone(int status_in);
+
+    private:
+        void resumeReader();
+
+    private:
+        std::coroutine_handle<> myConnecter;
+        int myConnectStatus;
+        std::coroutine_handle<> myReader;
+        std::deque<std::unique_ptr<BaseMessage>> myInbox;
+        // writers waiting for completion, in order of writes
+        std::deque<std::pair<std::coroutine_handle<>, int*>> myWriters;
+        bool myClosedFlag;
+    };
+
+    /**
+     * co_await sleep(ms): resume after the given time, on the loop.
+     */
+    class SleepAwaiter
+    {
+    public:
+        SleepAwaiter(uint64_t ms_in) : myMs(ms_in) { }
+        bool await_ready() const { return myMs == 0; }
+        void await_suspend(std::coroutine_handle<> handle_in);
+        void await_resume() const { }
+    private:
+        static void on_timer(uv_timer_t* handle);
+        uint64_t myMs;
+    };
+
+    inline SleepAwaiter sleep(uint64_t ms_in) { return SleepAwaiter(ms_in); }
+}
@@ -0,0 +1,286 @@
+#include "endpoint_table.hpp"
+
+#include <uv.h>
+
+#include <cstring>
+
+using namespace sample;
+using namespace std;
+
+
+EndpointKey::EndpointKey() :
+family(AF_UNSPEC),
+port(0)
+{
+    memset(addr, 0, sizeof(addr));
+}
+
+EndpointKey::EndpointKey(string const & host_in, int port_in) :
+EndpointKey()
+{
+    port = (uint16_t)port_in;
+    string host = host_in;
+    if (host.length() >= 2 && host[0] == '[' && host[host.length() - 1] == ']')
+    {
+        host = host.substr(1, host.length() - 2);
+    }
+    if (::uv_inet_pton(AF_INET, host.c_str(), addr) == 0)
+    {
+        family = AF_INET;
+        return;
+    }
+    if (::uv_inet_pton(AF_INET6, host.c_str(), addr) == 0)
+    {
+        family = AF_INET6;
+        return;
+    }
+    memset(addr, 0, sizeof(addr));
+    name = host_in;
+}
+
+EndpointKey::EndpointKey(struct sockaddr const * addr_in) :
+EndpointKey()
+{
+    if (addr_in->sa_family == AF_INET)
+    {
+        struct sockaddr_in const * in = (struct sockaddr_in const *)addr_in;
+        family = AF_INET;
+        port = ntohs(in->sin_port);
+        memcpy(addr, &in->sin_addr, 4);
+    }
+    else if (addr_in->sa_family == AF_INET6)
+    {
+        struct sockaddr_in6 const * in6 = (struct sockaddr_in6 const *)addr_in;
+        family = AF_INET6;
+        port = ntohs(in6->sin6_port);
+        memcpy(addr, &in6->sin6_addr, 16);
+    }
+}
+
+bool EndpointKey::operator==(EndpointKey const & other_in) const
+{
+    return family == other_in.family && port == other_in.port && memcmp(addr, other_in.addr, sizeof(addr)) == 0 && name == other_in.name;
+}
+
+size_t EndpointKey::hash() const
+{
+    // FNV-1a over the binary fields
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&h](uint8_t byte_in) { h = (h ^ byte_in) * 1099511628211ull; };
+    mix(family);
+    mix((uint8_t)(port >> 8));
+    mix((uint8_t)port);
+    size_t addrLen = (family == AF_INET) ? 4 : (family == AF_INET6 ? 16 : 0);
+    for (size_t i = 0; i < addrLen; ++i)
+    {
+        mix(addr[i]);
+    }
+    if (family == AF_UNSPEC)
+    {
+        h ^= std::hash<string>()(name);
+    }
+    return (size_t)h;
+}
+
+string EndpointKey::getHost() const
+{
+    char buf[64];
+    if (family == AF_INET || family == AF_INET6)
+    {
+        if (::uv_inet_ntop(family, addr, buf, sizeof(buf)) == 0)
+        {
+            return buf;
+        }
+        return "?";
+    }
+    return name;
+}
+
+
+mutex EndpointTable::ourMutex;
+unordered_map<EndpointKey, EndpointId, EndpointTable::KeyHash> EndpointTable::ourIds;
+unordered_map<string, EndpointId> EndpointTable::ourTextIds;
+atomic<EndpointTable::Entry*> EndpointTable::ourChunks[EndpointTable::MaxChunks];
+atomic<uint32_t> EndpointTable::ourSize(0);
+vector<EndpointId> EndpointTable::ourFree;
+
+EndpointId EndpointTable::intern(string const & host_in, int port_in)
+{
+    EndpointKey key(host_in, port_in);
+    lock_guard<mutex> lock(ourMutex);
+    return doIntern(key, false);
+}
+
+EndpointId EndpointTable::intern(string const & endpoint_in)
+{
+    lock_guard<mutex> lock(ourMutex);
+    auto known = ourTextIds.find(endpoint_in);
+    if (known != ourTextIds.end())
+    {
+        return known->second;
+    }
+    string host = endpoint_in;
+    int port = 0;
+    auto colonIdx = endpoint_in.rfind(':');
+    if (colonIdx != string::npos)
+    {
+        host = endpoint_in.substr(0, colonIdx);
+        try
+        {
+            port = std::stoi(endpoint_in.substr(colonIdx + 1));
+        }
+        catch(const std::exception& e)
+        {
+            port = 0;
+        }
+    }
+    EndpointId id = doIntern(EndpointKey(host, port), false);
+    if (id != 0)
+    {
+        ourTextIds[endpoint_in] = id;
+    }
+    return id;
+}
+
+EndpointId EndpointTable::intern(struct sockaddr const * addr_in)
+{
+    EndpointKey key(addr_in);
+    if (key.family == AF_UNSPEC)
+    {
+        key.name = "?";
+    }
+    lock_guard<mutex> lock(ourMutex);
+    return doIntern(key, false);
+}
+
+EndpointId EndpointTable::acquire(string const & host_in, int port_in)
+{
+    EndpointKey key(host_in, port_in);
+    lock_guard<mutex> lock(ourMutex);
+    return doIntern(key, true);
+}
+
+EndpointId EndpointTable::acquire(struct sockaddr const * addr_in)
+{
+    EndpointKey key(addr_in);
+    if (key.family == AF_UNSPEC)
+    {
+        key.name = "?";
+    }
+    lock_guard<mutex> lock(ourMutex);
+    return doIntern(key, true);
+}
+
+EndpointId EndpointTable::keep(EndpointId id_in)
+{
+    lock_guard<mutex> lock(ourMutex);
+    if (id_in == 0 || id_in > ourSize.load(memory_order_relaxed))
+    {
+        return 0;
+    }
+    Entry & entry = getSlot(id_in);
+    if (entry.refs > 0)
+    {
+        entry.refs = -1;
+    }
+    return id_in;
+}
+
+void EndpointTable::release(EndpointId id_in)
+{
+    lock_guard<mutex> lock(ourMutex);
+    if (id_in == 0 || id_in > ourSize.load(memory_order_relaxed))
+    {
+        return;
+    }
+    Entry & entry = getSlot(id_in);
+    if (entry.refs <= 0 || --entry.refs > 0)
+    {
+        // interned, or still referenced
+        return;
+    }
+    ourIds.erase(entry.key);
+    ourFree.push_back(id_in);
+}
+
+EndpointId EndpointTable::doIntern(EndpointKey const & key_in, bool acquire_in)
+{
+    auto known = ourIds.find(key_in);
+    if (known != ourIds.end())
+    {
+        Entry & entry = getSlot(known->second);
+        if (!acquire_in)
+        {
+            // kept from now on
+            entry.refs = -1;
+        }
+        else if (entry.refs >= 0)
+        {
+            ++entry.refs;
+        }
+        return known->second;
+    }
+    EndpointId id;
+    if (!ourFree.empty())
+    {
+        // not referenced any more, nobody reads it
+        id = ourFree.back();
+        ourFree.pop_back();
+    }
+    else
+    {
+        uint32_t size = ourSize.load(memory_order_relaxed);
+        if (size >= MaxChunks * ChunkSize)
+        {
+            return 0;
+        }
+        if ((size & (ChunkSize - 1)) == 0)
+        {
+            ourChunks[size >> ChunkBits].store(new Entry[ChunkSize], memory_order_release);
+        }
+        id = size + 1;
+    }
+    Entry & entry = getSlot(id);
+    entry.key = key_in;
+    entry.host = key_in.getHost();
+    entry.str = entry.host + ":" + to_string(key_in.port);
+    entry.refs = acquire_in ? 1 : -1;
+    if (id > ourSize.load(memory_order_relaxed))
+    {
+        // publishes the entry to the readers
+        ourSize.store(id, memory_order_release);
+    }
+    ourIds[key_in] = id;
+    return id;
+}
+
+EndpointTable::Entry const & EndpointTable::getEntry(EndpointId id_in)
+{
+    static const Entry none;
+    if (id_in == 0 || id_in > ourSize.load(memory_order_acquire))
+    {
+        return none;
+    }
+    return getSlot(id_in);
+}
+
+string const & EndpointTable::toString(EndpointId id_in)
+{
+    return getEntry(id_in).str;
+}
+
+string const & EndpointTable::getHost(EndpointId id_in)
+{
+    return getEntry(id_in).host;
+}
+
+int EndpointTable::getPort(EndpointId id_in)
+{
+    return getEntry(id_in).key.port;
+}
+
+size_t EndpointTable::size()
+{
+    lock_guard<mutex> lock(ourMutex);
+    return ourSize.load(memory_order_relaxed) - ourFree.size();
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct sockaddr; // forward
+
+namespace sample
+{
+    /// Small integer identity of an endpoint (address and port), see EndpointTable; 0 is none
+    typedef uint32_t EndpointId;
+
+    /**
+     * Binary endpoint: IPv4 or IPv6 address and port.  A host that is not a numeric address is kept by its name,
+     * it is not resolved (so "localhost" is not the same endpoint as "127.0.0.1").
+     */
+    struct EndpointKey
+    {
+    public:
+        EndpointKey();
+        /// From a host (numeric address, optionally in brackets, or a name) and port
+        EndpointKey(std::string const & host_in, int port_in);
+        /// From a socket address, IPv4 or IPv6; empty key for other families
+        EndpointKey(struct sockaddr const * addr_in);
+        bool operator==(EndpointKey const & other_in) const;
+        size_t hash() const;
+        std::string getHost() const;
+
+    public:
+        /// AF_INET, AF_INET6, or AF_UNSPEC for a name
+        uint8_t family;
+        uint16_t port;
+        /// Address in network order, 4 or 16 bytes used
+        uint8_t addr[16];
+        std::string name;
+    };
+
+    /**
+     * Process-wide intern table of endpoints: every distinct endpoint gets a small integer ID, for maps and comparisons;
+     * the "host:port" string is formatted once, for logs and the wire.  Interned endpoints are kept, their IDs are never reused.
+     * Remote endpoints of incoming connections (ephemeral ports, a new one for each connection) are acquired instead:
+     * kept while referenced, then their IDs are reused.
+     * Can be used from any thread (loops of several nodes in one process); interning takes a lock, lookups by ID do not.
+     */
+    class EndpointTable
+    {
+    public:
+        static EndpointId intern(std::string const & host_in, int port_in);
+        /// From "host:port"; the last colon separates the port
+        static EndpointId intern(std::string const & endpoint_in);
+        static EndpointId intern(struct sockaddr const * addr_in);
+        /// Intern with a reference, dropped by release; for the remote endpoint of an incoming connection
+        static EndpointId acquire(std::string const & host_in, int port_in);
+        static EndpointId acquire(struct sockaddr const * addr_in);
+        /// Keep an acquired endpoint as if interned, its ID is not reused (e.g. it is stored beyond the connection); returns the ID
+        static EndpointId keep(EndpointId id_in);
+        /// Drop a reference taken by acquire.  Without references (and if not interned meanwhile) the ID is reused, it must not be used any more.
+        static void release(EndpointId id_in);
+        /// "host:port", empty for 0; the reference stays valid (while the ID is)
+        static std::string const & toString(EndpointId id_in);
+        static std::string const & getHost(EndpointId id_in);
+        static int getPort(EndpointId id_in);
+        /// Number of endpoints in use
+        static size_t size();
+
+    private:
+        static const uint32_t ChunkBits = 10;
+        static const uint32_t ChunkSize = 1 << ChunkBits;
+        static const uint32_t MaxChunks = 4096;
+
+        struct Entry
+        {
+        public:
+            Entry() : refs(0) { }
+            EndpointKey key;
+            std::string host;
+            std::string str;
+            // references taken by acquire; -1: interned, kept
+            int refs;
+        };
+        struct KeyHash
+        {
+        public:
+            size_t operator()(EndpointKey const & key_in) const { return key_in.hash(); }
+        };
+        /// With the lock held; returns 0 if the table is full
+        static EndpointId doIntern(EndpointKey const & key_in, bool acquire_in);
+        static Entry & getSlot(EndpointId id_in) { return ourChunks[(id_in - 1) >> ChunkBits].load(std::memory_order_acquire)[(id_in - 1) & (ChunkSize - 1)]; }
+        static Entry const & getEntry(EndpointId id_in);
+
+    private:
+        static std::mutex ourMutex;
+        static std::unordered_map<EndpointKey, EndpointId, KeyHash> ourIds;
+        // textual forms seen already, not parsed again (of interned endpoints only)
+        static std::unordered_map<std::string, EndpointId> ourTextIds;
+        // entries by ID - 1, in chunks never moved or freed: read without the lock, up to ourSize (written before it is raised)
+        static std::atomic<Entry*> ourChunks[MaxChunks];
+        static std::atomic<uint32_t> ourSize;
+        // IDs of released entries, reused first
+        static std::vector<EndpointId> ourFree;
+    };
+}
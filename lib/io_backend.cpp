@@ -0,0 +1,20 @@
+#include "io_backend.hpp"
+
+#ifdef TCP_LIBUV_IO_URING
+#include "uring_backend.hpp"
+#endif
+
+using namespace sample;
+using namespace std;
+
+
+IoBackend* IoBackend::create(string const & name_in)
+{
+#ifdef TCP_LIBUV_IO_URING
+    if (name_in == "uring")
+    {
+        return new UringBackend();
+    }
+#endif
+    return nullptr;
+}
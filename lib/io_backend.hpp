@@ -0,0 +1,47 @@
+#pragma once
+
+#include "uv_socket.hpp"
+
+#include <uv.h>
+
+#include <string>
+
+namespace sample
+{
+    class NetClientBase; // forward
+    class NetHandler; // forward
+
+    /**
+     * Alternative socket I/O for connections, instead of libuv streams (libuv is the default, no backend).
+     * The libuv loop still drives everything (timers, async, outgoing connects); the backend hooks into it.
+     * A simulated backend (SimBackend) drives nothing, its SimNetwork does, see NetHandler::setSimulation.
+     * Connections using a backend call it to read, write and close; the backend reports back with
+     * NetClientBase::onReadData, onWriteCompleted and onBackendClosed, on the loop thread.
+     */
+    class IoBackend
+    {
+    public:
+        virtual ~IoBackend() = default;
+        virtual std::string getName() const = 0;
+        /// Set up on the loop, before it runs
+        virtual int init(uv_loop_t* loop_in) = 0;
+        /// Listen on a port; accepted sockets are passed to NetHandler::onBackendConnection
+        virtual int listen(int port_in, NetHandler* handler_in) = 0;
+        /// Start an outgoing connection, return its socket (attached to the connection); the outcome is reported
+        /// with NetClientBase::onBackendConnected.  UV_ENOTSUP if the backend does not make outgoing connections.
+        virtual int connect(NetClientBase* client_in, std::string const & host_in, int port_in) { return UV_ENOTSUP; }
+        /// Take over the connected socket of a connection
+        virtual void attach(NetClientBase* client_in, int fd_in) = 0;
+        virtual int readStart(NetClientBase* client_in) = 0;
+        virtual int readStop(NetClientBase* client_in) = 0;
+        /// Queue a buffer for sending; completion is reported with onWriteCompleted
+        virtual int write(NetClientBase* client_in, SharedBuffer const & buf_in) = 0;
+        /// Close the socket; onBackendClosed is called later
+        virtual void close(NetClientBase* client_in) = 0;
+        /// Forget the connection (it is deleted), close the socket if needed, no more callbacks
+        virtual void detach(NetClientBase* client_in) = 0;
+        virtual void printStats() = 0;
+        /// Create a backend by name ("uring"); nullptr if not known, or not built in
+        static IoBackend* create(std::string const & name_in);
+    };
+}
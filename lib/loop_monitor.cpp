@@ -0,0 +1,329 @@
+#include "loop_monitor.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+using namespace sample;
+using namespace std;
+
+
+DurationHistogram::DurationHistogram() :
+myCount(0),
+mySumUs(0),
+myMaxUs(0)
+{
+    for (int i = 0; i < BucketCount; ++i)
+    {
+        myBuckets[i] = 0;
+    }
+}
+
+void DurationHistogram::add(uint64_t us_in)
+{
+    // bucket i: up to 2^i us
+    int bucket = 0;
+    while (bucket < BucketCount - 1 && (1ull << bucket) < us_in)
+    {
+        ++bucket;
+    }
+    // one writer: no read-modify-write needed
+    myBuckets[bucket].store(myBuckets[bucket].load(memory_order_relaxed) + 1, memory_order_relaxed);
+    myCount.store(myCount.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    mySumUs.store(mySumUs.load(memory_order_relaxed) + us_in, memory_order_relaxed);
+    if (us_in > myMaxUs.load(memory_order_relaxed))
+    {
+        myMaxUs.store(us_in, memory_order_relaxed);
+    }
+}
+
+uint64_t DurationHistogram::getPercentileUs(double percentile_in) const
+{
+    uint64_t count = getCount();
+    if (count == 0)
+    {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(count * percentile_in / 100.0);
+    uint64_t sum = 0;
+    for (int i = 0; i < BucketCount; ++i)
+    {
+        sum += myBuckets[i].load(memory_order_relaxed);
+        if (sum > target)
+        {
+            return std::min(1ull << i, (unsigned long long)getMaxUs());
+        }
+    }
+    return getMaxUs();
+}
+
+
+thread_local LoopMonitor* LoopMonitor::ourCurrent = nullptr;
+mutex LoopMonitor::ourMonitorsMutex;
+condition_variable LoopMonitor::ourWatchdogWake;
+vector<LoopMonitor*> LoopMonitor::ourMonitors;
+thread LoopMonitor::ourWatchdog;
+// incremented when the watchdog is stopped, so an exiting one does not keep running beside a new one
+static uint64_t ourWatchdogGeneration = 0;
+
+LoopMonitor::LoopMonitor(LoopMonitorParams const & params_in) :
+myParams(params_in),
+myCheckNs(0),
+myPollCallbackNs(0),
+myLastLagNs(0),
+myDepth(0),
+mySlowestActivity(nullptr),
+mySlowestConnId(0),
+myBusySinceNs(0),
+myActivity(nullptr),
+myActivityConnId(0),
+myReportedSinceNs(0),
+myStallCount(0)
+{
+}
+
+int LoopMonitor::start(uv_loop_t* loop_in)
+{
+    uv_prepare_t* prepare = new uv_prepare_t();
+    prepare->data = (void*)this;
+    ::uv_prepare_init(loop_in, prepare);
+    ::uv_prepare_start(prepare, LoopMonitor::on_prepare);
+    ::uv_unref((uv_handle_t*)prepare);
+    uv_check_t* check = new uv_check_t();
+    check->data = (void*)this;
+    ::uv_check_init(loop_in, check);
+    ::uv_check_start(check, LoopMonitor::on_check);
+    ::uv_unref((uv_handle_t*)check);
+    if (myParams.lagIntervalMs > 0)
+    {
+        uv_timer_t* timer = new uv_timer_t();
+        timer->data = (void*)this;
+        ::uv_timer_init(loop_in, timer);
+        ::uv_timer_start(timer, LoopMonitor::on_lag_timer, myParams.lagIntervalMs, myParams.lagIntervalMs);
+        ::uv_unref((uv_handle_t*)timer);
+    }
+    if (myParams.stallMs == 0)
+    {
+        return 0;
+    }
+    lock_guard<mutex> lock(ourMonitorsMutex);
+    ourMonitors.push_back(this);
+    if (!ourWatchdog.joinable())
+    {
+        ourWatchdog = thread(LoopMonitor::runWatchdog);
+    }
+    return 0;
+}
+
+void LoopMonitor::stop()
+{
+    thread watchdog;
+    {
+        lock_guard<mutex> lock(ourMonitorsMutex);
+        auto i = std::find(ourMonitors.begin(), ourMonitors.end(), this);
+        if (i == ourMonitors.end())
+        {
+            return;
+        }
+        ourMonitors.erase(i);
+        if (ourMonitors.empty())
+        {
+            ++ourWatchdogGeneration;
+            watchdog = move(ourWatchdog);
+        }
+    }
+    if (watchdog.joinable())
+    {
+        ourWatchdogWake.notify_all();
+        watchdog.join();
+    }
+}
+
+void LoopMonitor::setCurrent(LoopMonitor* monitor_in)
+{
+    ourCurrent = monitor_in;
+    if (monitor_in == nullptr)
+    {
+        return;
+    }
+    string name;
+#ifdef __linux__
+    char buf[16] = { 0 };
+    if (::pthread_getname_np(::pthread_self(), buf, sizeof(buf)) == 0)
+    {
+        name = buf;
+    }
+#endif
+    lock_guard<mutex> lock(ourMonitorsMutex);
+    monitor_in->myThreadName = name.length() > 0 ? name : "loop";
+}
+
+void LoopMonitor::enter(LoopActivity & activity_inout)
+{
+    activity_inout.myPrevName = myActivity.load(memory_order_relaxed);
+    activity_inout.myPrevConnId = myActivityConnId.load(memory_order_relaxed);
+    myActivity.store(activity_inout.myName, memory_order_relaxed);
+    myActivityConnId.store(activity_inout.myConnId, memory_order_relaxed);
+    if (myDepth++ > 0)
+    {
+        return;
+    }
+    activity_inout.myStartNs = ::uv_hrtime();
+    if (myBusySinceNs.load(memory_order_relaxed) == 0)
+    {
+        // a callback of polling: busy until it returns
+        activity_inout.myInPoll = true;
+        myBusySinceNs.store(activity_inout.myStartNs, memory_order_relaxed);
+    }
+}
+
+void LoopMonitor::leave(LoopActivity & activity_inout)
+{
+    myActivity.store(activity_inout.myPrevName, memory_order_relaxed);
+    myActivityConnId.store(activity_inout.myPrevConnId, memory_order_relaxed);
+    if (--myDepth > 0)
+    {
+        return;
+    }
+    uint64_t durNs = ::uv_hrtime() - activity_inout.myStartNs;
+    if (durNs / 1000 > myCallbacks.getMaxUs())
+    {
+        mySlowestActivity = activity_inout.myName;
+        mySlowestConnId = activity_inout.myConnId;
+    }
+    myCallbacks.add(durNs / 1000);
+    if (activity_inout.myInPoll)
+    {
+        myPollCallbackNs += durNs;
+        myBusySinceNs.store(0, memory_order_relaxed);
+    }
+}
+
+void LoopMonitor::on_prepare(uv_prepare_t* handle)
+{
+    ((LoopMonitor*)handle->data)->onPrepare();
+}
+
+void LoopMonitor::on_check(uv_check_t* handle)
+{
+    ((LoopMonitor*)handle->data)->onCheck();
+}
+
+void LoopMonitor::on_lag_timer(uv_timer_t* handle)
+{
+    ((LoopMonitor*)handle->data)->onLagTimer();
+}
+
+void LoopMonitor::onPrepare()
+{
+    // about to poll: the iteration is done
+    if (myCheckNs != 0)
+    {
+        uint64_t busyNs = ::uv_hrtime() - myCheckNs + myPollCallbackNs;
+        myIterations.add(busyNs / 1000);
+    }
+    myPollCallbackNs = 0;
+    myBusySinceNs.store(0, memory_order_relaxed);
+}
+
+void LoopMonitor::onCheck()
+{
+    // polling is done: busy until the next poll
+    myCheckNs = ::uv_hrtime();
+    myBusySinceNs.store(myCheckNs, memory_order_relaxed);
+}
+
+void LoopMonitor::onLagTimer()
+{
+    uint64_t now = ::uv_hrtime();
+    if (myLastLagNs != 0)
+    {
+        uint64_t expected = myLastLagNs + (uint64_t)myParams.lagIntervalMs * 1000000;
+        myLag.add(now > expected ? (now - expected) / 1000 : 0);
+    }
+    myLastLagNs = now;
+}
+
+void LoopMonitor::checkStall(uint64_t now_in)
+{
+    uint64_t since = myBusySinceNs.load(memory_order_relaxed);
+    if (since == 0 || since == myReportedSinceNs || now_in < since + (uint64_t)myParams.stallMs * 1000000)
+    {
+        return;
+    }
+    // once per busy period; activity and busy start are read separately, they may be of neighboring callbacks
+    myReportedSinceNs = since;
+    LoopStall stall;
+    stall.busyMs = (now_in - since) / 1000000;
+    stall.activity = myActivity.load(memory_order_relaxed);
+    stall.connId = myActivityConnId.load(memory_order_relaxed);
+    if (myStalls.size() >= StallHistory)
+    {
+        myStalls.erase(myStalls.begin());
+    }
+    myStalls.push_back(stall);
+    myStallCount.store(myStallCount.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    cerr << "Loop stall: " << myThreadName << " busy for " << stall.busyMs << " ms, in "
+        << (stall.activity != nullptr ? stall.activity : "loop");
+    if (stall.connId != 0)
+    {
+        cerr << " conn " << stall.connId;
+    }
+    cerr << endl;
+}
+
+void LoopMonitor::runWatchdog()
+{
+    unique_lock<mutex> lock(ourMonitorsMutex);
+    uint64_t generation = ourWatchdogGeneration;
+    while (generation == ourWatchdogGeneration && !ourMonitors.empty())
+    {
+        uint32_t periodMs = 1000;
+        uint64_t now = ::uv_hrtime();
+        for (auto i = ourMonitors.begin(); i != ourMonitors.end(); ++i)
+        {
+            (*i)->checkStall(now);
+            periodMs = std::min(periodMs, std::max((*i)->myParams.stallMs / 4, (uint32_t)1));
+        }
+        ourWatchdogWake.wait_for(lock, chrono::milliseconds(periodMs));
+    }
+}
+
+void LoopMonitor::print(ostream & out_in) const
+{
+    out_in << "  loop " << myThreadName << ": iterations " << myIterations.getCount()
+        << " busy (us) p50 " << myIterations.getPercentileUs(50) << " p90 " << myIterations.getPercentileUs(90)
+        << " p99 " << myIterations.getPercentileUs(99) << " max " << myIterations.getMaxUs()
+        << ", callbacks " << myCallbacks.getCount() << " (us) p99 " << myCallbacks.getPercentileUs(99) << " max " << myCallbacks.getMaxUs();
+    if (mySlowestActivity != nullptr)
+    {
+        out_in << " " << mySlowestActivity;
+        if (mySlowestConnId != 0)
+        {
+            out_in << " conn " << mySlowestConnId;
+        }
+    }
+    uint64_t lagCount = myLag.getCount();
+    out_in << ", lag (us) avg " << (lagCount > 0 ? myLag.getSumUs() / lagCount : 0) << " p99 " << myLag.getPercentileUs(99)
+        << " max " << myLag.getMaxUs() << endl;
+    if (myParams.stallMs == 0)
+    {
+        return;
+    }
+    lock_guard<mutex> lock(ourMonitorsMutex);
+    out_in << "    stalls (busy > " << myParams.stallMs << " ms): " << getStallCount();
+    for (auto i = myStalls.begin(); i != myStalls.end(); ++i)
+    {
+        out_in << "  [" << i->busyMs << " ms " << (i->activity != nullptr ? i->activity : "loop");
+        if (i->connId != 0)
+        {
+            out_in << " conn " << i->connId;
+        }
+        out_in << "]";
+    }
+    out_in << endl;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <uv.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sample
+{
+    class LoopActivity; // forward
+
+    /// Params of loop monitoring, see LoopMonitor
+    struct LoopMonitorParams
+    {
+    public:
+        LoopMonitorParams() : stallMs(250), lagIntervalMs(100) { }
+        /// An iteration busy for longer is reported by the watchdog thread, with the callback running; 0 for no watchdog
+        uint32_t stallMs;
+        /// Period of the timer probing the loop lag
+        uint32_t lagIntervalMs;
+    };
+
+    /**
+     * Histogram of durations, in power-of-2 microsecond buckets.  One writer (the loop thread), readers on any thread.
+     */
+    class DurationHistogram
+    {
+    public:
+        static const int BucketCount = 32;
+
+        DurationHistogram();
+        void add(uint64_t us_in);
+        uint64_t getCount() const { return myCount.load(std::memory_order_relaxed); }
+        uint64_t getSumUs() const { return mySumUs.load(std::memory_order_relaxed); }
+        uint64_t getMaxUs() const { return myMaxUs.load(std::memory_order_relaxed); }
+        /// Upper bound of the bucket of the percentile
+        uint64_t getPercentileUs(double percentile_in) const;
+
+    private:
+        std::atomic<uint64_t> myBuckets[BucketCount];
+        std::atomic<uint64_t> myCount;
+        std::atomic<uint64_t> mySumUs;
+        std::atomic<uint64_t> myMaxUs;
+    };
+
+    /// A loop iteration that was busy longer than the threshold, as seen by the watchdog
+    struct LoopStall
+    {
+    public:
+        uint64_t busyMs;
+        /// Callback running at that moment (innermost), and its connection, if any
+        const char* activity;
+        uint32_t connId;
+    };
+
+    /**
+     * Health of one loop: duration of the busy part of each iteration (from the end of polling to the next poll, plus the
+     * callbacks run while polling), duration of the callbacks, lag of a periodic timer, in histograms.  Uses a prepare and
+     * a check handle, and a timer, not keeping the loop alive.  A watchdog thread, shared by the monitors of the process,
+     * reports iterations busy longer than a threshold, with the callback and connection running at that moment.
+     * Callbacks mark themselves with a LoopActivity.
+     */
+    class LoopMonitor
+    {
+    public:
+        LoopMonitor(LoopMonitorParams const & params_in);
+        /// Install the handles on the loop (before it runs, or from its thread), and register at the watchdog
+        int start(uv_loop_t* loop_in);
+        /// Unregister from the watchdog; call when the loop has stopped, its handles are closed with the loop
+        void stop();
+        /// The monitor of the loop running on this thread, if any
+        static LoopMonitor* current() { return ourCurrent; }
+        /// Set on the loop thread, before running the loop
+        static void setCurrent(LoopMonitor* monitor_in);
+        uint64_t getStallCount() const { return myStallCount.load(std::memory_order_relaxed); }
+        /// Print the histograms and the last stalls.  Call on the loop thread.
+        void print(std::ostream & out_in) const;
+
+    private:
+        friend class LoopActivity;
+        void enter(LoopActivity & activity_inout);
+        void leave(LoopActivity & activity_inout);
+        static void on_prepare(uv_prepare_t* handle);
+        static void on_check(uv_check_t* handle);
+        static void on_lag_timer(uv_timer_t* handle);
+        void onPrepare();
+        void onCheck();
+        void onLagTimer();
+        void checkStall(uint64_t now_in);
+        static void runWatchdog();
+
+    private:
+        static const size_t StallHistory = 8;
+        static thread_local LoopMonitor* ourCurrent;
+        static std::mutex ourMonitorsMutex;
+        static std::condition_variable ourWatchdogWake;
+        static std::vector<LoopMonitor*> ourMonitors;
+        static std::thread ourWatchdog;
+        LoopMonitorParams myParams;
+        std::string myThreadName;
+        // end of polling; 0 before the first iteration
+        uint64_t myCheckNs;
+        // callbacks run while polling, in this iteration
+        uint64_t myPollCallbackNs;
+        uint64_t myLastLagNs;
+        int myDepth;
+        DurationHistogram myIterations;
+        DurationHistogram myCallbacks;
+        DurationHistogram myLag;
+        const char* mySlowestActivity;
+        uint32_t mySlowestConnId;
+        // shared with the watchdog: start of the busy part of the current iteration (0 while polling), callback running
+        std::atomic<uint64_t> myBusySinceNs;
+        std::atomic<const char*> myActivity;
+        std::atomic<uint32_t> myActivityConnId;
+        // watchdog side, under ourMonitorsMutex
+        uint64_t myReportedSinceNs;
+        std::vector<LoopStall> myStalls;
+        std::atomic<uint64_t> myStallCount;
+    };
+
+    /**
+     * Marks a callback (or a part of it) running on the loop, for the loop monitor, while in scope.
+     * Nothing is done if the loop is not monitored.
+     */
+    class LoopActivity
+    {
+    public:
+        LoopActivity(const char* name_in, uint32_t connId_in = 0) :
+            myMonitor(LoopMonitor::current()), myName(name_in), myConnId(connId_in), myStartNs(0), myInPoll(false)
+        {
+            if (myMonitor != nullptr)
+            {
+                myMonitor->enter(*this);
+            }
+        }
+        ~LoopActivity()
+        {
+            if (myMonitor != nullptr)
+            {
+                myMonitor->leave(*this);
+            }
+        }
+        LoopActivity(LoopActivity const &) = delete;
+        LoopActivity & operator=(LoopActivity const &) = delete;
+
+    private:
+        friend class LoopMonitor;
+        LoopMonitor* myMonitor;
+        const char* myName;
+        uint32_t myConnId;
+        // set for the outermost one only
+        uint64_t myStartNs;
+        bool myInPoll;
+        // restored at the end
+        const char* myPrevName;
+        uint32_t myPrevConnId;
+    };
+}
@@ -0,0 +1,120 @@
+#include "loop_timer.hpp"
+
+#include "loop_monitor.hpp"
+#include "net_handler.hpp"
+#include "sim_network.hpp"
+#include "trace.hpp"
+
+using namespace sample;
+using namespace std;
+
+
+LoopTimer::LoopTimer() :
+myState(make_shared<TimerState>()),
+myUvTimer(nullptr)
+{
+    myState->myRepeatMs = 0;
+    myState->myGeneration = 0;
+    myState->myActive = false;
+}
+
+LoopTimer::~LoopTimer()
+{
+    stop();
+    if (myUvTimer != nullptr)
+    {
+        myUvTimer->data = nullptr;
+        if (!::uv_is_closing((uv_handle_t*)myUvTimer))
+        {
+            ::uv_close((uv_handle_t*)myUvTimer, [](uv_handle_t* handle) { delete (uv_timer_t*)handle; });
+        }
+        myUvTimer = nullptr;
+    }
+}
+
+void LoopTimer::start(uint64_t timeoutMs_in, uint64_t repeatMs_in, Callback callback_in)
+{
+    stop();
+    myState->myCallback = callback_in;
+    myState->myRepeatMs = repeatMs_in;
+    myState->myActive = true;
+    SimNetwork* sim = SimNetwork::getCurrent();
+    if (sim != nullptr)
+    {
+        scheduleSim(sim, myState, myState->myGeneration, timeoutMs_in);
+        return;
+    }
+    if (myUvTimer == nullptr)
+    {
+        myUvTimer = new uv_timer_t();
+        ::uv_timer_init(NetHandler::getUvLoop(), myUvTimer);
+    }
+    myUvTimer->data = (void*)this;
+    ::uv_timer_start(myUvTimer, LoopTimer::on_timer, timeoutMs_in, repeatMs_in);
+}
+
+void LoopTimer::stop()
+{
+    ++myState->myGeneration;
+    myState->myActive = false;
+    if (myUvTimer != nullptr)
+    {
+        ::uv_timer_stop(myUvTimer);
+    }
+}
+
+bool LoopTimer::isActive() const
+{
+    return myState->myActive;
+}
+
+uint64_t LoopTimer::now()
+{
+    SimNetwork* sim = SimNetwork::getCurrent();
+    if (sim != nullptr)
+    {
+        return sim->getNowMs();
+    }
+    return ::uv_now(NetHandler::getUvLoop());
+}
+
+void LoopTimer::on_timer(uv_timer_t* handle)
+{
+    LoopTimer* timer = (LoopTimer*)handle->data;
+    if (timer == nullptr)
+    {
+        return;
+    }
+    if (timer->myState->myRepeatMs == 0)
+    {
+        timer->myState->myActive = false;
+    }
+    ScopedTrace trace("on_timer", "uv");
+    LoopActivity activity("timer");
+    // a copy, the callback may restart or delete the timer
+    Callback callback = timer->myState->myCallback;
+    callback();
+}
+
+void LoopTimer::scheduleSim(SimNetwork* sim_in, weak_ptr<TimerState> state_in, uint64_t generation_in, uint64_t delayMs_in)
+{
+    sim_in->schedule(delayMs_in * 1000, [sim_in, state_in, generation_in]()
+    {
+        shared_ptr<TimerState> state = state_in.lock();
+        if (!state || state->myGeneration != generation_in || !state->myActive)
+        {
+            // stopped, restarted, or deleted
+            return;
+        }
+        if (state->myRepeatMs > 0)
+        {
+            scheduleSim(sim_in, state, generation_in, state->myRepeatMs);
+        }
+        else
+        {
+            state->myActive = false;
+        }
+        Callback callback = state->myCallback;
+        callback();
+    });
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <uv.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace sample
+{
+    class SimNetwork; // forward
+
+    /**
+     * Timer on the loop of the current thread: a libuv timer, or an event of the simulation (SimNetwork)
+     * that drives this thread, if any.  The callback is not called after stop, or once the timer is deleted.
+     */
+    class LoopTimer
+    {
+    public:
+        typedef std::function<void()> Callback;
+
+        LoopTimer();
+        ~LoopTimer();
+        LoopTimer(LoopTimer const &) = delete;
+        LoopTimer & operator=(LoopTimer const &) = delete;
+        /// Call the callback after timeout, then every repeat ms (0: only once); restarts if already active
+        void start(uint64_t timeoutMs_in, uint64_t repeatMs_in, Callback callback_in);
+        void stop();
+        bool isActive() const;
+        /// Current time in ms, of the loop of this thread: simulated time in a simulation, otherwise uv_now
+        static uint64_t now();
+
+    private:
+        class TimerState
+        {
+        public:
+            Callback myCallback;
+            uint64_t myRepeatMs;
+            // incremented at each start and stop, scheduled simulation events of older ones are ignored
+            uint64_t myGeneration;
+            bool myActive;
+        };
+
+        static void on_timer(uv_timer_t* handle);
+        static void scheduleSim(SimNetwork* sim_in, std::weak_ptr<TimerState> state_in, uint64_t generation_in, uint64_t delayMs_in);
+
+    private:
+        std::shared_ptr<TimerState> myState;
+        uv_timer_t* myUvTimer;
+    };
+}
@@ -0,0 +1,154 @@
+#include "mapped_file.hpp"
+
+#include <cerrno>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace sample;
+using namespace std;
+
+
+MappedFile::MappedFile() :
+myFd(-1),
+myData(nullptr),
+mySize(0),
+myReadOnly(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifndef _WIN32
+
+int MappedFile::open(string const & path_in, size_t minSize_in)
+{
+    close();
+    myPath = path_in;
+    myReadOnly = false;
+    myFd = ::open(path_in.c_str(), O_RDWR | O_CREAT, 0644);
+    if (myFd < 0)
+    {
+        return -errno;
+    }
+    struct stat st;
+    if (::fstat(myFd, &st) != 0)
+    {
+        int err = -errno;
+        close();
+        return err;
+    }
+    mySize = (size_t)st.st_size;
+    if (mySize < minSize_in)
+    {
+        if (::ftruncate(myFd, (off_t)minSize_in) != 0)
+        {
+            int err = -errno;
+            close();
+            return err;
+        }
+        mySize = minSize_in;
+    }
+    return map(false);
+}
+
+int MappedFile::openReadOnly(string const & path_in)
+{
+    close();
+    myPath = path_in;
+    myReadOnly = true;
+    myFd = ::open(path_in.c_str(), O_RDONLY);
+    if (myFd < 0)
+    {
+        return -errno;
+    }
+    struct stat st;
+    if (::fstat(myFd, &st) != 0)
+    {
+        int err = -errno;
+        close();
+        return err;
+    }
+    mySize = (size_t)st.st_size;
+    return map(true);
+}
+
+int MappedFile::map(bool readOnly_in)
+{
+    if (mySize == 0)
+    {
+        close();
+        return -EINVAL;
+    }
+    void* addr = ::mmap(nullptr, mySize, readOnly_in ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED, myFd, 0);
+    if (addr == MAP_FAILED)
+    {
+        int err = -errno;
+        close();
+        return err;
+    }
+    myData = (uint8_t*)addr;
+    return 0;
+}
+
+int MappedFile::grow(size_t newSize_in)
+{
+    if (myFd < 0 || myReadOnly)
+    {
+        return -EBADF;
+    }
+    if (newSize_in <= mySize)
+    {
+        return 0;
+    }
+    if (::ftruncate(myFd, (off_t)newSize_in) != 0)
+    {
+        return -errno;
+    }
+    ::munmap(myData, mySize);
+    myData = nullptr;
+    mySize = newSize_in;
+    return map(false);
+}
+
+void MappedFile::sync()
+{
+    if (myData != nullptr && !myReadOnly)
+    {
+        ::msync(myData, mySize, MS_ASYNC);
+    }
+}
+
+void MappedFile::close()
+{
+    if (myData != nullptr)
+    {
+        ::munmap(myData, mySize);
+        myData = nullptr;
+    }
+    if (myFd >= 0)
+    {
+        ::close(myFd);
+        myFd = -1;
+    }
+    mySize = 0;
+}
+
+#else // _WIN32
+
+// Not supported on Windows yet
+int MappedFile::open(string const & path_in, size_t minSize_in) { return -ENOSYS; }
+int MappedFile::openReadOnly(string const & path_in) { return -ENOSYS; }
+int MappedFile::map(bool readOnly_in) { return -ENOSYS; }
+int MappedFile::grow(size_t newSize_in) { return -ENOSYS; }
+void MappedFile::sync() { }
+void MappedFile::close() { }
+
+#endif // _WIN32
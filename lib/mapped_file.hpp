@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace sample
+{
+    /**
+     * A file mapped into memory (read-write or read-only).
+     * Errors are returned as negative values (-errno).
+     */
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        ~MappedFile();
+        MappedFile(MappedFile const &) = delete;
+        MappedFile & operator=(MappedFile const &) = delete;
+        /// Open read-write, create if needed; file is extended to at least minSize_in bytes
+        int open(std::string const & path_in, size_t minSize_in);
+        /// Open an existing file read-only
+        int openReadOnly(std::string const & path_in);
+        /// Extend the file and remap it; data pointer may change
+        int grow(size_t newSize_in);
+        /// Flush changes to disk (asynchronously)
+        void sync();
+        void close();
+        bool isOpen() const { return myData != nullptr; }
+        uint8_t* data() const { return myData; }
+        size_t size() const { return mySize; }
+        std::string getPath() const { return myPath; }
+
+    private:
+        int map(bool readOnly_in);
+
+    private:
+        std::string myPath;
+        int myFd;
+        uint8_t* myData;
+        size_t mySize;
+        bool myReadOnly;
+    };
+}
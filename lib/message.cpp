@@ -1,12 +1,64 @@
 #include "message.hpp"  
+#include "stage_stats.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <sstream>
 
 using namespace sample;
 using namespace std;
 
 
 BaseMessage::BaseMessage(MessageType type_in) :
-myType(type_in)
+myType(type_in),
+myRequestId(0)
+{
+}
+
+MessageClass BaseMessage::getMessageClass(MessageType type_in)
+{
+    switch (type_in)
+    {
+        case MessageType::Ping:
+        case MessageType::PingResponse:
+            return MessageClass::LatencyClass;
+        case MessageType::OtherPeer:
+        case MessageType::Publish:
+        case MessageType::Bulk:
+            return MessageClass::BulkClass;
+        default:
+            return MessageClass::ControlClass;
+    }
+}
+
+bool BaseMessage::isResponseType(MessageType type_in)
 {
+    return type_in == MessageType::HandshakeResponse || type_in == MessageType::PingResponse;
+}
+
+string BaseMessage::getClassName(MessageClass class_in)
+{
+    switch (class_in)
+    {
+        case MessageClass::ControlClass: return "control";
+        case MessageClass::LatencyClass: return "latency";
+        case MessageClass::BulkClass: return "bulk";
+        default: return "?";
+    }
+}
+
+int BaseMessage::parseClassName(string const & name_in, MessageClass & class_out)
+{
+    for (int i = 0; i < MessageClass::MessageClassCount; ++i)
+    {
+        if (name_in == getClassName((MessageClass)i))
+        {
+            class_out = (MessageClass)i;
+            return 0;
+        }
+    }
+    return -1;
 }
 
 
@@ -100,29 +152,200 @@ string OtherPeerMessage::toString() const
 }
 
 
+BulkMessage::BulkMessage(string name_in, uint64_t length_in) :
+BaseMessage(MessageType::Bulk),
+myName(name_in),
+myLength(length_in)
+{
+    // single token
+    replace(myName.begin(), myName.end(), ' ', '_');
+    if (myName.empty()) myName = "_";
+}
+
+void BulkMessage::visit(MessageVisitorBase & visitor_in) const
+{
+    visitor_in.bulk(*this);
+}
+
+string BulkMessage::toString() const
+{
+    return "Bulk " + myName + " " + to_string(myLength);
+}
+
+
+SubscribeMessage::SubscribeMessage(string topic_in, bool subscribe_in, int hops_in) :
+BaseMessage(MessageType::Subscribe),
+myTopic(topic_in),
+mySubscribe(subscribe_in),
+myHops(hops_in)
+{
+    replace(myTopic.begin(), myTopic.end(), ' ', '_');
+}
+
+void SubscribeMessage::visit(MessageVisitorBase & visitor_in) const
+{
+    visitor_in.subscribe(*this);
+}
+
+string SubscribeMessage::toString() const
+{
+    return string(mySubscribe ? "Subscribe " : "Unsubscribe ") + myTopic + (mySubscribe ? " " + to_string(myHops) : "");
+}
+
+
+PublishMessage::PublishMessage(uint64_t msgId_in, string topic_in, int ttl_in, string payload_in) :
+BaseMessage(MessageType::Publish),
+myMsgId(msgId_in),
+myTopic(topic_in),
+myTtl(ttl_in),
+myPayload(payload_in)
+{
+    // single tokens
+    replace(myTopic.begin(), myTopic.end(), ' ', '_');
+    replace(myPayload.begin(), myPayload.end(), ' ', '_');
+    if (myPayload.empty()) myPayload = "_";
+}
+
+void PublishMessage::visit(MessageVisitorBase & visitor_in) const
+{
+    visitor_in.publish(*this);
+}
+
+string PublishMessage::toString() const
+{
+    return "Publish " + myTopic + " " + myPayload + " " + to_string(myMsgId) + " " + to_string(myTtl);
+}
+
+
+MembershipMessage::MembershipMessage(Kind kind_in, string endpoint_in, int ttl_in, vector<string> endpoints_in) :
+BaseMessage(MessageType::Membership),
+myKind(kind_in),
+myEndpoint(endpoint_in),
+myTtl(ttl_in),
+myEndpoints(endpoints_in)
+{
+}
+
+void MembershipMessage::visit(MessageVisitorBase & visitor_in) const
+{
+    visitor_in.membership(*this);
+}
+
+string MembershipMessage::toString() const
+{
+    return "Membership " + kindToString(myKind) + " " + myEndpoint + " " + to_string(myTtl) + " " + to_string(myEndpoints.size());
+}
+
+string MembershipMessage::kindToString(Kind kind_in)
+{
+    switch (kind_in)
+    {
+        case Join: return "JOIN";
+        case ForwardJoin: return "FWDJOIN";
+        case Disconnect: return "DISC";
+        case Neighbor: return "NEIGH";
+        case NeighborAccept: return "NEIGHACC";
+        case NeighborReject: return "NEIGHREJ";
+        case Shuffle: return "SHUF";
+        case ShuffleReply: return "SHUFREP";
+    }
+    return "?";
+}
+
+int MembershipMessage::kindFromString(string const & text_in)
+{
+    for (int k = Join; k <= ShuffleReply; ++k)
+    {
+        if (kindToString((Kind)k) == text_in)
+        {
+            return k;
+        }
+    }
+    return 0;
+}
+
+
 void SerializerMessageVisitor::handshake(HandshakeMessage const & msg_in)
 {
-    myMessage = "HANDSH " + msg_in.getMyVersion() + " " + msg_in.getYourAddr() + " " + msg_in.getMyAddr();
+    setMessage(msg_in, "HANDSH " + msg_in.getMyVersion() + " " + msg_in.getYourAddr() + " " + msg_in.getMyAddr());
 }
 
 void SerializerMessageVisitor::handshakeResponse(HandshakeResponseMessage const & msg_in)
 {
-    myMessage = "HANDSHRESP " + msg_in.getMyVersion() + " " + msg_in.getMyAddr() + " " + msg_in.getYourAddr();
+    setMessage(msg_in, "HANDSHRESP " + msg_in.getMyVersion() + " " + msg_in.getMyAddr() + " " + msg_in.getYourAddr());
 }
 
 void SerializerMessageVisitor::ping(PingMessage const & msg_in)
 {
-    myMessage = "PING " + msg_in.getText();
+    setMessage(msg_in, "PING " + msg_in.getText());
 }
 
 void SerializerMessageVisitor::pingResponse(PingResponseMessage const & msg_in)
 {
-    myMessage = "PINGRESP " + msg_in.getText();
+    setMessage(msg_in, "PINGRESP " + msg_in.getText());
 }
 
 void SerializerMessageVisitor::otherPeer(OtherPeerMessage const & msg_in)
 {
-    myMessage = "OPEER " + msg_in.getHost() + " " + to_string(msg_in.getPort());
+    setMessage(msg_in, "OPEER " + msg_in.getHost() + " " + to_string(msg_in.getPort()));
+}
+
+void SerializerMessageVisitor::bulk(BulkMessage const & msg_in)
+{
+    setMessage(msg_in, "BULK " + msg_in.getName() + " " + to_string(msg_in.getLength()));
+}
+
+void SerializerMessageVisitor::subscribe(SubscribeMessage const & msg_in)
+{
+    if (msg_in.isSubscribe())
+    {
+        setMessage(msg_in, "SUB " + msg_in.getTopic() + " " + to_string(msg_in.getHops()));
+    }
+    else
+    {
+        setMessage(msg_in, "UNSUB " + msg_in.getTopic());
+    }
+}
+
+void SerializerMessageVisitor::publish(PublishMessage const & msg_in)
+{
+    char id[17];
+    snprintf(id, sizeof(id), "%016llx", (unsigned long long)msg_in.getMsgId());
+    setMessage(msg_in, "PUB " + string(id) + " " + msg_in.getTopic() + " " + to_string(msg_in.getTtl()) + " " + msg_in.getPayload());
+}
+
+void SerializerMessageVisitor::membership(MembershipMessage const & msg_in)
+{
+    // empty endpoint and list are sent as "-", the list is comma separated
+    string list;
+    for (auto i = msg_in.getEndpoints().begin(); i != msg_in.getEndpoints().end(); ++i)
+    {
+        if (!list.empty()) list += ",";
+        list += *i;
+    }
+    setMessage(msg_in, "HPV " + MembershipMessage::kindToString(msg_in.getKind()) + " " + (msg_in.getEndpoint().empty() ? "-" : msg_in.getEndpoint()) + " " +
+        to_string(msg_in.getTtl()) + " " + (list.empty() ? "-" : list));
+}
+
+void SerializerMessageVisitor::extension(BaseMessage const & msg_in, string const & body_in)
+{
+    setMessage(msg_in, body_in);
+}
+
+void SerializerMessageVisitor::setMessage(BaseMessage const & msg_in, string const & body_in)
+{
+    myMessage = body_in;
+    if (msg_in.getRequestId() != 0)
+    {
+        myMessage += " #" + to_string(msg_in.getRequestId());
+    }
+}
+
+map<string, MessageDeserializer::Parser> MessageDeserializer::ourParsers;
+
+void MessageDeserializer::registerParser(string const & keyword_in, Parser parser_in)
+{
+    ourParsers[keyword_in] = parser_in;
 }
 
 BaseMessage* MessageDeserializer::parseMessage(std::vector<std::string> const & tokens)
@@ -131,25 +354,94 @@ BaseMessage* MessageDeserializer::parseMessage(std::vector<std::string> const &
     {
         return nullptr;
     }
-    if (tokens[0] == "HANDSH" && tokens.size() >= 4)
+    // optional request ID, as last token; peers not knowing it ignore the extra token
+    size_t n = tokens.size();
+    uint32_t requestId = 0;
+    string const & last = tokens[n - 1];
+    if (n >= 2 && last.length() >= 2 && last.length() <= 11 && last[0] == '#' && isdigit(last[1]))
+    {
+        requestId = (uint32_t)stoul(last.substr(1));
+        --n;
+    }
+    BaseMessage* msg = parseMessageBody(tokens, n);
+    if (msg != nullptr)
+    {
+        msg->setRequestId(requestId);
+    }
+    return msg;
+}
+
+BaseMessage* MessageDeserializer::parseLine(string const & line_in)
+{
+    // split into tokens
+    vector<string> tokens;
+    {
+        STAGE_TIMER(StageTokenize);
+        string buf;
+        stringstream ss(line_in);
+        while (ss >> buf) tokens.push_back(buf);
+    }
+    STAGE_TIMER(StageParse);
+    return parseMessage(tokens);
+}
+
+BaseMessage* MessageDeserializer::parseMessageBody(std::vector<std::string> const & tokens, size_t n)
+{
+    if (tokens[0] == "HANDSH" && n >= 4)
     {
         return new HandshakeMessage(tokens[1], tokens[2], tokens[3]);
     }
-    else if (tokens[0] == "HANDSHRESP" && tokens.size() >= 4)
+    else if (tokens[0] == "HANDSHRESP" && n >= 4)
     {
         return new HandshakeResponseMessage(tokens[1], tokens[2], tokens[3]);
     }
-    else if (tokens[0] == "PING" && tokens.size() >= 2)
+    else if (tokens[0] == "PING" && n >= 2)
     {
         return new PingMessage(tokens[1]);
     }
-    else if (tokens[0] == "PINGRESP" && tokens.size() >= 2)
+    else if (tokens[0] == "PINGRESP" && n >= 2)
     {
         return new PingResponseMessage(tokens[1]);
     }
-    else if (tokens[0] == "OPEER" && tokens.size() >= 3)
+    else if (tokens[0] == "OPEER" && n >= 3)
     {
         return new OtherPeerMessage(tokens[1], stoi(tokens[2]));
     }
+    else if (tokens[0] == "BULK" && n >= 3 && isdigit(tokens[2][0]) && tokens[2].length() <= 19)
+    {
+        return new BulkMessage(tokens[1], stoull(tokens[2]));
+    }
+    else if ((tokens[0] == "SUB" || tokens[0] == "UNSUB") && n >= 2)
+    {
+        // hops is optional, 0 (own subscription) if missing
+        int hops = (n >= 3 && isdigit(tokens[2][0]) && tokens[2].length() <= 3) ? stoi(tokens[2]) : 0;
+        return new SubscribeMessage(tokens[1], tokens[0] == "SUB", hops);
+    }
+    else if (tokens[0] == "HPV" && n >= 5 && MembershipMessage::kindFromString(tokens[1]) != 0 && isdigit(tokens[3][0]) && tokens[3].length() <= 3)
+    {
+        vector<string> endpoints;
+        if (tokens[4] != "-")
+        {
+            stringstream ss(tokens[4]);
+            string ep;
+            while (getline(ss, ep, ','))
+            {
+                if (!ep.empty()) endpoints.push_back(ep);
+            }
+        }
+        return new MembershipMessage((MembershipMessage::Kind)MembershipMessage::kindFromString(tokens[1]), tokens[2] == "-" ? "" : tokens[2], stoi(tokens[3]), endpoints);
+    }
+    else if (tokens[0] == "PUB" && n >= 5 && tokens[1].length() == 16 && isxdigit(tokens[1][0]) && isdigit(tokens[3][0]) && tokens[3].length() <= 3)
+    {
+        return new PublishMessage(stoull(tokens[1], nullptr, 16), tokens[2], stoi(tokens[3]), tokens[4]);
+    }
+    if (!ourParsers.empty())
+    {
+        auto parser = ourParsers.find(tokens[0]);
+        if (parser != ourParsers.end())
+        {
+            return parser->second(tokens, n);
+        }
+    }
     return nullptr;
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -12,7 +15,23 @@ namespace sample
         HandshakeResponse = 2,
         Ping = 3,
         PingResponse = 4,
-        OtherPeer = 5
+        OtherPeer = 5,
+        Bulk = 6,
+        Subscribe = 7,
+        Publish = 8,
+        Membership = 9,
+        /// Types from here on are free for applications: parsed by a registered parser (see MessageDeserializer::registerParser),
+        /// serialized through MessageVisitorBase::extension, handled by registered handlers (see MessageHandlers)
+        FirstExtension = 64
+    };
+
+    /// Classes of message types, for rate limits
+    enum MessageClass
+    {
+        ControlClass = 0, // handshake, membership, subscriptions
+        LatencyClass = 1, // ping and its response
+        BulkClass = 2, // peer gossip, published messages, bulk payloads
+        MessageClassCount = 3
     };
 
     class MessageVisitorBase;  // forward decl
@@ -26,11 +45,25 @@ namespace sample
         BaseMessage(MessageType type_in);
         virtual ~BaseMessage() = default;
         MessageType getType() const { return myType; }
+        MessageClass getClass() const { return getMessageClass(myType); }
+        static MessageClass getMessageClass(MessageType type_in);
+        /// control, latency, bulk
+        static std::string getClassName(MessageClass class_in);
+        /// Return 0 if the name is known
+        static int parseClassName(std::string const & name_in, MessageClass & class_out);
+        /// Optional request ID, used to match responses to requests.  0 if not set.
+        uint32_t getRequestId() const { return myRequestId; }
+        void setRequestId(uint32_t requestId_in) { myRequestId = requestId_in; }
+        /// True for responses (their request ID is that of a request sent by this side); the IDs of the other messages
+        /// are numbered by the peer.  By type; messages of types added by applications can override it.
+        virtual bool isResponse() const { return isResponseType(myType); }
+        static bool isResponseType(MessageType type_in);
         virtual void visit(MessageVisitorBase & visitor_in) const = 0;
         virtual std::string toString() const = 0;
 
     private:
         MessageType myType;
+        uint32_t myRequestId;
     };
 
     class HandshakeMessage: public BaseMessage
@@ -104,6 +137,92 @@ namespace sample
         int myPort;
     };
 
+    /// Header of a bulk payload: the given number of raw bytes follow right after the message line
+    class BulkMessage: public BaseMessage
+    {
+    public:
+        BulkMessage(std::string name_in, uint64_t length_in);
+        std::string getName() const { return myName; }
+        uint64_t getLength() const { return myLength; }
+        void visit(MessageVisitorBase & visitor_in) const;
+        std::string toString() const;
+
+    private:
+        std::string myName;
+        uint64_t myLength;
+    };
+
+    /// Topic interest of the sender (or its withdrawal), for pub/sub routing; hops is the distance from the sender
+    /// to the nearest subscriber (0: the sender itself)
+    class SubscribeMessage: public BaseMessage
+    {
+    public:
+        SubscribeMessage(std::string topic_in, bool subscribe_in, int hops_in = 0);
+        std::string getTopic() const { return myTopic; }
+        bool isSubscribe() const { return mySubscribe; }
+        int getHops() const { return myHops; }
+        void visit(MessageVisitorBase & visitor_in) const;
+        std::string toString() const;
+
+    private:
+        std::string myTopic;
+        bool mySubscribe;
+        int myHops;
+    };
+
+    /// A published event on a topic; the ID is unique (origin node and sequence), TTL is the max. number of further hops
+    class PublishMessage: public BaseMessage
+    {
+    public:
+        PublishMessage(uint64_t msgId_in, std::string topic_in, int ttl_in, std::string payload_in);
+        uint64_t getMsgId() const { return myMsgId; }
+        std::string const & getTopic() const { return myTopic; }
+        int getTtl() const { return myTtl; }
+        std::string const & getPayload() const { return myPayload; }
+        void visit(MessageVisitorBase & visitor_in) const;
+        std::string toString() const;
+
+    private:
+        uint64_t myMsgId;
+        std::string myTopic;
+        int myTtl;
+        std::string myPayload;
+    };
+
+    /// Membership protocol message (HyParView: join, views, shuffle); endpoint, TTL and endpoint list are used depending on the kind
+    class MembershipMessage: public BaseMessage
+    {
+    public:
+        enum Kind
+        {
+            Join = 1,
+            ForwardJoin = 2,
+            Disconnect = 3,
+            Neighbor = 4,
+            NeighborAccept = 5,
+            NeighborReject = 6,
+            Shuffle = 7,
+            ShuffleReply = 8
+        };
+
+        MembershipMessage(Kind kind_in, std::string endpoint_in = "", int ttl_in = 0, std::vector<std::string> endpoints_in = std::vector<std::string>());
+        Kind getKind() const { return myKind; }
+        std::string const & getEndpoint() const { return myEndpoint; }
+        int getTtl() const { return myTtl; }
+        std::vector<std::string> const & getEndpoints() const { return myEndpoints; }
+        void visit(MessageVisitorBase & visitor_in) const;
+        std::string toString() const;
+        static std::string kindToString(Kind kind_in);
+        /// Kind from its text, 0 if unknown
+        static int kindFromString(std::string const & text_in);
+
+    private:
+        Kind myKind;
+        std::string myEndpoint;
+        int myTtl;
+        std::vector<std::string> myEndpoints;
+    };
+
     class MessageVisitorBase
     {
     public:
@@ -112,6 +231,12 @@ namespace sample
         virtual void ping(PingMessage const & msg_in) = 0;
         virtual void pingResponse(PingResponseMessage const & msg_in) = 0;
         virtual void otherPeer(OtherPeerMessage const & msg_in) = 0;
+        virtual void bulk(BulkMessage const & msg_in) = 0;
+        virtual void subscribe(SubscribeMessage const & msg_in) = 0;
+        virtual void publish(PublishMessage const & msg_in) = 0;
+        virtual void membership(MembershipMessage const & msg_in) = 0;
+        /// Message of a type added by an application, with its serialized body (keyword and arguments, without the request ID)
+        virtual void extension(BaseMessage const & msg_in, std::string const & body_in) { }
 	    virtual ~MessageVisitorBase() = default;
     };
 
@@ -126,8 +251,17 @@ namespace sample
         void ping(PingMessage const & msg_in);
         void pingResponse(PingResponseMessage const & msg_in);
         void otherPeer(OtherPeerMessage const & msg_in);
+        void bulk(BulkMessage const & msg_in);
+        void subscribe(SubscribeMessage const & msg_in);
+        void publish(PublishMessage const & msg_in);
+        void membership(MembershipMessage const & msg_in);
+        void extension(BaseMessage const & msg_in, std::string const & body_in);
         std::string getMessage() const { return myMessage; }
 
+    private:
+        /// Set serialized message, with optional request ID appended as a last token ('#12')
+        void setMessage(BaseMessage const & msg_in, std::string const & body_in);
+
     private:
         std::string myMessage;
     };
@@ -138,5 +272,20 @@ namespace sample
     public:
         /// Create new message object from the given tokens, if possible.
         static BaseMessage* parseMessage(std::vector<std::string> const & tokens);
+        /// Create new message object from a message line (without terminator), if possible.
+        static BaseMessage* parseLine(std::string const & line_in);
+        /// Creates a message from the first n tokens (without the request ID), nullptr if they are not valid
+        typedef std::function<BaseMessage*(std::vector<std::string> const & tokens, size_t n)> Parser;
+        /// Parse messages starting with the keyword (first token) with the parser, for types added by applications;
+        /// the built-in keywords cannot be replaced.  Register before any loop starts.
+        static void registerParser(std::string const & keyword_in, Parser parser_in);
+
+    private:
+        /// Parse message without the request ID, considering only the first n tokens
+        static BaseMessage* parseMessageBody(std::vector<std::string> const & tokens, size_t n);
+
+    private:
+        // by keyword
+        static std::map<std::string, Parser> ourParsers;
     };
 }
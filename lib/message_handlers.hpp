@@ -0,0 +1,76 @@
+#pragma once
+
+#include "message.hpp"
+
+#include <functional>
+#include <vector>
+
+namespace sample
+{
+    /**
+     * Registry of handlers of incoming messages, by message type: a flat table indexed by the type ID, so dispatch is one
+     * bounds check and one call, with no RTTI cast (the handler gets the message statically cast to the registered type).
+     * Types without a handler go to the default handler, if set.  Type IDs are plain integers, types added by an
+     * application (from MessageType::FirstExtension on) are registered the same way as the built-in ones.
+     * Not thread-safe: register before the loop starts, or on the loop thread.
+     */
+    template <class Context>
+    class MessageHandlers
+    {
+    public:
+        typedef std::function<void(Context &, BaseMessage const &)> Handler;
+
+        /// Register a typed handler (lambda or function object) of a type, replacing any previous one; e.g. add<PingMessage>(MessageType::Ping, ...)
+        template <class Message, class Function>
+        void add(int type_in, Function function_in)
+        {
+            set(type_in, [function_in](Context & context_in, BaseMessage const & msg_in)
+                { function_in(context_in, static_cast<Message const &>(msg_in)); });
+        }
+        /// Register a typed member function of an object as handler of a type, replacing any previous one
+        template <class Message, class Object, class Class>
+        void add(int type_in, Object* object_in, void (Class::*method_in)(Context &, Message const &))
+        {
+            set(type_in, [object_in, method_in](Context & context_in, BaseMessage const & msg_in)
+                { (object_in->*method_in)(context_in, static_cast<Message const &>(msg_in)); });
+        }
+        /// Register an untyped handler of a type; an empty one removes the handler
+        void set(int type_in, Handler handler_in)
+        {
+            if (type_in < 0)
+            {
+                return;
+            }
+            if ((size_t)type_in >= myHandlers.size())
+            {
+                myHandlers.resize((size_t)type_in + 1);
+            }
+            myHandlers[(size_t)type_in] = std::move(handler_in);
+        }
+        void remove(int type_in) { set(type_in, Handler()); }
+        bool has(int type_in) const { return type_in >= 0 && (size_t)type_in < myHandlers.size() && myHandlers[(size_t)type_in]; }
+        /// Handler of the types not registered
+        void setDefault(Handler handler_in) { myDefault = std::move(handler_in); }
+        /// Call the handler of the type of the message, or the default one; returns false if there was none
+        bool dispatch(Context & context_in, BaseMessage const & msg_in) const
+        {
+            size_t type = (size_t)msg_in.getType();
+            if (type < myHandlers.size() && myHandlers[type])
+            {
+                myHandlers[type](context_in, msg_in);
+                return true;
+            }
+            if (myDefault)
+            {
+                myDefault(context_in, msg_in);
+                return true;
+            }
+            return false;
+        }
+
+    private:
+        // by type ID
+        std::vector<Handler> myHandlers;
+        Handler myDefault;
+    };
+}
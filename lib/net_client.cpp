@@ -1,298 +1,1699 @@
 #include "net_client.hpp"
 
 #include "app.hpp"
+#include "capture.hpp"
+#include "io_backend.hpp"
+#include "loop_monitor.hpp"
 #include "message.hpp"
 #include "net_handler.hpp"
+#include "stage_stats.hpp"
+#include "trace.hpp"
 #include "uv_socket.hpp"
 
 #include <uv.h>
 
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <memory>
 
 using namespace sample;
 using namespace std;
 
 
-NetClientBase::NetClientBase(BaseApp* app_in, string const & peerAddr_in) :
+typedef NetClientBase::State S;
+typedef NetClientBase::Transition T;
+static constexpr uint8_t Read = NetClientBase::ActStartRead;
+static constexpr uint8_t Proc = NetClientBase::ActProcess;
+static constexpr uint8_t Ign = NetClientBase::ActIgnore;
+// illegal
+static constexpr T X = { S::Undefined, 0 };
+
+/// Connection state machine: next state and actions, by state (rows) and event (columns), see NetClientBase::handleEvent
+static constexpr T ourTransitions[S::StateCount][NetClientBase::EventCount] =
+{
+    //                 Connect              Connected                    Accept                Read                         Send                  WriteDone                    WriteError            Receive                      Close                 Closed
+    /* Undefined */    { X,                   X,                           X,                    X,                           X,                    X,                           X,                    X,                           X,                    X },
+    /* NotConnected */ { { S::Connecting, 0 }, X,                           { S::Accepted, 0 },   X,                           X,                    X,                           X,                    X,                           { S::Closing, 0 },    X },
+    /* Connecting */   { X,                   { S::Connected, Proc },      X,                    X,                           { S::Connecting, 0 }, { S::Connecting, Proc },     { S::Connecting, 0 }, X,                           { S::Closing, 0 },    X },
+    /* Connected */    { X,                   X,                           X,                    { S::Receiving, Read },      { S::Connected, 0 },  { S::Connected, Proc },      { S::Connected, 0 },  X,                           { S::Closing, 0 },    X },
+    /* Accepted */     { X,                   X,                           X,                    { S::Receiving, Read },      { S::Accepted, 0 },   { S::Accepted, Proc },       { S::Accepted, 0 },   X,                           { S::Closing, 0 },    X },
+    /* Receiving */    { X,                   X,                           X,                    { S::Receiving, 0 },         { S::Receiving, 0 },  { S::Receiving, Proc },      { S::Receiving, 0 },  { S::Receiving, Proc },      { S::Closing, 0 },    X },
+    /* Closing */      { X,                   { S::Closing, Ign },         X,                    { S::Closing, Ign },         { S::Closing, Ign },  { S::Closing, Ign },         { S::Closing, Ign },  { S::Closing, Ign },         { S::Closing, Ign },  { S::Closed, 0 } },
+    /* Closed */       { { S::Connecting, 0 }, { S::Closed, Ign },         X,                    { S::Closed, Ign },          { S::Closed, Ign },   { S::Closed, Ign },          { S::Closed, Ign },   { S::Closed, Ign },          { S::Closed, Ign },   X },
+};
+
+static constexpr T transitionOf(S state_in, NetClientBase::Event event_in) { return ourTransitions[state_in][event_in]; }
+static_assert(transitionOf(S::Receiving, NetClientBase::ReadEvent).actions == 0, "reading is started once");
+static_assert(transitionOf(S::Receiving, NetClientBase::SendEvent).next == S::Receiving && transitionOf(S::Receiving, NetClientBase::ReceiveEvent).next == S::Receiving,
+    "messages do not change the state");
+static_assert(transitionOf(S::Closed, NetClientBase::SendEvent).actions == Ign, "no sending after close");
+
+
+atomic<uint32_t> NetClientBase::ourNextConnId(1);
+ConnectionLimits NetClientBase::ourLimits;
+ReadBufferSizing NetClientBase::ourReadBufferSizing;
+atomic<uint64_t> NetClientBase::ourReadBufferGrows(0);
+atomic<uint64_t> NetClientBase::ourReadBufferShrinks(0);
+SendScheduling NetClientBase::ourSendScheduling;
+atomic<size_t> NetClientBase::ourTotalBufferedBytes(0);
+atomic<uint64_t> NetClientBase::ourLimitCloseCount(0);
+RateLimitParams NetClientBase::ourRateLimits;
+atomic<uint64_t> NetClientBase::ourRateDelayCount(0);
+atomic<uint64_t> NetClientBase::ourRateDropCount(0);
+atomic<uint64_t> NetClientBase::ourRateCloseCount(0);
+atomic<uint64_t> NetClientBase::ourUnparseableCount(0);
+thread_local list<NetClientBase*> NetClientBase::ourPausedReaders;
+atomic<uint64_t> NetClientBase::ourSentMessages(0);
+atomic<uint64_t> NetClientBase::ourSentBytes(0);
+atomic<uint64_t> NetClientBase::ourReceivedMessages(0);
+atomic<uint64_t> NetClientBase::ourReceivedBytes(0);
+atomic<uint64_t> NetClientBase::ourTryWrites(0);
+atomic<uint64_t> NetClientBase::ourTryWriteFull(0);
+atomic<uint64_t> NetClientBase::ourTryWritePartial(0);
+atomic<uint64_t> NetClientBase::ourAsyncWrites(0);
+RequestPolicy NetClientBase::ourRequestPolicy;
+RequestPolicy NetClientBase::ourIdempotentRequestPolicy;
+int NetClientBase::ourRequestCloseAfter = 0;
+atomic<uint64_t> NetClientBase::ourRequests(0);
+atomic<uint64_t> NetClientBase::ourRequestResponses(0);
+atomic<uint64_t> NetClientBase::ourRequestRetries(0);
+atomic<uint64_t> NetClientBase::ourRequestTimeouts(0);
+atomic<uint64_t> NetClientBase::ourRequestCancels(0);
+atomic<uint64_t> NetClientBase::ourRequestCloses(0);
+DurationHistogram NetClientBase::ourRequestLatency;
+
+SendScheduling::SendScheduling() :
+weighted(false),
+windowBytes(64 << 10)
+{
+    weights[MessageClass::ControlClass] = 4;
+    weights[MessageClass::LatencyClass] = 4;
+    weights[MessageClass::BulkClass] = 1;
+}
+
+int SendScheduling::parse(string const & text_in)
+{
+    if (text_in == "strict")
+    {
+        weighted = false;
+        return 0;
+    }
+    if (text_in.substr(0, 8) != "weighted")
+    {
+        return -1;
+    }
+    weighted = true;
+    if (text_in.length() == 8)
+    {
+        return 0;
+    }
+    unsigned int w[MessageClass::MessageClassCount];
+    if (text_in[8] != ':' || std::sscanf(text_in.c_str() + 9, "%u,%u,%u", &w[0], &w[1], &w[2]) != MessageClass::MessageClassCount)
+    {
+        return -1;
+    }
+    for (int i = 0; i < MessageClass::MessageClassCount; ++i)
+    {
+        weights[i] = std::max(w[i], 1u);
+    }
+    return 0;
+}
+
+string SendScheduling::toString() const
+{
+    if (!weighted)
+    {
+        return "strict";
+    }
+    return "weighted:" + to_string(weights[0]) + "," + to_string(weights[1]) + "," + to_string(weights[2]);
+}
+
+size_t ConnectionMemoryUsage::total() const
+{
+    return receiveBuffer + writeQueue + pendingWrites * (sizeof(uv_write_t) + sizeof(UvWriteRequest) + sizeof(uv_buf_t));
+}
+
+NetClientBase::NetClientBase(BaseApp* app_in, EndpointId peer_in) :
 myApp(app_in),
-myPeerAddr(peerAddr_in),
-myState(State::NotConnected)
+myState(State::NotConnected),
+myConnId(ourNextConnId++),
+myCaptureFlag(CaptureFile::get() != nullptr && CaptureFile::get()->isSampled(myConnId)),
+myPeerId(peer_in),
+myCanonPeerId(0),
+myUvStream(nullptr),
+myIoBackend(nullptr),
+myBackendFd(-1),
+myRequestTimerDue(0),
+myRequestTimeouts(0),
+myRequestTimeoutsInRow(0),
+myUnparseableCount(0),
+myWriteQueueBytes(0),
+myInFlightBytes(0),
+myPendingWrites(0),
+myAccountedBytes(0),
+myReadPaused(false),
+myRateDelayed(false),
+myBulkFile(nullptr),
+myDrrClass(0),
+myBulkWrite(nullptr),
+myBulkDirectRead(false),
+myReadBufferSize(std::max(std::min(ourReadBufferSizing.initialSize, ourReadBufferSizing.maxSize), ourReadBufferSizing.minSize)),
+mySmallReads(0)
+{
+    myRateLimiter.configure(ourRateLimits);
+    for (int i = 0; i < MessageClass::MessageClassCount; ++i)
+    {
+        myQueuedBytes[i] = 0;
+        myDrrCredits[i] = 0;
+    }
+}
+
+NetClientBase::~NetClientBase()
+{
+    //cout << "~NetClientBase " << getPeerAddr() << endl;
+    if (myIoBackend != nullptr)
+    {
+        myIoBackend->detach(this);
+    }
+    if (myBulkFile != nullptr)
+    {
+        bulkFileDone(UV_ECANCELED);
+    }
+    if (myBulkWrite != nullptr)
+    {
+        // deleted by on_bulk_write
+        myBulkWrite->myClient = nullptr;
+        myBulkWrite = nullptr;
+    }
+    ourPausedReaders.remove(this);
+    ourTotalBufferedBytes -= myAccountedBytes;
+    myAccountedBytes = 0;
+}
+
+ConnectionMemoryUsage NetClientBase::getMemoryUsage() const
+{
+    ConnectionMemoryUsage usage;
+    usage.receiveBuffer = myReceiveBuffer.capacity();
+    usage.writeQueue = myWriteQueueBytes;
+    usage.pendingWrites = myPendingWrites;
+    return usage;
+}
+
+void NetClientBase::updateBufferedBytes()
+{
+    size_t current = myReceiveBuffer.length() + myWriteQueueBytes;
+    if (current >= myAccountedBytes)
+    {
+        ourTotalBufferedBytes += current - myAccountedBytes;
+    }
+    else
+    {
+        ourTotalBufferedBytes -= myAccountedBytes - current;
+    }
+    myAccountedBytes = current;
+}
+
+bool NetClientBase::isOverBudget() const
+{
+    return ourLimits.memoryBudget > 0 && ourTotalBufferedBytes > ourLimits.memoryBudget;
+}
+
+void NetClientBase::pauseRead()
+{
+    if (myReadPaused || !hasSocket())
+    {
+        return;
+    }
+    stopReading();
+    myReadPaused = true;
+    ourPausedReaders.push_back(this);
+}
+
+int NetClientBase::startReading()
+{
+    if (myIoBackend != nullptr)
+    {
+        return myIoBackend->readStart(this);
+    }
+    ((uv_stream_t*)myUvStream)->data = (void*)asUvSocket();
+    return ::uv_read_start((uv_stream_t*)myUvStream, NetClientBase::alloc_buffer, UvCallbacks<NetClientBase>::on_read);
+}
+
+void NetClientBase::stopReading()
+{
+    if (myIoBackend != nullptr)
+    {
+        myIoBackend->readStop(this);
+    }
+    else
+    {
+        ::uv_read_stop((uv_stream_t*)myUvStream);
+    }
+}
+
+void NetClientBase::delayReceive(uint64_t waitMs_in)
+{
+    myRateLimiter.countDelayed();
+    ++ourRateDelayCount;
+    if (!myRateDelayed)
+    {
+        myRateDelayed = true;
+        if (!myReadPaused)
+        {
+            stopReading();
+        }
+    }
+    myRateTimer.start(waitMs_in, 0, [this]() { onRateTimer(); });
+}
+
+void NetClientBase::onRateTimer()
+{
+    myRateDelayed = false;
+    if (!hasSocket())
+    {
+        return;
+    }
+    int received = doProcessReceivedBuffer();
+    if (!hasSocket())
+    {
+        return;
+    }
+    if (!myRateDelayed && !myReadPaused && myBulkWrite == nullptr)
+    {
+        int res = startReading();
+        if (res < 0)
+        {
+            cerr << "Error from uv_read_start() " << res << " "<< ::uv_err_name(res) << endl;
+            close();
+            return;
+        }
+    }
+    updateBufferedBytes();
+    resumePausedReads();
+    if (received > 0)
+    {
+        handleEvent(Event::ReceiveEvent);
+    }
+}
+
+void NetClientBase::resumePausedReads()
+{
+    while (!ourPausedReaders.empty() && (ourLimits.memoryBudget == 0 || ourTotalBufferedBytes < ourLimits.memoryBudget))
+    {
+        NetClientBase* client = ourPausedReaders.front();
+        ourPausedReaders.pop_front();
+        client->myReadPaused = false;
+        if (client->hasSocket() && !client->myRateDelayed && client->myBulkWrite == nullptr)
+        {
+            client->startReading();
+        }
+    }
+}
+
+void NetClientBase::setUvStream(uv_tcp_t* stream_in)
+{
+    myUvStream = stream_in;
+    myUvStream->data = (void*)asUvSocket();
+}
+
+void NetClientBase::setBackendSocket(IoBackend* backend_in, int fd_in)
+{
+    myIoBackend = backend_in;
+    myBackendFd = fd_in;
+    myIoBackend->attach(this, fd_in);
+}
+
+SharedBuffer NetClientBase::serializeMessage(BaseMessage const & msg_in)
+{
+    STAGE_TIMER(StageSerialize);
+    SerializerMessageVisitor visitor;
+    msg_in.visit(visitor);
+    string msg = visitor.getMessage();
+    //cout << "serializeMessage " << msg.length() << " '" << msg << "'" << endl;
+    // convert to byte array, with terminator
+    auto binmsg = make_shared<vector<uint8_t>>();
+    binmsg->reserve(msg.length() + 1);
+    binmsg->assign(msg.begin(), msg.end());
+    binmsg->push_back('\n');
+    return binmsg;
+}
+
+int NetClientBase::sendMessage(BaseMessage const & msg_in)
+{
+    return sendMessage(msg_in, msg_in.getClass());
+}
+
+int NetClientBase::sendMessage(BaseMessage const & msg_in, MessageClass class_in)
+{
+    //cout << "NetClientBase::sendMessage " << msg_in.toString() << endl;
+    if (myState == State::Closing || myState == State::Closed)
+    {
+        return 0;
+    }
+    return sendBuffer(serializeMessage(msg_in), class_in);
+}
+
+int NetClientBase::sendBuffer(SharedBuffer const & buf_in, MessageClass class_in)
+{
+    return queueBuffer(buf_in, class_in, nullptr, false);
+}
+
+int NetClientBase::queueBuffer(SharedBuffer const & buf_in, MessageClass class_in, SharedBuffer const & payload_in, bool bulkFileHeader_in)
+{
+    STAGE_TIMER(StageSend);
+    if (!handleEvent(Event::SendEvent))
+    {
+        return 0;
+    }
+    if (ourLimits.maxBufferedBytes > 0 && myWriteQueueBytes + buf_in->size() > ourLimits.maxBufferedBytes)
+    {
+        // peer does not read
+        cerr << "Write queue limit exceeded, closing " << getNicePeerAddr() << " " << myWriteQueueBytes << endl;
+        ++ourLimitCloseCount;
+        close();
+        return UV_ENOBUFS;
+    }
+    ++ourSentMessages;
+    ourSentBytes += buf_in->size();
+    if (myCaptureFlag && CaptureFile::get() != nullptr)
+    {
+        // captured without terminator
+        size_t len = buf_in->size();
+        if (len > 0 && (*buf_in)[len - 1] == '\n') --len;
+        CaptureFile::get()->append(myConnId, CaptureFile::Out, (const char*)buf_in->data(), len);
+    }
+    QueuedWrite write;
+    write.myBuf = buf_in;
+    write.myPayload = payload_in;
+    write.myBulkFileHeader = bulkFileHeader_in;
+    mySendQueues[class_in].push_back(write);
+    myQueuedBytes[class_in] += write.size();
+    myWriteQueueBytes += write.size();
+    updateBufferedBytes();
+    if (isOverBudget())
+    {
+        // backpressure as for received data: the message is sent, but no more is read until memory drops (see
+        // resumePausedReads); the other connections pause at their next read
+        pauseRead();
+    }
+    flushQueues();
+    return hasSocket() ? 0 : UV_ENOTCONN;
+}
+
+int NetClientBase::nextSendClass()
+{
+    int first = -1;
+    for (int i = 0; i < MessageClass::MessageClassCount && first < 0; ++i)
+    {
+        if (!mySendQueues[i].empty())
+        {
+            first = i;
+        }
+    }
+    if (first < 0 || !ourSendScheduling.weighted)
+    {
+        return first;
+    }
+    // deficit round-robin: each class gets its weight of quanta per round, and sends while its credit covers the next message
+    while (true)
+    {
+        auto const & queue = mySendQueues[myDrrClass];
+        if (!queue.empty() && myDrrCredits[myDrrClass] >= (int64_t)queue.front().size())
+        {
+            return myDrrClass;
+        }
+        if (queue.empty())
+        {
+            // no credit saved while idle
+            myDrrCredits[myDrrClass] = 0;
+        }
+        myDrrClass = (myDrrClass + 1) % MessageClass::MessageClassCount;
+        if (!mySendQueues[myDrrClass].empty())
+        {
+            myDrrCredits[myDrrClass] += (int64_t)ourSendScheduling.weights[myDrrClass] * SendQuantumBytes;
+        }
+    }
+}
+
+void NetClientBase::flushQueues()
+{
+    vector<SharedBuffer> bufs;
+    size_t window = ourSendScheduling.windowBytes;
+    size_t batchBytes = 0;
+    while (hasSocket())
+    {
+        if (myBulkFile != nullptr && myBulkFile->myHeaderSent)
+        {
+            // must not interleave with the file payload, sent after it
+            break;
+        }
+        // at least one message, when nothing is in progress
+        if (window > 0 && (myInFlightBytes > 0 || batchBytes > 0) && myInFlightBytes + batchBytes >= window)
+        {
+            break;
+        }
+        int cls = nextSendClass();
+        if (cls < 0)
+        {
+            break;
+        }
+        QueuedWrite write = mySendQueues[cls].front();
+        mySendQueues[cls].pop_front();
+        myQueuedBytes[cls] -= write.size();
+        if (ourSendScheduling.weighted)
+        {
+            myDrrCredits[cls] -= (int64_t)write.size();
+        }
+        bufs.push_back(write.myBuf);
+        if (write.myPayload && !write.myPayload->empty())
+        {
+            bufs.push_back(write.myPayload);
+        }
+        batchBytes += write.size();
+        if (write.myBulkFileHeader && myBulkFile != nullptr)
+        {
+            // the file follows, see onWriteCompleted
+            myBulkFile->myHeaderSent = true;
+        }
+    }
+    if (bufs.empty())
+    {
+        return;
+    }
+    // accounted again when written
+    myWriteQueueBytes -= std::min(myWriteQueueBytes, batchBytes);
+    writeBuffers(bufs);
+}
+
+int NetClientBase::writeBuffers(vector<SharedBuffer> const & bufs_in)
+{
+    int res = 0;
+    size_t len = 0;
+    for (auto i = bufs_in.begin(); i != bufs_in.end(); ++i)
+    {
+        len += (*i)->size();
+    }
+    if (myIoBackend != nullptr)
+    {
+        for (auto i = bufs_in.begin(); i != bufs_in.end() && res == 0; ++i)
+        {
+            res = myIoBackend->write(this, *i);
+            if (res == 0)
+            {
+                myWriteQueueBytes += (*i)->size();
+                myInFlightBytes += (*i)->size();
+                ++myPendingWrites;
+            }
+        }
+    }
+    else
+    {
+        size_t first = 0;
+        size_t offset = 0;
+        res = tryWrite(bufs_in, first, offset);
+        if (res == 0 && first < bufs_in.size())
+        {
+            // the rest async
+            uv_write_t* req = new uv_write_t();
+            // wrap buffers into a UvWriteRequest object
+            UvWriteRequest* wrreq = new UvWriteRequest(asUvSocket(), (int)(bufs_in.size() - first));
+            for (size_t i = first; i < bufs_in.size(); ++i)
+            {
+                wrreq->add(bufs_in[i]);
+            }
+            // the part not yet written, of the first one
+            wrreq->bufs[0].base += offset;
+            wrreq->bufs[0].len -= offset;
+            len = 0;
+            for (int i = 0; i < wrreq->nbuf; ++i)
+            {
+                len += wrreq->bufs[i].len;
+            }
+            req->data = (void*)wrreq;
+            res = ::uv_write(req, (uv_stream_t*)myUvStream, &(wrreq->bufs[0]), wrreq->nbuf, UvCallbacks<NetClientBase>::on_write);
+            if (res == 0)
+            {
+                ++ourAsyncWrites;
+                myWriteQueueBytes += len;
+                myInFlightBytes += len;
+                // one per buffer, completed one by one, see onWrite
+                myPendingWrites += wrreq->nbuf;
+            }
+            else
+            {
+                delete wrreq;
+                delete req;
+            }
+        }
+    }
+    if (res == 0)
+    {
+        updateBufferedBytes();
+    }
+    else
+    {
+        if (res == -EBADF)
+        {
+            // socket closed
+        }
+        else
+        {
+            cerr << "Error from uv_write " << res << " " << ::uv_err_name(res) << endl;
+        }
+        close();
+        return res;
+    }
+    return 0;
+}
+
+int NetClientBase::tryWrite(vector<SharedBuffer> const & bufs_in, size_t & first_out, size_t & offset_out)
+{
+    first_out = 0;
+    offset_out = 0;
+    if (bufs_in.size() > MaxTryWriteBufs || ::uv_stream_get_write_queue_size((uv_stream_t*)myUvStream) > 0)
+    {
+        // behind the queued ones
+        return 0;
+    }
+    uv_buf_t uvBufs[MaxTryWriteBufs];
+    for (size_t i = 0; i < bufs_in.size(); ++i)
+    {
+        uvBufs[i] = ::uv_buf_init((char*)bufs_in[i]->data(), bufs_in[i]->size());
+    }
+    ++ourTryWrites;
+    int res = ::uv_try_write((uv_stream_t*)myUvStream, uvBufs, (unsigned int)bufs_in.size());
+    if (res == UV_EAGAIN || res == UV_ENOSYS || res == 0)
+    {
+        // socket buffer full, or still connecting
+        return 0;
+    }
+    if (res < 0)
+    {
+        return res;
+    }
+    // buffers written completely are in progress until their completion is reported, from the loop (see completeTryWrites)
+    size_t left = (size_t)res;
+    while (first_out < bufs_in.size() && left >= bufs_in[first_out]->size())
+    {
+        size_t size = bufs_in[first_out]->size();
+        left -= size;
+        myTryWritten.push_back(size);
+        myWriteQueueBytes += size;
+        myInFlightBytes += size;
+        ++myPendingWrites;
+        ++first_out;
+    }
+    offset_out = left;
+    if (first_out == bufs_in.size())
+    {
+        ++ourTryWriteFull;
+    }
+    else
+    {
+        ++ourTryWritePartial;
+    }
+    if (!myTryWritten.empty() && !myTryWriteTimer.isActive())
+    {
+        myTryWriteTimer.start(0, 0, [this]() { completeTryWrites(0); });
+    }
+    return 0;
+}
+
+void NetClientBase::completeTryWrites(int status_in)
+{
+    // writes by the completion handlers are reported in the next round
+    size_t count = myTryWritten.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t len = myTryWritten[i];
+        onWriteCompleted(len, status_in);
+    }
+    myTryWritten.erase(myTryWritten.begin(), myTryWritten.begin() + count);
+    if (!myTryWritten.empty())
+    {
+        myTryWriteTimer.start(0, 0, [this]() { completeTryWrites(0); });
+    }
+}
+
+void NetClientBase::dropQueuedWrites()
+{
+    for (int i = 0; i < MessageClass::MessageClassCount; ++i)
+    {
+        myWriteQueueBytes -= std::min(myWriteQueueBytes, myQueuedBytes[i]);
+        myQueuedBytes[i] = 0;
+        mySendQueues[i].clear();
+        myDrrCredits[i] = 0;
+    }
+    updateBufferedBytes();
+}
+
+int NetClientBase::sendBulk(string const & name_in, SharedBuffer const & data_in)
+{
+    if (myState == State::Closing || myState == State::Closed || !hasSocket())
+    {
+        return UV_ENOTCONN;
+    }
+    BulkMessage header(name_in, data_in->size());
+    // payload with its header, in one queue entry
+    return queueBuffer(serializeMessage(header), header.getClass(), data_in, false);
+}
+
+int NetClientBase::sendBulkFile(string const & name_in, int fd_in, int64_t offset_in, uint64_t length_in, BulkProgressCallback progress_in)
+{
+    if (myState == State::Closing || myState == State::Closed || !hasSocket())
+    {
+        return UV_ENOTCONN;
+    }
+    if (myBulkFile != nullptr)
+    {
+        // one at a time
+        return UV_EBUSY;
+    }
+    BulkFileSend* bulk = new BulkFileSend();
+    bulk->myClient = this;
+    bulk->myFd = fd_in;
+    bulk->myOffset = offset_in;
+    bulk->mySent = 0;
+    bulk->myTotal = length_in;
+    bulk->myProgress = progress_in;
+    bulk->myInFlight = false;
+    bulk->myRetryMs = 0;
+    bulk->myCloseHandle = nullptr;
+    bulk->myHeaderSent = false;
+    myBulkFile = bulk;
+    BulkMessage header(name_in, length_in);
+    int res = queueBuffer(serializeMessage(header), header.getClass(), nullptr, true);
+    if (res)
+    {
+        if (myBulkFile == bulk)
+        {
+            myBulkFile = nullptr;
+            delete bulk;
+        }
+        return res;
+    }
+    // started when the header (and the writes before it) are out, see onWriteCompleted
+    return 0;
+}
+
+void NetClientBase::bulkFileNext()
+{
+    BulkFileSend* bulk = myBulkFile;
+    if (bulk->mySent >= bulk->myTotal)
+    {
+        bulkFileDone(0);
+        return;
+    }
+    uint64_t remaining = bulk->myTotal - bulk->mySent;
+    uv_loop_t* loop = NetHandler::getUvLoop();
+#ifndef _WIN32
+    uv_os_fd_t sockFd;
+    if (myUvStream != nullptr && ::uv_fileno((uv_handle_t*)myUvStream, &sockFd) == 0)
+    {
+        // file to socket in the kernel, on the thread pool; nothing else writes to the socket meanwhile (see flushQueues)
+        bulk->myReq.data = (void*)bulk;
+        int res = ::uv_fs_sendfile(loop, &bulk->myReq, sockFd, bulk->myFd, bulk->myOffset + bulk->mySent,
+            (size_t)std::min(remaining, (uint64_t)BulkChunkSize), NetClientBase::on_bulk_sendfile);
+        if (res)
+        {
+            cerr << "Error from uv_fs_sendfile " << res << " " << ::uv_err_name(res) << endl;
+            bulkFileDone(res);
+            close();
+            return;
+        }
+        bulk->myInFlight = true;
+        return;
+    }
+#endif
+    // no socket descriptor (I/O backend): read a chunk on the thread pool, send it as a buffer
+    bulk->myChunk = make_shared<vector<uint8_t>>((size_t)std::min(remaining, (uint64_t)BulkCopyChunkSize));
+    uv_buf_t uvbuf = ::uv_buf_init((char*)bulk->myChunk->data(), (unsigned int)bulk->myChunk->size());
+    bulk->myReq.data = (void*)bulk;
+    int res = ::uv_fs_read(loop, &bulk->myReq, bulk->myFd, &uvbuf, 1, bulk->myOffset + bulk->mySent, NetClientBase::on_bulk_read);
+    if (res)
+    {
+        cerr << "Error from uv_fs_read " << res << " " << ::uv_err_name(res) << endl;
+        bulkFileDone(res);
+        close();
+        return;
+    }
+    bulk->myInFlight = true;
+}
+
+void NetClientBase::on_bulk_read(uv_fs_t* req)
+{
+    BulkFileSend* bulk = (BulkFileSend*)req->data;
+    ssize_t result = req->result;
+    ::uv_fs_req_cleanup(req);
+    bulk->myInFlight = false;
+    if (bulk->myClient == nullptr)
+    {
+        // connection is gone
+        delete bulk;
+        return;
+    }
+    bulk->myClient->onBulkRead(result);
+}
+
+void NetClientBase::onBulkRead(ssize_t result_in)
+{
+    BulkFileSend* bulk = myBulkFile;
+    if (bulkFileCloseDeferred())
+    {
+        return;
+    }
+    std::shared_ptr<vector<uint8_t>> buf = bulk->myChunk;
+    bulk->myChunk.reset();
+    if (result_in <= 0)
+    {
+        // short file
+        int status = result_in < 0 ? (int)result_in : UV_EOF;
+        cerr << "Bulk file read error " << status << " " << ::uv_err_name(status) << endl;
+        bulkFileDone(status);
+        close();
+        return;
+    }
+    buf->resize((size_t)result_in);
+    bulk->mySent += result_in;
+    // the next chunk is read when this one is out, see onWriteCompleted
+    if (writeBuffer(buf))
+    {
+        return;
+    }
+    if (bulk->myProgress && bulk->mySent < bulk->myTotal)
+    {
+        bulk->myProgress(bulk->mySent, bulk->myTotal, 0);
+    }
+}
+
+void NetClientBase::on_bulk_sendfile(uv_fs_t* req)
+{
+    BulkFileSend* bulk = (BulkFileSend*)req->data;
+    ssize_t result = req->result;
+    ::uv_fs_req_cleanup(req);
+    bulk->myInFlight = false;
+    if (bulk->myClient == nullptr)
+    {
+        // connection is gone
+        delete bulk;
+        return;
+    }
+    bulk->myClient->onBulkSendfile(result);
+}
+
+bool NetClientBase::bulkFileCloseDeferred()
+{
+    BulkFileSend* bulk = myBulkFile;
+    if (bulk->myCloseHandle == nullptr)
+    {
+        return false;
+    }
+    // closed meanwhile, the socket can go now
+    uv_handle_t* handle = bulk->myCloseHandle;
+    bulkFileDone(UV_ECANCELED);
+    handle->data = (void*)asUvSocket();
+    ::uv_close(handle, NetClientBase::on_close);
+    return true;
+}
+
+void NetClientBase::onBulkSendfile(ssize_t result_in)
+{
+    BulkFileSend* bulk = myBulkFile;
+    if (bulkFileCloseDeferred())
+    {
+        return;
+    }
+    if (result_in == UV_EAGAIN)
+    {
+        // socket buffer is full: retry later, backing off while it stays full
+        bulk->myRetryMs = bulk->myRetryMs == 0 ? BulkRetryMinMs : std::min(bulk->myRetryMs * 2, (uint64_t)BulkRetryMaxMs);
+        myBulkRetryTimer.start(bulk->myRetryMs, 0, [this]() { bulkFileNext(); });
+        return;
+    }
+    if (result_in <= 0)
+    {
+        int status = result_in < 0 ? (int)result_in : UV_EOF;
+        cerr << "Error from sendfile " << status << " " << ::uv_err_name(status) << " " << getNicePeerAddr() << endl;
+        bulkFileDone(status);
+        close();
+        return;
+    }
+    bulk->mySent += result_in;
+    bulk->myRetryMs = 0;
+    if (bulk->myProgress && bulk->mySent < bulk->myTotal)
+    {
+        bulk->myProgress(bulk->mySent, bulk->myTotal, 0);
+    }
+    bulkFileNext();
+}
+
+void NetClientBase::bulkFileDone(int status_in)
+{
+    BulkFileSend* bulk = myBulkFile;
+    myBulkFile = nullptr;
+    myBulkRetryTimer.stop();
+    BulkProgressCallback progress = bulk->myProgress;
+    uint64_t sent = bulk->mySent;
+    uint64_t total = bulk->myTotal;
+    if (bulk->myInFlight)
+    {
+        // deleted by the callback of the thread pool request
+        bulk->myClient = nullptr;
+    }
+    else
+    {
+        delete bulk;
+    }
+    if (progress)
+    {
+        progress(sent, total, status_in);
+    }
+    if (status_in == 0)
+    {
+        // writes queued meanwhile
+        flushQueues();
+    }
+}
+
+void NetClientBase::setRequestPolicy(RequestPolicy const & policy_in, int closeAfterTimeouts_in)
+{
+    ourIdempotentRequestPolicy = policy_in;
+    // a retry of a request with side effects could apply them twice
+    ourRequestPolicy = policy_in;
+    ourRequestPolicy.retries = 0;
+    ourRequestCloseAfter = closeAfterTimeouts_in;
+}
+
+int NetClientBase::sendRequest(BaseMessage & msg_in, ResponseCallback callback_in, RequestPolicy const & policy_in)
+{
+    if (myState == State::Closing || myState == State::Closed || !hasSocket())
+    {
+        return UV_ENOTCONN;
+    }
+    uint32_t requestId = myRequests.add(callback_in, policy_in, LoopTimer::now());
+    msg_in.setRequestId(requestId);
+    SharedBuffer buf = serializeMessage(msg_in);
+    MessageClass msgClass = msg_in.getClass();
+    if (policy_in.retries > 0)
+    {
+        // retries send the same bytes again
+        myRequests.setResend(requestId, [this, buf, msgClass]() { sendBuffer(buf, msgClass); });
+    }
+    ++ourRequests;
+    armRequestTimer();
+    return sendBuffer(buf, msgClass);
+}
+
+int NetClientBase::sendHandshake(HandshakeMessage & msg_in)
+{
+    return sendIdempotentRequest(msg_in, [this](int status_in, BaseMessage const * response_in)
+    {
+        if (status_in == 0)
+        {
+            assert(myApp != nullptr);
+            myApp->messageReceived(*this, *response_in);
+        }
+        else if (status_in == UV_ETIMEDOUT)
+        {
+            cerr << "Handshake timed out " << getNicePeerAddr() << ", closing" << endl;
+            close();
+        }
+    });
+}
+
+void NetClientBase::armRequestTimer()
+{
+    uint64_t due = myRequests.getNextDeadline();
+    if (due == 0)
+    {
+        // an armed timer is left to expire: requests completing and new ones coming is the common case
+        return;
+    }
+    if (myRequestTimerDue != 0 && myRequestTimerDue <= due)
+    {
+        return;
+    }
+    uint64_t now = LoopTimer::now();
+    myRequestTimerDue = due;
+    myRequestTimer.start(due > now ? due - now : 0, 0, [this]() { onRequestTimer(); });
+}
+
+void NetClientBase::onRequestTimer()
+{
+    myRequestTimerDue = 0;
+    int retried = 0;
+    int expired = myRequests.expire(LoopTimer::now(), retried);
+    ourRequestRetries += retried;
+    if (expired > 0)
+    {
+        ourRequestTimeouts += expired;
+        myRequestTimeouts += expired;
+        myRequestTimeoutsInRow += expired;
+        cerr << "Requests timed out: " << expired << " " << getNicePeerAddr() << endl;
+        if (ourRequestCloseAfter > 0 && myRequestTimeoutsInRow >= ourRequestCloseAfter && hasSocket())
+        {
+            // half-dead connection: the requests sent on it are stuck
+            cerr << "No responses to " << myRequestTimeoutsInRow << " requests in a row, closing " << getNicePeerAddr() << endl;
+            ++ourRequestCloses;
+            close();
+            return;
+        }
+    }
+    if (hasSocket())
+    {
+        armRequestTimer();
+    }
+}
+
+DurationHistogram const & NetClientBase::getRequestLatency()
+{
+    return ourRequestLatency;
+}
+
+void NetClientBase::on_close(uv_handle_t* handle)
+{
+    //cout << "on_close" << endl;
+    IUvSocket* uvSocket = (IUvSocket*)handle->data;
+    if (uvSocket == nullptr)
+    {
+        cerr << "Fatal error: uvSocket is nullptr " << endl;
+        return;
+    }
+    uvSocket->onClose(handle);
+}
+
+void NetClientBase::onClose(uv_handle_t* handle)
+{
+    //cout << "onClose" << endl;
+    if (handle != NULL)
+    {
+        delete handle;
+    }
+    // as the pending async writes, cancelled by uv_close
+    myTryWriteTimer.stop();
+    completeTryWrites(UV_ECANCELED);
+    handleEvent(Event::ClosedEvent);
+    Trace::instant("closed", "conn", "conn", myConnId);
+    // last: the app may release this connection
+    if (myApp != nullptr)
+    {
+        myApp->connectionClosed(this);
+    }
+}
+
+int NetClientBase::close()
+{
+    //cout << "NetClientBase::close " << getPeerAddr() << endl;
+    // also when closing already: the socket is released once, below
+    bool closing = myState == State::Closing;
+    handleEvent(Event::CloseEvent);
+    uv_handle_t* handle = (uv_handle_t*)myUvStream;
+    if (!hasSocket())
+    {
+        if (!closing && myState == State::Closing)
+        {
+            // no socket (not connected, or the connect failed): no close callback comes, closed now
+            handleEvent(Event::ClosedEvent);
+        }
+        return 0;
+    }
+    myUvStream = nullptr; // prevent double close
+    myBackendFd = -1;
+    myRequestTimer.stop();
+    myRequestTimerDue = 0;
+    myRateTimer.stop();
+    myRateDelayed = false;
+    if (myReadPaused)
+    {
+        ourPausedReaders.remove(this);
+        myReadPaused = false;
+    }
+    myReceiveBuffer.clear();
+    updateBufferedBytes();
+    ourRequestCancels += myRequests.cancelAll(UV_ECANCELED);
+    dropQueuedWrites();
+    if (myBulkWrite != nullptr)
+    {
+        // deleted by on_bulk_write
+        myBulkWrite->myClient = nullptr;
+        myBulkWrite = nullptr;
+    }
+    if (myBulkRecv)
+    {
+        finishBulkReceive(UV_ECANCELED);
+    }
+    if (myBulkFile != nullptr)
+    {
+        if (myBulkFile->myInFlight && handle != nullptr)
+        {
+            // the socket is used by sendfile, closed when it returns
+            myBulkFile->myCloseHandle = handle;
+            return 0;
+        }
+        bulkFileDone(UV_ECANCELED);
+    }
+    if (myIoBackend != nullptr)
+    {
+        // onBackendClosed is called later, as with uv_close
+        myIoBackend->close(this);
+        return 0;
+    }
+    if (::uv_is_closing(handle))
+    {
+        // already closing
+        cerr << "Warning: Socket is already closing " << getPeerAddr() << endl;
+        onClose(handle);
+        return 0;
+    }
+    handle->data = (void*)asUvSocket();
+    ::uv_close(handle, NetClientBase::on_close);
+    //cout << "NetClientBase::close closed" << endl;
+    return 0;
+}
+
+void NetClientBase::onBackendClosed()
+{
+    onClose(nullptr);
+}
+
+void NetClientBase::onWrite(uv_write_t* req, int status) 
 {
+    //cout << "NetClientBase::onWrite " << status << " "  << myState << endl;
+    UvWriteRequest* wrreq = (UvWriteRequest*)req->data;
+    // a write of several queued messages completes each of them
+    for (int i = 0; i < wrreq->nbuf; ++i)
+    {
+        onWriteCompleted(wrreq->bufs[i].len, status);
+    }
 }
 
-NetClientBase::~NetClientBase()
+void NetClientBase::onWriteCompleted(size_t len_in, int status_in)
 {
-    //cout << "~NetClientBase " << myPeerAddr << endl;
+    STAGE_TIMER(StageWriteDone);
+    LoopActivity activity("write", myConnId);
+    myWriteQueueBytes -= std::min(myWriteQueueBytes, len_in);
+    myInFlightBytes -= std::min(myInFlightBytes, len_in);
+    --myPendingWrites;
+    updateBufferedBytes();
+    resumePausedReads();
+    if (status_in == 0)
+    {
+        flushQueues();
+    }
+    onWriteDone(status_in);
+    if (myBulkFile != nullptr && myBulkFile->myHeaderSent && !myBulkFile->myInFlight && !myBulkRetryTimer.isActive() && myPendingWrites == 0 && hasSocket())
+    {
+        // header, or the previous copied chunk, is out
+        bulkFileNext();
+    }
 }
 
-void NetClientBase::setUvStream(uv_tcp_t* stream_in)
+void NetClientBase::onWriteDone(int status_in)
 {
-    myUvStream = stream_in;
-    myUvStream->data = (void*)dynamic_cast<IUvSocket*>(this);
+    // pending writes of a closed connection are cancelled, dropped
+    if (status_in != 0)
+    {
+        if (handleEvent(Event::WriteErrorEvent))
+        {
+            cerr << "write error " << status_in << " " << ::uv_strerror(status_in) << endl;
+            close();
+        }
+        return;
+    }
+    handleEvent(Event::WriteDoneEvent);
 }
 
-int NetClientBase::sendMessage(BaseMessage const & msg_in)
+int NetClientBase::doProcessReceivedBuffer()
 {
-    //cout << "NetClientBase::sendMessage " << msg_in.toString() << endl;
-    if (myState == State::Closing || myState == State::Closed)
+    if (myReceiveBuffer.empty())
     {
         return 0;
     }
-    myState = State::Sending;
-    SerializerMessageVisitor visitor;
-    msg_in.visit(visitor);
-    string msg = visitor.getMessage();
-    //cout << "sendMessage " << msg.length() << " '" << msg << "'" << endl;
-    msg += '\n'; // terminator
-    // convert to byte array
-    vector<uint8_t> binmsg(msg.begin(), msg.end());
-
-    uv_write_t* req = new uv_write_t();
-    // wrap buffers into a UvWriteRequest object
-    UvWriteRequest* wrreq = new UvWriteRequest(dynamic_cast<IUvSocket*>(this), 1);
-    wrreq->add(binmsg);
-    req->data = (void*)wrreq;
-    int res = ::uv_write(req, (uv_stream_t*)myUvStream, &(wrreq->bufs[0]), wrreq->nbuf, NetClientBase::on_write);
-    if (res)
+    int received = 0;
+    int terminatorIdx;
+    // no parsing during a bulk payload, its bytes are not in the buffer
+    while (!myBulkRecv && (myReceiveBuffer.length() > 0) && ((terminatorIdx = myReceiveBuffer.find('\n')) >= 0))
     {
-        if (res == -EBADF)
+        string msg1;
         {
-            // socket closed
+            STAGE_TIMER(StageFrame);
+            msg1 = myReceiveBuffer.substr(0, terminatorIdx); // without the terminator
         }
-        else
+        //cout << "Incoming message: from " << getPeerAddr() << " '" << msg1 << "' " << myReceiveBuffer.length() << endl;
+        BaseMessage* msg = MessageDeserializer::parseLine(msg1);
+        bool dropped = false;
+        if (myRateLimiter.isEnabled())
         {
-            cerr << "Error from uv_write " << res << " " << ::uv_err_name(res) << endl;
+            // unparseable lines are charged too (as control), garbage is no way around the limits
+            MessageClass msgClass = msg != nullptr ? msg->getClass() : MessageClass::ControlClass;
+            uint64_t waitMs = myRateLimiter.admit(msgClass, msg1.length() + 1, LoopTimer::now());
+            if (waitMs > 0)
+            {
+                delete msg;
+                msg = nullptr;
+                if (myRateLimiter.getAction() == RateLimitAction::RateDelay)
+                {
+                    // left in the buffer, taken when it fits the rate
+                    delayReceive(waitMs);
+                    return received;
+                }
+                if (myRateLimiter.getAction() == RateLimitAction::RateClose)
+                {
+                    cerr << "Rate limit exceeded, closing " << getNicePeerAddr() << endl;
+                    ++ourRateCloseCount;
+                    close();
+                    return received;
+                }
+                myRateLimiter.countDropped();
+                ++ourRateDropCount;
+                dropped = true;
+            }
         }
-        close();
+        {
+            STAGE_TIMER(StageFrame);
+            myReceiveBuffer = myReceiveBuffer.substr(terminatorIdx + 1);
+        }
+        if (myCaptureFlag && CaptureFile::get() != nullptr)
+        {
+            CaptureFile::get()->append(myConnId, CaptureFile::In, msg1.c_str(), msg1.length());
+        }
+        if (dropped)
+        {
+            continue;
+        }
+        if (msg == nullptr)
+        {
+            ++ourUnparseableCount;
+            ++myUnparseableCount;
+            if (myUnparseableCount <= UnparseableLogLimit)
+            {
+                cerr << "Error: Unparseable message '" << msg1.substr(0, 200) << "' from " << getNicePeerAddr()
+                    << (myUnparseableCount == UnparseableLogLimit ? ", further ones are only counted" : "") << endl;
+            }
+            continue;
+        }
+        ++ourReceivedMessages;
+        ourReceivedBytes += msg1.length() + 1;
+        ++received;
+        if (msg->getType() == MessageType::Bulk)
+        {
+            startBulkReceive((BulkMessage*)msg);
+            if (myBulkRecv && !myReceiveBuffer.empty())
+            {
+                // start of the payload came with the header
+                size_t used = bulkConsume(myReceiveBuffer.data(), myReceiveBuffer.length());
+                myReceiveBuffer.erase(0, used);
+            }
+            continue;
+        }
+        uint64_t latencyUs = 0;
+        // only responses: both sides number their own requests, a request of the peer may have the ID of one of ours
+        if (msg->getRequestId() != 0 && msg->isResponse() && myRequests.complete(*msg, latencyUs))
+        {
+            // response to a request, handled by its callback
+            ++ourRequestResponses;
+            ourRequestLatency.add(latencyUs);
+            myRequestTimeoutsInRow = 0;
+            delete msg;
+            continue;
+        }
+        STAGE_TIMER(StageDispatch);
+        ScopedTrace trace("dispatch", "app", "type", (uint64_t)msg->getType());
+        LoopActivity activity("dispatch", myConnId);
+        onMessage(msg);
     }
+    return received;
 }
 
-void NetClientBase::on_close(uv_handle_t* handle)
+void NetClientBase::startBulkReceive(BulkMessage* msg_in)
 {
-    //cout << "on_close" << endl;
-    IUvSocket* uvSocket = (IUvSocket*)handle->data;
-    if (uvSocket == nullptr)
+    myBulkRecv.reset(new BulkReceive());
+    myBulkRecv->myMsg.reset(msg_in);
+    myBulkRecv->myReceived = 0;
+    if (myApp != nullptr)
     {
-        cerr << "Fatal error: uvSocket is nullptr " << endl;
+        myBulkRecv->myTarget = myApp->bulkReceiveStarted(*this, *msg_in);
+    }
+    BulkTarget const & target = myBulkRecv->myTarget;
+    if (target.buffer != nullptr && target.bufferSize < msg_in->getLength())
+    {
+        cerr << "Bulk payload does not fit, closing " << getNicePeerAddr() << " " << msg_in->getLength() << " " << target.bufferSize << endl;
+        finishBulkReceive(UV_ENOBUFS);
+        close();
         return;
     }
-    uvSocket->onClose(handle);
+    if (msg_in->getLength() == 0)
+    {
+        finishBulkReceive(0);
+    }
 }
 
-void NetClientBase::onClose(uv_handle_t* handle)
+size_t NetClientBase::bulkConsume(const char* data_in, size_t len_in, unique_ptr<char[]> * buffer_inout)
 {
-    //cout << "onClose" << endl;
-    if (myApp != nullptr)
+    BulkReceive* bulk = myBulkRecv.get();
+    size_t len = (size_t)std::min((uint64_t)len_in, bulk->myMsg->getLength() - bulk->myReceived);
+    if (bulk->myTarget.buffer != nullptr)
     {
-        myApp->connectionClosed(this);
+        ::memcpy(bulk->myTarget.buffer + bulk->myReceived, data_in, len);
     }
-    if (handle != NULL)
+    else if (bulk->myTarget.fd >= 0)
     {
-        delete handle;
+        if (myBulkWrite != nullptr)
+        {
+            // the previous write is in progress, the bytes wait in the receive buffer
+            return 0;
+        }
+        // advanced when written, see onBulkWrite
+        bulkWriteFile(data_in, len, buffer_inout);
+        return len;
     }
-    myState = State::Closed;
+    // else discarded
+    bulkAdvance(len);
+    return len;
 }
 
-int NetClientBase::close()
+void NetClientBase::bulkWriteFile(const char* data_in, size_t len_in, unique_ptr<char[]> * buffer_inout)
 {
-    //cout << "NetClientBase::close " << getPeerAddr() << endl;
-    myState = State::Closing;
-    uv_handle_t* handle = (uv_handle_t*)myUvStream;
-    if (handle == nullptr) return 0;
-    myUvStream = nullptr; // prevent double close
-    if (::uv_is_closing(handle))
+    BulkFileWrite* write = new BulkFileWrite();
+    write->myClient = this;
+    if (buffer_inout != nullptr && buffer_inout->get() == data_in)
     {
-        // already closing
-        cerr << "Warning: Socket is already closing " << getPeerAddr() << endl;
-        onClose(handle);
-        return 0;
+        // the read buffer goes to the file as is; bytes after the payload are copied to the receive buffer still
+        write->myData = std::move(*buffer_inout);
     }
-    handle->data = (void*)dynamic_cast<IUvSocket*>(this);
-    ::uv_close(handle, NetClientBase::on_close);
-    //cout << "NetClientBase::close closed" << endl;
+    else
+    {
+        // from the receive buffer, or memory of the I/O backend, reused when this returns
+        write->myData.reset(new char[len_in]);
+        ::memcpy(write->myData.get(), data_in, len_in);
+    }
+    write->myLength = len_in;
+    write->myWritten = 0;
+    myBulkWrite = write;
+    // no disk I/O on the loop: the write goes to the thread pool, reading waits for it
+    stopReading();
+    bulkWriteNext();
 }
 
-void NetClientBase::on_write(uv_write_t* req, int status) 
+void NetClientBase::bulkWriteNext()
 {
-    //cout << "on_write " << status << endl;
-    UvWriteRequest* wrreq = (UvWriteRequest*)req->data;
-    if (wrreq == nullptr)
+    BulkFileWrite* write = myBulkWrite;
+    uv_buf_t uvbuf = ::uv_buf_init(write->myData.get() + write->myWritten, (unsigned int)(write->myLength - write->myWritten));
+    write->myReq.data = (void*)write;
+    int res = ::uv_fs_write(NetHandler::getUvLoop(), &write->myReq, myBulkRecv->myTarget.fd, &uvbuf, 1, -1, NetClientBase::on_bulk_write);
+    if (res)
     {
-        cerr << "Fatal error: uv_write_t->data is nullptr " << endl;
-        //uv_close((uv_handle_t*)req->handle, NULL);
-        return;
+        myBulkWrite = nullptr;
+        delete write;
+        cerr << "Bulk file write error " << res << " " << ::uv_err_name(res) << endl;
+        finishBulkReceive(res);
+        close();
     }
-    IUvSocket* uvSocket = wrreq->uvSocket;
-    if (uvSocket == nullptr)
+}
+
+void NetClientBase::on_bulk_write(uv_fs_t* req)
+{
+    BulkFileWrite* write = (BulkFileWrite*)req->data;
+    ssize_t result = req->result;
+    ::uv_fs_req_cleanup(req);
+    if (write->myClient == nullptr)
     {
-        cerr << "Fatal error: uvSocket is nullptr " << endl;
-        //uv_close((uv_handle_t*)req->handle, NULL);
+        // connection is gone
+        delete write;
         return;
     }
-    uvSocket->onWrite(req, status);
-    delete wrreq;
-    delete req;
+    write->myClient->onBulkWrite(result);
 }
 
-void NetClientBase::onWrite(uv_write_t* req, int status) 
+void NetClientBase::onBulkWrite(ssize_t result_in)
 {
-    //cout << "NetClientBase::onWrite " << status << " "  << myState << endl;
-    assert(myState == State::Sending || myState == State::Receiving || myState == State::Received);
-    if (status != 0) 
+    BulkFileWrite* write = myBulkWrite;
+    if (result_in < 0)
     {
-        cerr << "write error " << status << " " << ::uv_strerror(status) << endl;
-        //uv_close((uv_handle_t*) req->handle, NULL);
+        myBulkWrite = nullptr;
+        delete write;
+        cerr << "Bulk file write error " << result_in << " " << ::uv_err_name((int)result_in) << endl;
+        finishBulkReceive((int)result_in);
         close();
         return;
     }
-    process();
-}
-
-void NetClientBase::doProcessReceivedBuffer()
-{
-    if (myReceiveBuffer.empty())
+    write->myWritten += (size_t)result_in;
+    if (write->myWritten < write->myLength)
     {
+        // short write, the rest
+        bulkWriteNext();
         return;
     }
-    int terminatorIdx;
-    while ((myReceiveBuffer.length() > 0) && ((terminatorIdx = myReceiveBuffer.find('\n')) >= 0))
+    myBulkWrite = nullptr;
+    size_t len = write->myLength;
+    delete write;
+    bulkAdvance(len);
+    if (!hasSocket())
     {
-        string msg1 = myReceiveBuffer.substr(0, terminatorIdx); // without the terminator
-        myReceiveBuffer = myReceiveBuffer.substr(terminatorIdx + 1);
-        //cout << "Incoming message: from " << myPeerAddr << " '" << msg1 << "' " << myReceiveBuffer.length() << endl;
-        // split into tokens
-        std::vector<std::string> tokens; // Create vector to hold our words
+        return;
+    }
+    // bytes received meanwhile: more of the payload, or messages after it
+    if (myBulkRecv && !myReceiveBuffer.empty())
+    {
+        size_t used = bulkConsume(myReceiveBuffer.data(), myReceiveBuffer.length());
+        myReceiveBuffer.erase(0, used);
+        if (!hasSocket() || myBulkWrite != nullptr)
         {
-            std::string buf;                 // Have a buffer string
-            std::stringstream ss(msg1);       // Insert the string into a stream
-            while (ss >> buf) tokens.push_back(buf);
+            return;
         }
-        BaseMessage* msg = MessageDeserializer::parseMessage(tokens);
-        if (msg == nullptr)
+    }
+    int received = doProcessReceivedBuffer();
+    if (!hasSocket())
+    {
+        return;
+    }
+    updateBufferedBytes();
+    if (myBulkWrite == nullptr && !myReadPaused && !myRateDelayed)
+    {
+        int res = startReading();
+        if (res < 0)
         {
-            cerr << "Error: Unparseable message '" << msg1 << "' " << tokens.size() << endl;
-            continue;
+            cerr << "Error from uv_read_start() " << res << " "<< ::uv_err_name(res) << endl;
+            close();
+            return;
         }
-        myState = State::Received;
-        assert(myApp != nullptr);
-        myApp->messageReceived(*this, *msg);
-        delete msg;
+    }
+    if (received > 0)
+    {
+        handleEvent(Event::ReceiveEvent);
     }
 }
 
-void NetClientBase::on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
+void NetClientBase::bulkAdvance(size_t len_in)
 {
-    //cout << "on_read " << nread << endl; // << " " << (long)buf << " " << (long)buf->base << endl;
-    assert(stream != NULL);
-    IUvSocket* uvSocket = (IUvSocket*)(stream->data);
-    if (uvSocket == nullptr)
+    myBulkRecv->myReceived += len_in;
+    if (myBulkRecv->myReceived >= myBulkRecv->myMsg->getLength())
     {
-        cerr << "Fatal error: uvSocket is nullptr " << endl;
-        //uv_close((uv_handle_t*)stream, NULL);
-        //delete stream;
-        return;
+        finishBulkReceive(0);
+    }
+}
+
+void NetClientBase::finishBulkReceive(int status_in)
+{
+    unique_ptr<BulkReceive> bulk = std::move(myBulkRecv);
+    if (myApp != nullptr)
+    {
+        myApp->bulkReceived(*this, *bulk->myMsg, status_in);
     }
-    //cerr << (long)uvSocket << " " << buf->base[0] << endl;
-    uvSocket->onRead(stream, nread, buf);
+}
+
+void NetClientBase::onMessage(BaseMessage* msg_in)
+{
+    assert(myApp != nullptr);
+    myApp->messageReceived(*this, *msg_in);
+    delete msg_in;
 }
 
 void NetClientBase::alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
 {
     //cerr << "alloc_buffer " << suggested_size << endl;
-    size_t s = std::min(suggested_size, (size_t)16384);
+    NetClientBase* client = static_cast<NetClientBase*>((IUvSocket*)handle->data);
+    if (client != nullptr && client->myBulkRecv && client->myBulkRecv->myTarget.buffer != nullptr)
+    {
+        // read the bulk payload right into its destination, no copy
+        BulkReceive* bulk = client->myBulkRecv.get();
+        buf->base = bulk->myTarget.buffer + bulk->myReceived;
+        buf->len = (size_t)std::min(bulk->myMsg->getLength() - bulk->myReceived, (uint64_t)INT_MAX);
+        client->myBulkDirectRead = true;
+        return;
+    }
+    // suggested_size is always 64k with libuv
+    size_t s = (client != nullptr) ? client->myReadBufferSize : std::min(suggested_size, (size_t)16384);
     buf->base = new char[s];
     buf->len = s;
 }
 
+void NetClientBase::adaptReadBuffer(size_t nread_in, size_t len_in)
+{
+    // reads using at most this part of the buffer are small
+    static const int SmallReadDivisor = 8;
+    // shrink after this many small reads in a row
+    static const int ShrinkAfterReads = 16;
+    if (nread_in >= len_in)
+    {
+        // there may be more: fewer, larger reads
+        mySmallReads = 0;
+        if (myReadBufferSize < ourReadBufferSizing.maxSize)
+        {
+            myReadBufferSize = std::min(myReadBufferSize * 2, ourReadBufferSizing.maxSize);
+            ++ourReadBufferGrows;
+        }
+        return;
+    }
+    if (nread_in > len_in / SmallReadDivisor)
+    {
+        mySmallReads = 0;
+        return;
+    }
+    if (++mySmallReads < ShrinkAfterReads)
+    {
+        return;
+    }
+    mySmallReads = 0;
+    if (myReadBufferSize > ourReadBufferSizing.minSize)
+    {
+        myReadBufferSize = std::max(myReadBufferSize / 2, ourReadBufferSizing.minSize);
+        ++ourReadBufferShrinks;
+    }
+}
+
 void NetClientBase::onRead(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
 {
-    //cout << "onRead " << myPeerAddr << " " << nread << endl;
-    if (nread < 0)
+    //cout << "onRead " << getPeerAddr() << " " << nread << endl;
+    if (myBulkDirectRead)
+    {
+        // buffer is the bulk target
+        myBulkDirectRead = false;
+        onBulkDirectRead(nread);
+        return;
+    }
+    // buffer was allocated in alloc_buffer
+    unique_ptr<char[]> bufHolder(buf != nullptr ? buf->base : nullptr);
+    if (buf != nullptr && nread > 0)
+    {
+        adaptReadBuffer((size_t)nread, buf->len);
+    }
+    onReadData(buf != nullptr ? buf->base : nullptr, nread, &bufHolder);
+}
+
+void NetClientBase::onBulkDirectRead(ssize_t nread_in)
+{
+    if (nread_in <= 0 || !myBulkRecv)
     {
-        string errtxt = ::uv_strerror(nread);
+        onReadData(nullptr, nread_in);
+        return;
+    }
+    bulkAdvance(nread_in);
+    if (doProcessReceivedBuffer() > 0)
+    {
+        handleEvent(Event::ReceiveEvent);
+    }
+}
+
+void NetClientBase::onReadData(const char* data_in, ssize_t nread_in, unique_ptr<char[]> * buffer_inout)
+{
+    STAGE_TIMER(StageRead);
+    LoopActivity activity("read", myConnId);
+    if (nread_in < 0)
+    {
+        string errtxt = ::uv_strerror(nread_in);
         if (errtxt == "end of file")
         {
             // ...
         }
         else
         {
-            cerr << "Read error " << errtxt << " " << nread << " pending " << myReceiveBuffer.length() << endl;
+            cerr << "Read error " << errtxt << " " << nread_in << " pending " << myReceiveBuffer.length() << endl;
         }
         // close socket
         close();
         //delete stream;
         return;
     }
-    if (nread == 0)
+    if (nread_in == 0)
     {
-        cerr << "Socket closed while reading " << ::uv_strerror(nread) << "  pending " << myReceiveBuffer.length() << endl;
-        close();
-        //delete stream;
+        // nothing read (EAGAIN), not a close; EOF comes as UV_EOF
         return;
     }
-    if (buf != nullptr && buf->base != nullptr)
+    int received = 0;
+    if (data_in != nullptr)
     {
-        myReceiveBuffer.append(string(buf->base, nread));
+        size_t used = 0;
+        if (myBulkRecv)
+        {
+            used = bulkConsume(data_in, nread_in, buffer_inout);
+            if (!hasSocket())
+            {
+                return;
+            }
+        }
+        {
+            STAGE_TIMER(StageAppend);
+            myReceiveBuffer.append(data_in + used, nread_in - used);
+        }
         //cerr << "ReceiveBuffer increased to " << myReceiveBuffer.length() << endl;
-        doProcessReceivedBuffer();
+        received = doProcessReceivedBuffer();
+        // while rate delayed, the buffer holds complete messages; reading is stopped, it does not grow
+        // (while a bulk file write is pending it holds payload, at most what the backend delivers after the stop)
+        if (ourLimits.maxFrameSize > 0 && myReceiveBuffer.length() > ourLimits.maxFrameSize && !myRateDelayed && myBulkWrite == nullptr)
+        {
+            cerr << "Frame size limit exceeded, closing " << getNicePeerAddr() << " " << myReceiveBuffer.length() << endl;
+            ++ourLimitCloseCount;
+            close();
+            return;
+        }
+        if (ourLimits.maxBufferedBytes > 0 && myReceiveBuffer.length() + myWriteQueueBytes > ourLimits.maxBufferedBytes && myBulkWrite == nullptr)
+        {
+            cerr << "Buffer limit exceeded, closing " << getNicePeerAddr() << " " << myReceiveBuffer.length() + myWriteQueueBytes << endl;
+            ++ourLimitCloseCount;
+            close();
+            return;
+        }
+        updateBufferedBytes();
+        if (isOverBudget())
+        {
+            pauseRead();
+        }
     }
     //delete stream;
 
-    process();
+    if (received > 0)
+    {
+        handleEvent(Event::ReceiveEvent);
+    }
 }
 
 int NetClientBase::doRead()
 {
-    // communicate with client, process one message
     //cout << "doRead " << myState << endl;
-    assert(myState == State::Accepted || myState == State::Sent || myState == State::Sending || myState == State::Receiving);
-    myState = State::Receiving;
-    //cout << "doRead " << endl; //(long)((IUvSocket*)this) << " " << (long)((NetClientBase*)this) << " " << (long)((NetClientIn*)this) << endl;
-    //myReceiveBuffer.clear();
-    //static const int buflen = 256;
-    //char buffer[buflen];
-    ((uv_stream_t*)myUvStream)->data = (void*)dynamic_cast<IUvSocket*>(this);
-    int res = ::uv_read_start((uv_stream_t*)myUvStream, NetClientBase::alloc_buffer, NetClientBase::on_read);
-    if (res < 0)
+    // reading is started on the first call only, see the transition table
+    return handleEvent(Event::ReadEvent) ? 0 : UV_ECANCELED;
+}
+
+bool NetClientBase::handleEvent(Event event_in)
+{
+    Transition const & transition = ourTransitions[myState][event_in];
+    if (transition.next == State::Undefined)
     {
-        cerr << "Error from uv_read_start() " << res << " "<< ::uv_err_name(res) << endl;
-        close();
-        return res;
+        cerr << "Fatal error: illegal event " << getEventName(event_in) << " in state " << getStateName(myState) << " " << getNicePeerAddr() << endl;
+        assert(false);
+        return false;
     }
-    return 0;
+    if (transition.actions & Action::ActIgnore)
+    {
+        return false;
+    }
+    myState = transition.next;
+    if ((transition.actions & Action::ActStartRead) && !myReadPaused && !myRateDelayed)
+    {
+        // otherwise started when memory is released, or by the rate timer
+        int res = startReading();
+        if (res < 0)
+        {
+            cerr << "Error from uv_read_start() " << res << " "<< ::uv_err_name(res) << endl;
+            close();
+            return false;
+        }
+    }
+    if (transition.actions & Action::ActProcess)
+    {
+        process(event_in);
+    }
+    return true;
+}
+
+const char* NetClientBase::getStateName(State state_in)
+{
+    switch (state_in)
+    {
+        case State::Undefined: return "Undefined";
+        case State::NotConnected: return "NotConnected";
+        case State::Connecting: return "Connecting";
+        case State::Connected: return "Connected";
+        case State::Accepted: return "Accepted";
+        case State::Receiving: return "Receiving";
+        case State::Closing: return "Closing";
+        case State::Closed: return "Closed";
+        case State::StateCount: break;
+    }
+    return "?";
+}
+
+const char* NetClientBase::getEventName(Event event_in)
+{
+    switch (event_in)
+    {
+        case Event::ConnectEvent: return "Connect";
+        case Event::ConnectedEvent: return "Connected";
+        case Event::AcceptEvent: return "Accept";
+        case Event::ReadEvent: return "Read";
+        case Event::SendEvent: return "Send";
+        case Event::WriteDoneEvent: return "WriteDone";
+        case Event::WriteErrorEvent: return "WriteError";
+        case Event::ReceiveEvent: return "Receive";
+        case Event::CloseEvent: return "Close";
+        case Event::ClosedEvent: return "Closed";
+        case Event::EventCount: break;
+    }
+    return "?";
 }
 
 bool NetClientBase::isConnected() const
 {
-    if (myUvStream == nullptr) return false;
-    if (myState == State::Undefined || myState == State::NotConnected || myState == State::Connecting || myState == State::Closing || myState == State::Closed) return false;
+    if (!hasSocket()) return false;
+    if (myState != State::Connected && myState != State::Accepted && myState != State::Receiving) return false;
+    if (myUvStream == nullptr) return true; // socket of the I/O backend
     uv_os_fd_t fd;
     if (::uv_fileno((uv_handle_t*)myUvStream, &fd)) return false;
     if (fd <= 0) return false;
     return true;
 }
 
-NetClientIn::NetClientIn(ServerApp* app_in, uv_tcp_t* socket_in, string const & peerAddr_in) :
-NetClientBase(app_in, peerAddr_in)
+NetClientIn::NetClientIn(ServerApp* app_in, uv_tcp_t* socket_in, EndpointId peer_in) :
+NetClientBase(app_in, peer_in)
 {
     setUvStream(socket_in);
-    myState = State::Accepted;
+    handleEvent(Event::AcceptEvent);
+}
+
+NetClientIn::NetClientIn(ServerApp* app_in, IoBackend* backend_in, int fd_in, EndpointId peer_in) :
+NetClientBase(app_in, peer_in)
+{
+    setBackendSocket(backend_in, fd_in);
+    handleEvent(Event::AcceptEvent);
+}
+
+NetClientIn::~NetClientIn()
+{
+    EndpointTable::release(getPeerId());
 }
 
 
-NetClientOut::NetClientOut(BaseApp* app_in, string const & host_in, int port_in, int pingToSend_in) :
-NetClientBase(app_in, host_in + ":" + to_string(port_in)),
+NetClientOut::NetClientOut(BaseApp* app_in, string const & host_in, int port_in, int pingToSend_in, int pipelineDepth_in) :
+NetClientBase(app_in, EndpointTable::intern(host_in, port_in)),
 myHost(host_in),
 myPort(port_in),
 myPingToSend(pingToSend_in),
-mySendCounter(0)
+mySendCounter(0),
+myPipelineDepth(pipelineDepth_in),
+myPingSent(0),
+myPingDone(0),
+myConnectBackend(nullptr)
 {
 }
 
 void NetClientOut::on_connect(uv_connect_t* req, int status)
 {
+    ScopedTrace trace("on_connect", "uv");
     //cout << "on_connect " << status << " " << req->type << endl;
     IUvSocket* uvSocket = (IUvSocket*)req->data;
     if (uvSocket == nullptr)
@@ -306,11 +1707,13 @@ void NetClientOut::on_connect(uv_connect_t* req, int status)
 
 void NetClientOut::onConnect(uv_connect_t* req, int status)
 {
+    LoopActivity activity("connect", getConnId());
     //cout << "onConnect " << status << " " << req->type << endl;
     if (status != 0) 
     {
         cerr << "connect error " << myHost << ":" << myPort << " " << status << " " << ::uv_strerror(status) << endl;
-        //uv_close((uv_handle_t*) req->handle, NULL);
+        // release the socket, the app is notified with connectionClosed
+        close();
         return;
     }
 
@@ -318,30 +1721,64 @@ void NetClientOut::onConnect(uv_connect_t* req, int status)
     string remoteHost;
     int remotePort;
     NetHandler::getRemoteAddressHostPort((uv_tcp_t*)req->handle, remoteHost, remotePort);
+    connected(remoteHost, remotePort);
+}
+
+void NetClientOut::onBackendConnected(int status_in, string const & remoteHost_in)
+{
+    if (status_in != 0)
+    {
+        cerr << "connect error " << myHost << ":" << myPort << " " << status_in << " " << ::uv_strerror(status_in) << endl;
+        // the app is notified with connectionClosed
+        close();
+        return;
+    }
+    connected(remoteHost_in, myPort);
+}
+
+void NetClientOut::connected(string const & remoteHost_in, int remotePort_in)
+{
     // obtain canonical endpoint: IP is connected remote IP, port is original port
-    string canonEp;
-    if (remoteHost != myHost)
+    EndpointId canonEp = EndpointTable::intern(remoteHost_in, myPort);
+    if (canonEp != getPeerId())
     {
-        canonEp = remoteHost + ":" + to_string(myPort);
-        cout << "Canonical endpoint of " << myHost << ":" << myPort << " is " << canonEp << endl;
-        setCanonPeerAddr(canonEp);
+        cout << "Canonical endpoint of " << myHost << ":" << myPort << " is " << EndpointTable::toString(canonEp) << endl;
+        setCanonPeerId(canonEp);
     }
 
-    myState = State::Connected;
-    cout << "Connected to " << myHost << ":" << myPort << " (" << canonEp << " " << remoteHost << ":" << remotePort << ")" << endl;
-    process();
+    Trace::instant("connected", "conn", "conn", getConnId());
+    cout << "Connected to " << myHost << ":" << myPort << " (" << getCanonPeerAddr() << " " << remoteHost_in << ":" << remotePort_in << ")" << endl;
+    // the handshake is queued, then reading is started, once
+    handleEvent(Event::ConnectedEvent);
+    doRead();
 }
 
 int NetClientOut::connect()
 {
     //cout << "NetClientOut::connect " << myHost << ":" << myPort << endl;
-    if (myState >= State::Connected && myState < Closed)
+    if (!handleEvent(Event::ConnectEvent))
     {
-        cerr << "Fatal error: Connect on connected connection " << myState << endl;
+        cerr << "Fatal error: Connect on connected connection " << getStateName(myState) << endl;
         return -1;
     }
-    myState = State::Connecting;
     mySendCounter = 0;
+    myPingSent = 0;
+    myPingDone = 0;
+    if (myConnectBackend != nullptr)
+    {
+        int fd = myConnectBackend->connect(this, myHost, myPort);
+        if (fd >= 0)
+        {
+            setBackendSocket(myConnectBackend, fd);
+            return 0;
+        }
+        if (fd != UV_ENOTSUP)
+        {
+            cerr << "Error from connect() " << fd << " " << ::uv_err_name(fd) << endl;
+            return fd;
+        }
+        // the backend takes incoming connections only
+    }
     uv_tcp_t* socket = new uv_tcp_t();
     ::uv_tcp_init(NetHandler::getUvLoop(), socket);
     setUvStream(socket);
@@ -350,7 +1787,7 @@ int NetClientOut::connect()
     ::uv_ip4_addr(myHost.c_str(), myPort, &dest);
 
     uv_connect_t* connreq = new uv_connect_t();
-    connreq->data = (void*)dynamic_cast<IUvSocket*>(this);
+    connreq->data = (void*)asUvSocket();
     //cout << "connecting..." << endl;
     int res = ::uv_tcp_connect(connreq, socket, (const struct sockaddr*)&dest, NetClientOut::on_connect);
     if (res)
@@ -361,34 +1798,33 @@ int NetClientOut::connect()
     return 0;
 }
 
-void NetClientOut::process()
+void NetClientOut::process(Event event_in)
 {
-    //cout << "NetClientOut::process " << myState << endl;
-    switch (myState)
+    //cout << "NetClientOut::process " << getEventName(event_in) << endl;
+    switch (event_in)
     {
-        case State::Connected:
+        case Event::ConnectedEvent:
             {
                 mySendCounter = 0;
                 HandshakeMessage msg("V01", getPeerAddr(), myApp->getName());
-                sendMessage(msg);
+                sendHandshake(msg);
             }
             break;
 
-        case State::Sending:
+        case Event::WriteDoneEvent:
             ++mySendCounter;
-            doRead();
-            break;
-
-        case State::Sent:
-            doRead();
             break;
 
-        case State::Receiving:
-            doRead();
-            break;
-
-        case State::Received:
-            if (mySendCounter >= 1 + myPingToSend)
+        case Event::ReceiveEvent:
+            if (myPipelineDepth > 1)
+            {
+                // handshake is done, pings are sent as requests
+                if (mySendCounter >= 1)
+                {
+                    fillPipeline();
+                }
+            }
+            else if (mySendCounter >= 1 + myPingToSend)
             {
                 close();
             }
@@ -400,8 +1836,36 @@ void NetClientOut::process()
             break;
 
         default:
-            cerr << "Fatal error: unhandled state " << myState << endl;
-            assert(false);
             break;
     }
+}
+
+void NetClientOut::fillPipeline()
+{
+    while (myPingSent < myPingToSend && myPingSent - myPingDone < myPipelineDepth)
+    {
+        ++myPingSent;
+        PingMessage msg("Ping_from_" + myApp->getName() + "_to_" + getPeerAddr() + "_" + to_string(myPingSent));
+        int res = sendIdempotentRequest(msg, [this](int status_in, BaseMessage const * response_in) { onPingResponse(status_in, response_in); });
+        if (res)
+        {
+            return;
+        }
+    }
+}
+
+void NetClientOut::onPingResponse(int status_in, BaseMessage const * response_in)
+{
+    ++myPingDone;
+    if (status_in != 0)
+    {
+        cerr << "Ping request failed " << getPeerAddr() << " " << ::uv_err_name(status_in) << endl;
+    }
+    if (myPingDone >= myPingToSend)
+    {
+        cout << "All " << myPingDone << " pings done " << getPeerAddr() << endl;
+        close();
+        return;
+    }
+    fillPipeline();
 }
\ No newline at end of file
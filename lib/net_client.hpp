@@ -1,20 +1,95 @@
 #pragma once
 
 #include "uv_socket.hpp"
+#include "bulk.hpp"
+#include "endpoint_table.hpp"
+#include "loop_timer.hpp"
 #include "message.hpp"
+#include "rate_limit.hpp"
+#include "request_tracker.hpp"
 
 #include <uv.h>
 
+#include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
 #include <queue>
 #include <string>
 
 namespace sample
 {
     class BaseApp; // forward
+    class DurationHistogram; // forward
+    class IoBackend; // forward
     class ServerApp; // forward
 
+    /**
+     * Memory limits of connections.  0 means no limit.
+     */
+    struct ConnectionLimits
+    {
+    public:
+        ConnectionLimits() : maxFrameSize(0), maxBufferedBytes(0), memoryBudget(0) { }
+        /// Max. size of a message; a connection sending longer messages is closed
+        size_t maxFrameSize;
+        /// Max. bytes held by one connection (receive buffer and write queue); if exceeded, the connection is closed
+        size_t maxBufferedBytes;
+        /// Max. bytes held by all connections; if exceeded, reading is paused until memory is released
+        size_t memoryBudget;
+    };
+
+    /**
+     * Sizing of the read buffers of connections (libuv streams): each connection adapts its size to its recent reads,
+     * doubled after a read filling the buffer, halved after several reads using a small part of it, within the bounds.
+     */
+    struct ReadBufferSizing
+    {
+    public:
+        ReadBufferSizing() : minSize(1024), maxSize(64 << 10), initialSize(4096) { }
+        size_t minSize;
+        size_t maxSize;
+        /// Size of the first read of a connection, clamped to the bounds
+        size_t initialSize;
+    };
+
+    /**
+     * Order of the outgoing messages of a connection, by MessageClass.
+     * Messages wait in a queue per class while the socket has a window of bytes not yet written; when a write completes,
+     * the next ones are taken from the queues: by strict priority (control, then latency, then bulk),
+     * or by weighted round-robin (deficit round-robin, by bytes).
+     */
+    struct SendScheduling
+    {
+    public:
+        SendScheduling();
+        /// false: strict priority; true: weighted
+        bool weighted;
+        /// Share of each class with weighted scheduling, in quanta of SendQuantumBytes per round
+        uint32_t weights[MessageClass::MessageClassCount];
+        /// Max. bytes written to the socket and not yet completed; 0: no queuing, messages are written in order
+        size_t windowBytes;
+        /// Set from "strict", "weighted", or "weighted:c,l,b" (weights of control, latency, bulk); return 0 if valid
+        int parse(std::string const & text_in);
+        std::string toString() const;
+    };
+
+    /**
+     * Memory held by a connection.
+     */
+    struct ConnectionMemoryUsage
+    {
+    public:
+        size_t receiveBuffer; // bytes of incomplete messages
+        size_t writeQueue; // bytes of messages queued for sending
+        int pendingWrites; // no. of write requests in progress
+        size_t total() const;
+    };
+
     /**
      * Represents a connection.
+     * Its state changes by events only, as given by a transition table (see handleEvent).  Reading is started once, when
+     * connected or accepted, and kept running; sending and receiving messages do not change the state.
      */
     class NetClientBase: public IUvSocket
     {
@@ -24,52 +99,417 @@ namespace sample
             Undefined = 0,
             NotConnected,
             Connecting,
+            /// Outgoing connection established, reading not started yet
             Connected,
+            /// Incoming connection, reading not started yet
             Accepted,
-            Sending,
-            Sent,
+            /// Open, reading
             Receiving,
-            Received,
             Closing,
-            Closed
+            Closed,
+            StateCount
         };
 
+        /// Events of a connection, see handleEvent
+        enum Event
+        {
+            ConnectEvent = 0,
+            ConnectedEvent,
+            AcceptEvent,
+            ReadEvent,
+            SendEvent,
+            WriteDoneEvent,
+            WriteErrorEvent,
+            ReceiveEvent,
+            CloseEvent,
+            ClosedEvent,
+            EventCount
+        };
+
+        /// Actions of a transition, flags
+        enum Action
+        {
+            ActNone = 0,
+            /// Start reading of the socket (unless paused)
+            ActStartRead = 1,
+            /// Let the connection react to the event, see process
+            ActProcess = 2,
+            /// Event is too late (closing), it is dropped
+            ActIgnore = 4
+        };
+
+        /// Entry of the transition table; illegal if next is Undefined
+        struct Transition
+        {
+        public:
+            State next;
+            uint8_t actions;
+        };
+
+        /// Max. size of one sendfile call of a bulk payload
+        static const size_t BulkChunkSize = 1 << 20;
+        /// Max. buffers of a write tried synchronously (uv_try_write), larger batches are written async
+        static const size_t MaxTryWriteBufs = 16;
+        /// Chunk size of a bulk payload read and sent as buffer (no sendfile, with an I/O backend)
+        static const size_t BulkCopyChunkSize = 256 << 10;
+        /// Retry delay of a bulk sendfile after the socket buffer was full, doubled up to the max. while it stays full
+        static const uint64_t BulkRetryMinMs = 1;
+        static const uint64_t BulkRetryMaxMs = 64;
+        /// Bytes per weight unit and round of weighted send scheduling
+        static const size_t SendQuantumBytes = 1500;
+        /// Unparseable incoming messages logged per connection, further ones are only counted
+        static const int UnparseableLogLimit = 3;
+
     public:
-        NetClientBase(BaseApp* app_in, std::string const & peerAddr_in);
+        NetClientBase(BaseApp* app_in, EndpointId peer_in);
         virtual ~NetClientBase();
-	    std::string getPeerAddr() const { return myPeerAddr; }
-	    std::string getCanonPeerAddr() const { return myCanonPeerAddr; }
-	    std::string getNicePeerAddr() const { return myCanonPeerAddr.length() > 0 ? myCanonPeerAddr : myPeerAddr; }
-	    void setCanonPeerAddr(std::string peerAddr_in) { myCanonPeerAddr = peerAddr_in; }
-        // Send a message to this peer
+        /// Process-unique ID of this connection
+        uint32_t getConnId() const { return myConnId; }
+        /// Peer endpoint, as connected; canonical one (listening endpoint of the peer), if known, 0 otherwise; for comparisons
+        EndpointId getPeerId() const { return myPeerId; }
+        EndpointId getCanonPeerId() const { return myCanonPeerId; }
+        EndpointId getNicePeerId() const { return myCanonPeerId != 0 ? myCanonPeerId : myPeerId; }
+        void setCanonPeerId(EndpointId peer_in) { myCanonPeerId = peer_in; }
+        /// The same as strings ("host:port"), for logs and messages
+        std::string const & getPeerAddr() const { return EndpointTable::toString(myPeerId); }
+        std::string const & getCanonPeerAddr() const { return EndpointTable::toString(myCanonPeerId); }
+        std::string const & getNicePeerAddr() const { return EndpointTable::toString(getNicePeerId()); }
+        State getState() const { return myState; }
+        static const char* getStateName(State state_in);
+        static const char* getEventName(Event event_in);
+        // Send a message to this peer, in the class of its type
         int sendMessage(BaseMessage const & msg_in);
+        /// Send a message in this class, see SendScheduling
+        int sendMessage(BaseMessage const & msg_in, MessageClass class_in);
+        /// Send an already serialized message (see serializeMessage); the buffer is not copied, it can be shared among connections
+        int sendBuffer(SharedBuffer const & buf_in, MessageClass class_in = MessageClass::ControlClass);
+        /// Serialize a message into a buffer, with terminator, ready to be sent to any number of peers
+        static SharedBuffer serializeMessage(BaseMessage const & msg_in);
+        /// Send a request to this peer, without waiting for the response of previous requests.
+        /// A new request ID is set in the message, callback is invoked when the response with matching ID arrives,
+        /// or on timeout (after the retries of the policy), or when the connection is closed.
+        int sendRequest(BaseMessage & msg_in, ResponseCallback callback_in, RequestPolicy const & policy_in);
+        /// With the default policy, no retries, see setRequestPolicy
+        int sendRequest(BaseMessage & msg_in, ResponseCallback callback_in) { return sendRequest(msg_in, callback_in, ourRequestPolicy); }
+        /// A request that is safe to send again (Ping, Handshake): timed out attempts are retried, see setRequestPolicy
+        int sendIdempotentRequest(BaseMessage & msg_in, ResponseCallback callback_in) { return sendRequest(msg_in, callback_in, ourIdempotentRequestPolicy); }
+        /// Send the handshake as a request: the response goes to the app as any other message, without one the connection is closed
+        int sendHandshake(HandshakeMessage & msg_in);
+        size_t getPendingRequestCount() const { return myRequests.size(); }
+        /// Requests of this connection timed out (after their retries)
+        uint64_t getRequestTimeoutCount() const { return myRequestTimeouts; }
+        /// Send a bulk payload from memory: BULK header, then the raw bytes; the buffer is not copied
+        int sendBulk(std::string const & name_in, SharedBuffer const & data_in);
+        /// Send a bulk payload from a file region: BULK header, then the bytes with sendfile, from page cache to the socket.
+        /// Sent in chunks, after the writes already queued; writes queued meanwhile are sent after it.
+        int sendBulkFile(std::string const & name_in, int fd_in, int64_t offset_in, uint64_t length_in, BulkProgressCallback progress_in);
+        bool isBulkSending() const { return myBulkFile != nullptr; }
+        ConnectionMemoryUsage getMemoryUsage() const;
+        /// Bytes of messages of this class waiting in the send queue (not yet given to the socket)
+        size_t getQueuedBytes(MessageClass class_in) const { return myQueuedBytes[class_in]; }
+        bool isReadPaused() const { return myReadPaused; }
+        /// Reading stopped until the next received message fits the rate limits
+        bool isRateDelayed() const { return myRateDelayed; }
+        RateLimitStats const & getRateLimitStats() const { return myRateLimiter.getStats(); }
+        /// Set the limits, for all connections.  As the other process-wide settings below: set before any loop starts,
+        /// the loop threads read them without synchronization (see ServerApp::applyConnectionParams)
+        static void setLimits(ConnectionLimits const & limits_in) { ourLimits = limits_in; }
+        static ConnectionLimits getLimits() { return ourLimits; }
+        /// Set the read buffer bounds, for connections created afterwards
+        static void setReadBufferSizing(ReadBufferSizing const & sizing_in) { ourReadBufferSizing = sizing_in; }
+        static ReadBufferSizing getReadBufferSizing() { return ourReadBufferSizing; }
+        /// Current read buffer size of this connection, see ReadBufferSizing
+        size_t getReadBufferSize() const { return myReadBufferSize; }
+        /// No. of read buffer size changes, of all connections
+        static uint64_t getReadBufferGrowCount() { return ourReadBufferGrows; }
+        static uint64_t getReadBufferShrinkCount() { return ourReadBufferShrinks; }
+        /// Set the scheduling of outgoing messages, for all connections
+        static void setSendScheduling(SendScheduling const & scheduling_in) { ourSendScheduling = scheduling_in; }
+        static SendScheduling getSendScheduling() { return ourSendScheduling; }
+        /// Total bytes held by all connections
+        static size_t getTotalBufferedBytes() { return ourTotalBufferedBytes; }
+        /// No. of connections closed because they exceeded a limit
+        static uint64_t getLimitCloseCount() { return ourLimitCloseCount; }
+        /// Set the rate limits of incoming messages, per connection; for connections created afterwards
+        static void setRateLimits(RateLimitParams const & limits_in) { ourRateLimits = limits_in; }
+        static RateLimitParams getRateLimits() { return ourRateLimits; }
+        /// No. of incoming messages delayed or dropped, and connections closed, because of the rate limits
+        static uint64_t getRateDelayCount() { return ourRateDelayCount; }
+        static uint64_t getRateDropCount() { return ourRateDropCount; }
+        static uint64_t getRateCloseCount() { return ourRateCloseCount; }
+        /// No. of unparseable incoming messages, of all connections
+        static uint64_t getUnparseableCount() { return ourUnparseableCount; }
+        /// No. of connections with reading paused, because of the memory budget
+        static size_t getPausedCount() { return ourPausedReaders.size(); }
+        /// Message and byte totals of all connections, in the process (bulk payloads not included)
+        static uint64_t getSentMessageCount() { return ourSentMessages; }
+        static uint64_t getSentByteCount() { return ourSentBytes; }
+        static uint64_t getReceivedMessageCount() { return ourReceivedMessages; }
+        static uint64_t getReceivedByteCount() { return ourReceivedBytes; }
+        /// Writes on libuv streams: synchronous attempts (uv_try_write), written completely or partly by them, async writes
+        static uint64_t getTryWriteCount() { return ourTryWrites; }
+        static uint64_t getTryWriteFullCount() { return ourTryWriteFull; }
+        static uint64_t getTryWritePartialCount() { return ourTryWritePartial; }
+        static uint64_t getAsyncWriteCount() { return ourAsyncWrites; }
+        /// Set the deadline and retries of idempotent requests, and after how many timed out requests in a row a connection is closed (0: never).
+        /// Other requests get the same deadline, without retries.
+        static void setRequestPolicy(RequestPolicy const & policy_in, int closeAfterTimeouts_in);
+        static RequestPolicy getRequestPolicy() { return ourRequestPolicy; }
+        static RequestPolicy getIdempotentRequestPolicy() { return ourIdempotentRequestPolicy; }
+        static int getRequestCloseAfter() { return ourRequestCloseAfter; }
+        /// Requests of all connections: sent, answered, attempts retried, timed out (after the retries), cancelled by close;
+        /// connections closed because of timeouts
+        static uint64_t getRequestCount() { return ourRequests; }
+        static uint64_t getRequestResponseCount() { return ourRequestResponses; }
+        static uint64_t getRequestRetryCount() { return ourRequestRetries; }
+        static uint64_t getRequestTimeoutTotal() { return ourRequestTimeouts; }
+        static uint64_t getRequestCancelCount() { return ourRequestCancels; }
+        static uint64_t getRequestCloseCount() { return ourRequestCloses; }
+        /// Time from sending a request (its first attempt) to the response
+        static DurationHistogram const & getRequestLatency();
         int close();
-        void onRead(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
-        void onWrite(uv_write_t* req, int status);
+        void onRead(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) final;
+        void onWrite(uv_write_t* req, int status) final;
         void onClose(uv_handle_t* handle);
+        /// Process received data (nread_in < 0: error or EOF); from libuv or the I/O backend.
+        /// If given, buffer_inout holds data_in on the heap, a bulk file write may take it instead of a copy.
+        void onReadData(const char* data_in, ssize_t nread_in, std::unique_ptr<char[]> * buffer_inout = nullptr);
+        /// A write of len_in bytes has completed; from libuv or the I/O backend
+        void onWriteCompleted(size_t len_in, int status_in);
+        /// The I/O backend has closed the socket
+        void onBackendClosed();
+        /// An outgoing connection of the I/O backend is established (status 0), or has failed
+        virtual void onBackendConnected(int status_in, std::string const & remoteHost_in) { }
+        /// Start reading, if not yet reading
         int doRead();
-        virtual void process() { }
+        /// React to an event of the connection (connected, a write done, messages received), in its state
+        virtual void process(Event event_in) { }
         bool isConnected() const;
 
     protected:
         void setUvStream(uv_tcp_t* stream_in);
+        /// Use the I/O backend for this connection, instead of libuv; it takes over the connected socket
+        void setBackendSocket(IoBackend* backend_in, int fd_in);
+        /// Called for each received message (except responses to requests sent with sendRequest), takes ownership.
+        /// By default passes it to the app.
+        virtual void onMessage(BaseMessage* msg_in);
+        /// Called when a write has completed, after its accounting.  By default closes on error, processes on success.
+        virtual void onWriteDone(int status_in);
+        /// This connection as socket, as stored in handle data
+        IUvSocket* asUvSocket() { return this; }
+        /// Change the state by the transition table, and perform the actions of the transition.
+        /// Return false if the event is dropped (too late, or illegal; illegal ones assert).
+        bool handleEvent(Event event_in);
         
     private:
         static void alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
-        static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
-        static void on_write(uv_write_t* req, int status);
+        /// Adapt the read buffer size to a read of nread_in bytes into a buffer of size len_in
+        void adaptReadBuffer(size_t nread_in, size_t len_in);
         static void on_close(uv_handle_t* handle);
-        void doProcessReceivedBuffer();
+        static void on_bulk_sendfile(uv_fs_t* req);
+        static void on_bulk_read(uv_fs_t* req);
+        static void on_bulk_write(uv_fs_t* req);
+        bool hasSocket() const { return myUvStream != nullptr || myBackendFd >= 0; }
+        /// Write the buffers on the libuv stream right away, as far as the socket takes them, if nothing is queued in libuv.
+        /// Set the first buffer not written completely, and the bytes written of it; return 0 or an error.
+        int tryWrite(std::vector<SharedBuffer> const & bufs_in, size_t & first_out, size_t & offset_out);
+        /// Report the buffers written by tryWrite as completed, those present at the call
+        void completeTryWrites(int status_in);
+        /// Queue a message for writing, in the queue of its class, and flush.  A bulk payload follows its header,
+        /// it is not captured, and not subject to the write queue limit.
+        int queueBuffer(SharedBuffer const & buf_in, MessageClass class_in, SharedBuffer const & payload_in, bool bulkFileHeader_in);
+        /// Write queued messages to the socket, while the window allows
+        void flushQueues();
+        /// Class of the next message to write, by the scheduling; -1 if none is queued
+        int nextSendClass();
+        /// Write buffers to the socket, now, in one request
+        int writeBuffers(std::vector<SharedBuffer> const & bufs_in);
+        int writeBuffer(SharedBuffer const & buf_in) { return writeBuffers(std::vector<SharedBuffer>(1, buf_in)); }
+        void dropQueuedWrites();
+        /// Send the next chunk of the outgoing file bulk payload, or finish it
+        void bulkFileNext();
+        void onBulkSendfile(ssize_t result_in);
+        void onBulkRead(ssize_t result_in);
+        /// If the connection was closed while the thread pool used its socket, close the socket now, and return true
+        bool bulkFileCloseDeferred();
+        void bulkFileDone(int status_in);
+        void startBulkReceive(BulkMessage* msg_in);
+        /// Take incoming bulk payload bytes, return the number used
+        size_t bulkConsume(const char* data_in, size_t len_in, std::unique_ptr<char[]> * buffer_inout = nullptr);
+        /// Payload bytes arrived, in the target already
+        void bulkAdvance(size_t len_in);
+        void onBulkDirectRead(ssize_t nread_in);
+        /// Write incoming bulk payload bytes to the target file, in the thread pool; reading waits for it.
+        /// Takes buffer_inout if it holds the bytes, else copies them.
+        void bulkWriteFile(const char* data_in, size_t len_in, std::unique_ptr<char[]> * buffer_inout);
+        /// Start the write of the rest of the bytes of myBulkWrite
+        void bulkWriteNext();
+        void onBulkWrite(ssize_t result_in);
+        void finishBulkReceive(int status_in);
+        /// Take complete messages from the receive buffer; return the number received
+        int doProcessReceivedBuffer();
+        void onRequestTimer();
+        /// Set the request timer to the next deadline, if earlier than the one set; stop it if there are no requests
+        void armRequestTimer();
+        /// Update accounted memory of this connection, and the total
+        void updateBufferedBytes();
+        bool isOverBudget() const;
+        void pauseRead();
+        int startReading();
+        void stopReading();
+        /// Stop reading, until the rate limits let the next message through
+        void delayReceive(uint64_t waitMs_in);
+        void onRateTimer();
+        /// Resume reading of paused connections, while below memory budget
+        static void resumePausedReads();
 
     protected:
         BaseApp* myApp;
         State myState;
 
     private:
-        std::string myPeerAddr;
-        std::string myCanonPeerAddr;
+        static std::atomic<uint32_t> ourNextConnId;
+        static ConnectionLimits ourLimits;
+        static ReadBufferSizing ourReadBufferSizing;
+        static std::atomic<uint64_t> ourReadBufferGrows;
+        static std::atomic<uint64_t> ourReadBufferShrinks;
+        static SendScheduling ourSendScheduling;
+        static std::atomic<size_t> ourTotalBufferedBytes;
+        static std::atomic<uint64_t> ourLimitCloseCount;
+        static RateLimitParams ourRateLimits;
+        static std::atomic<uint64_t> ourRateDelayCount;
+        static std::atomic<uint64_t> ourRateDropCount;
+        static std::atomic<uint64_t> ourRateCloseCount;
+        static std::atomic<uint64_t> ourUnparseableCount;
+        // per loop thread, paused readers are resumed on their own loop
+        static thread_local std::list<NetClientBase*> ourPausedReaders;
+        static std::atomic<uint64_t> ourSentMessages;
+        static std::atomic<uint64_t> ourSentBytes;
+        static std::atomic<uint64_t> ourReceivedMessages;
+        static std::atomic<uint64_t> ourReceivedBytes;
+        static std::atomic<uint64_t> ourTryWrites;
+        static std::atomic<uint64_t> ourTryWriteFull;
+        static std::atomic<uint64_t> ourTryWritePartial;
+        static std::atomic<uint64_t> ourAsyncWrites;
+        static RequestPolicy ourRequestPolicy;
+        static RequestPolicy ourIdempotentRequestPolicy;
+        static int ourRequestCloseAfter;
+        static std::atomic<uint64_t> ourRequests;
+        static std::atomic<uint64_t> ourRequestResponses;
+        static std::atomic<uint64_t> ourRequestRetries;
+        static std::atomic<uint64_t> ourRequestTimeouts;
+        static std::atomic<uint64_t> ourRequestCancels;
+        static std::atomic<uint64_t> ourRequestCloses;
+        // added to by every loop: with several loops in one process the counts are approximate (one-writer histogram)
+        static DurationHistogram ourRequestLatency;
+        uint32_t myConnId;
+        // true if frames of this connection are captured
+        bool myCaptureFlag;
+        EndpointId myPeerId;
+        EndpointId myCanonPeerId;
         std::string myReceiveBuffer;
         uv_tcp_t* myUvStream;
+        // if set, sockets I/O goes through it instead of myUvStream
+        IoBackend* myIoBackend;
+        int myBackendFd;
+        RequestTracker myRequests;
+        // one for all requests, set to the next deadline (not moved later when requests complete, see armRequestTimer)
+        LoopTimer myRequestTimer;
+        uint64_t myRequestTimerDue;
+        uint64_t myRequestTimeouts;
+        // timed out requests since the last response
+        int myRequestTimeoutsInRow;
+        int myUnparseableCount;
+        // queued and in progress
+        size_t myWriteQueueBytes;
+        // in progress, see SendScheduling::windowBytes
+        size_t myInFlightBytes;
+        int myPendingWrites;
+        // buffers written by tryWrite, their completion is reported from the loop, as that of async writes
+        std::vector<size_t> myTryWritten;
+        LoopTimer myTryWriteTimer;
+        // bytes of this connection included in ourTotalBufferedBytes
+        size_t myAccountedBytes;
+        bool myReadPaused;
+        RateLimiter myRateLimiter;
+        // the next message in the receive buffer waits for the rate limits, reading is stopped
+        bool myRateDelayed;
+        LoopTimer myRateTimer;
+
+        /// Outgoing file bulk payload
+        class BulkFileSend
+        {
+        public:
+            NetClientBase* myClient;
+            int myFd;
+            int64_t myOffset;
+            uint64_t mySent;
+            uint64_t myTotal;
+            BulkProgressCallback myProgress;
+            // a sendfile, or a read of the file, is running in the thread pool
+            bool myInFlight;
+            uv_fs_t myReq;
+            // delay of the next retry while the socket buffer is full, see myBulkRetryTimer
+            uint64_t myRetryMs;
+            // chunk read from the file (no sendfile)
+            std::shared_ptr<std::vector<uint8_t>> myChunk;
+            // connection closed while the socket is used by sendfile, close it afterwards
+            uv_handle_t* myCloseHandle;
+            // the BULK header is written, the payload goes next, queued messages wait
+            bool myHeaderSent;
+        };
+
+        /// Message in a send queue
+        class QueuedWrite
+        {
+        public:
+            SharedBuffer myBuf;
+            // bulk payload from memory, written right after its header
+            SharedBuffer myPayload;
+            // the header of the file bulk payload (myBulkFile)
+            bool myBulkFileHeader;
+            size_t size() const { return myBuf->size() + (myPayload ? myPayload->size() : 0); }
+        };
+
+        /// Incoming bulk payload
+        class BulkReceive
+        {
+        public:
+            std::unique_ptr<BulkMessage> myMsg;
+            BulkTarget myTarget;
+            uint64_t myReceived;
+        };
+
+        /// Write of incoming bulk payload bytes to the target file, in the thread pool
+        class BulkFileWrite
+        {
+        public:
+            // nullptr if the connection is gone
+            NetClientBase* myClient;
+            uv_fs_t myReq;
+            // the read buffer, handed over, or a copy of the bytes
+            std::unique_ptr<char[]> myData;
+            size_t myLength;
+            size_t myWritten;
+        };
+
+        BulkFileSend* myBulkFile;
+        // sendfile got EAGAIN: retried from the loop (libuv allows no poll handle on the socket of a stream)
+        LoopTimer myBulkRetryTimer;
+        // messages waiting to be written, per class
+        std::deque<QueuedWrite> mySendQueues[MessageClass::MessageClassCount];
+        size_t myQueuedBytes[MessageClass::MessageClassCount];
+        // weighted scheduling: class of the current round, and its remaining bytes
+        int myDrrClass;
+        int64_t myDrrCredits[MessageClass::MessageClassCount];
+        std::unique_ptr<BulkReceive> myBulkRecv;
+        // in progress, reading waits for it
+        BulkFileWrite* myBulkWrite;
+        // the last alloc_buffer returned memory of the bulk target
+        bool myBulkDirectRead;
+        // adaptive read buffer: size of the next one, consecutive small reads
+        size_t myReadBufferSize;
+        int mySmallReads;
     };
 
     /**
@@ -78,7 +518,11 @@ namespace sample
     class NetClientIn: public NetClientBase
     {
     public:
-        NetClientIn(ServerApp* app_in, uv_tcp_t* client_in, std::string const & peerAddr_in);
+        /// peer_in is acquired (see EndpointTable::acquire), released with the connection
+        NetClientIn(ServerApp* app_in, uv_tcp_t* client_in, EndpointId peer_in);
+        /// Connection on a socket accepted by the I/O backend
+        NetClientIn(ServerApp* app_in, IoBackend* backend_in, int fd_in, EndpointId peer_in);
+        virtual ~NetClientIn();
     };
 
     /**
@@ -87,19 +531,32 @@ namespace sample
     class NetClientOut: public NetClientBase
     {
     public:
-        NetClientOut(BaseApp* app_in, std::string const & host_in, int port_in, int pingToSend_in);
+        /// pipelineDepth_in: max. number of Pings outstanding at the same time; with 1, Pings are sent one after the other
+        NetClientOut(BaseApp* app_in, std::string const & host_in, int port_in, int pingToSend_in, int pipelineDepth_in = 1);
         int connect();
-        // Perform state-dependent next action in the client state diagram
-        virtual void process();
+        /// Connect through this I/O backend, if it supports outgoing connections (otherwise with libuv).  Set before connect.
+        void setConnectBackend(IoBackend* backend_in) { myConnectBackend = backend_in; }
+        /// Handshake when connected, then Pings, one after the response of the other (or pipelined)
+        virtual void process(Event event_in);
         void onConnect(uv_connect_t* req, int status);
+        void onBackendConnected(int status_in, std::string const & remoteHost_in);
         
     private:
         static void on_connect(uv_connect_t* req, int status);
+        /// Connection established, to the given remote IP
+        void connected(std::string const & remoteHost_in, int remotePort_in);
+        /// Send Ping requests, until the pipeline is full
+        void fillPipeline();
+        void onPingResponse(int status_in, BaseMessage const * response_in);
 
     private:
         std::string myHost;
         int myPort;
         int myPingToSend;
         int mySendCounter;
+        int myPipelineDepth;
+        int myPingSent;
+        int myPingDone;
+        IoBackend* myConnectBackend;
     };
 }
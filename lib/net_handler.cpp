@@ -1,7 +1,12 @@
 #include "net_handler.hpp"
 
 #include "app.hpp"
+#include "io_backend.hpp"
+#include "loop_monitor.hpp"
 #include "net_client.hpp"
+#include "sim_network.hpp"
+#include "thread_placement.hpp"
+#include "trace.hpp"
 
 #include <cassert>
 #include <iostream>
@@ -11,14 +16,41 @@ using namespace std;
 
 
 uv_loop_t* NetHandler::myUvLoop = nullptr;
+thread_local uv_loop_t* NetHandler::ourThreadLoop = nullptr;
+atomic<int> NetHandler::ourLoopThreadCount(0);
+
+NetHandler::LoopScope::LoopScope(uv_loop_t* loop_in) :
+myPrevLoop(ourThreadLoop)
+{
+    if (loop_in != nullptr)
+    {
+        ourThreadLoop = loop_in;
+    }
+}
+
+NetHandler::LoopScope::~LoopScope()
+{
+    ourThreadLoop = myPrevLoop;
+}
 
 NetHandler::NetHandler(BaseApp* app_in) :
-myApp(app_in)
+myApp(app_in),
+myIoBackend(nullptr),
+myUvAsync(nullptr),
+myUvPrepare(nullptr),
+myLastPrepareNs(0),
+myOwnLoop(nullptr),
+mySimulation(nullptr),
+myLoopMonitor(nullptr)
 {
 }
 
 uv_loop_t* NetHandler::getUvLoop()
 {
+    if (ourThreadLoop != nullptr)
+    {
+        return ourThreadLoop;
+    }
     if (myUvLoop == nullptr)
     {
         myUvLoop = new uv_loop_t();
@@ -65,20 +97,40 @@ int NetHandler::runLoop()
         }
     }
     //cerr << "uv loop closed" << endl;    
-    deleteUvLoop();
+    if (ourThreadLoop == nullptr)
+    {
+        // a private loop is kept, it is owned by its handler
+        deleteUvLoop();
+    }
 
     return 0;
 }
 
 int NetHandler::start()
 {
+    if (mySimulation != nullptr)
+    {
+        return 0;
+    }
+    LoopScope scope(myOwnLoop);
     return startUvLoop();
 }
 
 int NetHandler::startWithListen(int port_in, int tryNextPorts_in)
 {
+    LoopScope scope(myOwnLoop);
+    if (myIoBackend != nullptr)
+    {
+        int res = myIoBackend->init(getUvLoop());
+        if (res)
+        {
+            cerr << "Could not start I/O backend " << myIoBackend->getName() << ", using libuv" << endl;
+            delete myIoBackend;
+            myIoBackend = nullptr;
+        }
+    }
     int actualPort = doListen(port_in, tryNextPorts_in);
-    if (actualPort <= 0)
+    if (actualPort <= 0 || mySimulation != nullptr)
     {
         return actualPort;
     }
@@ -92,9 +144,25 @@ int NetHandler::startWithListen(int port_in, int tryNextPorts_in)
 
 int NetHandler::stop()
 {
+    if (mySimulation != nullptr)
+    {
+        // the simulation stops when it is not run
+        return 0;
+    }
+    LoopScope scope(myOwnLoop);
     return stopUvLoop();
 }
 
+void NetHandler::useOwnLoop()
+{
+    if (myOwnLoop != nullptr)
+    {
+        return;
+    }
+    myOwnLoop = new uv_loop_t();
+    ::uv_loop_init(myOwnLoop);
+}
+
 int NetHandler::startUvLoop()
 {
     myBgThreadStop = false;
@@ -102,11 +170,23 @@ int NetHandler::startUvLoop()
     uv_loop_t* loop = getUvLoop();
     // async handle to be able to awake loop when needed
     myUvAsync = new uv_async_t();
-    int res = ::uv_async_init(loop, myUvAsync, NULL);
+    int res = ::uv_async_init(loop, myUvAsync, NetHandler::on_async);
     assert(res == 0);
+    myUvAsync->data = (void*)this;
+    // loop iterations, for the trace; does not keep the loop alive
+    myUvPrepare = new uv_prepare_t();
+    myUvPrepare->data = (void*)this;
+    ::uv_prepare_init(loop, myUvPrepare);
+    ::uv_prepare_start(myUvPrepare, NetHandler::on_prepare);
+    ::uv_unref((uv_handle_t*)myUvPrepare);
+    myLastPrepareNs = 0;
+    if (myLoopMonitor != nullptr)
+    {
+        myLoopMonitor->start(loop);
+    }
 
     // start loop in backround thread
-    myBgThread = move(thread([=]() { return this->doBgThread(); }));
+    myBgThread = move(thread([this]() { return this->doBgThread(); }));
 
     return 0;
 }
@@ -123,35 +203,89 @@ int NetHandler::stopUvLoop()
     // thread should end, wait for it
     myBgThread.join();
     //cerr << "Bg thread joined" << endl;
+    if (myLoopMonitor != nullptr)
+    {
+        myLoopMonitor->stop();
+    }
     return 0;
 }
 
-void NetHandler::on_close(uv_handle_t* handle)
+void NetHandler::setSimulation(SimNetwork* sim_in, IoBackend* backend_in)
 {
-    //cout << "on_close" << endl;
-    if (handle != NULL)
+    mySimulation = sim_in;
+    myIoBackend = backend_in;
+}
+
+void NetHandler::post(function<void()> fn_in)
+{
+    if (mySimulation != nullptr)
     {
-        delete handle;
+        mySimulation->schedule(0, fn_in);
+        return;
+    }
+    {
+        lock_guard<mutex> lock(myPostedMutex);
+        myPosted.push_back(fn_in);
+    }
+    if (myUvAsync != nullptr)
+    {
+        ::uv_async_send(myUvAsync);
     }
 }
 
-void NetHandler::on_new_connection(uv_stream_t* server, int status)
+void NetHandler::on_async(uv_async_t* handle)
 {
-    //cerr << "on_new_connection " << status << endl;
-    IUvSocket* uvSocket = (IUvSocket*)server->data;
-    //cerr << "on_new_connection " << status << " " << (long)uvSocket << endl;
-    if (uvSocket == nullptr)
+    NetHandler* handler = (NetHandler*)handle->data;
+    if (handler == nullptr)
     {
-        cerr << "Fatal error: uvSocket is nullptr " << (long)server->accepted_fd;
-        //uv_close((uv_handle_t*)server, NULL);
-        //delete server;
         return;
     }
-    uvSocket->onNewConnection(server, status);
+    ScopedTrace trace("on_async", "uv");
+    LoopActivity activity("posted");
+    handler->onAsync();
+}
+
+void NetHandler::on_prepare(uv_prepare_t* handle)
+{
+    NetHandler* handler = (NetHandler*)handle->data;
+    if (handler == nullptr || !Trace::isEnabled())
+    {
+        return;
+    }
+    // from one iteration (before polling) to the next; nested spans are the callbacks of the iteration
+    uint64_t now = Trace::now();
+    if (handler->myLastPrepareNs != 0)
+    {
+        Trace::span("loop-iteration", "loop", handler->myLastPrepareNs);
+    }
+    handler->myLastPrepareNs = now;
+}
+
+void NetHandler::onAsync()
+{
+    vector<function<void()>> posted;
+    {
+        lock_guard<mutex> lock(myPostedMutex);
+        posted.swap(myPosted);
+    }
+    for (auto i = posted.begin(); i != posted.end(); ++i)
+    {
+        (*i)();
+    }
+}
+
+void NetHandler::on_close(uv_handle_t* handle)
+{
+    //cout << "on_close" << endl;
+    if (handle != NULL)
+    {
+        delete handle;
+    }
 }
 
 void NetHandler::onNewConnection(uv_stream_t* server, int status)
 {
+    LoopActivity activity("accept");
     //cerr << "NetHandler::onNewConnection " << status << endl;
     if (status < 0)
     {
@@ -170,7 +304,7 @@ void NetHandler::onNewConnection(uv_stream_t* server, int status)
         return;
     }
     //cout << "accept res " << res << endl;
-    string clientAddr = getRemoteAddress(client);
+    EndpointId clientAddr = getRemoteEndpoint(client, true);
     //cout << "clientAddr " << clientAddr << endl;
     //{
     //    uv_os_fd_t fd;
@@ -178,65 +312,83 @@ void NetHandler::onNewConnection(uv_stream_t* server, int status)
     //    cout << "Accepted connection " << fd << " from " << clientAddr << endl;
     //}
     assert(myApp != nullptr);
-    shared_ptr<NetClientIn> cliin = make_shared<NetClientIn>((ServerApp*)myApp, client, clientAddr);
-    shared_ptr<NetClientBase> cli = dynamic_pointer_cast<NetClientBase>(cliin);
+    shared_ptr<NetClientBase> cli = make_shared<NetClientIn>((ServerApp*)myApp, client, clientAddr);
     //cli->setSelfPtr(cli);
+    Trace::instant("accepted", "conn", "conn", cli->getConnId());
     myApp->inConnectionReceived(cli);
     int error = cli->doRead();
 }
 
-string NetHandler::getRemoteAddress(const uv_tcp_t* socket_in)
+void NetHandler::onBackendConnection(int fd_in, EndpointId peer_in)
 {
-    string host;
-    int port;
-    getRemoteAddressHostPort(socket_in, host, port);
-    string addr = host + ":" + to_string(port);
-    return addr;
+    LoopActivity activity("accept");
+    assert(myApp != nullptr);
+    shared_ptr<NetClientBase> cli = make_shared<NetClientIn>((ServerApp*)myApp, myIoBackend, fd_in, peer_in);
+    Trace::instant("accepted", "conn", "conn", cli->getConnId());
+    myApp->inConnectionReceived(cli);
+    // if reading cannot start, doRead logs it and closes the connection
+    cli->doRead();
 }
 
-void NetHandler::getRemoteAddressHostPort(const uv_tcp_t* socket_in, string & host_out, int & port_out)
+void NetHandler::onBackendConnection(int fd_in)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    if (::getpeername(fd_in, (struct sockaddr*)&addr, &addrlen) != 0)
+    {
+        addr.ss_family = AF_UNSPEC;
+    }
+    onBackendConnection(fd_in, EndpointTable::acquire((struct sockaddr*)&addr));
+}
+
+EndpointId NetHandler::getRemoteEndpoint(const uv_tcp_t* socket_in, bool acquire_in)
 {
-    host_out = "?";
-    port_out = 0;
-    //uv_os_fd_t fd;
-    //uv_fileno((uv_handle_t*)socket_in, &fd);
-    struct sockaddr sockaddr;
-    int addrlen = sizeof(sockaddr);
-    int res = ::uv_tcp_getpeername(socket_in, &sockaddr, &addrlen);
+    struct sockaddr_storage addr;
+    int addrlen = sizeof(addr);
+    int res = ::uv_tcp_getpeername(socket_in, (struct sockaddr*)&addr, &addrlen);
     if (res != 0)
     {
         cerr << "Error from uv_tcp_getpeername " << res << " " << ::uv_err_name(res) << endl;
-        return;
+        addr.ss_family = AF_UNSPEC;
     }
-    if (sockaddr.sa_family == AF_INET)
+    return acquire_in ? EndpointTable::acquire((struct sockaddr*)&addr) : EndpointTable::intern((struct sockaddr*)&addr);
+}
+
+void NetHandler::getRemoteAddressHostPort(const uv_tcp_t* socket_in, string & host_out, int & port_out)
+{
+    EndpointId remote = getRemoteEndpoint(socket_in);
+    host_out = EndpointTable::getHost(remote);
+    port_out = EndpointTable::getPort(remote);
+}
+
+int NetHandler::broadcastMessage(BaseMessage const & msg_in, vector<NetClientBase*> const & clients_in)
+{
+    if (clients_in.empty())
     {
-        char remoteIp[256];
-        //sockaddr.sin_addr.s_addr = ::ntohl(sockaddr.sin_addr.s_addr);
-        if (::uv_inet_ntop(AF_INET, &(((struct sockaddr_in*)&sockaddr)->sin_addr), remoteIp, 256))
-        {
-            return;
-        }
-        host_out = remoteIp;
-        port_out = ((struct sockaddr_in*)&sockaddr)->sin_port;
-        return;
+        return 0;
     }
-    if (sockaddr.sa_family == AF_INET6)
+    SharedBuffer buf = NetClientBase::serializeMessage(msg_in);
+    int cnt = 0;
+    for (auto i = clients_in.begin(); i != clients_in.end(); ++i)
     {
-        char remoteIp[256];
-        if (::uv_inet_ntop(AF_INET6, &(((struct sockaddr_in6*)&sockaddr)->sin6_addr), remoteIp, 256))
+        if (*i != nullptr && (*i)->isConnected())
         {
-            return;
+            if ((*i)->sendBuffer(buf, msg_in.getClass()) == 0)
+            {
+                ++cnt;
+            }
         }
-        host_out = remoteIp;
-        port_out = ((struct sockaddr_in6*)&sockaddr)->sin6_port;
-        return;
     }
-    return;
+    return cnt;
 }
 
 int NetHandler::doBindAndListen(int port_in)
 {
     cerr << "doBindAndListen trying port " << port_in << endl;
+    if (myIoBackend != nullptr)
+    {
+        return myIoBackend->listen(port_in, this);
+    }
     uv_loop_t* loop = getUvLoop();
     uv_tcp_t* server = new uv_tcp_t();
     ::uv_tcp_init(loop, server);
@@ -250,8 +402,8 @@ int NetHandler::doBindAndListen(int port_in)
         cerr << "Bind error " << ::uv_strerror(res) << endl;
         return res;
     }
-    server->data = (void*)dynamic_cast<IUvSocket*>(this);
-    res = ::uv_listen((uv_stream_t*)server, 10, NetHandler::on_new_connection);
+    server->data = (void*)static_cast<IUvSocket*>(this);
+    res = ::uv_listen((uv_stream_t*)server, 10, UvCallbacks<NetHandler>::on_new_connection);
     if (res)
     {
         cerr << "Listen error " << ::uv_strerror(res) << endl;
@@ -285,12 +437,53 @@ int NetHandler::doListen(int port_in, int tryNextPorts_in)
 void NetHandler::on_walk(uv_handle_t* handle, void* arg)
 {
     //cout << "on_walk" << endl;
+    if (::uv_is_closing(handle))
+    {
+        // closed by its owner (connection, timer), deleted in its own callback
+        return;
+    }
     ::uv_close(handle, NetHandler::on_close);
 }
 
+void NetHandler::setLoopPlacement(vector<int> const & cpus_in, string const & threadName_in)
+{
+    myLoopCpus = cpus_in;
+    myLoopThreadName = threadName_in;
+}
+
+void NetHandler::setLoopMonitor(LoopMonitorParams const & params_in)
+{
+    if (myLoopMonitor == nullptr)
+    {
+        myLoopMonitor = new LoopMonitor(params_in);
+    }
+}
+
+void NetHandler::placeLoopThread()
+{
+    int idx = ourLoopThreadCount++;
+    if (!myLoopCpus.empty())
+    {
+        ThreadPlacement::pinCurrentThread(vector<int>(1, myLoopCpus[idx % myLoopCpus.size()]));
+    }
+    string name = myLoopThreadName.length() > 0 ? myLoopThreadName : "uv-loop-" + to_string(idx);
+    ThreadPlacement::setCurrentThreadName(name);
+    ThreadPlacement::registerCurrentThread(name);
+    LoopMonitor::setCurrent(myLoopMonitor);
+}
+
 int NetHandler::doBgThread()
 {
     //cerr << "UV LOOPLOOP starting" << endl;
+    placeLoopThread();
+    if (myOwnLoop != nullptr)
+    {
+        // a private loop is closed at the end of the run, it is not restarted
+        ourThreadLoop = myOwnLoop;
+        runLoop();
+        ThreadPlacement::unregisterCurrentThread();
+        return 0;
+    }
     // Note: this second loop is not really necessary
     while (!myBgThreadStop)
     {
@@ -299,7 +492,7 @@ int NetHandler::doBgThread()
         //cout << "Sleeping..." << endl;
         std::this_thread::sleep_for(1s);
     }
-    
+    ThreadPlacement::unregisterCurrentThread();
     //cerr << "UV LOOPLOOP closed" << endl;
     return 0;
 }
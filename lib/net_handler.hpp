@@ -1,19 +1,31 @@
 #pragma once
 
+#include "endpoint_table.hpp"
 #include "uv_socket.hpp"
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 namespace sample
 {
     class BaseApp; // forward
+    class BaseMessage; // forward
+    class IoBackend; // forward
+    class LoopMonitor; // forward
+    struct LoopMonitorParams; // forward
+    class NetClientBase; // forward
+    class SimNetwork; // forward
 
     class NetHandler: public IUvSocket
     {
     public:
         NetHandler(BaseApp* app_in);
+        /// The loop of the current thread: the loop of the handler running on it, or the process-wide loop
         static uv_loop_t* getUvLoop();
         static void deleteUvLoop();
         static int runLoop();
@@ -21,27 +33,81 @@ namespace sample
         // return actual listen port
         int startWithListen(int port_in, int tryNextPorts_in);
         int stop();
-        void onNewConnection(uv_stream_t* server, int status);
-        /// Obtain the remote endpoint (host:port) of a connected socket
-        static std::string getRemoteAddress(const uv_tcp_t* socket_in);
+        /// Run on a private loop, instead of the process-wide one, so several handlers (nodes) can live in one process.  Set before start.
+        void useOwnLoop();
+        /// The loop this handler runs on
+        uv_loop_t* getLoop() const { return myOwnLoop != nullptr ? myOwnLoop : getUvLoop(); }
+        /// Pin the loop thread to one of these CPUs (round-robin over the loop threads of the process; not pinned if empty),
+        /// and name it (uv-loop-n by default).  Set before start.
+        void setLoopPlacement(std::vector<int> const & cpus_in, std::string const & threadName_in);
+        /// Monitor the health of the loop (iteration durations, lag, stalls), see LoopMonitor.  Set before start.
+        void setLoopMonitor(LoopMonitorParams const & params_in);
+        LoopMonitor* getLoopMonitor() const { return myLoopMonitor; }
+        /// Execute a function on the loop thread, soon.  Can be called from any thread.
+        void post(std::function<void()> fn_in);
+        void onNewConnection(uv_stream_t* server, int status) final;
+        /// Use an I/O backend for listening and incoming connections, instead of libuv.  Set before start.
+        void setIoBackend(IoBackend* backend_in) { myIoBackend = backend_in; }
+        IoBackend* getIoBackend() const { return myIoBackend; }
+        /// Run in a simulation, on its thread, with its clock: no loop thread is started, posted functions are simulation events,
+        /// sockets are those of the backend (a SimBackend of the network).  Set before start.
+        void setSimulation(SimNetwork* sim_in, IoBackend* backend_in);
+        bool isSimulated() const { return mySimulation != nullptr; }
+        /// New connection accepted by the I/O backend; peer_in is acquired (see EndpointTable::acquire), the connection releases it
+        void onBackendConnection(int fd_in);
+        void onBackendConnection(int fd_in, EndpointId peer_in);
+        /// Obtain the remote endpoint of a connected socket; acquired (see EndpointTable::acquire) for an incoming connection
+        static EndpointId getRemoteEndpoint(const uv_tcp_t* socket_in, bool acquire_in = false);
         static void getRemoteAddressHostPort(const uv_tcp_t* socket_in, std::string & host_out, int & port_out);
+        /// Send the same message to several connections; it is serialized only once, and the buffer is shared.
+        /// Return the number of connections it was sent to.
+        static int broadcastMessage(BaseMessage const & msg_in, std::vector<NetClientBase*> const & clients_in);
 
     private:
+        /// Makes the private loop of a handler the current one of this thread, while in scope
+        class LoopScope
+        {
+        public:
+            LoopScope(uv_loop_t* loop_in);
+            ~LoopScope();
+        private:
+            uv_loop_t* myPrevLoop;
+        };
+
         int startUvLoop();
         int stopUvLoop();
         int doBindAndListen(int port_in);
         // return actual listen port
         int doListen(int port_in, int tryNextPorts_in);
         int doBgThread();
-        static void on_new_connection(uv_stream_t* server, int status);
+        /// Pin, name and register the loop thread, on it
+        void placeLoopThread();
+        static void on_async(uv_async_t* handle);
+        void onAsync();
+        static void on_prepare(uv_prepare_t* handle);
         static void on_close(uv_handle_t* handle);
         static void on_walk(uv_handle_t* handle, void* arg);
 
     private:
         static uv_loop_t* myUvLoop;
+        // private loop of the handler running on this thread, if any
+        static thread_local uv_loop_t* ourThreadLoop;
+        // loop threads started, for round-robin placement
+        static std::atomic<int> ourLoopThreadCount;
         BaseApp* myApp;
+        IoBackend* myIoBackend;
         uv_async_t* myUvAsync;
+        uv_prepare_t* myUvPrepare;
+        // start of the current loop iteration, for the trace
+        uint64_t myLastPrepareNs;
         std::thread myBgThread;
         bool myBgThreadStop;
+        std::mutex myPostedMutex;
+        std::vector<std::function<void()>> myPosted;
+        uv_loop_t* myOwnLoop;
+        SimNetwork* mySimulation;
+        std::vector<int> myLoopCpus;
+        std::string myLoopThreadName;
+        LoopMonitor* myLoopMonitor;
     };
 }
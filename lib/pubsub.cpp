@@ -0,0 +1,276 @@
+#include "pubsub.hpp"
+
+#include "message.hpp"
+#include "net_client.hpp"
+
+#include <algorithm>
+
+using namespace sample;
+using namespace std;
+
+
+SeenCache::SeenCache(uint32_t windowMs_in, size_t capacity_in) :
+myWindowMs(windowMs_in),
+myCapacity(std::max(capacity_in, (size_t)1))
+{
+}
+
+bool SeenCache::add(uint64_t id_in, uint64_t nowMs_in)
+{
+    expire(nowMs_in);
+    if (!myIds.insert(id_in).second)
+    {
+        return false;
+    }
+    myOrder.push_back(make_pair(nowMs_in, id_in));
+    if (myOrder.size() > myCapacity)
+    {
+        myIds.erase(myOrder.front().second);
+        myOrder.pop_front();
+    }
+    return true;
+}
+
+void SeenCache::expire(uint64_t nowMs_in)
+{
+    while (!myOrder.empty() && myOrder.front().first + myWindowMs < nowMs_in)
+    {
+        myIds.erase(myOrder.front().second);
+        myOrder.pop_front();
+    }
+}
+
+
+PubSubRouter::PubSubRouter(uint32_t nodeId_in, SendFunction send_in, DeliverFunction deliver_in, uint32_t seenWindowMs_in, size_t seenCapacity_in) :
+myNodeId(nodeId_in),
+myNextSeq(1),
+mySend(send_in),
+myDeliver(deliver_in),
+mySeen(seenWindowMs_in, seenCapacity_in)
+{
+}
+
+void PubSubRouter::subscribe(string const & topic_in)
+{
+    if (!mySubscriptions.insert(topic_in).second)
+    {
+        return;
+    }
+    updateInterest(topic_in);
+}
+
+void PubSubRouter::unsubscribe(string const & topic_in)
+{
+    if (mySubscriptions.erase(topic_in) == 0)
+    {
+        return;
+    }
+    updateInterest(topic_in);
+}
+
+void PubSubRouter::sendSubscription(LinkId link_in, string const & topic_in, bool subscribe_in, int hops_in)
+{
+    SubscribeMessage msg(topic_in, subscribe_in, hops_in);
+    mySend(link_in, NetClientBase::serializeMessage(msg));
+}
+
+int PubSubRouter::getInterestHops(string const & topic_in, LinkId except_in) const
+{
+    if (isSubscribed(topic_in))
+    {
+        return 0;
+    }
+    int hops = -1;
+    auto topicLinks = myTopicLinks.find(topic_in);
+    if (topicLinks == myTopicLinks.end())
+    {
+        return hops;
+    }
+    for (auto i = topicLinks->second.begin(); i != topicLinks->second.end(); ++i)
+    {
+        if (*i == except_in)
+        {
+            continue;
+        }
+        int linkHops = myLinks.find(*i)->second.myInterest.find(topic_in)->second + 1;
+        if (hops < 0 || linkHops < hops)
+        {
+            hops = linkHops;
+        }
+    }
+    // a neighbor would be one hop farther, out of the reach of a message
+    return hops + 1 < DefaultTtl ? hops : -1;
+}
+
+void PubSubRouter::updateInterest(string const & topic_in)
+{
+    for (auto i = myLinks.begin(); i != myLinks.end(); ++i)
+    {
+        int hops = getInterestHops(topic_in, i->first);
+        auto advertised = i->second.myAdvertised.find(topic_in);
+        int current = advertised == i->second.myAdvertised.end() ? -1 : advertised->second;
+        if (hops == current)
+        {
+            continue;
+        }
+        if (hops < 0)
+        {
+            i->second.myAdvertised.erase(advertised);
+            sendSubscription(i->first, topic_in, false, 0);
+        }
+        else
+        {
+            i->second.myAdvertised[topic_in] = hops;
+            sendSubscription(i->first, topic_in, true, hops);
+        }
+    }
+}
+
+uint64_t PubSubRouter::publish(string const & topic_in, string const & payload_in, uint64_t nowMs_in)
+{
+    uint64_t msgId = ((uint64_t)myNodeId << 32) | myNextSeq++;
+    PublishMessage msg(msgId, topic_in, DefaultTtl, payload_in);
+    mySeen.add(msgId, nowMs_in);
+    ++myStats.published;
+    if (isSubscribed(topic_in))
+    {
+        ++myStats.delivered;
+        myDeliver(msg);
+    }
+    forward(msg, 0, false);
+    return msgId;
+}
+
+void PubSubRouter::linkAdded(LinkId link_in)
+{
+    if (myLinks.find(link_in) != myLinks.end())
+    {
+        return;
+    }
+    myLinks[link_in] = Link();
+    // all topics we may be interested in; only the new link gets anything
+    set<string> topics(mySubscriptions);
+    for (auto i = myTopicLinks.begin(); i != myTopicLinks.end(); ++i)
+    {
+        topics.insert(i->first);
+    }
+    for (auto i = topics.begin(); i != topics.end(); ++i)
+    {
+        updateInterest(*i);
+    }
+}
+
+void PubSubRouter::linkRemoved(LinkId link_in)
+{
+    auto link = myLinks.find(link_in);
+    if (link == myLinks.end())
+    {
+        return;
+    }
+    vector<string> topics;
+    for (auto t = link->second.myInterest.begin(); t != link->second.myInterest.end(); ++t)
+    {
+        vector<LinkId> & links = myTopicLinks[t->first];
+        links.erase(std::remove(links.begin(), links.end(), link_in), links.end());
+        if (links.empty())
+        {
+            myTopicLinks.erase(t->first);
+        }
+        topics.push_back(t->first);
+    }
+    myLinks.erase(link);
+    // interest learned over the link is gone, or farther now
+    for (auto i = topics.begin(); i != topics.end(); ++i)
+    {
+        updateInterest(*i);
+    }
+}
+
+void PubSubRouter::onSubscribe(LinkId link_in, SubscribeMessage const & msg_in)
+{
+    auto link = myLinks.find(link_in);
+    if (link == myLinks.end())
+    {
+        // not (yet) a pub/sub link
+        return;
+    }
+    string const & topic = msg_in.getTopic();
+    if (msg_in.isSubscribe())
+    {
+        auto interest = link->second.myInterest.find(topic);
+        if (interest == link->second.myInterest.end())
+        {
+            link->second.myInterest[topic] = std::max(msg_in.getHops(), 0);
+            myTopicLinks[topic].push_back(link_in);
+        }
+        else if (interest->second != msg_in.getHops())
+        {
+            interest->second = std::max(msg_in.getHops(), 0);
+        }
+        else
+        {
+            return;
+        }
+    }
+    else if (link->second.myInterest.erase(topic) > 0)
+    {
+        vector<LinkId> & links = myTopicLinks[topic];
+        links.erase(std::remove(links.begin(), links.end(), link_in), links.end());
+        if (links.empty())
+        {
+            myTopicLinks.erase(topic);
+        }
+    }
+    else
+    {
+        return;
+    }
+    updateInterest(topic);
+}
+
+void PubSubRouter::onPublish(LinkId link_in, PublishMessage const & msg_in, uint64_t nowMs_in)
+{
+    ++myStats.received;
+    if (!mySeen.add(msg_in.getMsgId(), nowMs_in))
+    {
+        ++myStats.duplicates;
+        return;
+    }
+    if (isSubscribed(msg_in.getTopic()))
+    {
+        ++myStats.delivered;
+        myDeliver(msg_in);
+    }
+    if (msg_in.getTtl() <= 1)
+    {
+        ++myStats.ttlExpired;
+        return;
+    }
+    PublishMessage fwd(msg_in.getMsgId(), msg_in.getTopic(), msg_in.getTtl() - 1, msg_in.getPayload());
+    forward(fwd, link_in, true);
+}
+
+void PubSubRouter::forward(PublishMessage const & msg_in, LinkId except_in, bool hasExcept_in)
+{
+    auto topicLinks = myTopicLinks.find(msg_in.getTopic());
+    if (topicLinks == myTopicLinks.end())
+    {
+        return;
+    }
+    SharedBuffer buf;
+    for (auto i = topicLinks->second.begin(); i != topicLinks->second.end(); ++i)
+    {
+        if (hasExcept_in && *i == except_in)
+        {
+            continue;
+        }
+        if (buf == nullptr)
+        {
+            // serialized only if there is a link to send to, once for all of them
+            buf = NetClientBase::serializeMessage(msg_in);
+            ++myStats.serialized;
+        }
+        mySend(*i, buf);
+        ++myStats.forwarded;
+    }
+}
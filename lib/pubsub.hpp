@@ -0,0 +1,133 @@
+#pragma once
+
+#include "uv_socket.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace sample
+{
+    class PublishMessage; // forward
+    class SubscribeMessage; // forward
+
+    /**
+     * Recently seen message IDs, for duplicate suppression.  Bounded: entries expire after a time window,
+     * and above the capacity the oldest ones are dropped.
+     */
+    class SeenCache
+    {
+    public:
+        SeenCache(uint32_t windowMs_in, size_t capacity_in);
+        /// Add an ID; returns false if it was seen already
+        bool add(uint64_t id_in, uint64_t nowMs_in);
+        bool contains(uint64_t id_in) const { return myIds.count(id_in) > 0; }
+        size_t size() const { return myIds.size(); }
+
+    private:
+        void expire(uint64_t nowMs_in);
+
+    private:
+        uint32_t myWindowMs;
+        size_t myCapacity;
+        std::unordered_set<uint64_t> myIds;
+        // (time, ID), oldest first
+        std::deque<std::pair<uint64_t, uint64_t>> myOrder;
+    };
+
+    struct PubSubStats
+    {
+    public:
+        PubSubStats() : published(0), received(0), delivered(0), duplicates(0), ttlExpired(0), serialized(0), forwarded(0) { }
+        /// Published locally
+        uint64_t published;
+        /// Received from links
+        uint64_t received;
+        /// Delivered to local subscriptions
+        uint64_t delivered;
+        uint64_t duplicates;
+        uint64_t ttlExpired;
+        /// Messages serialized for forwarding (once per message, shared by the links)
+        uint64_t serialized;
+        /// Buffers sent to links
+        uint64_t forwarded;
+    };
+
+    /**
+     * Topic publish/subscribe over the overlay links (floodsub style).
+     * Nodes advertise their interest in topics to their neighbors: their own subscriptions, and the interest
+     * advertised by their other neighbors (split horizon: never back to the link it came from), with the distance
+     * to the nearest subscriber.  Like a distance vector, interest farther than the TTL of a message is not advertised,
+     * which also ends the counting up of stale interest in a cycle after an unsubscription.
+     * A published message is forwarded only to neighbors interested in its topic, so it reaches the subscribers
+     * also over nodes not subscribed themselves.
+     * Duplicates (arriving over several paths) are dropped using a seen-message cache.
+     * Independent of the transport: links are identified by an ID, and serialized buffers are sent
+     * through a function (a connection, or in-memory in a simulation).
+     */
+    class PubSubRouter
+    {
+    public:
+        typedef uint32_t LinkId;
+        typedef std::function<void(LinkId link_in, SharedBuffer const & buf_in)> SendFunction;
+        typedef std::function<void(PublishMessage const & msg_in)> DeliverFunction;
+        static const int DefaultTtl = 16;
+        static const uint32_t DefaultSeenWindowMs = 120000;
+        static const size_t DefaultSeenCapacity = 65536;
+
+        /// Node ID is the upper half of the IDs of messages published here, should be unique in the network
+        PubSubRouter(uint32_t nodeId_in, SendFunction send_in, DeliverFunction deliver_in,
+            uint32_t seenWindowMs_in = DefaultSeenWindowMs, size_t seenCapacity_in = DefaultSeenCapacity);
+        /// Change the node ID, before publishing
+        void setNodeId(uint32_t nodeId_in) { myNodeId = nodeId_in; }
+        void subscribe(std::string const & topic_in);
+        void unsubscribe(std::string const & topic_in);
+        bool isSubscribed(std::string const & topic_in) const { return mySubscriptions.count(topic_in) > 0; }
+        /// Publish a message to the subscribers of the topic (delivered locally too, if subscribed); returns its ID
+        uint64_t publish(std::string const & topic_in, std::string const & payload_in, uint64_t nowMs_in);
+        /// A link is up: our interest is sent to it
+        void linkAdded(LinkId link_in);
+        void linkRemoved(LinkId link_in);
+        void onSubscribe(LinkId link_in, SubscribeMessage const & msg_in);
+        void onPublish(LinkId link_in, PublishMessage const & msg_in, uint64_t nowMs_in);
+        PubSubStats const & getStats() const { return myStats; }
+        size_t getLinkCount() const { return myLinks.size(); }
+        size_t getSeenCount() const { return mySeen.size(); }
+
+    private:
+        class Link
+        {
+        public:
+            // topics the link is interested in, with its distance to the nearest subscriber
+            std::map<std::string, int> myInterest;
+            // what we advertised to it
+            std::map<std::string, int> myAdvertised;
+        };
+
+        /// Send to the links interested in the topic (except one), serialized once
+        void forward(PublishMessage const & msg_in, LinkId except_in, bool hasExcept_in);
+        /// Our distance to the nearest subscriber of the topic, not counting the given link; -1 if none (within the TTL)
+        int getInterestHops(std::string const & topic_in, LinkId except_in) const;
+        /// Advertise the changes of our interest in the topic to the links
+        void updateInterest(std::string const & topic_in);
+        void sendSubscription(LinkId link_in, std::string const & topic_in, bool subscribe_in, int hops_in);
+
+    private:
+        uint32_t myNodeId;
+        uint32_t myNextSeq;
+        SendFunction mySend;
+        DeliverFunction myDeliver;
+        std::set<std::string> mySubscriptions;
+        std::map<LinkId, Link> myLinks;
+        // interested links by topic, for the fan-out
+        std::map<std::string, std::vector<LinkId>> myTopicLinks;
+        SeenCache mySeen;
+        PubSubStats myStats;
+    };
+}
@@ -0,0 +1,154 @@
+#include "rate_limit.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+using namespace sample;
+using namespace std;
+
+
+bool RateLimitParams::isEnabled() const
+{
+    if (total.isSet())
+    {
+        return true;
+    }
+    for (int i = 0; i < MessageClass::MessageClassCount; ++i)
+    {
+        if (perClass[i].isSet())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int RateLimitParams::setClassLimits(string const & list_in)
+{
+    stringstream ss(list_in);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        if (item.length() == 0)
+        {
+            continue;
+        }
+        size_t eq = item.find('=');
+        size_t slash = item.find('/');
+        MessageClass cls;
+        if (eq == string::npos || BaseMessage::parseClassName(item.substr(0, eq), cls) != 0)
+        {
+            return -1;
+        }
+        RateLimit limit;
+        limit.messagesPerSec = std::max(std::atof(item.substr(eq + 1, slash == string::npos ? string::npos : slash - eq - 1).c_str()), 0.0);
+        if (slash != string::npos)
+        {
+            limit.bytesPerSec = std::max(std::atof(item.substr(slash + 1).c_str()), 0.0);
+        }
+        perClass[cls] = limit;
+    }
+    return 0;
+}
+
+int RateLimitParams::setAction(string const & name_in)
+{
+    if (name_in == "delay") action = RateLimitAction::RateDelay;
+    else if (name_in == "drop") action = RateLimitAction::RateDrop;
+    else if (name_in == "close") action = RateLimitAction::RateClose;
+    else return -1;
+    return 0;
+}
+
+
+TokenBucket::TokenBucket() :
+myRatePerSec(0),
+mySize(0),
+myTokens(0),
+myLastMs(0)
+{
+}
+
+void TokenBucket::configure(double ratePerSec_in, uint32_t burstMs_in)
+{
+    myRatePerSec = ratePerSec_in;
+    // at least one message (or byte) fits
+    mySize = std::max(ratePerSec_in * burstMs_in / 1000.0, 1.0);
+    myTokens = mySize;
+    myLastMs = 0;
+}
+
+void TokenBucket::refill(uint64_t nowMs_in)
+{
+    if (myLastMs == 0 || nowMs_in < myLastMs)
+    {
+        myLastMs = nowMs_in;
+        return;
+    }
+    myTokens = std::min(mySize, myTokens + myRatePerSec * (nowMs_in - myLastMs) / 1000.0);
+    myLastMs = nowMs_in;
+}
+
+uint64_t TokenBucket::getWaitMs(double amount_in, uint64_t nowMs_in)
+{
+    if (!isLimited())
+    {
+        return 0;
+    }
+    refill(nowMs_in);
+    // larger than the bucket: passes when it is full
+    double needed = std::min(amount_in, mySize);
+    if (myTokens >= needed)
+    {
+        return 0;
+    }
+    return (uint64_t)std::ceil((needed - myTokens) * 1000.0 / myRatePerSec);
+}
+
+
+RateLimiter::RateLimiter() :
+myEnabled(false),
+myAction(RateLimitAction::RateDelay)
+{
+}
+
+void RateLimiter::configure(RateLimitParams const & params_in)
+{
+    myEnabled = params_in.isEnabled();
+    myAction = params_in.action;
+    myMessages[0].configure(params_in.total.messagesPerSec, params_in.burstMs);
+    myBytes[0].configure(params_in.total.bytesPerSec, params_in.burstMs);
+    for (int i = 0; i < MessageClass::MessageClassCount; ++i)
+    {
+        myMessages[1 + i].configure(params_in.perClass[i].messagesPerSec, params_in.burstMs);
+        myBytes[1 + i].configure(params_in.perClass[i].bytesPerSec, params_in.burstMs);
+    }
+}
+
+uint64_t RateLimiter::admit(MessageClass class_in, size_t bytes_in, uint64_t nowMs_in)
+{
+    if (!myEnabled)
+    {
+        return 0;
+    }
+    int buckets[2] = { 0, 1 + (int)class_in };
+    uint64_t waitMs = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        waitMs = std::max(waitMs, myMessages[buckets[i]].getWaitMs(1, nowMs_in));
+        waitMs = std::max(waitMs, myBytes[buckets[i]].getWaitMs((double)bytes_in, nowMs_in));
+    }
+    if (waitMs > 0)
+    {
+        return waitMs;
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        myMessages[buckets[i]].take(1);
+        myBytes[buckets[i]].take((double)bytes_in);
+    }
+    ++myStats.admitted;
+    return 0;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "message.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace sample
+{
+    /// Max. rates, 0 means no limit
+    struct RateLimit
+    {
+    public:
+        RateLimit() : messagesPerSec(0), bytesPerSec(0) { }
+        double messagesPerSec;
+        double bytesPerSec;
+        bool isSet() const { return messagesPerSec > 0 || bytesPerSec > 0; }
+    };
+
+    /// What to do with an incoming message over the limit
+    enum RateLimitAction
+    {
+        /// Keep it, stop reading until it fits the rate; the peer is slowed down by TCP flow control
+        RateDelay = 0,
+        /// Discard it
+        RateDrop = 1,
+        /// Close the connection
+        RateClose = 2
+    };
+
+    /**
+     * Limits of incoming messages, per connection: for all messages, and for each message class.
+     */
+    struct RateLimitParams
+    {
+    public:
+        RateLimitParams() : action(RateLimitAction::RateDelay), burstMs(1000) { }
+        RateLimit total;
+        RateLimit perClass[MessageClass::MessageClassCount];
+        RateLimitAction action;
+        /// Bucket sizes, as time at the rate: this much traffic may come at once, after a quiet period
+        uint32_t burstMs;
+        bool isEnabled() const;
+        /// Set class limits from a list such as "latency=100/0,bulk=1000/1000000" (messages/s and bytes/s); return 0 if valid
+        int setClassLimits(std::string const & list_in);
+        /// delay, drop or close; return 0 if valid
+        int setAction(std::string const & name_in);
+    };
+
+    /// Counters of a rate limiter
+    struct RateLimitStats
+    {
+    public:
+        RateLimitStats() : admitted(0), delayed(0), dropped(0) { }
+        uint64_t admitted;
+        uint64_t delayed;
+        uint64_t dropped;
+    };
+
+    /**
+     * Token bucket: refilled at the rate, up to its size; an amount passes if the bucket has it.
+     * An amount larger than the bucket passes when the bucket is full, and leaves it in debt.
+     */
+    class TokenBucket
+    {
+    public:
+        TokenBucket();
+        /// Rate 0: no limit
+        void configure(double ratePerSec_in, uint32_t burstMs_in);
+        bool isLimited() const { return myRatePerSec > 0; }
+        /// Time until the amount can pass, 0 if it can now (it is not taken)
+        uint64_t getWaitMs(double amount_in, uint64_t nowMs_in);
+        void take(double amount_in) { myTokens -= amount_in; }
+
+    private:
+        void refill(uint64_t nowMs_in);
+
+    private:
+        double myRatePerSec;
+        double mySize;
+        double myTokens;
+        uint64_t myLastMs;
+    };
+
+    /**
+     * Rate limits of the incoming messages of one connection: message and byte buckets, in total and per class.
+     * A message passes if all its buckets have room, then it is taken from all of them.
+     */
+    class RateLimiter
+    {
+    public:
+        RateLimiter();
+        void configure(RateLimitParams const & params_in);
+        bool isEnabled() const { return myEnabled; }
+        RateLimitAction getAction() const { return myAction; }
+        /// Admit a message: return 0 if it passes (it is counted), or the time until it would pass
+        uint64_t admit(MessageClass class_in, size_t bytes_in, uint64_t nowMs_in);
+        void countDelayed() { ++myStats.delayed; }
+        void countDropped() { ++myStats.dropped; }
+        RateLimitStats const & getStats() const { return myStats; }
+
+    private:
+        bool myEnabled;
+        RateLimitAction myAction;
+        // messages and bytes: in total, then per class
+        TokenBucket myMessages[1 + MessageClass::MessageClassCount];
+        TokenBucket myBytes[1 + MessageClass::MessageClassCount];
+        RateLimitStats myStats;
+    };
+}
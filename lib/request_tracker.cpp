@@ -0,0 +1,131 @@
+#include "request_tracker.hpp"
+
+#include "message.hpp"
+
+#include <uv.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace sample;
+using namespace std;
+
+
+RequestTracker::RequestTracker() :
+myNextId(1)
+{
+}
+
+uint32_t RequestTracker::add(ResponseCallback callback_in, RequestPolicy const & policy_in, uint64_t now_in)
+{
+    uint32_t id = myNextId++;
+    if (myNextId == 0)
+    {
+        // skip 0 on wraparound, it means 'no request ID'
+        myNextId = 1;
+    }
+    PendingRequest & req = myPending[id];
+    req.myCallback = callback_in;
+    req.myPolicy = policy_in;
+    req.mySentNs = ::uv_hrtime();
+    req.myAttempts = 1;
+    req.myBackingOff = false;
+    req.myDeadline = myDeadlines.insert(make_pair(now_in + (uint64_t)std::max(policy_in.timeoutMs, 0), id));
+    return id;
+}
+
+void RequestTracker::setResend(uint32_t requestId_in, function<void()> resend_in)
+{
+    auto i = myPending.find(requestId_in);
+    if (i != myPending.end())
+    {
+        i->second.myResend = resend_in;
+    }
+}
+
+ResponseCallback RequestTracker::remove(map<uint32_t, PendingRequest>::iterator request_in)
+{
+    ResponseCallback callback = request_in->second.myCallback;
+    myDeadlines.erase(request_in->second.myDeadline);
+    myPending.erase(request_in);
+    return callback;
+}
+
+bool RequestTracker::complete(BaseMessage const & response_in, uint64_t & latencyUs_out)
+{
+    auto i = myPending.find(response_in.getRequestId());
+    if (i == myPending.end())
+    {
+        return false;
+    }
+    latencyUs_out = (::uv_hrtime() - i->second.mySentNs) / 1000;
+    // remove before invoking, callback may issue new requests
+    ResponseCallback callback = remove(i);
+    if (callback)
+    {
+        callback(0, &response_in);
+    }
+    return true;
+}
+
+int RequestTracker::expire(uint64_t now_in, int & retried_out)
+{
+    retried_out = 0;
+    vector<ResponseCallback> expired;
+    vector<function<void()>> resends;
+    while (!myDeadlines.empty() && myDeadlines.begin()->first <= now_in)
+    {
+        uint32_t id = myDeadlines.begin()->second;
+        myDeadlines.erase(myDeadlines.begin());
+        PendingRequest & req = myPending[id];
+        if (req.myBackingOff)
+        {
+            // backoff is over, send again
+            req.myBackingOff = false;
+            ++req.myAttempts;
+            req.myDeadline = myDeadlines.insert(make_pair(now_in + (uint64_t)std::max(req.myPolicy.timeoutMs, 0), id));
+            resends.push_back(req.myResend);
+            continue;
+        }
+        if (req.myResend && req.myAttempts <= req.myPolicy.retries)
+        {
+            ++retried_out;
+            int shift = std::min(req.myAttempts - 1, 20);
+            uint64_t backoff = std::min((uint64_t)std::max(req.myPolicy.backoffMs, 0) << shift, (uint64_t)std::max(req.myPolicy.maxBackoffMs, 0));
+            req.myBackingOff = true;
+            // without backoff it is due right away, sent again below
+            req.myDeadline = myDeadlines.insert(make_pair(now_in + backoff, id));
+            continue;
+        }
+        expired.push_back(req.myCallback);
+        myPending.erase(id);
+    }
+    // after the bookkeeping: these may send, complete or cancel requests
+    for (auto i = resends.begin(); i != resends.end(); ++i)
+    {
+        (*i)();
+    }
+    for (auto i = expired.begin(); i != expired.end(); ++i)
+    {
+        if (*i)
+        {
+            (*i)(UV_ETIMEDOUT, nullptr);
+        }
+    }
+    return (int)expired.size();
+}
+
+int RequestTracker::cancelAll(int status_in)
+{
+    map<uint32_t, PendingRequest> pending;
+    pending.swap(myPending);
+    myDeadlines.clear();
+    for (auto i = pending.begin(); i != pending.end(); ++i)
+    {
+        if (i->second.myCallback)
+        {
+            i->second.myCallback(status_in, nullptr);
+        }
+    }
+    return (int)pending.size();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+
+namespace sample
+{
+    class BaseMessage; // forward
+
+    /// Completion callback of a request.  Status is 0 if the response has arrived,
+    /// or UV_ETIMEDOUT / UV_ECANCELED (in that case response is nullptr).
+    typedef std::function<void(int status_in, BaseMessage const * response_in)> ResponseCallback;
+
+    /**
+     * Deadline and retries of a request.  A retry sends the same message again, with the same request ID
+     * (a late response to an earlier attempt completes it), so retries are only for idempotent requests (Ping, Handshake).
+     */
+    struct RequestPolicy
+    {
+    public:
+        RequestPolicy() : timeoutMs(10000), retries(0), backoffMs(100), maxBackoffMs(2000) { }
+        RequestPolicy(int timeoutMs_in, int retries_in = 0) : timeoutMs(timeoutMs_in), retries(retries_in), backoffMs(100), maxBackoffMs(2000) { }
+
+    public:
+        /// Deadline of each attempt, from its sending
+        int timeoutMs;
+        /// Attempts after the first one, when the previous one has timed out
+        int retries;
+        /// Wait before the first retry, doubled for each next one, up to maxBackoffMs
+        int backoffMs;
+        int maxBackoffMs;
+    };
+
+    /**
+     * Keeps track of the outstanding requests of a connection, matches responses by request ID.
+     * Deadlines are kept in order, so the owner needs one timer, set to the next deadline (see getNextDeadline),
+     * and expiring looks only at the requests due.
+     */
+    class RequestTracker
+    {
+    public:
+        RequestTracker();
+        /// Register a new request sent now, return its request ID (nonzero)
+        uint32_t add(ResponseCallback callback_in, RequestPolicy const & policy_in, uint64_t now_in);
+        /// Set how to send the request again, for retries; without it the request is not retried
+        void setResend(uint32_t requestId_in, std::function<void()> resend_in);
+        /// Complete the request with the ID of the response, if pending.  Return true if it was pending, with the time since the first attempt.
+        bool complete(BaseMessage const & response_in, uint64_t & latencyUs_out);
+        /// Handle the requests with deadline passed: send them again if they have retries left (after the backoff),
+        /// otherwise time them out.  Return the number of timed out ones; retried_out: the number of attempts timed out and retried.
+        int expire(uint64_t now_in, int & retried_out);
+        /// Complete all pending requests with the given error status, return their number
+        int cancelAll(int status_in);
+        /// The earliest deadline (or end of a backoff), 0 if there are no requests
+        uint64_t getNextDeadline() const { return myDeadlines.empty() ? 0 : myDeadlines.begin()->first; }
+        bool empty() const { return myPending.empty(); }
+        size_t size() const { return myPending.size(); }
+
+    private:
+        typedef std::multimap<uint64_t, uint32_t> Deadlines;
+
+        class PendingRequest
+        {
+        public:
+            ResponseCallback myCallback;
+            std::function<void()> myResend;
+            RequestPolicy myPolicy;
+            // first attempt, uv_hrtime
+            uint64_t mySentNs;
+            int myAttempts;
+            // waiting before sending again; the deadline is the end of the backoff
+            bool myBackingOff;
+            Deadlines::iterator myDeadline;
+        };
+
+        /// Remove the request, return its callback
+        ResponseCallback remove(std::map<uint32_t, PendingRequest>::iterator request_in);
+
+    private:
+        uint32_t myNextId;
+        std::map<uint32_t, PendingRequest> myPending;
+        // deadline -> request ID, earliest first
+        Deadlines myDeadlines;
+    };
+}
@@ -0,0 +1,423 @@
+#include "sim_network.hpp"
+
+#include "net_client.hpp"
+#include "net_handler.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace sample;
+using namespace std;
+
+
+thread_local SimNetwork* SimNetwork::ourCurrent = nullptr;
+
+SimNetwork::SimNetwork(uint32_t seed_in) :
+myPrevCurrent(ourCurrent),
+myNowUs(0),
+myNextSeq(0),
+myRandom(seed_in),
+myNextFd(1),
+myNextEphemeralPort(32768)
+{
+    ourCurrent = this;
+}
+
+SimNetwork::~SimNetwork()
+{
+    ourCurrent = myPrevCurrent;
+}
+
+SimNetwork* SimNetwork::getCurrent()
+{
+    return ourCurrent;
+}
+
+void SimNetwork::schedule(uint64_t delayUs_in, Event event_in)
+{
+    QueuedEvent ev;
+    ev.myTimeUs = myNowUs + delayUs_in;
+    ev.mySeq = myNextSeq++;
+    ev.myEvent = std::move(event_in);
+    myEvents.push_back(std::move(ev));
+    std::push_heap(myEvents.begin(), myEvents.end(), std::greater<QueuedEvent>());
+}
+
+size_t SimNetwork::runUntil(uint64_t timeMs_in)
+{
+    uint64_t limitUs = timeMs_in * 1000;
+    size_t count = 0;
+    while (!myEvents.empty() && myEvents.front().myTimeUs <= limitUs)
+    {
+        std::pop_heap(myEvents.begin(), myEvents.end(), std::greater<QueuedEvent>());
+        QueuedEvent ev = std::move(myEvents.back());
+        myEvents.pop_back();
+        myNowUs = std::max(myNowUs, ev.myTimeUs);
+        ev.myEvent();
+        ++count;
+    }
+    myNowUs = std::max(myNowUs, limitUs);
+    myStats.events += count;
+    return count;
+}
+
+void SimNetwork::setLinkParams(string const & hostA_in, string const & hostB_in, SimLinkParams const & params_in)
+{
+    myLinks[make_pair(std::min(hostA_in, hostB_in), std::max(hostA_in, hostB_in))] = params_in;
+}
+
+SimLinkParams const & SimNetwork::getLinkParams(string const & hostA_in, string const & hostB_in) const
+{
+    if (myLinks.empty())
+    {
+        return myDefaultLink;
+    }
+    auto link = myLinks.find(make_pair(std::min(hostA_in, hostB_in), std::max(hostA_in, hostB_in)));
+    return link != myLinks.end() ? link->second : myDefaultLink;
+}
+
+uint64_t SimNetwork::getDelayUs(SimLinkParams const & link_in)
+{
+    uint64_t delay = (uint64_t)link_in.latencyMs * 1000;
+    if (link_in.jitterMs > 0)
+    {
+        delay += myRandom() % ((uint64_t)link_in.jitterMs * 1000 + 1);
+    }
+    return delay;
+}
+
+SimNetwork::SimSocket* SimNetwork::findSocket(int fd_in)
+{
+    auto socket = mySockets.find(fd_in);
+    return socket != mySockets.end() ? &socket->second : nullptr;
+}
+
+int SimNetwork::newSocket(string const & localHost_in, string const & peerHost_in)
+{
+    int fd = myNextFd++;
+    SimSocket & socket = mySockets[fd];
+    socket.myClient = nullptr;
+    socket.myLocalHost = localHost_in;
+    socket.myPeerHost = peerHost_in;
+    socket.myPeerFd = -1;
+    socket.myReading = false;
+    socket.myClosed = false;
+    socket.myPendingEof = false;
+    socket.mySendFreeUs = 0;
+    socket.myLastArrivalUs = 0;
+    return fd;
+}
+
+int SimNetwork::listen(string const & host_in, int port_in, NetHandler* handler_in)
+{
+    string endpoint = host_in + ":" + to_string(port_in);
+    if (myListeners.find(endpoint) != myListeners.end())
+    {
+        return UV_EADDRINUSE;
+    }
+    myListeners[endpoint] = handler_in;
+    return 0;
+}
+
+int SimNetwork::connect(SimBackend* backend_in, NetClientBase* client_in, string const & host_in, int port_in)
+{
+    string host = (host_in == "localhost") ? "127.0.0.1" : host_in;
+    ++myStats.connects;
+    int fd = newSocket(backend_in->getHost(), host);
+    mySockets[fd].myClient = client_in;
+    string target = host + ":" + to_string(port_in);
+    schedule(getDelayUs(getLinkParams(backend_in->getHost(), host)), [this, fd, target]() { onSyn(fd, target); });
+    return fd;
+}
+
+void SimNetwork::onSyn(int fd_in, string const & target_in)
+{
+    SimSocket* socket = findSocket(fd_in);
+    if (socket == nullptr || socket->myClosed)
+    {
+        // given up meanwhile
+        return;
+    }
+    uint64_t backDelay = getDelayUs(getLinkParams(socket->myLocalHost, socket->myPeerHost));
+    auto listener = myListeners.find(target_in);
+    if (listener == myListeners.end())
+    {
+        ++myStats.refused;
+        schedule(backDelay, [this, fd_in]()
+        {
+            SimSocket* socket = findSocket(fd_in);
+            if (socket != nullptr && socket->myClient != nullptr && !socket->myClosed)
+            {
+                socket->myClient->onBackendConnected(UV_ECONNREFUSED, "");
+            }
+        });
+        return;
+    }
+    // accepted: the peer socket is handed to the listening node, it can send right away
+    int peerFd = newSocket(socket->myPeerHost, socket->myLocalHost);
+    socket->myPeerFd = peerFd;
+    mySockets[peerFd].myPeerFd = fd_in;
+    myNextEphemeralPort = myNextEphemeralPort >= 60999 ? 32768 : myNextEphemeralPort + 1;
+    listener->second->onBackendConnection(peerFd, EndpointTable::acquire(socket->myLocalHost, myNextEphemeralPort));
+    schedule(backDelay, [this, fd_in]()
+    {
+        SimSocket* socket = findSocket(fd_in);
+        if (socket != nullptr && socket->myClient != nullptr && !socket->myClosed)
+        {
+            socket->myClient->onBackendConnected(0, socket->myPeerHost);
+        }
+    });
+}
+
+void SimNetwork::attach(int fd_in, NetClientBase* client_in)
+{
+    SimSocket* socket = findSocket(fd_in);
+    if (socket != nullptr)
+    {
+        socket->myClient = client_in;
+    }
+}
+
+int SimNetwork::write(int fd_in, SharedBuffer const & buf_in)
+{
+    SimSocket* socket = findSocket(fd_in);
+    if (socket == nullptr || socket->myClosed)
+    {
+        return UV_EBADF;
+    }
+    if (socket->myPeerFd < 0)
+    {
+        return UV_EPIPE;
+    }
+    SimLinkParams const & link = getLinkParams(socket->myLocalHost, socket->myPeerHost);
+    size_t len = buf_in->size();
+    ++myStats.writes;
+    myStats.bytes += len;
+    uint64_t sendStart = std::max(myNowUs, socket->mySendFreeUs);
+    uint64_t sendUs = link.bandwidth > 0 ? (uint64_t)len * 1000000 / link.bandwidth : 0;
+    socket->mySendFreeUs = sendStart + sendUs;
+    uint64_t arrival = socket->mySendFreeUs + getDelayUs(link);
+    uint64_t retransmitUs = (uint64_t)link.retransmitMs * 1000;
+    while (link.lossRate > 0 && std::uniform_real_distribution<double>(0, 1)(myRandom) < link.lossRate)
+    {
+        ++myStats.retransmits;
+        arrival += retransmitUs;
+        retransmitUs *= 2;
+    }
+    // in order, a delayed write holds up the ones after it
+    arrival = std::max(arrival, socket->myLastArrivalUs);
+    socket->myLastArrivalUs = arrival;
+    int peerFd = socket->myPeerFd;
+    schedule(socket->mySendFreeUs - myNowUs, [this, fd_in, len]()
+    {
+        SimSocket* socket = findSocket(fd_in);
+        if (socket != nullptr && socket->myClient != nullptr)
+        {
+            socket->myClient->onWriteCompleted(len, socket->myClosed ? UV_ECANCELED : 0);
+        }
+    });
+    schedule(arrival - myNowUs, [this, peerFd, buf_in]() { deliver(peerFd, buf_in); });
+    return 0;
+}
+
+void SimNetwork::deliver(int fd_in, SharedBuffer const & buf_in)
+{
+    SimSocket* socket = findSocket(fd_in);
+    if (socket == nullptr || socket->myClosed)
+    {
+        return;
+    }
+    if (!socket->myReading || socket->myClient == nullptr || !socket->myPending.empty())
+    {
+        socket->myPending.push_back(buf_in);
+        return;
+    }
+    socket->myClient->onReadData((const char*)buf_in->data(), (ssize_t)buf_in->size());
+}
+
+void SimNetwork::deliverEof(int fd_in)
+{
+    SimSocket* socket = findSocket(fd_in);
+    if (socket == nullptr || socket->myClosed)
+    {
+        return;
+    }
+    socket->myPeerFd = -1;
+    if (!socket->myReading || socket->myClient == nullptr || !socket->myPending.empty())
+    {
+        socket->myPendingEof = true;
+        return;
+    }
+    socket->myClient->onReadData(nullptr, UV_EOF);
+}
+
+void SimNetwork::flushPending(int fd_in)
+{
+    while (true)
+    {
+        // looked up again each time, the client may close or stop reading
+        SimSocket* socket = findSocket(fd_in);
+        if (socket == nullptr || socket->myClosed || !socket->myReading || socket->myClient == nullptr)
+        {
+            return;
+        }
+        if (!socket->myPending.empty())
+        {
+            SharedBuffer buf = socket->myPending.front();
+            socket->myPending.pop_front();
+            socket->myClient->onReadData((const char*)buf->data(), (ssize_t)buf->size());
+            continue;
+        }
+        if (socket->myPendingEof)
+        {
+            socket->myPendingEof = false;
+            socket->myClient->onReadData(nullptr, UV_EOF);
+        }
+        return;
+    }
+}
+
+void SimNetwork::readStart(int fd_in)
+{
+    SimSocket* socket = findSocket(fd_in);
+    if (socket == nullptr || socket->myReading)
+    {
+        return;
+    }
+    socket->myReading = true;
+    if (!socket->myPending.empty() || socket->myPendingEof)
+    {
+        schedule(0, [this, fd_in]() { flushPending(fd_in); });
+    }
+}
+
+void SimNetwork::readStop(int fd_in)
+{
+    SimSocket* socket = findSocket(fd_in);
+    if (socket != nullptr)
+    {
+        socket->myReading = false;
+    }
+}
+
+void SimNetwork::closeToPeer(SimSocket & socket_in)
+{
+    if (socket_in.myPeerFd < 0)
+    {
+        return;
+    }
+    SimLinkParams const & link = getLinkParams(socket_in.myLocalHost, socket_in.myPeerHost);
+    uint64_t arrival = std::max(myNowUs + getDelayUs(link), socket_in.myLastArrivalUs);
+    int peerFd = socket_in.myPeerFd;
+    socket_in.myPeerFd = -1;
+    schedule(arrival - myNowUs, [this, peerFd]() { deliverEof(peerFd); });
+}
+
+void SimNetwork::close(int fd_in)
+{
+    SimSocket* socket = findSocket(fd_in);
+    if (socket == nullptr || socket->myClosed)
+    {
+        return;
+    }
+    ++myStats.closes;
+    socket->myClosed = true;
+    socket->myReading = false;
+    socket->myPending.clear();
+    closeToPeer(*socket);
+    // reported later, as uv_close
+    schedule(0, [this, fd_in]()
+    {
+        SimSocket* socket = findSocket(fd_in);
+        if (socket != nullptr && socket->myClient != nullptr)
+        {
+            socket->myClient->onBackendClosed();
+        }
+    });
+}
+
+void SimNetwork::detach(int fd_in)
+{
+    SimSocket* socket = findSocket(fd_in);
+    if (socket == nullptr)
+    {
+        return;
+    }
+    closeToPeer(*socket);
+    mySockets.erase(fd_in);
+}
+
+SimBackend::SimBackend(SimNetwork & network_in, string const & host_in) :
+myNetwork(network_in),
+myHost(host_in),
+myConnects(0),
+myWrites(0)
+{
+}
+
+int SimBackend::getFd(NetClientBase* client_in) const
+{
+    auto fd = myFds.find(client_in);
+    return fd != myFds.end() ? fd->second : -1;
+}
+
+int SimBackend::listen(int port_in, NetHandler* handler_in)
+{
+    return myNetwork.listen(myHost, port_in, handler_in);
+}
+
+int SimBackend::connect(NetClientBase* client_in, string const & host_in, int port_in)
+{
+    ++myConnects;
+    int fd = myNetwork.connect(this, client_in, host_in, port_in);
+    myFds[client_in] = fd;
+    return fd;
+}
+
+void SimBackend::attach(NetClientBase* client_in, int fd_in)
+{
+    myFds[client_in] = fd_in;
+    myNetwork.attach(fd_in, client_in);
+}
+
+int SimBackend::readStart(NetClientBase* client_in)
+{
+    myNetwork.readStart(getFd(client_in));
+    return 0;
+}
+
+int SimBackend::readStop(NetClientBase* client_in)
+{
+    myNetwork.readStop(getFd(client_in));
+    return 0;
+}
+
+int SimBackend::write(NetClientBase* client_in, SharedBuffer const & buf_in)
+{
+    ++myWrites;
+    return myNetwork.write(getFd(client_in), buf_in);
+}
+
+void SimBackend::close(NetClientBase* client_in)
+{
+    myNetwork.close(getFd(client_in));
+}
+
+void SimBackend::detach(NetClientBase* client_in)
+{
+    int fd = getFd(client_in);
+    if (fd < 0)
+    {
+        return;
+    }
+    myFds.erase(client_in);
+    myNetwork.detach(fd);
+}
+
+void SimBackend::printStats()
+{
+    SimNetworkStats const & stats = myNetwork.getStats();
+    cout << "  sim " << myHost << ": sockets " << myFds.size() << " connects " << myConnects << " writes " << myWrites
+        << "  network: time " << myNetwork.getNowMs() << " ms events " << stats.events << " sockets " << myNetwork.getSocketCount()
+        << " writes " << stats.writes << " bytes " << stats.bytes << " retransmits " << stats.retransmits << endl;
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include "io_backend.hpp"
+#include "uv_socket.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace sample
+{
+    class NetClientBase; // forward
+    class NetHandler; // forward
+    class SimBackend; // forward
+
+    /**
+     * Properties of a simulated link between two hosts, same in both directions.
+     */
+    struct SimLinkParams
+    {
+    public:
+        SimLinkParams() : latencyMs(5), jitterMs(0), bandwidth(0), lossRate(0), retransmitMs(200) { }
+        /// One-way delay, and max. random extra delay
+        uint32_t latencyMs;
+        uint32_t jitterMs;
+        /// Bytes per second in each direction of a connection, 0 for unlimited
+        uint64_t bandwidth;
+        /// Probability that a write is lost on the wire.  Connections are reliable streams:
+        /// a lost write is retransmitted, it arrives retransmitMs later (doubled at each repeated loss), and delays the ones after it.
+        double lossRate;
+        uint32_t retransmitMs;
+    };
+
+    struct SimNetworkStats
+    {
+    public:
+        SimNetworkStats() : events(0), connects(0), refused(0), writes(0), bytes(0), retransmits(0), closes(0) { }
+        uint64_t events;
+        uint64_t connects;
+        uint64_t refused;
+        uint64_t writes;
+        uint64_t bytes;
+        uint64_t retransmits;
+        uint64_t closes;
+    };
+
+    /**
+     * Discrete-event simulation of a network of hosts, in memory, with a simulated clock.
+     * Connections are simulated reliable streams between SimBackends, one per host; data, connects and closes
+     * are events delivered after the link latency (and bandwidth and loss delays).  Timers (LoopTimer) are events too.
+     * Events are processed in time order, same-time ones in the order they were scheduled; with the same seed, runs are identical.
+     * Single-threaded: the nodes, their timers and the network run on the thread that created the simulation.
+     */
+    class SimNetwork
+    {
+    public:
+        typedef std::function<void()> Event;
+
+        SimNetwork(uint32_t seed_in);
+        ~SimNetwork();
+        /// The simulation of this thread, nullptr if none
+        static SimNetwork* getCurrent();
+        uint64_t getNowMs() const { return myNowUs / 1000; }
+        uint64_t getNowUs() const { return myNowUs; }
+        /// Run an event later, in simulated time
+        void schedule(uint64_t delayUs_in, Event event_in);
+        /// Process events up to the given time, then advance the clock to it; return the number of events processed
+        size_t runUntil(uint64_t timeMs_in);
+        size_t runFor(uint64_t durationMs_in) { return runUntil(getNowMs() + durationMs_in); }
+        size_t getQueuedEventCount() const { return myEvents.size(); }
+        void setDefaultLinkParams(SimLinkParams const & params_in) { myDefaultLink = params_in; }
+        /// Link between two hosts, both directions
+        void setLinkParams(std::string const & hostA_in, std::string const & hostB_in, SimLinkParams const & params_in);
+        SimLinkParams const & getLinkParams(std::string const & hostA_in, std::string const & hostB_in) const;
+        SimNetworkStats const & getStats() const { return myStats; }
+        size_t getSocketCount() const { return mySockets.size(); }
+        /// Seeded random numbers, for the simulated nodes too
+        uint32_t random() { return (uint32_t)myRandom(); }
+
+        /// Socket operations of SimBackend, by simulated socket descriptor
+        int listen(std::string const & host_in, int port_in, NetHandler* handler_in);
+        /// Start connecting; return the descriptor of the new socket, the result is reported with onBackendConnected
+        int connect(SimBackend* backend_in, NetClientBase* client_in, std::string const & host_in, int port_in);
+        void attach(int fd_in, NetClientBase* client_in);
+        int write(int fd_in, SharedBuffer const & buf_in);
+        void readStart(int fd_in);
+        void readStop(int fd_in);
+        void close(int fd_in);
+        void detach(int fd_in);
+
+    private:
+        class QueuedEvent
+        {
+        public:
+            uint64_t myTimeUs;
+            uint64_t mySeq;
+            Event myEvent;
+            bool operator>(QueuedEvent const & other_in) const { return myTimeUs != other_in.myTimeUs ? myTimeUs > other_in.myTimeUs : mySeq > other_in.mySeq; }
+        };
+
+        class SimSocket
+        {
+        public:
+            // nullptr once detached
+            NetClientBase* myClient;
+            std::string myLocalHost;
+            std::string myPeerHost;
+            // -1 before connected, and after the peer is closed
+            int myPeerFd;
+            bool myReading;
+            bool myClosed;
+            // received, not read yet (reading stopped, or not started yet)
+            std::deque<SharedBuffer> myPending;
+            bool myPendingEof;
+            // end of sending of the last write (bandwidth), arrival of the last write at the peer (order)
+            uint64_t mySendFreeUs;
+            uint64_t myLastArrivalUs;
+        };
+
+        SimSocket* findSocket(int fd_in);
+        int newSocket(std::string const & localHost_in, std::string const & peerHost_in);
+        /// One-way delay of a link, with jitter
+        uint64_t getDelayUs(SimLinkParams const & link_in);
+        void onSyn(int fd_in, std::string const & target_in);
+        void deliver(int fd_in, SharedBuffer const & buf_in);
+        void deliverEof(int fd_in);
+        /// Pass pending data to a reading client
+        void flushPending(int fd_in);
+        /// Notify the peer of a closed socket, after the data in flight
+        void closeToPeer(SimSocket & socket_in);
+
+    private:
+        static thread_local SimNetwork* ourCurrent;
+        SimNetwork* myPrevCurrent;
+        uint64_t myNowUs;
+        uint64_t myNextSeq;
+        // min-heap on time
+        std::vector<QueuedEvent> myEvents;
+        std::mt19937 myRandom;
+        SimLinkParams myDefaultLink;
+        std::map<std::pair<std::string, std::string>, SimLinkParams> myLinks;
+        // listening handlers, by host:port
+        std::map<std::string, NetHandler*> myListeners;
+        std::unordered_map<int, SimSocket> mySockets;
+        int myNextFd;
+        int myNextEphemeralPort;
+        SimNetworkStats myStats;
+    };
+
+    /**
+     * I/O backend of one simulated host: listening, incoming and outgoing connections go through the SimNetwork.
+     */
+    class SimBackend: public IoBackend
+    {
+    public:
+        SimBackend(SimNetwork & network_in, std::string const & host_in);
+        std::string getName() const { return "sim"; }
+        std::string const & getHost() const { return myHost; }
+        int init(uv_loop_t* loop_in) { return 0; }
+        int listen(int port_in, NetHandler* handler_in);
+        int connect(NetClientBase* client_in, std::string const & host_in, int port_in);
+        void attach(NetClientBase* client_in, int fd_in);
+        int readStart(NetClientBase* client_in);
+        int readStop(NetClientBase* client_in);
+        int write(NetClientBase* client_in, SharedBuffer const & buf_in);
+        void close(NetClientBase* client_in);
+        void detach(NetClientBase* client_in);
+        void printStats();
+
+    private:
+        /// Socket of a connection, -1 if not known
+        int getFd(NetClientBase* client_in) const;
+
+    private:
+        SimNetwork & myNetwork;
+        std::string myHost;
+        // socket descriptors, by connection
+        std::map<NetClientBase*, int> myFds;
+        uint64_t myConnects;
+        uint64_t myWrites;
+    };
+}
@@ -0,0 +1,128 @@
+#include "stage_stats.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+using namespace sample;
+using namespace std;
+
+
+StageHistogram::StageHistogram() :
+myCount(0),
+mySumNs(0),
+myMaxNs(0)
+{
+    for (int i = 0; i < BucketCount; ++i)
+    {
+        myBuckets[i] = 0;
+    }
+}
+
+void StageHistogram::add(uint64_t ns_in)
+{
+    // bucket i: up to 2^i ns
+    int bucket = 0;
+    while (bucket < BucketCount - 1 && (1ull << bucket) < ns_in)
+    {
+        ++bucket;
+    }
+    // one writer: no read-modify-write needed
+    myBuckets[bucket].store(myBuckets[bucket].load(memory_order_relaxed) + 1, memory_order_relaxed);
+    myCount.store(myCount.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    mySumNs.store(mySumNs.load(memory_order_relaxed) + ns_in, memory_order_relaxed);
+    if (ns_in > myMaxNs.load(memory_order_relaxed))
+    {
+        myMaxNs.store(ns_in, memory_order_relaxed);
+    }
+}
+
+uint64_t StageHistogram::getPercentileNs(double percentile_in) const
+{
+    uint64_t count = getCount();
+    if (count == 0)
+    {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(count * percentile_in / 100.0);
+    uint64_t sum = 0;
+    for (int i = 0; i < BucketCount; ++i)
+    {
+        sum += myBuckets[i].load(memory_order_relaxed);
+        if (sum > target)
+        {
+            return std::min(1ull << i, (unsigned long long)getMaxNs());
+        }
+    }
+    return getMaxNs();
+}
+
+
+mutex StageStats::ourAllMutex;
+vector<shared_ptr<StageStats>> StageStats::ourAll;
+
+const char* StageStats::getStageName(StatsStage stage_in)
+{
+    switch (stage_in)
+    {
+        case StatsStage::StageRead: return "read";
+        case StatsStage::StageAppend: return "append";
+        case StatsStage::StageFrame: return "frame";
+        case StatsStage::StageTokenize: return "tokenize";
+        case StatsStage::StageParse: return "parse";
+        case StatsStage::StageDispatch: return "dispatch";
+        case StatsStage::StageSerialize: return "serialize";
+        case StatsStage::StageSend: return "send";
+        case StatsStage::StageWriteDone: return "write-done";
+        case StatsStage::StageCount: break;
+    }
+    return "?";
+}
+
+StageStats & StageStats::current()
+{
+    thread_local shared_ptr<StageStats> stats;
+    if (!stats)
+    {
+        stats = make_shared<StageStats>();
+#ifdef __linux__
+        char name[16] = { 0 };
+        if (::pthread_getname_np(::pthread_self(), name, sizeof(name)) == 0)
+        {
+            stats->myThreadName = name;
+        }
+#endif
+        lock_guard<mutex> lock(ourAllMutex);
+        if (stats->myThreadName.empty())
+        {
+            stats->myThreadName = "thread-" + to_string(ourAll.size());
+        }
+        ourAll.push_back(stats);
+    }
+    return *stats;
+}
+
+void StageStats::print(ostream & out_in)
+{
+    lock_guard<mutex> lock(ourAllMutex);
+    for (auto t = ourAll.begin(); t != ourAll.end(); ++t)
+    {
+        out_in << "  stages of " << (*t)->myThreadName << " (ns: count avg p50 p90 p99 max):" << endl;
+        for (int i = 0; i < StatsStage::StageCount; ++i)
+        {
+            StageHistogram const & h = (*t)->myStages[i];
+            uint64_t count = h.getCount();
+            if (count == 0)
+            {
+                continue;
+            }
+            out_in << "    " << left << setw(11) << getStageName((StatsStage)i) << right
+                << " " << count << " " << h.getSumNs() / count
+                << " " << h.getPercentileNs(50) << " " << h.getPercentileNs(90) << " " << h.getPercentileNs(99)
+                << " " << h.getMaxNs() << endl;
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+// Stage timers of the hot path, compiled in with the TCP_LIBUV_STAGE_STATS option (CMake), otherwise STAGE_TIMER is empty.
+
+#ifdef TCP_LIBUV_STAGE_STATS
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace sample
+{
+    /// Stages of receiving and sending a message
+    enum StatsStage
+    {
+        /// A read callback, all of it
+        StageRead = 0,
+        /// Append to the receive buffer
+        StageAppend = 1,
+        /// Split the receive buffer into lines
+        StageFrame = 2,
+        /// Split a line into tokens
+        StageTokenize = 3,
+        /// Create the message from the tokens
+        StageParse = 4,
+        /// Handling of the message: onMessage, messageReceived of the app
+        StageDispatch = 5,
+        /// Serialize a message to send
+        StageSerialize = 6,
+        /// Queue a message and submit writes
+        StageSend = 7,
+        /// A write callback
+        StageWriteDone = 8,
+        StageCount = 9
+    };
+
+    /**
+     * Histogram of durations, in power of 2 ns buckets.  Written by one thread, read by any.
+     */
+    class StageHistogram
+    {
+    public:
+        static const int BucketCount = 40;
+
+        StageHistogram();
+        void add(uint64_t ns_in);
+        uint64_t getCount() const { return myCount.load(std::memory_order_relaxed); }
+        uint64_t getSumNs() const { return mySumNs.load(std::memory_order_relaxed); }
+        uint64_t getMaxNs() const { return myMaxNs.load(std::memory_order_relaxed); }
+        /// Upper bound of the bucket of this percentile (0 .. 100)
+        uint64_t getPercentileNs(double percentile_in) const;
+
+    private:
+        std::atomic<uint64_t> myBuckets[BucketCount];
+        std::atomic<uint64_t> myCount;
+        std::atomic<uint64_t> mySumNs;
+        std::atomic<uint64_t> myMaxNs;
+    };
+
+    /**
+     * Stage durations of one thread (one loop): a histogram per stage.
+     * Each thread records into its own, without locking; all of them are kept for printing, also after their thread ended.
+     */
+    class StageStats
+    {
+    public:
+        static const char* getStageName(StatsStage stage_in);
+        /// Add a duration of a stage, on the current thread
+        static void record(StatsStage stage_in, uint64_t ns_in) { current().myStages[stage_in].add(ns_in); }
+        /// Print the histograms of all threads
+        static void print(std::ostream & out_in);
+
+    private:
+        static StageStats & current();
+
+    private:
+        static std::mutex ourAllMutex;
+        static std::vector<std::shared_ptr<StageStats>> ourAll;
+        std::string myThreadName;
+        StageHistogram myStages[StatsStage::StageCount];
+    };
+
+    /**
+     * Measures its scope as a stage, with steady_clock.
+     */
+    class ScopedStageTimer
+    {
+    public:
+        explicit ScopedStageTimer(StatsStage stage_in) : myStage(stage_in), myStart(std::chrono::steady_clock::now()) { }
+        ~ScopedStageTimer()
+        {
+            StageStats::record(myStage, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - myStart).count());
+        }
+        ScopedStageTimer(ScopedStageTimer const &) = delete;
+        ScopedStageTimer & operator=(ScopedStageTimer const &) = delete;
+
+    private:
+        StatsStage myStage;
+        std::chrono::steady_clock::time_point myStart;
+    };
+}
+
+#define STAGE_TIMER_NAME2(line_in) stageTimer_ ## line_in
+#define STAGE_TIMER_NAME(line_in) STAGE_TIMER_NAME2(line_in)
+/// Time the rest of the enclosing scope as this stage
+#define STAGE_TIMER(stage_in) sample::ScopedStageTimer STAGE_TIMER_NAME(__LINE__)(sample::StatsStage::stage_in)
+
+#else
+
+#define STAGE_TIMER(stage_in)
+
+#endif
@@ -0,0 +1,288 @@
+#include "thread_placement.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace sample;
+using namespace std;
+
+
+/// Work requests placing the threadpool threads, see placeThreadpool
+class PoolPlacement
+{
+public:
+    vector<int> myCpus;
+    int mySize;
+    int myArrived;
+    mutex myMutex;
+    condition_variable myAllArrived;
+};
+
+class PoolPlacementWork
+{
+public:
+    uv_work_t myReq;
+    shared_ptr<PoolPlacement> myPlacement;
+};
+
+static void on_place_worker(uv_work_t* req)
+{
+    PoolPlacement & placement = *((PoolPlacementWork*)req->data)->myPlacement;
+    int idx = 0;
+    {
+        unique_lock<mutex> lock(placement.myMutex);
+        idx = placement.myArrived++;
+        placement.myAllArrived.notify_all();
+        // hold this thread until all the others have taken one, bounded in case the pool is smaller
+        placement.myAllArrived.wait_for(lock, chrono::seconds(2), [&placement]() { return placement.myArrived >= placement.mySize; });
+    }
+    if (!placement.myCpus.empty())
+    {
+        ThreadPlacement::pinCurrentThread(vector<int>(1, placement.myCpus[idx % placement.myCpus.size()]));
+    }
+    string name = "uv-worker-" + to_string(idx);
+    ThreadPlacement::setCurrentThreadName(name);
+    ThreadPlacement::registerCurrentThread(name);
+}
+
+static void on_place_worker_done(uv_work_t* req, int status)
+{
+    delete (PoolPlacementWork*)req->data;
+}
+
+#ifdef __linux__
+/// CPU a thread last ran on, from /proc; -1 if not known
+static int getLastCpu(long tid_in)
+{
+    ifstream stat("/proc/self/task/" + to_string(tid_in) + "/stat");
+    string line;
+    if (!getline(stat, line))
+    {
+        return -1;
+    }
+    size_t end = line.rfind(')');
+    if (end == string::npos)
+    {
+        return -1;
+    }
+    // fields after the command, the first is the 3rd; processor is the 39th
+    istringstream fields(line.substr(end + 1));
+    string field;
+    for (int i = 3; i <= 39; ++i)
+    {
+        if (!(fields >> field))
+        {
+            return -1;
+        }
+    }
+    return std::atoi(field.c_str());
+}
+#endif
+
+
+mutex ThreadPlacement::ourThreadsMutex;
+vector<ThreadPlacement::RegisteredThread> ThreadPlacement::ourThreads;
+bool ThreadPlacement::ourThreadpoolPlaced = false;
+
+vector<int> ThreadPlacement::parseCpuList(string const & list_in)
+{
+    vector<int> cpus;
+    stringstream ss(list_in);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        if (item.length() == 0)
+        {
+            continue;
+        }
+        int first = 0;
+        int last = 0;
+        char dash = 0;
+        istringstream range(item);
+        if (!(range >> first) || first < 0)
+        {
+            return vector<int>();
+        }
+        last = first;
+        if (range >> dash)
+        {
+            if (dash != '-' || !(range >> last) || last < first)
+            {
+                return vector<int>();
+            }
+        }
+        for (int cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+string ThreadPlacement::formatCpuList(vector<int> const & cpus_in)
+{
+    string list;
+    for (size_t i = 0; i < cpus_in.size(); )
+    {
+        size_t j = i;
+        while (j + 1 < cpus_in.size() && cpus_in[j + 1] == cpus_in[j] + 1)
+        {
+            ++j;
+        }
+        list += (list.length() > 0 ? "," : "") + to_string(cpus_in[i]);
+        if (j > i)
+        {
+            list += "-" + to_string(cpus_in[j]);
+        }
+        i = j + 1;
+    }
+    return list;
+}
+
+int ThreadPlacement::pinCurrentThread(vector<int> const & cpus_in)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto i = cpus_in.begin(); i != cpus_in.end(); ++i)
+    {
+        if (*i >= 0 && *i < CPU_SETSIZE)
+        {
+            CPU_SET(*i, &set);
+        }
+    }
+    int res = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+    if (res != 0)
+    {
+        cerr << "Could not pin thread to CPUs " << formatCpuList(cpus_in) << ": " << res << endl;
+        return -res;
+    }
+    return 0;
+#else
+    return UV_ENOTSUP;
+#endif
+}
+
+int ThreadPlacement::setCurrentThreadName(string const & name_in)
+{
+#ifdef __linux__
+    // the kernel keeps 15 characters
+    return -::pthread_setname_np(::pthread_self(), name_in.substr(0, 15).c_str());
+#else
+    return UV_ENOTSUP;
+#endif
+}
+
+long ThreadPlacement::getCurrentTid()
+{
+#ifdef __linux__
+    return (long)::syscall(SYS_gettid);
+#else
+    return 0;
+#endif
+}
+
+void ThreadPlacement::registerCurrentThread(string const & name_in)
+{
+    RegisteredThread thread;
+    thread.myName = name_in;
+    thread.myTid = getCurrentTid();
+    lock_guard<mutex> lock(ourThreadsMutex);
+    ourThreads.push_back(thread);
+}
+
+void ThreadPlacement::unregisterCurrentThread()
+{
+    long tid = getCurrentTid();
+    lock_guard<mutex> lock(ourThreadsMutex);
+    ourThreads.erase(std::remove_if(ourThreads.begin(), ourThreads.end(),
+        [tid](RegisteredThread const & thread_in) { return thread_in.myTid == tid; }), ourThreads.end());
+}
+
+vector<ThreadPlacementInfo> ThreadPlacement::getThreads()
+{
+    vector<ThreadPlacementInfo> threads;
+    lock_guard<mutex> lock(ourThreadsMutex);
+    for (auto i = ourThreads.begin(); i != ourThreads.end(); ++i)
+    {
+        ThreadPlacementInfo info;
+        info.name = i->myName;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (::sched_getaffinity((pid_t)i->myTid, sizeof(set), &set) == 0)
+        {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            {
+                if (CPU_ISSET(cpu, &set))
+                {
+                    info.cpus.push_back(cpu);
+                }
+            }
+        }
+        info.lastCpu = getLastCpu(i->myTid);
+#endif
+        threads.push_back(info);
+    }
+    return threads;
+}
+
+int ThreadPlacement::setThreadpoolSize(int size_in)
+{
+    // libuv reads it when the threadpool is first used, and caps it at 1024
+    int size = std::min(std::max(size_in, 1), 1024);
+    return ::uv_os_setenv("UV_THREADPOOL_SIZE", to_string(size).c_str());
+}
+
+int ThreadPlacement::getThreadpoolSize()
+{
+    const char* size = std::getenv("UV_THREADPOOL_SIZE");
+    if (size == nullptr || std::atoi(size) <= 0)
+    {
+        // libuv default
+        return 4;
+    }
+    return std::min(std::atoi(size), 1024);
+}
+
+int ThreadPlacement::placeThreadpool(uv_loop_t* loop_in, vector<int> const & cpus_in)
+{
+    if (ourThreadpoolPlaced)
+    {
+        return 0;
+    }
+    ourThreadpoolPlaced = true;
+    auto placement = make_shared<PoolPlacement>();
+    placement->myCpus = cpus_in;
+    placement->mySize = getThreadpoolSize();
+    placement->myArrived = 0;
+    for (int i = 0; i < placement->mySize; ++i)
+    {
+        PoolPlacementWork* work = new PoolPlacementWork();
+        work->myPlacement = placement;
+        work->myReq.data = (void*)work;
+        int res = ::uv_queue_work(loop_in, &work->myReq, on_place_worker, on_place_worker_done);
+        if (res != 0)
+        {
+            delete work;
+            cerr << "Could not place threadpool threads: " << res << " " << ::uv_err_name(res) << endl;
+            return res;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <uv.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sample
+{
+    /// A named thread of the process, see ThreadPlacement::registerCurrentThread
+    struct ThreadPlacementInfo
+    {
+    public:
+        ThreadPlacementInfo() : lastCpu(-1) { }
+        std::string name;
+        /// CPUs the thread may run on (all, if not pinned)
+        std::vector<int> cpus;
+        /// CPU the thread last ran on, -1 if not known
+        int lastCpu;
+    };
+
+    /**
+     * CPU affinity and names of the loop and libuv threadpool threads, for stable placement and for profiling.
+     * Pinning and naming are supported on Linux; elsewhere they return UV_ENOTSUP and do nothing.
+     * Named threads are registered, their placement is reported in the stats.
+     */
+    class ThreadPlacement
+    {
+    public:
+        /// Parse a CPU list, such as "0-3,8,10"; empty if invalid
+        static std::vector<int> parseCpuList(std::string const & list_in);
+        static std::string formatCpuList(std::vector<int> const & cpus_in);
+        /// Restrict the current thread to these CPUs
+        static int pinCurrentThread(std::vector<int> const & cpus_in);
+        /// Set the name of the current thread (max. 15 characters are kept)
+        static int setCurrentThreadName(std::string const & name_in);
+        /// Register the current thread for the stats, by name; unregister before it ends
+        static void registerCurrentThread(std::string const & name_in);
+        static void unregisterCurrentThread();
+        /// Placement of the registered threads, taken now
+        static std::vector<ThreadPlacementInfo> getThreads();
+        /// Size of the libuv threadpool (UV_THREADPOOL_SIZE).  Set before the first use of the threadpool (file, DNS, work requests).
+        static int setThreadpoolSize(int size_in);
+        static int getThreadpoolSize();
+        /// Pin and name each thread of the libuv threadpool (uv-worker-n), round-robin on the CPUs (any, if empty).
+        /// Work requests are queued on the loop, one per thread, and wait for each other, so each thread takes exactly one.
+        /// Call on the thread of the loop, or before it runs.  Once per process.
+        static int placeThreadpool(uv_loop_t* loop_in, std::vector<int> const & cpus_in);
+
+    private:
+        class RegisteredThread
+        {
+        public:
+            std::string myName;
+            // kernel thread ID
+            long myTid;
+        };
+
+        static long getCurrentTid();
+
+    private:
+        static std::mutex ourThreadsMutex;
+        static std::vector<RegisteredThread> ourThreads;
+        static bool ourThreadpoolPlaced;
+    };
+}
@@ -0,0 +1,170 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+using namespace sample;
+using namespace std;
+
+
+atomic<bool> Trace::ourEnabled(false);
+atomic<size_t> Trace::ourEventsPerThread(Trace::DefaultEventsPerThread);
+mutex Trace::ourBuffersMutex;
+vector<shared_ptr<Trace::ThreadBuffer>> Trace::ourBuffers;
+
+void Trace::enable(size_t eventsPerThread_in)
+{
+    ourEventsPerThread = std::max(eventsPerThread_in, (size_t)16);
+    ourEnabled = true;
+}
+
+void Trace::disable()
+{
+    ourEnabled = false;
+}
+
+Trace::ThreadBuffer & Trace::current()
+{
+    thread_local shared_ptr<ThreadBuffer> buffer;
+    if (!buffer)
+    {
+        buffer = make_shared<ThreadBuffer>();
+        buffer->myEvents.resize(ourEventsPerThread);
+        buffer->myNext = 0;
+        buffer->myWrapped = false;
+#ifdef __linux__
+        char name[16] = { 0 };
+        if (::pthread_getname_np(::pthread_self(), name, sizeof(name)) == 0)
+        {
+            buffer->myThreadName = name;
+        }
+#endif
+        lock_guard<mutex> lock(ourBuffersMutex);
+        buffer->myTid = (int)ourBuffers.size() + 1;
+        if (buffer->myThreadName.empty())
+        {
+            buffer->myThreadName = "thread-" + to_string(buffer->myTid);
+        }
+        ourBuffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+void Trace::add(TraceEvent const & event_in)
+{
+    ThreadBuffer & buffer = current();
+    // only contended while writing the file
+    lock_guard<mutex> lock(buffer.myMutex);
+    buffer.myEvents[buffer.myNext] = event_in;
+    if (++buffer.myNext >= buffer.myEvents.size())
+    {
+        buffer.myNext = 0;
+        buffer.myWrapped = true;
+    }
+}
+
+void Trace::span(const char* name_in, const char* category_in, uint64_t startNs_in, const char* argName_in, uint64_t arg_in)
+{
+    uint64_t end = now();
+    TraceEvent event;
+    event.name = name_in;
+    event.category = category_in;
+    event.phase = 'X';
+    event.startNs = startNs_in;
+    event.durNs = end > startNs_in ? end - startNs_in : 0;
+    event.argName = argName_in;
+    event.arg = arg_in;
+    add(event);
+}
+
+void Trace::instant(const char* name_in, const char* category_in, const char* argName_in, uint64_t arg_in)
+{
+    if (!isEnabled())
+    {
+        return;
+    }
+    TraceEvent event;
+    event.name = name_in;
+    event.category = category_in;
+    event.phase = 'i';
+    event.startNs = now();
+    event.durNs = 0;
+    event.argName = argName_in;
+    event.arg = arg_in;
+    add(event);
+}
+
+/// Microseconds, as used in the trace format, with ns precision
+static void writeMicros(ostream & out_in, uint64_t ns_in)
+{
+    out_in << ns_in / 1000 << "." << (char)('0' + ns_in / 100 % 10) << (char)('0' + ns_in / 10 % 10) << (char)('0' + ns_in % 10);
+}
+
+int Trace::writeJson(string const & path_in)
+{
+    ofstream out(path_in);
+    if (!out)
+    {
+        cerr << "Could not write trace file " << path_in << endl;
+        return UV_EIO;
+    }
+    vector<shared_ptr<ThreadBuffer>> buffers;
+    {
+        lock_guard<mutex> lock(ourBuffersMutex);
+        buffers = ourBuffers;
+    }
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << endl;
+    bool first = true;
+    size_t count = 0;
+    for (auto b = buffers.begin(); b != buffers.end(); ++b)
+    {
+        vector<TraceEvent> events;
+        {
+            // oldest first
+            lock_guard<mutex> lock((*b)->myMutex);
+            if ((*b)->myWrapped)
+            {
+                events.assign((*b)->myEvents.begin() + (*b)->myNext, (*b)->myEvents.end());
+            }
+            events.insert(events.end(), (*b)->myEvents.begin(), (*b)->myEvents.begin() + (*b)->myNext);
+        }
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << (*b)->myTid
+            << ",\"args\":{\"name\":\"" << (*b)->myThreadName << "\"}}";
+        first = false;
+        for (auto e = events.begin(); e != events.end(); ++e)
+        {
+            out << ",\n{\"name\":\"" << e->name << "\",\"cat\":\"" << e->category << "\",\"ph\":\"" << e->phase
+                << "\",\"pid\":1,\"tid\":" << (*b)->myTid << ",\"ts\":";
+            writeMicros(out, e->startNs);
+            if (e->phase == 'X')
+            {
+                out << ",\"dur\":";
+                writeMicros(out, e->durNs);
+            }
+            else
+            {
+                // instant of the thread
+                out << ",\"s\":\"t\"";
+            }
+            if (e->argName != nullptr)
+            {
+                out << ",\"args\":{\"" << e->argName << "\":" << e->arg << "}";
+            }
+            out << "}";
+        }
+        count += events.size();
+    }
+    out << "\n]}" << endl;
+    if (!out)
+    {
+        cerr << "Could not write trace file " << path_in << endl;
+        return UV_EIO;
+    }
+    cout << "Trace written to " << path_in << ", " << count << " events" << endl;
+    return 0;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <uv.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sample
+{
+    /// A recorded event; names are string literals, not copied
+    struct TraceEvent
+    {
+    public:
+        const char* name;
+        const char* category;
+        /// 'X': span of startNs .. startNs + durNs; 'i': instant at startNs
+        char phase;
+        uint64_t startNs;
+        uint64_t durNs;
+        /// Optional argument (connection ID, message type), shown if argName is set
+        const char* argName;
+        uint64_t arg;
+    };
+
+    /**
+     * Timeline of the loop threads, for Chrome trace / Perfetto: spans of loop iterations, libuv callbacks and app handlers,
+     * instants of connection events.  Each thread records into its own ring buffer, the oldest events are overwritten.
+     * Disabled by default; then a trace point costs a single check of a flag.
+     */
+    class Trace
+    {
+    public:
+        static const size_t DefaultEventsPerThread = 1 << 16;
+
+        /// Start recording; the ring buffer of each thread keeps this many events
+        static void enable(size_t eventsPerThread_in = DefaultEventsPerThread);
+        static void disable();
+        static bool isEnabled() { return ourEnabled.load(std::memory_order_relaxed); }
+        static uint64_t now() { return ::uv_hrtime(); }
+        /// Record a span, from start until now, on the current thread
+        static void span(const char* name_in, const char* category_in, uint64_t startNs_in, const char* argName_in = nullptr, uint64_t arg_in = 0);
+        static void instant(const char* name_in, const char* category_in, const char* argName_in = nullptr, uint64_t arg_in = 0);
+        /// Write the recorded events of all threads as Chrome trace JSON (chrome://tracing, ui.perfetto.dev); return 0 on success
+        static int writeJson(std::string const & path_in);
+
+    private:
+        class ThreadBuffer
+        {
+        public:
+            std::mutex myMutex;
+            std::string myThreadName;
+            int myTid;
+            std::vector<TraceEvent> myEvents;
+            // next slot; the ring is full once it has wrapped
+            size_t myNext;
+            bool myWrapped;
+        };
+
+        static ThreadBuffer & current();
+        static void add(TraceEvent const & event_in);
+
+    private:
+        static std::atomic<bool> ourEnabled;
+        static std::atomic<size_t> ourEventsPerThread;
+        static std::mutex ourBuffersMutex;
+        static std::vector<std::shared_ptr<ThreadBuffer>> ourBuffers;
+    };
+
+    /**
+     * Records its scope as a span, if tracing is enabled.
+     */
+    class ScopedTrace
+    {
+    public:
+        ScopedTrace(const char* name_in, const char* category_in, const char* argName_in = nullptr, uint64_t arg_in = 0) :
+            myName(name_in), myCategory(category_in), myArgName(argName_in), myArg(arg_in), myStart(Trace::isEnabled() ? Trace::now() : 0) { }
+        ~ScopedTrace()
+        {
+            if (myStart != 0)
+            {
+                Trace::span(myName, myCategory, myStart, myArgName, myArg);
+            }
+        }
+        ScopedTrace(ScopedTrace const &) = delete;
+        ScopedTrace & operator=(ScopedTrace const &) = delete;
+
+    private:
+        const char* myName;
+        const char* myCategory;
+        const char* myArgName;
+        uint64_t myArg;
+        uint64_t myStart;
+    };
+}
@@ -0,0 +1,739 @@
+#include "uring_backend.hpp"
+
+#include "net_client.hpp"
+#include "net_handler.hpp"
+
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using namespace sample;
+using namespace std;
+
+
+static int uring_setup(unsigned entries_in, struct io_uring_params* params_in)
+{
+    return (int)::syscall(__NR_io_uring_setup, entries_in, params_in);
+}
+
+static int uring_enter(int fd_in, unsigned toSubmit_in, unsigned minComplete_in, unsigned flags_in)
+{
+    return (int)::syscall(__NR_io_uring_enter, fd_in, toSubmit_in, minComplete_in, flags_in, nullptr, 0);
+}
+
+static int uring_register(int fd_in, unsigned opcode_in, void* arg_in, unsigned nrArgs_in)
+{
+    return (int)::syscall(__NR_io_uring_register, fd_in, opcode_in, arg_in, nrArgs_in);
+}
+
+UringBackend::UringBackend() :
+myRingFd(-1),
+mySqRing(nullptr),
+mySqRingSize(0),
+myCqRing(nullptr),
+myCqRingSize(0),
+mySqes(nullptr),
+mySqesSize(0),
+myToSubmit(0),
+myBufRing(nullptr),
+myBufRingSize(0),
+myBufTail(0),
+myBufMem(nullptr),
+myEventFd(-1),
+myListenFd(-1),
+myAcceptArmed(false),
+myHandler(nullptr),
+myUvPoll(nullptr),
+myUvPrepare(nullptr),
+myUvCheck(nullptr),
+myEnterCalls(0),
+mySubmitted(0),
+myCompletions(0),
+myAccepts(0),
+myRecvs(0),
+myRecvBytes(0),
+myNoBufs(0),
+mySendCalls(0),
+mySendBuffers(0),
+mySendBytes(0)
+{
+}
+
+UringBackend::~UringBackend()
+{
+    // uv handles belong to the loop, they are closed with it
+    for (auto i = myConns.begin(); i != myConns.end(); ++i)
+    {
+        ::close(i->second.myFd);
+    }
+    myConns.clear();
+    if (myListenFd >= 0) ::close(myListenFd);
+    if (myRingFd >= 0) ::close(myRingFd);
+    if (myEventFd >= 0) ::close(myEventFd);
+    if (mySqes != nullptr) ::munmap(mySqes, mySqesSize);
+    if (myCqRing != nullptr && myCqRing != mySqRing) ::munmap(myCqRing, myCqRingSize);
+    if (mySqRing != nullptr) ::munmap(mySqRing, mySqRingSize);
+    if (myBufRing != nullptr) ::munmap(myBufRing, myBufRingSize);
+    delete[] myBufMem;
+}
+
+int UringBackend::init(uv_loop_t* loop_in)
+{
+    struct io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+    myRingFd = uring_setup(RingEntries, &params);
+    if (myRingFd < 0)
+    {
+        int err = -errno;
+        cerr << "Error from io_uring_setup " << err << " " << ::uv_err_name(err) << endl;
+        return err;
+    }
+    mySqEntries = params.sq_entries;
+    mySqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    myCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap)
+    {
+        mySqRingSize = myCqRingSize = std::max(mySqRingSize, myCqRingSize);
+    }
+    mySqRing = ::mmap(nullptr, mySqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, myRingFd, IORING_OFF_SQ_RING);
+    if (mySqRing == MAP_FAILED)
+    {
+        mySqRing = nullptr;
+        return -errno;
+    }
+    if (singleMmap)
+    {
+        myCqRing = mySqRing;
+    }
+    else
+    {
+        myCqRing = ::mmap(nullptr, myCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, myRingFd, IORING_OFF_CQ_RING);
+        if (myCqRing == MAP_FAILED)
+        {
+            myCqRing = nullptr;
+            return -errno;
+        }
+    }
+    mySqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = ::mmap(nullptr, mySqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, myRingFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        return -errno;
+    }
+    mySqes = (struct io_uring_sqe*)sqes;
+    char* sq = (char*)mySqRing;
+    mySqHead = (unsigned*)(sq + params.sq_off.head);
+    mySqTail = (unsigned*)(sq + params.sq_off.tail);
+    mySqFlags = (unsigned*)(sq + params.sq_off.flags);
+    mySqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    mySqArray = (unsigned*)(sq + params.sq_off.array);
+    char* cq = (char*)myCqRing;
+    myCqHead = (unsigned*)(cq + params.cq_off.head);
+    myCqTail = (unsigned*)(cq + params.cq_off.tail);
+    myCqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    myCqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // provided buffers for recv, the kernel picks one per completion
+    myBufRingSize = BufRingEntries * sizeof(struct io_uring_buf);
+    void* bufRing = ::mmap(nullptr, myBufRingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (bufRing == MAP_FAILED)
+    {
+        return -errno;
+    }
+    myBufRing = (struct io_uring_buf_ring*)bufRing;
+    struct io_uring_buf_reg reg;
+    ::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)myBufRing;
+    reg.ring_entries = BufRingEntries;
+    reg.bgid = BufGroup;
+    if (uring_register(myRingFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        int err = -errno;
+        cerr << "Error registering io_uring buffer ring " << err << " " << ::uv_err_name(err) << endl;
+        return err;
+    }
+    myBufMem = new char[BufRingEntries * BufSize];
+    myBufTail = 0;
+    for (unsigned i = 0; i < BufRingEntries; ++i)
+    {
+        recycleBuffer((uint16_t)i);
+    }
+
+    // completions are signalled on the eventfd, polled by the loop
+    myEventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (myEventFd < 0)
+    {
+        return -errno;
+    }
+    if (uring_register(myRingFd, IORING_REGISTER_EVENTFD, &myEventFd, 1) < 0)
+    {
+        return -errno;
+    }
+    myUvPoll = new uv_poll_t();
+    ::uv_poll_init(loop_in, myUvPoll, myEventFd);
+    myUvPoll->data = (void*)this;
+    ::uv_poll_start(myUvPoll, UV_READABLE, UringBackend::on_poll);
+    myUvPrepare = new uv_prepare_t();
+    ::uv_prepare_init(loop_in, myUvPrepare);
+    myUvPrepare->data = (void*)this;
+    ::uv_prepare_start(myUvPrepare, UringBackend::on_prepare);
+    myUvCheck = new uv_check_t();
+    ::uv_check_init(loop_in, myUvCheck);
+    myUvCheck->data = (void*)this;
+    ::uv_check_start(myUvCheck, UringBackend::on_check);
+    cout << "io_uring backend initialized, " << mySqEntries << " entries" << endl;
+    return 0;
+}
+
+int UringBackend::listen(int port_in, NetHandler* handler_in)
+{
+    if (myListenFd >= 0)
+    {
+        return UV_EBUSY;
+    }
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+    int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    ::uv_ip4_addr("0.0.0.0", port_in, &addr);
+    if (::bind(fd, (const struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        int err = -errno;
+        cerr << "Bind error " << ::uv_strerror(err) << endl;
+        ::close(fd);
+        return err;
+    }
+    if (::listen(fd, 128) < 0)
+    {
+        int err = -errno;
+        cerr << "Listen error " << ::uv_strerror(err) << endl;
+        ::close(fd);
+        return err;
+    }
+    myListenFd = fd;
+    myHandler = handler_in;
+    armAccept();
+    submit();
+    return 0;
+}
+
+void UringBackend::attach(NetClientBase* client_in, int fd_in)
+{
+    Conn & conn = myConns[client_in->getConnId()];
+    conn.myClient = client_in;
+    conn.myFd = fd_in;
+}
+
+int UringBackend::readStart(NetClientBase* client_in)
+{
+    uint32_t connId = client_in->getConnId();
+    auto i = myConns.find(connId);
+    if (i == myConns.end() || i->second.myClient == nullptr)
+    {
+        return UV_ENOTCONN;
+    }
+    i->second.myWantRead = true;
+    if (!i->second.myRecvArmed)
+    {
+        armRecv(connId, i->second);
+    }
+    return 0;
+}
+
+int UringBackend::readStop(NetClientBase* client_in)
+{
+    uint32_t connId = client_in->getConnId();
+    auto i = myConns.find(connId);
+    if (i == myConns.end())
+    {
+        return UV_ENOTCONN;
+    }
+    i->second.myWantRead = false;
+    if (i->second.myRecvArmed)
+    {
+        // data completed before the cancel is still delivered
+        struct io_uring_sqe* sqe = getSqe();
+        if (sqe == nullptr)
+        {
+            return UV_ENOBUFS;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = userData(OpRecv, connId);
+        sqe->user_data = userData(OpCancel, connId);
+    }
+    return 0;
+}
+
+int UringBackend::write(NetClientBase* client_in, SharedBuffer const & buf_in)
+{
+    uint32_t connId = client_in->getConnId();
+    auto i = myConns.find(connId);
+    if (i == myConns.end() || i->second.myClient == nullptr)
+    {
+        return UV_ENOTCONN;
+    }
+    i->second.mySendQueue.push_back(buf_in);
+    if (!i->second.mySendInFlight)
+    {
+        scheduleSend(connId, i->second);
+    }
+    return 0;
+}
+
+void UringBackend::close(NetClientBase* client_in)
+{
+    uint32_t connId = client_in->getConnId();
+    auto i = myConns.find(connId);
+    if (i == myConns.end() || i->second.myClient == nullptr)
+    {
+        return;
+    }
+    i->second.myClient = nullptr;
+    i->second.myWantRead = false;
+    // pending recv and send complete with error or EOF
+    ::shutdown(i->second.myFd, SHUT_RDWR);
+    myClosed.push_back(client_in);
+    myReleaseList.push_back(connId);
+}
+
+void UringBackend::detach(NetClientBase* client_in)
+{
+    myClosed.erase(std::remove(myClosed.begin(), myClosed.end(), client_in), myClosed.end());
+    uint32_t connId = client_in->getConnId();
+    auto i = myConns.find(connId);
+    if (i == myConns.end())
+    {
+        return;
+    }
+    if (i->second.myClient != nullptr)
+    {
+        i->second.myClient = nullptr;
+        i->second.myWantRead = false;
+        ::shutdown(i->second.myFd, SHUT_RDWR);
+        myReleaseList.push_back(connId);
+    }
+}
+
+void UringBackend::printStats()
+{
+    cout << "  io_uring: enter " << myEnterCalls << " submitted " << mySubmitted << " completions " << myCompletions
+        << "  accepts " << myAccepts << "  recv " << myRecvs << " bytes " << myRecvBytes << " nobufs " << myNoBufs
+        << "  sendmsg " << mySendCalls << " buffers " << mySendBuffers << " bytes " << mySendBytes
+        << "  connections " << myConns.size() << endl;
+}
+
+void UringBackend::on_poll(uv_poll_t* handle, int status, int events)
+{
+    UringBackend* backend = (UringBackend*)handle->data;
+    if (backend == nullptr)
+    {
+        return;
+    }
+    uint64_t count;
+    while (::read(backend->myEventFd, &count, sizeof(count)) > 0) { }
+    backend->reap();
+}
+
+void UringBackend::on_prepare(uv_prepare_t* handle)
+{
+    UringBackend* backend = (UringBackend*)handle->data;
+    if (backend == nullptr)
+    {
+        return;
+    }
+    backend->flush();
+}
+
+void UringBackend::on_check(uv_check_t* handle)
+{
+    UringBackend* backend = (UringBackend*)handle->data;
+    if (backend == nullptr)
+    {
+        return;
+    }
+    backend->flush();
+}
+
+struct io_uring_sqe* UringBackend::getSqe()
+{
+    unsigned tail = *mySqTail;
+    unsigned head = __atomic_load_n(mySqHead, __ATOMIC_ACQUIRE);
+    if (tail - head >= mySqEntries)
+    {
+        submit();
+        head = __atomic_load_n(mySqHead, __ATOMIC_ACQUIRE);
+        if (tail - head >= mySqEntries)
+        {
+            cerr << "io_uring submission queue full" << endl;
+            return nullptr;
+        }
+    }
+    unsigned idx = tail & mySqMask;
+    struct io_uring_sqe* sqe = &mySqes[idx];
+    ::memset(sqe, 0, sizeof(struct io_uring_sqe));
+    mySqArray[idx] = idx;
+    // no SQ polling, the kernel reads the entry only on io_uring_enter, after it is filled in
+    __atomic_store_n(mySqTail, tail + 1, __ATOMIC_RELEASE);
+    ++myToSubmit;
+    return sqe;
+}
+
+int UringBackend::submit()
+{
+    bool overflow = (__atomic_load_n(mySqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) != 0;
+    if (myToSubmit == 0 && !overflow)
+    {
+        return 0;
+    }
+    int res = uring_enter(myRingFd, myToSubmit, 0, overflow ? IORING_ENTER_GETEVENTS : 0);
+    ++myEnterCalls;
+    if (res < 0)
+    {
+        int err = errno;
+        if (err == EAGAIN || err == EBUSY || err == EINTR)
+        {
+            // retried with the next flush
+            return 0;
+        }
+        cerr << "Error from io_uring_enter " << -err << " " << ::uv_err_name(-err) << endl;
+        return -err;
+    }
+    mySubmitted += res;
+    myToSubmit -= std::min(myToSubmit, (unsigned)res);
+    return res;
+}
+
+void UringBackend::reap()
+{
+    unsigned head = *myCqHead;
+    while (true)
+    {
+        unsigned tail = __atomic_load_n(myCqTail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            break;
+        }
+        // copy, and free the slot before handling, handlers may cause new completions
+        struct io_uring_cqe cqe = myCqes[head & myCqMask];
+        ++head;
+        __atomic_store_n(myCqHead, head, __ATOMIC_RELEASE);
+        ++myCompletions;
+        uint32_t id = (uint32_t)(cqe.user_data & 0xFFFFFFFF);
+        switch ((Op)(cqe.user_data >> 32))
+        {
+            case OpAccept:
+                handleAccept(cqe);
+                break;
+
+            case OpRecv:
+                handleRecv(id, cqe);
+                break;
+
+            case OpSend:
+                handleSend(id, cqe);
+                break;
+
+            case OpCancel:
+            default:
+                break;
+        }
+    }
+}
+
+void UringBackend::flush()
+{
+    if (!mySendList.empty())
+    {
+        vector<uint32_t> sendList;
+        sendList.swap(mySendList);
+        for (auto i = sendList.begin(); i != sendList.end(); ++i)
+        {
+            auto c = myConns.find(*i);
+            if (c == myConns.end()) continue;
+            c->second.mySendScheduled = false;
+            if (c->second.myClient != nullptr && !c->second.mySendInFlight && !c->second.mySendQueue.empty())
+            {
+                submitSend(*i, c->second);
+            }
+        }
+    }
+    if (!myRearmList.empty())
+    {
+        vector<uint32_t> rearmList;
+        rearmList.swap(myRearmList);
+        for (auto i = rearmList.begin(); i != rearmList.end(); ++i)
+        {
+            auto c = myConns.find(*i);
+            if (c == myConns.end()) continue;
+            if (c->second.myClient != nullptr && c->second.myWantRead && !c->second.myRecvArmed)
+            {
+                armRecv(*i, c->second);
+            }
+        }
+    }
+    if (myListenFd >= 0 && !myAcceptArmed)
+    {
+        armAccept();
+    }
+    submit();
+    if (!myReleaseList.empty())
+    {
+        vector<uint32_t> releaseList;
+        releaseList.swap(myReleaseList);
+        for (auto i = releaseList.begin(); i != releaseList.end(); ++i)
+        {
+            releaseIfDone(*i);
+        }
+    }
+    if (!myClosed.empty())
+    {
+        vector<NetClientBase*> closed;
+        closed.swap(myClosed);
+        for (auto i = closed.begin(); i != closed.end(); ++i)
+        {
+            (*i)->onBackendClosed();
+        }
+    }
+}
+
+void UringBackend::handleAccept(struct io_uring_cqe const & cqe_in)
+{
+    if ((cqe_in.flags & IORING_CQE_F_MORE) == 0)
+    {
+        // re-armed with the next flush
+        myAcceptArmed = false;
+    }
+    if (cqe_in.res < 0)
+    {
+        if (cqe_in.res != -ECANCELED)
+        {
+            cerr << "New connection error " << ::uv_strerror(cqe_in.res) << endl;
+        }
+        return;
+    }
+    ++myAccepts;
+    if (myHandler == nullptr)
+    {
+        ::close(cqe_in.res);
+        return;
+    }
+    myHandler->onBackendConnection(cqe_in.res);
+}
+
+void UringBackend::handleRecv(uint32_t connId_in, struct io_uring_cqe const & cqe_in)
+{
+    bool hasBuf = (cqe_in.flags & IORING_CQE_F_BUFFER) != 0;
+    uint16_t bufId = (uint16_t)(cqe_in.flags >> IORING_CQE_BUFFER_SHIFT);
+    auto i = myConns.find(connId_in);
+    if (i == myConns.end())
+    {
+        if (hasBuf) recycleBuffer(bufId);
+        return;
+    }
+    if ((cqe_in.flags & IORING_CQE_F_MORE) == 0)
+    {
+        i->second.myRecvArmed = false;
+        if (i->second.myWantRead && i->second.myClient != nullptr)
+        {
+            myRearmList.push_back(connId_in);
+        }
+    }
+    NetClientBase* client = i->second.myClient;
+    if (cqe_in.res > 0)
+    {
+        ++myRecvs;
+        myRecvBytes += cqe_in.res;
+        if (client != nullptr && hasBuf)
+        {
+            // data is copied to the receive buffer
+            client->onReadData(myBufMem + (size_t)bufId * BufSize, cqe_in.res);
+        }
+    }
+    else if (cqe_in.res == 0)
+    {
+        if (client != nullptr)
+        {
+            client->onReadData(nullptr, UV_EOF);
+        }
+    }
+    else if (cqe_in.res == -ENOBUFS)
+    {
+        // out of provided buffers, re-armed with the next flush
+        ++myNoBufs;
+    }
+    else if (cqe_in.res != -ECANCELED)
+    {
+        if (client != nullptr)
+        {
+            client->onReadData(nullptr, cqe_in.res);
+        }
+    }
+    if (hasBuf)
+    {
+        recycleBuffer(bufId);
+    }
+    releaseIfDone(connId_in);
+}
+
+void UringBackend::handleSend(uint32_t connId_in, struct io_uring_cqe const & cqe_in)
+{
+    auto i = myConns.find(connId_in);
+    if (i == myConns.end())
+    {
+        return;
+    }
+    Conn & conn = i->second;
+    conn.mySendInFlight = false;
+    if (cqe_in.res < 0)
+    {
+        if (conn.myClient != nullptr && !conn.mySendQueue.empty())
+        {
+            // the client closes on error
+            size_t len = conn.mySendQueue.front()->size();
+            conn.mySendQueue.pop_front();
+            conn.mySendOffset = 0;
+            conn.myClient->onWriteCompleted(len, cqe_in.res);
+        }
+        releaseIfDone(connId_in);
+        return;
+    }
+    size_t sent = (size_t)cqe_in.res;
+    mySendBytes += sent;
+    while (sent > 0 && !conn.mySendQueue.empty())
+    {
+        size_t remaining = conn.mySendQueue.front()->size() - conn.mySendOffset;
+        if (sent < remaining)
+        {
+            // partial, rest is sent next
+            conn.mySendOffset += sent;
+            break;
+        }
+        sent -= remaining;
+        size_t len = conn.mySendQueue.front()->size();
+        conn.mySendQueue.pop_front();
+        conn.mySendOffset = 0;
+        if (conn.myClient != nullptr)
+        {
+            conn.myClient->onWriteCompleted(len, 0);
+        }
+    }
+    if (conn.myClient != nullptr && !conn.mySendQueue.empty())
+    {
+        scheduleSend(connId_in, conn);
+    }
+    releaseIfDone(connId_in);
+}
+
+void UringBackend::armAccept()
+{
+    struct io_uring_sqe* sqe = getSqe();
+    if (sqe == nullptr)
+    {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = myListenFd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = userData(OpAccept, 0);
+    myAcceptArmed = true;
+}
+
+void UringBackend::armRecv(uint32_t connId_in, Conn & conn_in)
+{
+    struct io_uring_sqe* sqe = getSqe();
+    if (sqe == nullptr)
+    {
+        myRearmList.push_back(connId_in);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn_in.myFd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BufGroup;
+    sqe->user_data = userData(OpRecv, connId_in);
+    conn_in.myRecvArmed = true;
+}
+
+void UringBackend::scheduleSend(uint32_t connId_in, Conn & conn_in)
+{
+    if (conn_in.mySendScheduled)
+    {
+        return;
+    }
+    conn_in.mySendScheduled = true;
+    mySendList.push_back(connId_in);
+}
+
+void UringBackend::submitSend(uint32_t connId_in, Conn & conn_in)
+{
+    // all queued buffers in one sendmsg
+    conn_in.myIov.clear();
+    for (auto b = conn_in.mySendQueue.begin(); b != conn_in.mySendQueue.end() && conn_in.myIov.size() < MaxIovPerSend; ++b)
+    {
+        size_t offset = conn_in.myIov.empty() ? conn_in.mySendOffset : 0;
+        struct iovec iov;
+        iov.iov_base = (void*)((*b)->data() + offset);
+        iov.iov_len = (*b)->size() - offset;
+        conn_in.myIov.push_back(iov);
+    }
+    ::memset(&conn_in.myMsg, 0, sizeof(conn_in.myMsg));
+    conn_in.myMsg.msg_iov = conn_in.myIov.data();
+    conn_in.myMsg.msg_iovlen = conn_in.myIov.size();
+    struct io_uring_sqe* sqe = getSqe();
+    if (sqe == nullptr)
+    {
+        scheduleSend(connId_in, conn_in);
+        return;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn_in.myFd;
+    sqe->addr = (uint64_t)&conn_in.myMsg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = userData(OpSend, connId_in);
+    conn_in.mySendInFlight = true;
+    ++mySendCalls;
+    mySendBuffers += conn_in.myIov.size();
+}
+
+void UringBackend::recycleBuffer(uint16_t bufId_in)
+{
+    // the ring is an array of io_uring_buf, the tail overlays the first entry;
+    // not using the bufs member, its flexible array declaration has a different offset in C++
+    struct io_uring_buf* buf = ((struct io_uring_buf*)myBufRing) + (myBufTail & (BufRingEntries - 1));
+    buf->addr = (uint64_t)(myBufMem + (size_t)bufId_in * BufSize);
+    buf->len = BufSize;
+    buf->bid = bufId_in;
+    ++myBufTail;
+    __atomic_store_n(&myBufRing->tail, myBufTail, __ATOMIC_RELEASE);
+}
+
+void UringBackend::releaseIfDone(uint32_t connId_in)
+{
+    auto i = myConns.find(connId_in);
+    if (i == myConns.end())
+    {
+        return;
+    }
+    if (i->second.myClient != nullptr || i->second.myRecvArmed || i->second.mySendInFlight)
+    {
+        return;
+    }
+    ::close(i->second.myFd);
+    myConns.erase(i);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+// io_uring socket backend, Linux only; built with the TCP_LIBUV_IO_URING CMake option.
+
+#include "io_backend.hpp"
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <uv.h>
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+
+namespace sample
+{
+    /**
+     * io_uring socket backend: multishot accept, multishot recv into a provided buffer ring,
+     * and sends batched per connection (one sendmsg with all queued buffers).
+     * Submissions are collected, and submitted once per loop phase (prepare and check);
+     * completions are signalled through an eventfd, polled by the libuv loop.
+     */
+    class UringBackend: public IoBackend
+    {
+    public:
+        UringBackend();
+        virtual ~UringBackend();
+        std::string getName() const { return "uring"; }
+        int init(uv_loop_t* loop_in);
+        int listen(int port_in, NetHandler* handler_in);
+        void attach(NetClientBase* client_in, int fd_in);
+        int readStart(NetClientBase* client_in);
+        int readStop(NetClientBase* client_in);
+        int write(NetClientBase* client_in, SharedBuffer const & buf_in);
+        void close(NetClientBase* client_in);
+        void detach(NetClientBase* client_in);
+        void printStats();
+
+    private:
+        enum Op
+        {
+            OpAccept = 1,
+            OpRecv = 2,
+            OpSend = 3,
+            OpCancel = 4
+        };
+
+        class Conn
+        {
+        public:
+            Conn() : myClient(nullptr), myFd(-1), myWantRead(false), myRecvArmed(false), mySendInFlight(false), mySendScheduled(false), mySendOffset(0) { }
+            // nullptr once closed
+            NetClientBase* myClient;
+            int myFd;
+            bool myWantRead;
+            bool myRecvArmed;
+            bool mySendInFlight;
+            bool mySendScheduled;
+            // buffers to send, in order; the first ones are in flight, they are kept until completion
+            std::deque<SharedBuffer> mySendQueue;
+            // bytes of the first buffer already sent
+            size_t mySendOffset;
+            struct msghdr myMsg;
+            std::vector<struct iovec> myIov;
+        };
+
+        static const unsigned RingEntries = 1024;
+        static const unsigned BufRingEntries = 512; // power of 2
+        static const unsigned BufSize = 16384;
+        static const uint16_t BufGroup = 1;
+        static const size_t MaxIovPerSend = 64;
+
+        static uint64_t userData(Op op_in, uint32_t id_in) { return ((uint64_t)op_in << 32) | id_in; }
+        static void on_poll(uv_poll_t* handle, int status, int events);
+        static void on_prepare(uv_prepare_t* handle);
+        static void on_check(uv_check_t* handle);
+        /// Next free submission entry, nullptr if the ring is full even after submitting
+        struct io_uring_sqe* getSqe();
+        int submit();
+        /// Process completions
+        void reap();
+        /// Send queued buffers, re-arm, submit, report closed connections; once per loop phase
+        void flush();
+        void handleAccept(struct io_uring_cqe const & cqe_in);
+        void handleRecv(uint32_t connId_in, struct io_uring_cqe const & cqe_in);
+        void handleSend(uint32_t connId_in, struct io_uring_cqe const & cqe_in);
+        void armAccept();
+        void armRecv(uint32_t connId_in, Conn & conn_in);
+        void submitSend(uint32_t connId_in, Conn & conn_in);
+        void scheduleSend(uint32_t connId_in, Conn & conn_in);
+        void recycleBuffer(uint16_t bufId_in);
+        /// Remove a closed connection, once it has no operations in flight
+        void releaseIfDone(uint32_t connId_in);
+
+    private:
+        int myRingFd;
+        void* mySqRing;
+        size_t mySqRingSize;
+        void* myCqRing;
+        size_t myCqRingSize;
+        struct io_uring_sqe* mySqes;
+        size_t mySqesSize;
+        unsigned mySqEntries;
+        unsigned* mySqHead;
+        unsigned* mySqTail;
+        unsigned* mySqFlags;
+        unsigned mySqMask;
+        unsigned* mySqArray;
+        unsigned* myCqHead;
+        unsigned* myCqTail;
+        unsigned myCqMask;
+        struct io_uring_cqe* myCqes;
+        // entries added since the last submit
+        unsigned myToSubmit;
+        struct io_uring_buf_ring* myBufRing;
+        size_t myBufRingSize;
+        uint16_t myBufTail;
+        char* myBufMem;
+        int myEventFd;
+        int myListenFd;
+        bool myAcceptArmed;
+        NetHandler* myHandler;
+        uv_poll_t* myUvPoll;
+        uv_prepare_t* myUvPrepare;
+        uv_check_t* myUvCheck;
+        // by connection ID
+        std::map<uint32_t, Conn> myConns;
+        std::vector<uint32_t> mySendList;
+        std::vector<uint32_t> myRearmList;
+        std::vector<uint32_t> myReleaseList;
+        std::vector<NetClientBase*> myClosed;
+        // statistics
+        uint64_t myEnterCalls;
+        uint64_t mySubmitted;
+        uint64_t myCompletions;
+        uint64_t myAccepts;
+        uint64_t myRecvs;
+        uint64_t myRecvBytes;
+        uint64_t myNoBufs;
+        uint64_t mySendCalls;
+        uint64_t mySendBuffers;
+        uint64_t mySendBytes;
+    };
+}
@@ -1,7 +1,5 @@
 #include "uv_socket.hpp"
 
-#include <string.h>
-
 using namespace sample;
 
 UvWriteRequest::UvWriteRequest(IUvSocket* uvSocket_in, int nbuf_in) :
@@ -13,16 +11,19 @@ bufs(new uv_buf_t[nbuf_in])
 
 UvWriteRequest::~UvWriteRequest()
 {
-    for (int i = 0; i < nbuf; ++i) delete[] bufs[i].base;
+    // buffers are released with refs
     delete[] bufs;
 }
 
 void UvWriteRequest::add(std::vector<uint8_t> const & buf_in)
 {
-    size_t bufsize = buf_in.size();
-    uint8_t* buf2 = new uint8_t[bufsize];
-    ::memcpy(buf2, &buf_in[0], bufsize);
-    uv_buf_t uvbuf = ::uv_buf_init((char*)&buf2[0], bufsize);
+    add(std::make_shared<std::vector<uint8_t> const>(buf_in));
+}
+
+void UvWriteRequest::add(SharedBuffer const & buf_in)
+{
+    refs.push_back(buf_in);
+    uv_buf_t uvbuf = ::uv_buf_init((char*)buf_in->data(), buf_in->size());
     bufs[nbuf] = uvbuf;
     ++nbuf;
 }
@@ -1,9 +1,12 @@
 #pragma once
 
+#include "trace.hpp"
+
 #include <uv.h>
 
+#include <iostream>
+#include <memory>
 #include <vector>
-//#include <iostream>
 
 namespace sample
 {
@@ -23,6 +26,9 @@ namespace sample
         virtual void onTimer(uv_timer_t* timer) { }
     };
 
+    /// Immutable buffer, can be shared by several write requests (e.g. same message sent to many peers).
+    typedef std::shared_ptr<std::vector<uint8_t> const> SharedBuffer;
+
     // Used together with write requests, keeps reference to write buffer while needed.
     class UvWriteRequest
     {
@@ -31,10 +37,84 @@ namespace sample
         IUvSocket* uvSocket;
         uv_buf_t* bufs;
         int nbuf;
+        // keeps the buffers alive until the write is done
+        std::vector<SharedBuffer> refs;
 
     public:
         UvWriteRequest(IUvSocket* uvSocket_in, int nbuf_in);
         ~UvWriteRequest();
+        /// Add a copy of the buffer
         void add(std::vector<uint8_t> const & buf_in);
+        /// Add a shared buffer, without copy
+        void add(SharedBuffer const & buf_in);
+    };
+
+    /**
+     * Static libuv callbacks for a socket class T known at compile time.
+     * Handle data holds the IUvSocket pointer of the object (as with the virtual callbacks), it is converted
+     * to T with static_cast (no RTTI), and the handler of T is called directly, without virtual dispatch.
+     * Handlers used this way should be final in T.
+     */
+    template <class T>
+    class UvCallbacks
+    {
+    public:
+        static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
+        {
+            ScopedTrace trace("on_read", "uv", "nread", (uint64_t)nread);
+            T* socket = socketOf(stream->data);
+            if (socket == nullptr)
+            {
+                std::cerr << "Fatal error: uvSocket is nullptr " << std::endl;
+                return;
+            }
+            socket->T::onRead(stream, nread, buf);
+        }
+
+        static void on_write(uv_write_t* req, int status)
+        {
+            ScopedTrace trace("on_write", "uv");
+            UvWriteRequest* wrreq = (UvWriteRequest*)req->data;
+            if (wrreq == nullptr)
+            {
+                std::cerr << "Fatal error: uv_write_t->data is nullptr " << std::endl;
+                return;
+            }
+            T* socket = socketOf(wrreq->uvSocket);
+            if (socket == nullptr)
+            {
+                std::cerr << "Fatal error: uvSocket is nullptr " << std::endl;
+                return;
+            }
+            socket->T::onWrite(req, status);
+            delete wrreq;
+            delete req;
+        }
+
+        static void on_new_connection(uv_stream_t* server, int status)
+        {
+            ScopedTrace trace("on_new_connection", "uv");
+            T* socket = socketOf(server->data);
+            if (socket == nullptr)
+            {
+                std::cerr << "Fatal error: uvSocket is nullptr " << std::endl;
+                return;
+            }
+            socket->T::onNewConnection(server, status);
+        }
+
+        static void on_timer(uv_timer_t* timer)
+        {
+            ScopedTrace trace("on_timer", "uv");
+            T* socket = socketOf(timer->data);
+            if (socket == nullptr)
+            {
+                return;
+            }
+            socket->T::onTimer(timer);
+        }
+
+    private:
+        static T* socketOf(void* data_in) { return static_cast<T*>((IUvSocket*)data_in); }
     };
 }
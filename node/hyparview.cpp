@@ -0,0 +1,401 @@
+#include "hyparview.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace sample;
+using namespace std;
+
+
+HyParView::HyParView(HyParViewParams const & params_in, SendFunction send_in, DisconnectFunction disconnect_in, IsSelfFunction isSelf_in, uint32_t seed_in) :
+myParams(params_in),
+mySend(send_in),
+myDisconnect(disconnect_in),
+myIsSelf(isSelf_in),
+myRandom(seed_in),
+myNowMs(0),
+myLastShuffleMs(0)
+{
+}
+
+void HyParView::join(EndpointId contact_in)
+{
+    if (myIsSelf(contact_in) || isActive(contact_in))
+    {
+        return;
+    }
+    addActive(contact_in);
+    mySend(contact_in, MembershipMessage(MembershipMessage::Join));
+}
+
+void HyParView::addPassive(EndpointId peer_in)
+{
+    addPassiveInternal(peer_in, set<EndpointId>());
+}
+
+bool HyParView::isActive(EndpointId peer_in) const
+{
+    return std::find(myActive.begin(), myActive.end(), peer_in) != myActive.end();
+}
+
+void HyParView::onMessage(EndpointId from_in, MembershipMessage const & msg_in)
+{
+    switch (msg_in.getKind())
+    {
+        case MembershipMessage::Join:
+            {
+                // new node: take it, and spread it with random walks from all other active peers
+                ++myStats.joins;
+                addActive(from_in);
+                MembershipMessage fwd(MembershipMessage::ForwardJoin, EndpointTable::toString(from_in), myParams.activeRwl);
+                for (auto i = myActive.begin(); i != myActive.end(); ++i)
+                {
+                    if (*i != from_in)
+                    {
+                        mySend(*i, fwd);
+                    }
+                }
+            }
+            break;
+
+        case MembershipMessage::ForwardJoin:
+            handleForwardJoin(from_in, msg_in);
+            break;
+
+        case MembershipMessage::Disconnect:
+            ++myStats.disconnects;
+            if (removeActive(from_in))
+            {
+                addPassive(from_in);
+            }
+            myDisconnect(from_in);
+            break;
+
+        case MembershipMessage::Neighbor:
+            // TTL is the priority: 1 (high) if the requester has no active peers, must be accepted
+            ++myStats.neighborRequests;
+            if (isActive(from_in) || msg_in.getTtl() > 0 || (int)myActive.size() < myParams.activeSize)
+            {
+                addActive(from_in);
+                mySend(from_in, MembershipMessage(MembershipMessage::NeighborAccept));
+            }
+            else
+            {
+                mySend(from_in, MembershipMessage(MembershipMessage::NeighborReject));
+            }
+            break;
+
+        case MembershipMessage::NeighborAccept:
+            ++myStats.neighborAccepted;
+            myPending.erase(from_in);
+            addActive(from_in);
+            break;
+
+        case MembershipMessage::NeighborReject:
+            ++myStats.neighborRejected;
+            myPending.erase(from_in);
+            if (!isActive(from_in))
+            {
+                myDisconnect(from_in);
+            }
+            break;
+
+        case MembershipMessage::Shuffle:
+            handleShuffle(from_in, msg_in);
+            break;
+
+        case MembershipMessage::ShuffleReply:
+            ++myStats.shuffleReplies;
+            integrate(toIds(msg_in.getEndpoints()), myLastShuffle);
+            myLastShuffle.clear();
+            if (!isActive(from_in) && !isPending(from_in))
+            {
+                // temporary connection of the reply
+                myDisconnect(from_in);
+            }
+            break;
+    }
+}
+
+void HyParView::handleForwardJoin(EndpointId from_in, MembershipMessage const & msg_in)
+{
+    ++myStats.forwardJoins;
+    EndpointId newPeer = toId(msg_in.getEndpoint());
+    if (newPeer == 0 || myIsSelf(newPeer))
+    {
+        return;
+    }
+    if (msg_in.getTtl() == myParams.passiveRwl)
+    {
+        addPassive(newPeer);
+    }
+    EndpointId next = 0;
+    if (msg_in.getTtl() > 0 && myActive.size() > 1)
+    {
+        next = randomActive(from_in, newPeer);
+    }
+    if (next == 0)
+    {
+        // end of the walk: new peer goes to the active view, it has to accept
+        if (!isActive(newPeer))
+        {
+            addActive(newPeer);
+            mySend(newPeer, MembershipMessage(MembershipMessage::Neighbor, "", 1));
+        }
+        return;
+    }
+    mySend(next, MembershipMessage(MembershipMessage::ForwardJoin, msg_in.getEndpoint(), msg_in.getTtl() - 1));
+}
+
+void HyParView::handleShuffle(EndpointId from_in, MembershipMessage const & msg_in)
+{
+    ++myStats.shuffles;
+    // origin is filled in by the first hop, as seen by it
+    EndpointId origin = msg_in.getEndpoint().empty() ? from_in : toId(msg_in.getEndpoint());
+    if (myIsSelf(origin))
+    {
+        return;
+    }
+    EndpointId next = 0;
+    if (msg_in.getTtl() > 1 && myActive.size() > 1)
+    {
+        next = randomActive(from_in, origin);
+    }
+    if (next != 0)
+    {
+        mySend(next, MembershipMessage(MembershipMessage::Shuffle, EndpointTable::toString(origin), msg_in.getTtl() - 1, msg_in.getEndpoints()));
+        return;
+    }
+    // end of the walk: answer with as many passive peers, and take the received ones (and the origin)
+    vector<EndpointId> reply = sample(myPassive, (int)msg_in.getEndpoints().size());
+    mySend(origin, MembershipMessage(MembershipMessage::ShuffleReply, "", 0, toStrings(reply)));
+    vector<EndpointId> received = toIds(msg_in.getEndpoints());
+    received.push_back(origin);
+    integrate(received, reply);
+}
+
+void HyParView::integrate(vector<EndpointId> const & peers_in, vector<EndpointId> const & sent_in)
+{
+    set<EndpointId> evictFirst(sent_in.begin(), sent_in.end());
+    for (auto i = peers_in.begin(); i != peers_in.end(); ++i)
+    {
+        addPassiveInternal(*i, evictFirst);
+    }
+}
+
+void HyParView::onPeerFailed(EndpointId peer_in)
+{
+    if (myPending.erase(peer_in) > 0)
+    {
+        // could not connect
+        ++myStats.failures;
+        removePassive(peer_in);
+    }
+    if (removeActive(peer_in))
+    {
+        ++myStats.failures;
+        fillActive();
+    }
+}
+
+void HyParView::onTimer(uint64_t nowMs_in)
+{
+    myNowMs = nowMs_in;
+    expirePending();
+    fillActive();
+    if (nowMs_in >= myLastShuffleMs + myParams.shufflePeriodMs)
+    {
+        myLastShuffleMs = nowMs_in;
+        shuffle();
+    }
+}
+
+void HyParView::fillActive()
+{
+    // one request per free slot at a time
+    vector<EndpointId> candidates;
+    for (auto i = myPassive.begin(); i != myPassive.end(); ++i)
+    {
+        if (!isPending(*i))
+        {
+            candidates.push_back(*i);
+        }
+    }
+    int toRequest = myParams.activeSize - (int)myActive.size() - (int)myPending.size();
+    vector<EndpointId> picked = sample(candidates, toRequest);
+    for (auto i = picked.begin(); i != picked.end(); ++i)
+    {
+        myPending[*i] = myNowMs;
+        mySend(*i, MembershipMessage(MembershipMessage::Neighbor, "", myActive.empty() ? 1 : 0));
+    }
+}
+
+void HyParView::expirePending()
+{
+    for (auto i = myPending.begin(); i != myPending.end(); )
+    {
+        if (myNowMs < i->second + (uint64_t)myParams.neighborTimeoutMs)
+        {
+            ++i;
+            continue;
+        }
+        // the request or its answer is lost: as a failed connect, the slot is free for another candidate
+        ++myStats.neighborExpired;
+        EndpointId peer = i->first;
+        i = myPending.erase(i);
+        removePassive(peer);
+        if (!isActive(peer))
+        {
+            myDisconnect(peer);
+        }
+    }
+}
+
+void HyParView::shuffle()
+{
+    EndpointId target = randomActive(0, 0);
+    if (target == 0)
+    {
+        return;
+    }
+    vector<EndpointId> peers = sample(myActive, myParams.shuffleActive);
+    peers.erase(std::remove(peers.begin(), peers.end(), target), peers.end());
+    vector<EndpointId> passive = sample(myPassive, myParams.shufflePassive);
+    peers.insert(peers.end(), passive.begin(), passive.end());
+    myLastShuffle = peers;
+    mySend(target, MembershipMessage(MembershipMessage::Shuffle, "", myParams.activeRwl, toStrings(peers)));
+}
+
+void HyParView::addActive(EndpointId peer_in)
+{
+    if (myIsSelf(peer_in) || isActive(peer_in))
+    {
+        return;
+    }
+    removePassive(peer_in);
+    if ((int)myActive.size() >= myParams.activeSize)
+    {
+        dropRandomActive();
+    }
+    myActive.push_back(peer_in);
+}
+
+void HyParView::dropRandomActive()
+{
+    if (myActive.empty())
+    {
+        return;
+    }
+    size_t idx = uniform_int_distribution<size_t>(0, myActive.size() - 1)(myRandom);
+    EndpointId peer = myActive[idx];
+    myActive.erase(myActive.begin() + idx);
+    // the peer closes the connection on Disconnect, after the message is out
+    mySend(peer, MembershipMessage(MembershipMessage::Disconnect));
+    addPassive(peer);
+}
+
+bool HyParView::removeActive(EndpointId peer_in)
+{
+    auto i = std::find(myActive.begin(), myActive.end(), peer_in);
+    if (i == myActive.end())
+    {
+        return false;
+    }
+    myActive.erase(i);
+    return true;
+}
+
+void HyParView::addPassiveInternal(EndpointId peer_in, set<EndpointId> const & evictFirst_in)
+{
+    if (peer_in == 0 || myIsSelf(peer_in) || isActive(peer_in) || std::find(myPassive.begin(), myPassive.end(), peer_in) != myPassive.end())
+    {
+        return;
+    }
+    if ((int)myPassive.size() >= myParams.passiveSize)
+    {
+        if (myPassive.empty())
+        {
+            return;
+        }
+        // evict one that was sent away in a shuffle, or a random one
+        size_t idx = myPassive.size();
+        for (size_t j = 0; j < myPassive.size(); ++j)
+        {
+            if (evictFirst_in.count(myPassive[j]) > 0)
+            {
+                idx = j;
+                break;
+            }
+        }
+        if (idx == myPassive.size())
+        {
+            idx = uniform_int_distribution<size_t>(0, myPassive.size() - 1)(myRandom);
+        }
+        myPassive.erase(myPassive.begin() + idx);
+    }
+    myPassive.push_back(peer_in);
+}
+
+bool HyParView::removePassive(EndpointId peer_in)
+{
+    auto i = std::find(myPassive.begin(), myPassive.end(), peer_in);
+    if (i == myPassive.end())
+    {
+        return false;
+    }
+    myPassive.erase(i);
+    return true;
+}
+
+EndpointId HyParView::randomActive(EndpointId except1_in, EndpointId except2_in)
+{
+    vector<EndpointId> candidates;
+    for (auto i = myActive.begin(); i != myActive.end(); ++i)
+    {
+        if (*i != except1_in && *i != except2_in)
+        {
+            candidates.push_back(*i);
+        }
+    }
+    if (candidates.empty())
+    {
+        return 0;
+    }
+    return candidates[uniform_int_distribution<size_t>(0, candidates.size() - 1)(myRandom)];
+}
+
+vector<EndpointId> HyParView::sample(vector<EndpointId> const & from_in, int count_in)
+{
+    vector<EndpointId> result = from_in;
+    std::shuffle(result.begin(), result.end(), myRandom);
+    if (count_in < 0) count_in = 0;
+    if ((int)result.size() > count_in)
+    {
+        result.resize(count_in);
+    }
+    return result;
+}
+
+vector<EndpointId> HyParView::toIds(vector<string> const & endpoints_in)
+{
+    vector<EndpointId> peers;
+    for (auto i = endpoints_in.begin(); i != endpoints_in.end(); ++i)
+    {
+        EndpointId peer = toId(*i);
+        if (peer != 0)
+        {
+            peers.push_back(peer);
+        }
+    }
+    return peers;
+}
+
+vector<string> HyParView::toStrings(vector<EndpointId> const & peers_in)
+{
+    vector<string> endpoints;
+    for (auto i = peers_in.begin(); i != peers_in.end(); ++i)
+    {
+        endpoints.push_back(EndpointTable::toString(*i));
+    }
+    return endpoints;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "../lib/endpoint_table.hpp"
+#include "../lib/message.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace sample
+{
+    struct HyParViewParams
+    {
+    public:
+        HyParViewParams() : activeSize(5), passiveSize(30), activeRwl(6), passiveRwl(3), shuffleActive(3), shufflePassive(4), shufflePeriodMs(10000), neighborTimeoutMs(10000) { }
+        /// Max. number of active peers (connected)
+        int activeSize;
+        /// Max. number of passive peers (known, not connected)
+        int passiveSize;
+        /// Random walk length of a join (active view of the end node)
+        int activeRwl;
+        /// Hop of the join random walk where the new node goes to the passive view
+        int passiveRwl;
+        /// Number of active and passive peers sent in a shuffle
+        int shuffleActive;
+        int shufflePassive;
+        int shufflePeriodMs;
+        /// A Neighbor request without answer (lost, or the peer is gone silently) is given up after this time
+        int neighborTimeoutMs;
+    };
+
+    struct HyParViewStats
+    {
+    public:
+        HyParViewStats() : joins(0), forwardJoins(0), neighborRequests(0), neighborAccepted(0), neighborRejected(0), disconnects(0), shuffles(0), shuffleReplies(0), failures(0), neighborExpired(0) { }
+        uint64_t joins;
+        uint64_t forwardJoins;
+        uint64_t neighborRequests;
+        uint64_t neighborAccepted;
+        uint64_t neighborRejected;
+        uint64_t disconnects;
+        uint64_t shuffles;
+        uint64_t shuffleReplies;
+        uint64_t failures;
+        /// Neighbor requests given up without answer, see HyParViewParams::neighborTimeoutMs
+        uint64_t neighborExpired;
+    };
+
+    /**
+     * HyParView membership: a small active view (connected peers, symmetric), and a larger passive view
+     * (known peers, for repair).  New nodes join through a contact, and are spread with random walks;
+     * the passive views are refreshed by periodic shuffles; a failed active peer is replaced from the passive view.
+     * Every node keeps a bounded number of connections, while the overlay stays connected.
+     * Peers are endpoints, by ID (see EndpointTable), formatted only in the messages; messages go through a function, which connects if needed.
+     */
+    class HyParView
+    {
+    public:
+        typedef std::function<void(EndpointId peer_in, MembershipMessage const & msg_in)> SendFunction;
+        /// Close the connection(s) to a peer, it is no longer in the active view
+        typedef std::function<void(EndpointId peer_in)> DisconnectFunction;
+        typedef std::function<bool(EndpointId peer_in)> IsSelfFunction;
+
+        HyParView(HyParViewParams const & params_in, SendFunction send_in, DisconnectFunction disconnect_in, IsSelfFunction isSelf_in, uint32_t seed_in);
+        /// Join the overlay through a contact peer
+        void join(EndpointId contact_in);
+        /// A peer learned otherwise (peer store, peer exchange), goes to the passive view
+        void addPassive(EndpointId peer_in);
+        void onMessage(EndpointId from_in, MembershipMessage const & msg_in);
+        /// The connection to a peer is lost, or could not be established
+        void onPeerFailed(EndpointId peer_in);
+        /// Periodic: expire unanswered Neighbor requests, fill the active view from the passive one, shuffle
+        void onTimer(uint64_t nowMs_in);
+        bool isActive(EndpointId peer_in) const;
+        bool isPending(EndpointId peer_in) const { return myPending.count(peer_in) > 0; }
+        std::vector<EndpointId> const & getActiveView() const { return myActive; }
+        std::vector<EndpointId> const & getPassiveView() const { return myPassive; }
+        HyParViewStats const & getStats() const { return myStats; }
+
+    private:
+        /// Add to the active view; if full, a random one is dropped
+        void addActive(EndpointId peer_in);
+        void dropRandomActive();
+        bool removeActive(EndpointId peer_in);
+        void addPassiveInternal(EndpointId peer_in, std::set<EndpointId> const & evictFirst_in);
+        bool removePassive(EndpointId peer_in);
+        /// Random active peer, except the given ones; 0 if none
+        EndpointId randomActive(EndpointId except1_in, EndpointId except2_in);
+        std::vector<EndpointId> sample(std::vector<EndpointId> const & from_in, int count_in);
+        void fillActive();
+        void expirePending();
+        void shuffle();
+        void handleForwardJoin(EndpointId from_in, MembershipMessage const & msg_in);
+        void handleShuffle(EndpointId from_in, MembershipMessage const & msg_in);
+        void integrate(std::vector<EndpointId> const & peers_in, std::vector<EndpointId> const & sent_in);
+        /// Endpoints of a message, and for a message
+        static EndpointId toId(std::string const & endpoint_in) { return endpoint_in.empty() ? 0 : EndpointTable::intern(endpoint_in); }
+        static std::vector<EndpointId> toIds(std::vector<std::string> const & endpoints_in);
+        static std::vector<std::string> toStrings(std::vector<EndpointId> const & peers_in);
+
+    private:
+        HyParViewParams myParams;
+        SendFunction mySend;
+        DisconnectFunction myDisconnect;
+        IsSelfFunction myIsSelf;
+        std::mt19937 myRandom;
+        std::vector<EndpointId> myActive;
+        std::vector<EndpointId> myPassive;
+        // Neighbor requests sent, waiting for the answer, with the time sent
+        std::map<EndpointId, uint64_t> myPending;
+        // time of the last onTimer
+        uint64_t myNowMs;
+        // peers sent in the last shuffle, replaced first by the reply
+        std::vector<EndpointId> myLastShuffle;
+        uint64_t myLastShuffleMs;
+        HyParViewStats myStats;
+    };
+}
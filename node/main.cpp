@@ -1,5 +1,6 @@
 #include "node.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 using namespace sample;
@@ -12,6 +13,34 @@ void usage(AppParams const & params_in)
     cout << "Usage:  tcp-libuv-node [options]" << endl;
     cout << "  -peer [endpoint]   Extra PeerBoot peer.  Optional.  Example: -peer localhost:5500" << endl;
     cout << "  -port [port]       PeerBoot listening port.  0 for default.  Default: " << params_in.listenPort << endl;
+    cout << "  -peerdb [file]     Persist known peers in this file, and reconnect to them at start.  Optional." << endl;
+    cout << "  -maxframe [bytes]  Max. message size, longer ones close the connection.  Default: " << params_in.maxFrameSize << endl;
+    cout << "  -maxconnbuf [bytes]  Max. bytes buffered per connection.  Default: " << params_in.maxConnBufferedBytes << endl;
+    cout << "  -membudget [bytes] Max. bytes buffered by all connections, reading pauses above.  Default: " << params_in.memoryBudget << endl;
+    cout << "  -readbufmin [bytes]  Min. read buffer of a connection, it adapts to the reads within the bounds.  Default: " << params_in.readBufferMin << endl;
+    cout << "  -readbufmax [bytes]  Max. read buffer of a connection.  Default: " << params_in.readBufferMax << endl;
+    cout << "  -reqtimeout [ms]   Deadline of requests (Ping, Handshake).  Default: " << params_in.requestTimeoutMs << endl;
+    cout << "  -reqretries [n]    Retries of a timed out idempotent request (Ping, Handshake), with backoff.  Default: " << params_in.requestRetries << endl;
+    cout << "  -reqcloseafter [n] Close a connection after n requests timed out in a row, 0 for never.  Default: " << params_in.requestCloseAfter << endl;
+    cout << "  -capture [file]    Capture message frames into file, for tcp-libuv-replay.  Optional." << endl;
+    cout << "  -capture-sample [n]  Capture only every n-th connection.  Default: " << params_in.captureSampleEvery << endl;
+    cout << "  -iobackend [name]  Socket I/O of incoming connections: uv or uring (if built in).  Default: " << params_in.ioBackend << endl;
+    cout << "  -activeview [n]    Max. connected peers (membership active view), 0 to connect to every known peer.  Default: " << params_in.activeViewSize << endl;
+    cout << "  -passiveview [n]   Max. known, not connected peers (membership passive view).  Default: " << params_in.passiveViewSize << endl;
+    cout << "  -bulkdir [dir]     Store incoming bulk payloads in this directory (otherwise discarded).  Optional." << endl;
+    cout << "  -loopcpus [list]   Pin the loop thread to a CPU of this list, such as 2 or 0-3,8.  Optional." << endl;
+    cout << "  -workercpus [list] Pin the libuv threadpool threads to these CPUs, one each, round-robin.  Optional." << endl;
+    cout << "  -threadpool [n]    Number of libuv threadpool threads, 0 for the libuv default.  Default: " << params_in.threadpoolSize << endl;
+    cout << "  -ratemsgs [n]      Max. incoming messages per second, per connection, 0 for no limit.  Default: " << params_in.rateLimitMessages << endl;
+    cout << "  -ratebytes [n]     Max. incoming message bytes per second, per connection, 0 for no limit.  Default: " << params_in.rateLimitBytes << endl;
+    cout << "  -rateclass [list]  Limits per message class, messages/s and bytes/s, such as latency=100/0,bulk=1000/1000000.  Optional." << endl;
+    cout << "  -rateaction [name] Over the rate limits: delay (stop reading), drop or close.  Default: " << params_in.rateLimitAction << endl;
+    cout << "  -rateburst [ms]    Burst allowed by the rate limits, as time at the rate.  Default: " << params_in.rateLimitBurstMs << endl;
+    cout << "  -sendsched [mode]  Order of outgoing messages: strict (control, latency, then bulk) or weighted[:c,l,b].  Default: " << params_in.sendScheduling << endl;
+    cout << "  -sendwindow [bytes]  Max. bytes in progress on a socket, more wait in the send queues; 0 for no queuing.  Default: " << params_in.sendWindowBytes << endl;
+    cout << "  -trace [file]        Trace loop iterations, callbacks and connection events, written to file (Chrome trace JSON) at exit" << endl;
+    cout << "  -tracesize [n]       Events kept per thread while tracing, the oldest are dropped.  Default: " << params_in.traceEvents << endl;
+    cout << "  -stallms [ms]        Report loop iterations busy longer than this, with the callback running; 0 for no watchdog.  Default: " << params_in.loopStallMs << endl;
     cout << "Simple example:" << endl;
     cout << "  tcp-libuv-node -port 5005 -peer localhost:5000" << endl;
     cout << endl;
@@ -35,6 +64,174 @@ void processArgs(AppParams & params_inout, int argn, char ** argc)
             params_inout.listenPort = std::stoi(argc[i]);
             params_inout.listenPortRange = 1;  // port is given, only try that one
         }
+        else if (string(argc[i]) == "-peerdb")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.peerStoreFile = argc[i];
+        }
+        else if (string(argc[i]) == "-maxframe")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.maxFrameSize = (size_t)std::stoul(argc[i]);
+        }
+        else if (string(argc[i]) == "-maxconnbuf")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.maxConnBufferedBytes = (size_t)std::stoul(argc[i]);
+        }
+        else if (string(argc[i]) == "-membudget")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.memoryBudget = (size_t)std::stoul(argc[i]);
+        }
+        else if (string(argc[i]) == "-readbufmin")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.readBufferMin = (size_t)std::stoul(argc[i]);
+        }
+        else if (string(argc[i]) == "-readbufmax")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.readBufferMax = (size_t)std::stoul(argc[i]);
+        }
+        else if (string(argc[i]) == "-reqtimeout")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.requestTimeoutMs = std::stoi(argc[i]);
+        }
+        else if (string(argc[i]) == "-reqretries")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.requestRetries = std::stoi(argc[i]);
+        }
+        else if (string(argc[i]) == "-reqcloseafter")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.requestCloseAfter = std::stoi(argc[i]);
+        }
+        else if (string(argc[i]) == "-capture")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.captureFile = argc[i];
+        }
+        else if (string(argc[i]) == "-capture-sample")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.captureSampleEvery = std::max(std::stoi(argc[i]), 1);
+        }
+        else if (string(argc[i]) == "-iobackend")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.ioBackend = argc[i];
+        }
+        else if (string(argc[i]) == "-activeview")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.activeViewSize = std::max(std::stoi(argc[i]), 0);
+        }
+        else if (string(argc[i]) == "-passiveview")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.passiveViewSize = std::max(std::stoi(argc[i]), 1);
+        }
+        else if (string(argc[i]) == "-bulkdir")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.bulkDir = argc[i];
+        }
+        else if (string(argc[i]) == "-loopcpus")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.loopCpus = argc[i];
+        }
+        else if (string(argc[i]) == "-workercpus")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.workerCpus = argc[i];
+        }
+        else if (string(argc[i]) == "-threadpool")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.threadpoolSize = std::max(std::stoi(argc[i]), 0);
+        }
+        else if (string(argc[i]) == "-ratemsgs")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.rateLimitMessages = std::max(std::stod(argc[i]), 0.0);
+        }
+        else if (string(argc[i]) == "-ratebytes")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.rateLimitBytes = std::max(std::stod(argc[i]), 0.0);
+        }
+        else if (string(argc[i]) == "-rateclass")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.rateLimitClasses = argc[i];
+        }
+        else if (string(argc[i]) == "-rateaction")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.rateLimitAction = argc[i];
+        }
+        else if (string(argc[i]) == "-rateburst")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.rateLimitBurstMs = std::max(std::stoi(argc[i]), 1);
+        }
+        else if (string(argc[i]) == "-sendsched")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.sendScheduling = argc[i];
+        }
+        else if (string(argc[i]) == "-sendwindow")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.sendWindowBytes = (size_t)std::stoul(argc[i]);
+        }
+        else if (string(argc[i]) == "-trace")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.traceFile = argc[i];
+        }
+        else if (string(argc[i]) == "-stallms")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.loopStallMs = std::max(std::stoi(argc[i]), 0);
+        }
+        else if (string(argc[i]) == "-tracesize")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            params_inout.traceEvents = (size_t)std::stoul(argc[i]);
+        }
     }
 }
 
@@ -58,11 +255,52 @@ int main(int argn, char ** argc)
     processArgs(appParams, argn, argc);
     printArgs(appParams);
 
+    ServerApp::applyConnectionParams(appParams);
     NodeApp app;
     app.start(appParams);
 
-    cout << "Press Enter to exit ...";
-    cin.get();
+    cout << "Press Enter to exit, s + Enter to print stats, b <file> + Enter to send a file to the peers," << endl;
+    cout << "  sub <topic> / unsub <topic> / pub <topic> <text> + Enter for publish/subscribe, trace <file> + Enter to write the trace ..." << endl;
+    string line;
+    while (getline(cin, line))
+    {
+        if (line == "s")
+        {
+            app.printStats();
+            continue;
+        }
+        if (line.length() > 2 && line.substr(0, 2) == "b ")
+        {
+            app.sendBulkFile(line.substr(2));
+            continue;
+        }
+        if (line.substr(0, 4) == "sub " && line.length() > 4)
+        {
+            app.subscribe(line.substr(4));
+            continue;
+        }
+        if (line.substr(0, 6) == "unsub " && line.length() > 6)
+        {
+            app.unsubscribe(line.substr(6));
+            continue;
+        }
+        if (line.substr(0, 6) == "trace " && line.length() > 6)
+        {
+            NodeApp::writeTrace(line.substr(6));
+            continue;
+        }
+        if (line.substr(0, 4) == "pub ")
+        {
+            // pub topic text
+            size_t sep = line.find(' ', 4);
+            if (sep != string::npos && sep > 4)
+            {
+                app.publish(line.substr(4, sep - 4), line.substr(sep + 1));
+            }
+            continue;
+        }
+        break;
+    }
     cout << endl;
 
     app.stop();
@@ -1,11 +1,20 @@
 #include "node.hpp"
 #include "peer_conn.hpp"
 #include "endpoint.hpp"
+#include "../lib/capture.hpp"
 #include "../lib/net_handler.hpp"
 #include "../lib/net_client.hpp"
+#include "../lib/sim_network.hpp"
 
+#include <uv.h>
+
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <fcntl.h>
+#include <future>
 #include <iostream>
+#include <random>
 
 using namespace sample;
 using namespace std;
@@ -35,17 +44,71 @@ void NodeApp::PeerInfo::resetClient()
 
 
 NodeApp::NodeApp() :
-ServerApp()
+ServerApp(),
+myPubSub((uint32_t)std::random_device()(),
+    [this](PubSubRouter::LinkId link_in, SharedBuffer const & buf_in) { sendToLink(link_in, buf_in); },
+    [](PublishMessage const & msg_in) { cout << "App: Published on " << msg_in.getTopic() << ": '" << msg_in.getPayload() << "'" << endl; }),
+myListenPort(0)
 {
     myNetHandler = new NetHandler(this);
+    // replaces the Handshake handler of ServerApp
+    myMessageHandlers.add<HandshakeMessage>(MessageType::Handshake, this, &NodeApp::handleMessage);
+    myMessageHandlers.add<HandshakeResponseMessage>(MessageType::HandshakeResponse, this, &NodeApp::handleMessage);
+    myMessageHandlers.add<PingResponseMessage>(MessageType::PingResponse, this, &NodeApp::handleMessage);
+    myMessageHandlers.add<OtherPeerMessage>(MessageType::OtherPeer, this, &NodeApp::handleMessage);
+    myMessageHandlers.add<SubscribeMessage>(MessageType::Subscribe, this, &NodeApp::handleMessage);
+    myMessageHandlers.add<PublishMessage>(MessageType::Publish, this, &NodeApp::handleMessage);
+    myMessageHandlers.add<MembershipMessage>(MessageType::Membership, this, &NodeApp::handleMessage);
 }
 
 void NodeApp::start(AppParams const & appParams_in)
 {
+    applyThreadPlacement(appParams_in, myNetHandler);
+    applyIoBackend(appParams_in, myNetHandler);
+    applyLoopMonitor(appParams_in, myNetHandler);
+    applyTrace(appParams_in);
+    myTraceFile = appParams_in.traceFile;
+    myBulkDir = appParams_in.bulkDir;
+    // seeded: the same choices in each run, different ones on each node
+    uint32_t seed = appParams_in.randomSeed != 0 ? appParams_in.randomSeed : (uint32_t)std::random_device()();
+    myPubSub.setNodeId(seed);
+    if (appParams_in.activeViewSize > 0)
+    {
+        HyParViewParams params;
+        params.activeSize = appParams_in.activeViewSize;
+        params.passiveSize = std::max(appParams_in.passiveViewSize, appParams_in.activeViewSize);
+        myMembership.reset(new HyParView(params,
+            [this](EndpointId peer_in, MembershipMessage const & msg_in) { sendToPeer(peer_in, msg_in); },
+            [this](EndpointId peer_in) { disconnectPeer(peer_in); },
+            [this](EndpointId peer_in) { return isSelf(peer_in); },
+            seed));
+    }
+    // add stored peers, good ones are retried more
+    if (appParams_in.peerStoreFile.length() > 0)
+    {
+        if (myPeerStore.open(appParams_in.peerStoreFile, appParams_in.peerStoreCapacity) == 0)
+        {
+            auto stored = myPeerStore.getPeers();
+            for(auto i = stored.begin(); i != stored.end(); ++i)
+            {
+                if (myMembership)
+                {
+                    myMembership->addPassive(normalizeEndpoint(i->host, i->port));
+                    continue;
+                }
+                addOutPeerCandidate(i->host, i->port, i->successCount > 0 ? 3 : 1);
+            }
+        }
+    }
     // add constant peer candidates, for localhost
     int n = 2;
     for (int i = 0; i < n; ++i)
     {
+        if (myMembership)
+        {
+            myContacts.push_back(normalizeEndpoint("localhost", 5000 + i));
+            continue;
+        }
         addOutPeerCandidate("localhost", 5000 + i, 1);
     }
     // add extra peer candidates
@@ -56,11 +119,21 @@ void NodeApp::start(AppParams const & appParams_in)
             if (appParams_in.extraPeers[i].length() > 0)
             {
                 Endpoint extraPeerEp(appParams_in.extraPeers[i]);
+                if (myMembership)
+                {
+                    myContacts.push_back(normalizeEndpoint(extraPeerEp.getHost(), extraPeerEp.getPort()));
+                    continue;
+                }
                 addOutPeerCandidate(extraPeerEp.getHost(), extraPeerEp.getPort(), 1000000);
             }
         }
     }
 
+    if (appParams_in.captureFile.length() > 0)
+    {
+        CaptureFile::open(appParams_in.captureFile, appParams_in.captureSampleEvery, appParams_in.captureMaxSize);
+    }
+
     myNetHandler->startWithListen(appParams_in.listenPort, appParams_in.listenPortRange);
 }
 
@@ -68,6 +141,17 @@ void NodeApp::listenStarted(int port)
 {
     cout << "App: Listening on port " << port << endl;
     myName = ":" + to_string(port);
+    myListenPort = port;
+    if (myMembership)
+    {
+        // join through the contacts, the active view is filled and kept by the membership
+        for (auto i = myContacts.begin(); i != myContacts.end(); ++i)
+        {
+            myMembership->join(*i);
+        }
+        myMembershipTimer.start(MembershipTimerMs, MembershipTimerMs, [this]() { onMembershipTimer(); });
+        return;
+    }
     // try to connect to clients
     tryOutConnections();
 }
@@ -75,16 +159,17 @@ void NodeApp::listenStarted(int port)
 
 void NodeApp::addOutPeerCandidate(std::string host_in, int port_in, int toTry_in)
 {
-    PeerCandidateInfo pc = PeerCandidateInfo(host_in, port_in, toTry_in);
-    string key = host_in + ":" + to_string(port_in);
-    if (myPeerCands.find(key) != myPeerCands.end())
+    EndpointId key = EndpointTable::intern(host_in, port_in);
+    auto known = myPeerCands.find(key);
+    if (known != myPeerCands.end())
     {
         // already present
-        myPeerCands[key].myToTry = toTry_in + myPeerCands[key].myConnTryCount;
+        known->second.myToTry = toTry_in + known->second.myConnTryCount;
         return;
     }
-    myPeerCands[key] = pc;
-    cout << "App: Added peer candidate " << key << " " << myPeerCands.size() << endl;
+    myPeerCands[key] = PeerCandidateInfo(host_in, port_in, toTry_in);
+    myPeerStore.add(key);
+    cout << "App: Added peer candidate " << EndpointTable::toString(key) << " " << myPeerCands.size() << endl;
     //debugPrintPeerCands();
 }
 
@@ -93,7 +178,7 @@ void NodeApp::debugPrintPeerCands()
     cout << "PeerCands: " << myPeerCands.size() << "  ";
     for (auto i = myPeerCands.begin(); i != myPeerCands.end(); ++i)
     {
-        cout << "[" << i->first << " " << i->second.myToTry << " " << i->second.myConnTryCount << ":" << i->second.myConnectedCount << "] ";
+        cout << "[" << EndpointTable::toString(i->first) << " " << i->second.myToTry << " " << i->second.myConnTryCount << ":" << i->second.myConnectedCount << "] ";
     }
     cout << endl;
 }
@@ -125,6 +210,7 @@ void NodeApp::tryOutConnections()
             {
                 // try outgoing connection
                 ++i->second.myConnTryCount;
+                myPeerStore.connectTried(i->first);
                 int res = tryOutConnection(i->second.myHost, i->second.myPort);
                 if (!res)
                 {
@@ -136,7 +222,7 @@ void NodeApp::tryOutConnections()
     }
 }
 
-bool NodeApp::isPeerConnected(string peerAddr_in, bool outDir_in)
+bool NodeApp::isPeerConnected(EndpointId peer_in, bool outDir_in)
 {
     for(auto i = myPeers.begin(); i != myPeers.end(); ++i)
     {
@@ -144,7 +230,7 @@ bool NodeApp::isPeerConnected(string peerAddr_in, bool outDir_in)
         {
             if (i->myClient != nullptr)
             {
-                if (i->myClient->getPeerAddr() == peerAddr_in || i->myClient->getCanonPeerAddr() == peerAddr_in)
+                if (i->myClient->getPeerId() == peer_in || i->myClient->getCanonPeerId() == peer_in)
                 {
                     return true;
                 }
@@ -166,15 +252,15 @@ int NodeApp::tryOutConnection(std::string host_in, int port_in)
         }
     }
     // try outgoing connection
-    Endpoint ep = Endpoint(host_in, port_in);
-    string key = ep.getEndpoint();
-    //cout << "Trying outgoing conn to " << key << endl;
+    //cout << "Trying outgoing conn to " << host_in << ":" << port_in << endl;
     auto peerout = make_shared<PeerClientOut>(this, host_in, port_in);
-    auto peerBase = dynamic_pointer_cast<NetClientBase>(peerout);
+    shared_ptr<NetClientBase> peerBase = peerout;
     PeerInfo p;
     p.setClient(peerBase);
     p.myOutFlag = true;
+    p.myAddedMs = LoopTimer::now();
     myPeers.push_back(p);
+    peerout->setConnectBackend(myNetHandler->getIoBackend());
     int res = peerout->connect();
     if (res)
     {
@@ -188,16 +274,116 @@ int NodeApp::tryOutConnection(std::string host_in, int port_in)
 void NodeApp::stop()
 {
     myNetHandler->stop();
+    CaptureFile::close();
+    myPeerStore.close();
+    if (myTraceFile.length() > 0)
+    {
+        writeTrace(myTraceFile);
+    }
+}
+
+void NodeApp::useOwnLoop()
+{
+    myNetHandler->useOwnLoop();
+}
+
+void NodeApp::useSimulation(SimNetwork & network_in, string const & host_in)
+{
+    myNetHandler->setSimulation(&network_in, new SimBackend(network_in, host_in));
+}
+
+int NodeApp::getStatus(NodeStatus & status_out, int timeoutMs_in)
+{
+    if (myNetHandler->isSimulated())
+    {
+        // same thread
+        status_out = doGetStatus();
+        return 0;
+    }
+    // shared: a late answer is set after we have given up
+    auto status = make_shared<promise<NodeStatus>>();
+    future<NodeStatus> result = status->get_future();
+    myNetHandler->post([this, status]() { status->set_value(doGetStatus()); });
+    if (result.wait_for(chrono::milliseconds(std::max(timeoutMs_in, 0))) != future_status::ready)
+    {
+        return UV_ETIMEDOUT;
+    }
+    status_out = result.get();
+    return 0;
+}
+
+NodeStatus NodeApp::doGetStatus() const
+{
+    NodeStatus status;
+    status.listenPort = myListenPort;
+    for (auto i = myPeers.begin(); i != myPeers.end(); ++i)
+    {
+        if (i->myClient != nullptr && i->myClient->isConnected())
+        {
+            status.connectedPeers.push_back(i->myClient->getNicePeerAddr());
+        }
+    }
+    if (myMembership)
+    {
+        for (auto i = myMembership->getActiveView().begin(); i != myMembership->getActiveView().end(); ++i)
+        {
+            status.activePeers.push_back(EndpointTable::toString(*i));
+        }
+        status.knownPeers = status.activePeers;
+        for (auto i = myMembership->getPassiveView().begin(); i != myMembership->getPassiveView().end(); ++i)
+        {
+            status.knownPeers.push_back(EndpointTable::toString(*i));
+        }
+        return status;
+    }
+    for (auto i = myPeerCands.begin(); i != myPeerCands.end(); ++i)
+    {
+        status.knownPeers.push_back(EndpointTable::toString(i->first));
+    }
+    return status;
+}
+
+void NodeApp::printStats()
+{
+    myNetHandler->post([this]()
+    {
+        vector<NetClientBase*> clients;
+        for(auto i = myPeers.begin(); i != myPeers.end(); ++i)
+        {
+            clients.push_back(i->myClient.get());
+        }
+        printConnectionStats(clients);
+        printIoBackendStats(myNetHandler);
+        printThreadStats();
+        printLoopStats(myNetHandler);
+        printStageStats();
+        if (myMembership)
+        {
+            HyParViewStats const & ms = myMembership->getStats();
+            cout << "  membership: active " << myMembership->getActiveView().size() << " [";
+            for (auto i = myMembership->getActiveView().begin(); i != myMembership->getActiveView().end(); ++i)
+            {
+                cout << (i == myMembership->getActiveView().begin() ? "" : " ") << EndpointTable::toString(*i);
+            }
+            cout << "] passive " << myMembership->getPassiveView().size() << " joins " << ms.joins << " forward-joins " << ms.forwardJoins
+                << " neighbor " << ms.neighborRequests << "/" << ms.neighborAccepted << "/" << ms.neighborRejected << " disconnects " << ms.disconnects
+                << " shuffles " << ms.shuffles << "/" << ms.shuffleReplies << " failures " << ms.failures << " neighbor-expired " << ms.neighborExpired << endl;
+        }
+        PubSubStats const & ps = myPubSub.getStats();
+        cout << "  pubsub: links " << myPubSub.getLinkCount() << " published " << ps.published << " received " << ps.received
+            << " delivered " << ps.delivered << " duplicates " << ps.duplicates << " ttl-expired " << ps.ttlExpired
+            << " serialized " << ps.serialized << " forwarded " << ps.forwarded << " seen " << myPubSub.getSeenCount() << endl;
+    });
 }
 
 void NodeApp::inConnectionReceived(std::shared_ptr<NetClientBase>& client_in)
 {
     assert(client_in != nullptr);
-    string cliaddr = client_in->getPeerAddr();
-    cout << "App: New incoming connection: " << cliaddr << endl;
+    cout << "App: New incoming connection: " << client_in->getPeerAddr() << endl;
     PeerInfo p;
     p.setClient(client_in);
     p.myOutFlag = false;
+    p.myAddedMs = LoopTimer::now();
     myPeers.push_back(p);
     //debugPrintPeers();
 }
@@ -205,13 +391,15 @@ void NodeApp::inConnectionReceived(std::shared_ptr<NetClientBase>& client_in)
 void NodeApp::connectionClosed(NetClientBase* client_in)
 {
     assert(client_in != nullptr);
-    string cliaddr = client_in->getPeerAddr();
-    cout << "App: Connection done: " << cliaddr << " " << myPeers.size() << endl;
+    EndpointId cliaddr = client_in->getPeerId();
+    cout << "App: Connection done: " << client_in->getPeerAddr() << " " << myPeers.size() << endl;
+    myPubSub.linkRemoved(client_in->getConnId());
+    EndpointId peer = client_in->getNicePeerId();
     for(auto i = myPeers.begin(); i != myPeers.end(); ++i)
     {
         if (i->myClient != nullptr)
         {
-            if (i->myClient.get() == client_in || i->myClient->getPeerAddr() == cliaddr)
+            if (i->myClient.get() == client_in || i->myClient->getPeerId() == cliaddr)
             {
                 cout << "Removing disconnected client " << myPeers.size() << " " << i->myClient->getPeerAddr() << endl;
                 i->resetClient();
@@ -233,91 +421,243 @@ void NodeApp::connectionClosed(NetClientBase* client_in)
             }
         }
     }
+    if (myMembership && findPeerClient(peer, false) == nullptr)
+    {
+        // last connection to the peer
+        myPendingSends.erase(peer);
+        myMembership->onPeerFailed(peer);
+    }
 }
 
 void NodeApp::messageReceived(NetClientBase & client_in, BaseMessage const & msg_in)
 {
-    if (msg_in.getType() != MessageType::OtherPeer)
+    if (msg_in.getType() != MessageType::OtherPeer && msg_in.getType() != MessageType::Publish)
     {
         cout << "App: Received: from " << client_in.getNicePeerAddr() << " '" << msg_in.toString() << "'" << endl;
     }
-    switch (msg_in.getType())
-    {
-        case MessageType::Handshake:
-            {
-                HandshakeMessage const & hsMsg = dynamic_cast<HandshakeMessage const &>(msg_in);
-                //cout << "Handshake message received, '" << hsMsg.getMyAddr() << "'" << endl;
-                if (hsMsg.getMyVersion() != "V01")
-                {
-                    cerr << "Wrong version ''" << hsMsg.getMyVersion() << "'" << endl;
-                    client_in.close();
-                    return;
-                }
+    myMessageHandlers.dispatch(client_in, msg_in);
+}
 
-                string peerEp = client_in.getPeerAddr();
-                if (!isPeerConnected(peerEp, false))
-                {
-                    cerr << "Error: cannot find client in peers list " << peerEp << endl;
-                    return;
-                }
+void NodeApp::handleMessage(NetClientBase & client_in, HandshakeMessage const & msg_in)
+{
+    //cout << "Handshake message received, '" << msg_in.getMyAddr() << "'" << endl;
+    if (msg_in.getMyVersion() != "V01")
+    {
+        cerr << "Wrong version ''" << msg_in.getMyVersion() << "'" << endl;
+        client_in.close();
+        return;
+    }
 
-                HandshakeResponseMessage resp("V01", myName, peerEp);
-                client_in.sendMessage(resp);
+    string const & peerEp = client_in.getPeerAddr();
+    if (!isPeerConnected(client_in.getPeerId(), false))
+    {
+        cerr << "Error: cannot find client in peers list " << peerEp << endl;
+        return;
+    }
 
-                // find canonical name of this peer: host is actual connected ip, port is reported by peer
-                int peerPort = Endpoint(peerEp).getPort();
-                string canonHost = Endpoint(peerEp).getHost();
-                int canonPort = peerPort;
-                string reportedPeerName = hsMsg.getMyAddr();
-                if (reportedPeerName.substr(0, 1) != ":")
-                {
-                    cerr << "Could not retrieve listening port of incoming peer " << client_in.getPeerAddr() << " " << reportedPeerName << endl;
-                }
-                else
-                {
-                    canonPort = stoi(reportedPeerName.substr(1));
-                    string canonEp = canonHost + ":" + to_string(canonPort);
-                    if (canonEp != peerEp)
-                    {
-                        // canonical is different
-                        cout << "Canonical peer of " << peerEp << " is " << canonEp << endl;
-                        client_in.setCanonPeerAddr(canonEp);
-
-                        // try to connect ougoing too (to canonical peer addr)
-                        addOutPeerCandidate(canonHost, canonPort, 1);
-                        tryOutConnections();
-                    }
-                }
-                sendOtherPeers(client_in);
-            }
-            break;
+    HandshakeResponseMessage resp("V01", myName, peerEp);
+    resp.setRequestId(msg_in.getRequestId());
+    client_in.sendMessage(resp);
 
-        case MessageType::Ping:
-            {
-                PingMessage const & pingMsg = dynamic_cast<PingMessage const &>(msg_in);
-                //cout << "Ping message received, '" << pingMsg.getText() << "'" << endl;
-                PingResponseMessage resp("Resp_from_" + myName + "_to_" + pingMsg.getText());
-                client_in.sendMessage(resp);
-            }
-            break;
+    // find canonical name of this peer: host is actual connected ip, port is reported by peer
+    string const & canonHost = EndpointTable::getHost(client_in.getPeerId());
+    int canonPort = EndpointTable::getPort(client_in.getPeerId());
+    string reportedPeerName = msg_in.getMyAddr();
+    if (reportedPeerName.substr(0, 1) != ":")
+    {
+        cerr << "Could not retrieve listening port of incoming peer " << client_in.getPeerAddr() << " " << reportedPeerName << endl;
+    }
+    else
+    {
+        canonPort = stoi(reportedPeerName.substr(1));
+        EndpointId canonEp = EndpointTable::intern(canonHost, canonPort);
+        if (canonEp != client_in.getPeerId())
+        {
+            // canonical is different
+            cout << "Canonical peer of " << peerEp << " is " << EndpointTable::toString(canonEp) << endl;
+            client_in.setCanonPeerId(canonEp);
 
-        case MessageType::OtherPeer:
+            if (!myMembership)
             {
-                OtherPeerMessage const & peerMsg = dynamic_cast<OtherPeerMessage const &>(msg_in);
-                //cout << "OtherPeer message received, " << peerMsg.getHost() << ":" << peerMsg.getPort() << " " << peerMsg.toString() << endl;
-                addOutPeerCandidate(peerMsg.getHost(), peerMsg.getPort(), 1);
+                // try to connect ougoing too (to canonical peer addr)
+                addOutPeerCandidate(canonHost, canonPort, 1);
                 tryOutConnections();
             }
-            break;
+        }
+    }
+    sendOtherPeers(client_in);
+    myPubSub.linkAdded(client_in.getConnId());
+}
 
-        case MessageType::HandshakeResponse:
-        case MessageType::PingResponse:
-            // OK, noop
-            break;
+void NodeApp::handleMessage(NetClientBase & client_in, OtherPeerMessage const & msg_in)
+{
+    //cout << "OtherPeer message received, " << msg_in.getHost() << ":" << msg_in.getPort() << " " << msg_in.toString() << endl;
+    if (myMembership)
+    {
+        // known, not connected
+        myPeerStore.add(EndpointTable::intern(msg_in.getHost(), msg_in.getPort()));
+        myMembership->addPassive(normalizeEndpoint(msg_in.getHost(), msg_in.getPort()));
+        return;
+    }
+    addOutPeerCandidate(msg_in.getHost(), msg_in.getPort(), 1);
+    tryOutConnections();
+}
+
+void NodeApp::handleMessage(NetClientBase & client_in, HandshakeResponseMessage const & msg_in)
+{
+    // handshake with outgoing peer done
+    myPeerStore.connectSucceeded(client_in.getPeerId());
+    myPubSub.linkAdded(client_in.getConnId());
+    if (msg_in.getYourAddr().length() > 0)
+    {
+        // how the peer sees us
+        mySelfHosts.insert(EndpointKey(Endpoint(msg_in.getYourAddr()).getHost(), 0).getHost());
+    }
+    // messages waiting for this connection
+    auto pending = myPendingSends.find(client_in.getNicePeerId());
+    if (pending != myPendingSends.end())
+    {
+        vector<SharedBuffer> bufs;
+        bufs.swap(pending->second);
+        myPendingSends.erase(pending);
+        for (auto i = bufs.begin(); i != bufs.end(); ++i)
+        {
+            client_in.sendBuffer(*i);
+        }
+    }
+}
 
-        default:
-            assert(false);
+void NodeApp::handleMessage(NetClientBase & client_in, MembershipMessage const & msg_in)
+{
+    if (!myMembership)
+    {
+        return;
     }
+    // the views may hold the peer after this connection is gone: its ID must not be reused
+    myMembership->onMessage(EndpointTable::keep(client_in.getNicePeerId()), msg_in);
+}
+
+void NodeApp::sendToPeer(EndpointId peer_in, BaseMessage const & msg_in)
+{
+    NetClientBase* client = findPeerClient(peer_in, true);
+    if (client != nullptr)
+    {
+        client->sendMessage(msg_in);
+        return;
+    }
+    // sent when connected, see HandshakeResponse
+    myPendingSends[peer_in].push_back(NetClientBase::serializeMessage(msg_in));
+    if (findPeerClient(peer_in, false) == nullptr)
+    {
+        tryOutConnection(EndpointTable::getHost(peer_in), EndpointTable::getPort(peer_in));
+    }
+}
+
+void NodeApp::disconnectPeer(EndpointId peer_in)
+{
+    myPendingSends.erase(peer_in);
+    for(auto i = myPeers.begin(); i != myPeers.end(); ++i)
+    {
+        if (i->myClient != nullptr && i->myClient->getNicePeerId() == peer_in)
+        {
+            i->myClient->close();
+        }
+    }
+}
+
+NetClientBase* NodeApp::findPeerClient(EndpointId peer_in, bool connectedOnly_in) const
+{
+    for(auto i = myPeers.begin(); i != myPeers.end(); ++i)
+    {
+        NetClientBase* client = i->myClient.get();
+        if (client == nullptr || client->getNicePeerId() != peer_in)
+        {
+            continue;
+        }
+        if (connectedOnly_in ? client->isConnected() : (client->getState() != NetClientBase::State::Closing && client->getState() != NetClientBase::State::Closed))
+        {
+            return client;
+        }
+    }
+    return nullptr;
+}
+
+bool NodeApp::isSelf(EndpointId peer_in) const
+{
+    if (EndpointTable::getPort(peer_in) != myListenPort)
+    {
+        return false;
+    }
+    string const & host = EndpointTable::getHost(peer_in);
+    return host == "localhost" || host == "127.0.0.1" || host == "::1" || host == "[::1]" || mySelfHosts.count(host) > 0;
+}
+
+EndpointId NodeApp::normalizeEndpoint(string const & host_in, int port_in)
+{
+    return EndpointTable::intern(host_in == "localhost" ? "127.0.0.1" : host_in, port_in);
+}
+
+void NodeApp::onMembershipTimer()
+{
+    uint64_t now = LoopTimer::now();
+    myMembership->onTimer(now);
+    for(auto i = myPeers.begin(); i != myPeers.end(); ++i)
+    {
+        if (i->myClient == nullptr || now < i->myAddedMs + MembershipGraceMs)
+        {
+            continue;
+        }
+        EndpointId peer = i->myClient->getNicePeerId();
+        if (!myMembership->isActive(peer) && !myMembership->isPending(peer))
+        {
+            i->myClient->close();
+        }
+    }
+}
+
+void NodeApp::handleMessage(NetClientBase & client_in, SubscribeMessage const & msg_in)
+{
+    myPubSub.onSubscribe(client_in.getConnId(), msg_in);
+}
+
+void NodeApp::handleMessage(NetClientBase & client_in, PublishMessage const & msg_in)
+{
+    myPubSub.onPublish(client_in.getConnId(), msg_in, LoopTimer::now());
+}
+
+void NodeApp::subscribe(string const & topic_in)
+{
+    myNetHandler->post([this, topic_in]() { myPubSub.subscribe(topic_in); });
+}
+
+void NodeApp::unsubscribe(string const & topic_in)
+{
+    myNetHandler->post([this, topic_in]() { myPubSub.unsubscribe(topic_in); });
+}
+
+void NodeApp::publish(string const & topic_in, string const & payload_in)
+{
+    myNetHandler->post([this, topic_in, payload_in]()
+    {
+        myPubSub.publish(topic_in, payload_in, LoopTimer::now());
+    });
+}
+
+void NodeApp::sendToLink(uint32_t connId_in, SharedBuffer const & buf_in)
+{
+    for(auto i = myPeers.begin(); i != myPeers.end(); ++i)
+    {
+        if (i->myClient != nullptr && i->myClient->getConnId() == connId_in)
+        {
+            i->myClient->sendBuffer(buf_in, MessageClass::BulkClass);
+            return;
+        }
+    }
+}
+
+void NodeApp::handleMessage(NetClientBase & client_in, PingResponseMessage const & msg_in)
+{
+    // OK, noop
 }
 
 void NodeApp::sendOtherPeers(NetClientBase & client_in)
@@ -325,38 +665,163 @@ void NodeApp::sendOtherPeers(NetClientBase & client_in)
     // send current outgoing connection addresses
     auto peers = getConnectedPeers();
     //cout << "NodeApp::sendOtherPeers " << peers.size() << " " << client_in.getPeerAddr() << endl;
+    // serialized messages are cached, the same ones are sent to every peer; drop the ones not connected any more
+    map<EndpointId, SharedBuffer> bufs;
     for(auto i = peers.begin(); i != peers.end(); ++i)
+    {
+        auto cached = myOtherPeerBufs.find(*i);
+        if (cached != myOtherPeerBufs.end())
+        {
+            bufs[*i] = cached->second;
+        }
+        else
+        {
+            bufs[*i] = NetClientBase::serializeMessage(OtherPeerMessage(EndpointTable::getHost(*i), EndpointTable::getPort(*i)));
+        }
+    }
+    myOtherPeerBufs.swap(bufs);
+    for(auto i = myOtherPeerBufs.begin(); i != myOtherPeerBufs.end(); ++i)
     {
         if (!client_in.isConnected())
         {
             return;
         }
-        string ep = i->getEndpoint();
-        //cout << ep << " " << client_in.getPeerAddr() << endl;
-        if (ep != client_in.getPeerAddr())
+        //cout << i->first << " " << client_in.getPeerAddr() << endl;
+        if (i->first != client_in.getPeerId())
         {
-            //cout << "sendOtherPeers " << client_in.getPeerAddr() << " " << i->getEndpoint() << endl;
-            client_in.sendMessage(OtherPeerMessage(i->getHost(), i->getPort()));
+            //cout << "sendOtherPeers " << client_in.getPeerAddr() << " " << i->first << endl;
+            // gossip, behind control and latency traffic
+            client_in.sendBuffer(i->second, MessageClass::BulkClass);
         }
     }
 }
 
-vector<Endpoint> NodeApp::getConnectedPeers() const
+int NodeApp::broadcastMessage(BaseMessage const & msg_in, NetClientBase const * except_in)
 {
-    // collect in a map to discard duplicates
-    map<string, int> peers;
+    vector<NetClientBase*> clients;
     for(auto i = myPeers.begin(); i != myPeers.end(); ++i)
     {
-        if (i->myClient != nullptr && i->myClient->isConnected() && i->myClient->getCanonPeerAddr().length() > 0)
+        if (i->myClient != nullptr && i->myClient.get() != except_in && i->myClient->isConnected())
         {
-            peers[i->myClient->getCanonPeerAddr()] = 1;
+            clients.push_back(i->myClient.get());
         }
     }
-    // convert to vector
-    vector<Endpoint> vec;
-    for(auto i = peers.begin(); i != peers.end(); ++i)
+    return NetHandler::broadcastMessage(msg_in, clients);
+}
+
+void NodeApp::sendBulkFile(string const & path_in)
+{
+    myNetHandler->post([this, path_in]()
+    {
+        uv_loop_t* loop = NetHandler::getUvLoop();
+        uv_fs_t req;
+        int fd = ::uv_fs_open(loop, &req, path_in.c_str(), O_RDONLY, 0, nullptr);
+        ::uv_fs_req_cleanup(&req);
+        if (fd < 0)
+        {
+            cerr << "App: Cannot open " << path_in << " " << ::uv_err_name(fd) << endl;
+            return;
+        }
+        int res = ::uv_fs_fstat(loop, &req, fd, nullptr);
+        uint64_t size = req.statbuf.st_size;
+        ::uv_fs_req_cleanup(&req);
+        if (res < 0)
+        {
+            cerr << "App: Cannot stat " << path_in << " " << ::uv_err_name(res) << endl;
+            ::uv_fs_close(loop, &req, fd, nullptr);
+            ::uv_fs_req_cleanup(&req);
+            return;
+        }
+        // file is shared by the transfers (reads are positioned), closed after the last one
+        shared_ptr<int> file(new int(fd), [](int* fd_in)
+        {
+            uv_fs_t closeReq;
+            ::uv_fs_close(NetHandler::getUvLoop(), &closeReq, *fd_in, nullptr);
+            ::uv_fs_req_cleanup(&closeReq);
+            delete fd_in;
+        });
+        string name = path_in.substr(path_in.find_last_of("/\\") + 1);
+        for(auto i = myPeers.begin(); i != myPeers.end(); ++i)
+        {
+            if (i->myClient == nullptr || !i->myClient->isConnected())
+            {
+                continue;
+            }
+            string peerAddr = i->myClient->getNicePeerAddr();
+            res = i->myClient->sendBulkFile(name, fd, 0, size, [file, name, peerAddr](uint64_t sent_in, uint64_t total_in, int status_in)
+            {
+                if (status_in != 0)
+                {
+                    cerr << "App: Bulk send of " << name << " to " << peerAddr << " failed " << ::uv_err_name(status_in) << " " << sent_in << "/" << total_in << endl;
+                }
+                else if (sent_in >= total_in)
+                {
+                    cout << "App: Bulk sent " << name << " " << total_in << " to " << peerAddr << endl;
+                }
+            });
+            if (res)
+            {
+                cerr << "App: Bulk send of " << name << " to " << peerAddr << " not started " << ::uv_err_name(res) << endl;
+            }
+        }
+    });
+}
+
+BulkTarget NodeApp::bulkReceiveStarted(NetClientBase & client_in, BulkMessage const & msg_in)
+{
+    BulkTarget target;
+    if (myBulkDir.empty())
+    {
+        return target;
+    }
+    // no directories from the peer
+    string name = msg_in.getName().substr(msg_in.getName().find_last_of("/\\") + 1);
+    if (name.empty() || name == "." || name == "..")
+    {
+        return target;
+    }
+    string path = myBulkDir + "/" + name;
+    uv_fs_t req;
+    int fd = ::uv_fs_open(NetHandler::getUvLoop(), &req, path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644, nullptr);
+    ::uv_fs_req_cleanup(&req);
+    if (fd < 0)
+    {
+        cerr << "App: Cannot create " << path << " " << ::uv_err_name(fd) << endl;
+        return target;
+    }
+    myBulkFiles[&client_in] = fd;
+    target.fd = fd;
+    return target;
+}
+
+void NodeApp::bulkReceived(NetClientBase & client_in, BulkMessage const & msg_in, int status_in)
+{
+    auto file = myBulkFiles.find(&client_in);
+    if (file != myBulkFiles.end())
     {
-        vec.push_back(Endpoint(i->first));
+        uv_fs_t req;
+        ::uv_fs_close(NetHandler::getUvLoop(), &req, file->second, nullptr);
+        ::uv_fs_req_cleanup(&req);
+        myBulkFiles.erase(file);
+    }
+    ServerApp::bulkReceived(client_in, msg_in, status_in);
+}
+
+void NodeApp::peerRttMeasured(NetClientBase & client_in, uint32_t rttMs_in)
+{
+    myPeerStore.rttMeasured(client_in.getPeerId(), rttMs_in);
+}
+
+vector<EndpointId> NodeApp::getConnectedPeers() const
+{
+    // collect in a set to discard duplicates
+    set<EndpointId> peers;
+    for(auto i = myPeers.begin(); i != myPeers.end(); ++i)
+    {
+        if (i->myClient != nullptr && i->myClient->isConnected() && i->myClient->getCanonPeerId() != 0)
+        {
+            peers.insert(i->myClient->getCanonPeerId());
+        }
     }
-    return vec;
+    return vector<EndpointId>(peers.begin(), peers.end());
 }
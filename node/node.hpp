@@ -1,10 +1,18 @@
 #pragma once
 
 #include "endpoint.hpp"
+#include "hyparview.hpp"
+#include "peer_store.hpp"
 #include "../lib/app.hpp"
+#include "../lib/loop_timer.hpp"
+#include "../lib/pubsub.hpp"
+#include "../lib/uv_socket.hpp"
+
+#include <uv.h>
 
 #include <map>
 #include <memory>
+#include <set>
 #include <vector>
 #include <list>
 
@@ -12,7 +20,28 @@ namespace sample
 {
     class NetHandler; // forward
     class NetClientIn; // forward
+    class HandshakeResponseMessage; // forward
+    class PingResponseMessage; // forward
+    class OtherPeerMessage; // forward
+    class SubscribeMessage; // forward
+    class PublishMessage; // forward
+    class MembershipMessage; // forward
     class PeerClientOut; // forward
+    class SimNetwork; // forward
+
+    /// Snapshot of the state of a node, see NodeApp::getStatus
+    struct NodeStatus
+    {
+    public:
+        NodeStatus() : listenPort(0) { }
+        int listenPort;
+        /// Endpoints of the connected peer connections, in and out (canonical, if known)
+        std::vector<std::string> connectedPeers;
+        /// Known peer endpoints: peer candidates, or the active and passive views with membership
+        std::vector<std::string> knownPeers;
+        /// Membership active view, empty without membership
+        std::vector<std::string> activePeers;
+    };
 
     class NodeApp: public ServerApp
     {
@@ -22,17 +51,51 @@ namespace sample
         virtual void start(AppParams const & appParams_in);
         /// Stop the background thread loop, stop listening
         void stop();
+        /// Run on a private loop, for several nodes in one process.  Call before start.
+        void useOwnLoop();
+        /// Run as a host of a simulated network, on its thread and clock (see SimNetwork).  Call before start.
+        void useSimulation(SimNetwork & network_in, std::string const & host_in);
+        /// Current status, taken on the loop thread; can be called from any other thread, waits for it at most the given time.
+        /// Returns 0, or UV_ETIMEDOUT if the loop did not answer in time.
+        int getStatus(NodeStatus & status_out, int timeoutMs_in);
+        /// Print statistics (on the loop thread), can be called from any thread
+        virtual void printStats();
         void sendOtherPeers(NetClientBase & client_in);
+        /// Send a message to all connected peers (except one, optional), serialized only once
+        int broadcastMessage(BaseMessage const & msg_in, NetClientBase const * except_in = nullptr);
+        /// Called when a Ping round-trip to an outgoing peer is measured
+        void peerRttMeasured(NetClientBase & client_in, uint32_t rttMs_in);
+        /// Typed message handlers, registered in the constructor (see MessageHandlers); Ping is handled as in ServerApp
+        using ServerApp::handleMessage;
+        void handleMessage(NetClientBase & client_in, HandshakeMessage const & msg_in);
+        void handleMessage(NetClientBase & client_in, HandshakeResponseMessage const & msg_in);
+        void handleMessage(NetClientBase & client_in, PingResponseMessage const & msg_in);
+        void handleMessage(NetClientBase & client_in, OtherPeerMessage const & msg_in);
+        void handleMessage(NetClientBase & client_in, SubscribeMessage const & msg_in);
+        void handleMessage(NetClientBase & client_in, PublishMessage const & msg_in);
+        void handleMessage(NetClientBase & client_in, MembershipMessage const & msg_in);
+        /// Pub/sub, see PubSubRouter; can be called from any thread
+        void subscribe(std::string const & topic_in);
+        void unsubscribe(std::string const & topic_in);
+        void publish(std::string const & topic_in, std::string const & payload_in);
+        /// Send a file as bulk payload to all connected peers (with sendfile), can be called from any thread
+        void sendBulkFile(std::string const & path_in);
+        /// Incoming bulk payloads are stored in the bulk directory, if set
+        BulkTarget bulkReceiveStarted(NetClientBase & client_in, BulkMessage const & msg_in);
+        void bulkReceived(NetClientBase & client_in, BulkMessage const & msg_in, int status_in);
 
     protected:
         /// Called when server is listening on a port already
         virtual void listenStarted(int port);
         void addOutPeerCandidate(std::string host_in, int port_in, int toTry_in);
         void tryOutConnections();
-        bool isPeerConnected(std::string peerAddr_in, bool outDir_in);
+        bool isPeerConnected(EndpointId peer_in, bool outDir_in);
         int tryOutConnection(std::string host_in, int port_in);
         void debugPrintPeerCands();
         void debugPrintPeers();
+        /// Keep connections not in the active view this long, for requests and replies in flight
+        static const int MembershipGraceMs = 10000;
+        static const int MembershipTimerMs = 1000;
         /// Called when a new incoming connection is received
         void inConnectionReceived(std::shared_ptr<NetClientBase>& client_in);
         /// Called when an incoming connection has finished
@@ -41,7 +104,22 @@ namespace sample
         void messageReceived(NetClientBase & client_in, BaseMessage const & msg_in);
         // Send all known active out peer connections to this peer
         virtual std::string getName() { return myName; }
-        std::vector<Endpoint> getConnectedPeers() const;
+        /// Canonical endpoints of the connected peers, without duplicates
+        std::vector<EndpointId> getConnectedPeers() const;
+        /// Send to a peer connection, by connection ID (pub/sub link)
+        void sendToLink(uint32_t connId_in, SharedBuffer const & buf_in);
+        /// Send to a peer by endpoint; connects first if not connected (membership)
+        void sendToPeer(EndpointId peer_in, BaseMessage const & msg_in);
+        /// Close the connections to a peer
+        void disconnectPeer(EndpointId peer_in);
+        /// Connection to a peer (canonical endpoint), connected or connecting
+        NetClientBase* findPeerClient(EndpointId peer_in, bool connectedOnly_in) const;
+        bool isSelf(EndpointId peer_in) const;
+        /// Endpoint of a peer for the membership: localhost as 127.0.0.1, the same peer has the same ID
+        static EndpointId normalizeEndpoint(std::string const & host_in, int port_in);
+        /// Periodic membership work, and closing connections to peers not in the active view
+        void onMembershipTimer();
+        NodeStatus doGetStatus() const;
 
     protected:
         class PeerCandidateInfo
@@ -69,14 +147,33 @@ namespace sample
             // current connections
             std::shared_ptr<NetClientBase> myClient;
             bool myOutFlag;
+            uint64_t myAddedMs;
         };
 
     private:
         NetHandler* myNetHandler;
         std::string myName;
         // peer candidates (outgoing connections to try)
-        std::map<std::string, PeerCandidateInfo> myPeerCands;
+        std::map<EndpointId, PeerCandidateInfo> myPeerCands;
         // current peer connections
         std::list<PeerInfo> myPeers;
+        // serialized OtherPeer messages, by endpoint, reused for all peers
+        std::map<EndpointId, SharedBuffer> myOtherPeerBufs;
+        // persisted peer candidates, optional
+        PeerStore myPeerStore;
+        std::string myBulkDir;
+        // files of incoming bulk payloads, by connection
+        std::map<NetClientBase*, int> myBulkFiles;
+        // pub/sub routing, links are the handshaked peer connections
+        PubSubRouter myPubSub;
+        // bounded membership; not set if connecting to every known peer
+        std::unique_ptr<HyParView> myMembership;
+        std::vector<EndpointId> myContacts;
+        int myListenPort;
+        // own hosts, as seen by peers (formatted as by EndpointTable::getHost)
+        std::set<std::string> mySelfHosts;
+        // messages waiting for the connection to a peer
+        std::map<EndpointId, std::vector<SharedBuffer>> myPendingSends;
+        LoopTimer myMembershipTimer;
     };
 }
@@ -11,83 +11,53 @@ using namespace std;
 
 PeerClientOut::PeerClientOut(BaseApp* app_in, string const & host_in, int port_in) :
 NetClientOut(app_in, host_in, port_in, 1),
-mySendCounter(0),
-myTimer(nullptr)
+mySendCounter(0)
 {
 }
 
 PeerClientOut::~PeerClientOut()
 {
     //cout << "PeerClientOut::~PeerClientOut" << endl;
-    if (myTimer != nullptr)
-    {
-        uv_timer_stop(myTimer);
-        myTimer = nullptr;
-    }
-}
-
-void PeerClientOut::on_timer(uv_timer_t* handle)
-{
-    IUvSocket* uvSocket = (IUvSocket*)(handle->data);
-    //cout << "on_timer " << (long)handle << " " << (long)uvSocket << endl;
-    if (uvSocket == nullptr)
-    {
-        cerr << "Fatal error: uvSocket is nullptr " << endl;
-        //uv_close((uv_handle_t*)req->handle, NULL);
-        return;
-    }
-    uvSocket->onTimer(handle);
 }
 
 void PeerClientOut::onTimer(uv_timer_t* handle)
 {
     //cout << "onTimer " << myState << " " << isConnected() << " " << (long)handle << endl;
     PingMessage msg("Ping_from_" + myApp->getName() + "_to_" + getPeerAddr() + "_" + to_string(mySendCounter));
-    sendMessage(msg);
-    ((NodeApp*)myApp)->sendOtherPeers(*(dynamic_cast<NetClientBase*>(this)));
+    uint64_t sentTime = LoopTimer::now();
+    sendIdempotentRequest(msg, [this, sentTime](int status_in, BaseMessage const * response_in)
+    {
+        if (status_in == 0)
+        {
+            ((NodeApp*)myApp)->peerRttMeasured(*this, (uint32_t)(LoopTimer::now() - sentTime));
+        }
+    });
+    ((NodeApp*)myApp)->sendOtherPeers(*this);
 }
 
-void PeerClientOut::process()
+void PeerClientOut::process(Event event_in)
 {
-    //cout << "PeerClientOut::process " << myState << endl;
-    switch (myState)
+    //cout << "PeerClientOut::process " << getEventName(event_in) << endl;
+    switch (event_in)
     {
-        case State::Connected:
+        case Event::ConnectedEvent:
             {
-                myTimer = new uv_timer_t();
-                uv_timer_init(NetHandler::getUvLoop(), myTimer);
                 int pingPeriod = 3000; // ms
                 this->onTimer(nullptr);
-                myTimer->data = (void*)this;
-                //timer->data = (void*)dynamic_cast<IUvSocket*>(this);
-                uv_timer_start(myTimer, PeerClientOut::on_timer, pingPeriod, pingPeriod);
+                myTimer.start(pingPeriod, pingPeriod, [this]() { onTimer(nullptr); });
                 mySendCounter = 0;
                 HandshakeMessage msg("V01", getPeerAddr(), myApp->getName());
-                sendMessage(msg);
-                ((NodeApp*)myApp)->sendOtherPeers(*(dynamic_cast<NetClientBase*>(this)));
+                sendHandshake(msg);
+                ((NodeApp*)myApp)->sendOtherPeers(*this);
             }
             break;
 
-        case State::Sending:
+        case Event::WriteDoneEvent:
             ++mySendCounter;
-            doRead();
-            break;
-
-        case State::Sent:
-            doRead();
-            break;
-
-        case State::Receiving:
-            doRead();
-            break;
-
-        case State::Received:
             break;
 
         default:
-            cerr << "Fatal error: unhandled state " << myState << endl;
-            assert(false);
+            // responses are handled by the app, and by request callbacks
             break;
     }
-    return;
 }
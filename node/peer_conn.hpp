@@ -18,12 +18,11 @@ namespace sample
     public:
         PeerClientOut(BaseApp* app_in, std::string const & host_in, int port_in);
         virtual ~PeerClientOut();
-        virtual void process();
-        static void on_timer(uv_timer_t* handle);
-        virtual void onTimer(uv_timer_t* handle);
+        virtual void process(Event event_in);
+        void onTimer(uv_timer_t* handle) final;
 
     private:
         int mySendCounter;
-        uv_timer_t* myTimer;
+        LoopTimer myTimer;
     };
 }
@@ -0,0 +1,153 @@
+#include "peer_store.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+using namespace sample;
+using namespace std;
+
+
+static const char PeerStoreMagic[8] = { 'T', 'L', 'U', 'V', 'P', 'E', 'E', 'R' };
+
+PeerStore::PeerStore()
+{
+}
+
+int PeerStore::open(string const & path_in, uint32_t capacity_in)
+{
+    close();
+    size_t size = sizeof(PeerStoreHeader) + capacity_in * sizeof(PeerStoreRecord);
+    int res = myFile.open(path_in, size);
+    if (res)
+    {
+        cerr << "Could not open peer store " << path_in << " " << res << endl;
+        return res;
+    }
+    PeerStoreHeader* hdr = header();
+    size_t fileCapacity = (myFile.size() - sizeof(PeerStoreHeader)) / sizeof(PeerStoreRecord);
+    if (::memcmp(hdr->magic, PeerStoreMagic, sizeof(PeerStoreMagic)) != 0 || hdr->capacity > fileCapacity || hdr->count > hdr->capacity)
+    {
+        // new or invalid, initialize
+        ::memset(myFile.data(), 0, myFile.size());
+        ::memcpy(hdr->magic, PeerStoreMagic, sizeof(PeerStoreMagic));
+        hdr->capacity = (uint32_t)fileCapacity;
+        hdr->count = 0;
+    }
+    for (uint32_t i = 0; i < hdr->count; ++i)
+    {
+        PeerStoreRecord* r = record(i);
+        r->host[sizeof(r->host) - 1] = 0;
+        myIndex[EndpointTable::intern(r->host, r->port)] = i;
+    }
+    cout << "Peer store " << path_in << " loaded, " << hdr->count << " peers" << endl;
+    return 0;
+}
+
+void PeerStore::close()
+{
+    myFile.sync();
+    myFile.close();
+    myIndex.clear();
+}
+
+bool PeerStore::isBetter(PeerStoreRecord const & r1_in, PeerStoreRecord const & r2_in)
+{
+    if (r1_in.successCount != r2_in.successCount)
+    {
+        return r1_in.successCount > r2_in.successCount;
+    }
+    return r1_in.lastSeen > r2_in.lastSeen;
+}
+
+vector<PeerStoreRecord> PeerStore::getPeers() const
+{
+    vector<PeerStoreRecord> peers;
+    if (!isOpen())
+    {
+        return peers;
+    }
+    for (uint32_t i = 0; i < header()->count; ++i)
+    {
+        peers.push_back(*record(i));
+    }
+    sort(peers.begin(), peers.end(), PeerStore::isBetter);
+    return peers;
+}
+
+PeerStoreRecord* PeerStore::findOrAdd(EndpointId peer_in)
+{
+    if (!isOpen())
+    {
+        return nullptr;
+    }
+    auto i = myIndex.find(peer_in);
+    if (i != myIndex.end())
+    {
+        return record(i->second);
+    }
+    string const & host = EndpointTable::getHost(peer_in);
+    if (host.empty() || host.length() >= sizeof(PeerStoreRecord::host))
+    {
+        return nullptr;
+    }
+    PeerStoreHeader* hdr = header();
+    uint32_t idx = hdr->count;
+    if (hdr->count < hdr->capacity)
+    {
+        ++hdr->count;
+    }
+    else
+    {
+        // full, replace the worst one
+        if (hdr->capacity == 0)
+        {
+            return nullptr;
+        }
+        idx = 0;
+        for (uint32_t j = 1; j < hdr->count; ++j)
+        {
+            if (isBetter(*record(idx), *record(j)))
+            {
+                idx = j;
+            }
+        }
+        PeerStoreRecord* old = record(idx);
+        myIndex.erase(EndpointTable::intern(old->host, old->port));
+    }
+    PeerStoreRecord* r = record(idx);
+    ::memset(r, 0, sizeof(PeerStoreRecord));
+    ::strncpy(r->host, host.c_str(), sizeof(r->host) - 1);
+    r->port = EndpointTable::getPort(peer_in);
+    myIndex[peer_in] = idx;
+    return r;
+}
+
+void PeerStore::add(EndpointId peer_in)
+{
+    findOrAdd(peer_in);
+}
+
+void PeerStore::connectTried(EndpointId peer_in)
+{
+    PeerStoreRecord* r = findOrAdd(peer_in);
+    if (r == nullptr) return;
+    ++r->tryCount;
+}
+
+void PeerStore::connectSucceeded(EndpointId peer_in)
+{
+    PeerStoreRecord* r = findOrAdd(peer_in);
+    if (r == nullptr) return;
+    ++r->successCount;
+    r->lastSeen = (uint64_t)::time(nullptr);
+}
+
+void PeerStore::rttMeasured(EndpointId peer_in, uint32_t rttMs_in)
+{
+    PeerStoreRecord* r = findOrAdd(peer_in);
+    if (r == nullptr) return;
+    r->rttMs = rttMs_in;
+    r->lastSeen = (uint64_t)::time(nullptr);
+}
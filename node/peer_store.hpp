@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../lib/endpoint_table.hpp"
+#include "../lib/mapped_file.hpp"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace sample
+{
+    /**
+     * Peer store file format: a PeerStoreHeader, then a fixed number of PeerStoreRecord slots.
+     */
+    struct PeerStoreHeader
+    {
+        char magic[8];
+        uint32_t capacity;
+        uint32_t count;
+    };
+
+    struct PeerStoreRecord
+    {
+        char host[64]; // null-terminated
+        int32_t port;
+        uint32_t tryCount; // no of connection trials
+        uint32_t successCount; // no of successful connections (handshakes)
+        uint32_t rttMs; // last measured round-trip time, 0 if not known
+        uint64_t lastSeen; // time of last success or response, seconds since epoch
+    };
+
+    /**
+     * Persistent database of peer candidates, in a memory-mapped file.
+     * Loaded at start, updated in place as connections are tried and peers respond.
+     * When full, the least useful peer is replaced.
+     */
+    class PeerStore
+    {
+    public:
+        PeerStore();
+        int open(std::string const & path_in, uint32_t capacity_in);
+        void close();
+        bool isOpen() const { return myFile.isOpen(); }
+        /// All stored peers, best ones first (most successes, most recently seen)
+        std::vector<PeerStoreRecord> getPeers() const;
+        void add(EndpointId peer_in);
+        void connectTried(EndpointId peer_in);
+        void connectSucceeded(EndpointId peer_in);
+        void rttMeasured(EndpointId peer_in, uint32_t rttMs_in);
+
+    private:
+        PeerStoreHeader* header() const { return (PeerStoreHeader*)myFile.data(); }
+        PeerStoreRecord* record(uint32_t idx_in) const { return ((PeerStoreRecord*)(myFile.data() + sizeof(PeerStoreHeader))) + idx_in; }
+        /// Find record, add if not present; nullptr if the store is not open
+        PeerStoreRecord* findOrAdd(EndpointId peer_in);
+        static bool isBetter(PeerStoreRecord const & r1_in, PeerStoreRecord const & r2_in);
+
+    private:
+        MappedFile myFile;
+        // index of records, by endpoint
+        std::map<EndpointId, uint32_t> myIndex;
+    };
+}
@@ -0,0 +1,102 @@
+#include "pubsub_sim.hpp"
+
+#include <uv.h>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace sample;
+using namespace std;
+
+
+void usage()
+{
+    cout << "TCP LibUV PubSub Bench" << endl;
+    cout << "Usage:  tcp-libuv-pubsub-bench [options]" << endl;
+    cout << "  -nodes [n]         Number of simulated nodes.  Default: 128" << endl;
+    cout << "  -degree [n]        Average number of links per node.  Default: 6" << endl;
+    cout << "  -messages [n]      Number of messages published (from random nodes, on random topics).  Default: 20000" << endl;
+    cout << "  -topics [n]        Number of topics.  Default: 8" << endl;
+    cout << "  -subs [percent]    Share of nodes subscribed to each topic.  Default: 50" << endl;
+    cout << "  -seed [n]          Random seed.  Default: 1" << endl;
+    cout << "Simple example:" << endl;
+    cout << "  tcp-libuv-pubsub-bench -nodes 256 -subs 25" << endl;
+    cout << endl;
+}
+
+int main(int argn, char ** argc)
+{
+    usage();
+    int nodes = 128;
+    int degree = 6;
+    int messages = 20000;
+    int topics = 8;
+    int subsPercent = 50;
+    uint32_t seed = 1;
+    for (int i = 1; i < argn; ++i)
+    {
+        if (i + 1 >= argn) break;
+        string arg = argc[i];
+        if (arg == "-nodes") nodes = std::max(std::stoi(argc[++i]), 1);
+        else if (arg == "-degree") degree = std::stoi(argc[++i]);
+        else if (arg == "-messages") messages = std::stoi(argc[++i]);
+        else if (arg == "-topics") topics = std::max(std::stoi(argc[++i]), 1);
+        else if (arg == "-subs") subsPercent = std::min(std::max(std::stoi(argc[++i]), 0), 100);
+        else if (arg == "-seed") seed = (uint32_t)std::stoul(argc[++i]);
+    }
+
+    uint64_t setupStart = ::uv_hrtime();
+    PubSubSim sim(nodes, degree, seed);
+    mt19937 random(seed + 1);
+    uniform_int_distribution<int> pickNode(0, nodes - 1);
+    uniform_int_distribution<int> pickTopic(0, topics - 1);
+    uniform_int_distribution<int> pickPercent(0, 99);
+    vector<int> subscriberCount(topics, 0);
+    for (int t = 0; t < topics; ++t)
+    {
+        for (int n = 0; n < nodes; ++n)
+        {
+            if (pickPercent(random) < subsPercent)
+            {
+                sim.subscribe(n, "topic" + to_string(t));
+                ++subscriberCount[t];
+            }
+        }
+    }
+    size_t setupHandled = sim.run();
+    double setupMs = (::uv_hrtime() - setupStart) / 1e6;
+    cout << "Nodes " << nodes << ", links " << sim.getLinkCount() << ", topics " << topics << ", subscriptions sent " << setupHandled
+        << ", setup " << setupMs << " ms" << endl;
+
+    uint64_t expected = 0;
+    size_t handled = 0;
+    uint64_t bytesBefore = sim.getBytesSent();
+    uint64_t start = ::uv_hrtime();
+    for (int m = 0; m < messages; ++m)
+    {
+        int topic = pickTopic(random);
+        sim.publish(pickNode(random), "topic" + to_string(topic), "event_" + to_string(m));
+        expected += subscriberCount[topic];
+        handled += sim.run();
+    }
+    double elapsedSec = (::uv_hrtime() - start) / 1e9;
+
+    PubSubStats total = sim.getTotalStats();
+    cout << "Published " << total.published << " in " << elapsedSec * 1000 << " ms: " << (uint64_t)(total.published / elapsedSec) << " msg/s, "
+        << (uint64_t)(total.delivered / elapsedSec) << " deliveries/s, " << (uint64_t)(handled / elapsedSec) << " link messages/s" << endl;
+    cout << "Delivered " << total.delivered << " of " << expected << " (" << (expected > 0 ? 100.0 * total.delivered / expected : 0.0) << "%)"
+        << ", duplicates dropped " << total.duplicates << ", ttl-expired " << total.ttlExpired << endl;
+    cout << "Forwarded buffers " << total.forwarded << " (" << (double)total.forwarded / std::max(total.published, (uint64_t)1) << " per message), serialized "
+        << total.serialized << " (" << (double)total.forwarded / std::max(total.serialized, (uint64_t)1) << " links per buffer), bytes "
+        << sim.getBytesSent() - bytesBefore << endl;
+    if (total.delivered != expected)
+    {
+        // links lose nothing here, every subscriber has to get every message on its topic
+        cerr << "Error: delivered " << total.delivered << " of " << expected << endl;
+        return 1;
+    }
+    return 0;
+}
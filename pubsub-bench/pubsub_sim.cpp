@@ -0,0 +1,147 @@
+#include "pubsub_sim.hpp"
+
+#include "../lib/message.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace sample;
+using namespace std;
+
+
+PubSubSim::PubSubSim(int nodeCount_in, int degree_in, uint32_t seed_in) :
+myLinkCount(0),
+myNowMs(1),
+myBytesSent(0),
+myRandom(seed_in)
+{
+    myMessageHandlers.add<SubscribeMessage>(MessageType::Subscribe, this, &PubSubSim::handleMessage);
+    myMessageHandlers.add<PublishMessage>(MessageType::Publish, this, &PubSubSim::handleMessage);
+    myMessageHandlers.setDefault([this](SimLink const & link_in, BaseMessage const & msg_in) { handleMessage(link_in, msg_in); });
+    myNodes.resize(nodeCount_in);
+    for (uint32_t i = 0; i < (uint32_t)nodeCount_in; ++i)
+    {
+        SimNode & node = myNodes[i];
+        node.delivered = 0;
+        // link ID is the index of the neighbor node
+        node.router.reset(new PubSubRouter(i + 1,
+            [this, i](PubSubRouter::LinkId link_in, SharedBuffer const & buf_in) { send(i, link_in, buf_in); },
+            [this, i](PublishMessage const & msg_in) { ++myNodes[i].delivered; }));
+    }
+    if (nodeCount_in < 2)
+    {
+        return;
+    }
+    // ring
+    for (uint32_t i = 0; i < (uint32_t)nodeCount_in; ++i)
+    {
+        connect(i, (i + 1) % nodeCount_in);
+    }
+    // random links, until the average degree is reached
+    size_t target = (size_t)nodeCount_in * std::max(degree_in, 2) / 2;
+    uniform_int_distribution<uint32_t> pick(0, nodeCount_in - 1);
+    int tries = 0;
+    while (myLinkCount < target && tries < 100 * nodeCount_in)
+    {
+        ++tries;
+        connect(pick(myRandom), pick(myRandom));
+    }
+    run();
+}
+
+void PubSubSim::connect(uint32_t a_in, uint32_t b_in)
+{
+    if (a_in == b_in)
+    {
+        return;
+    }
+    vector<uint32_t> & na = myNodes[a_in].neighbors;
+    if (std::find(na.begin(), na.end(), b_in) != na.end())
+    {
+        return;
+    }
+    na.push_back(b_in);
+    myNodes[b_in].neighbors.push_back(a_in);
+    ++myLinkCount;
+    myNodes[a_in].router->linkAdded(b_in);
+    myNodes[b_in].router->linkAdded(a_in);
+}
+
+void PubSubSim::send(uint32_t from_in, uint32_t to_in, SharedBuffer const & buf_in)
+{
+    InFlight f;
+    f.to = to_in;
+    f.from = from_in;
+    f.buf = buf_in;
+    myQueue.push_back(f);
+    myBytesSent += buf_in->size();
+}
+
+void PubSubSim::subscribe(int node_in, string const & topic_in)
+{
+    myNodes[node_in].router->subscribe(topic_in);
+}
+
+void PubSubSim::publish(int node_in, string const & topic_in, string const & payload_in)
+{
+    ++myNowMs;
+    myNodes[node_in].router->publish(topic_in, payload_in, myNowMs);
+}
+
+size_t PubSubSim::run()
+{
+    size_t count = 0;
+    while (!myQueue.empty())
+    {
+        InFlight f = myQueue.front();
+        myQueue.pop_front();
+        ++count;
+        // as received on a connection: one line, without the terminator
+        size_t len = f.buf->size();
+        if (len > 0 && (*f.buf)[len - 1] == '\n') --len;
+        BaseMessage* msg = MessageDeserializer::parseLine(string((const char*)f.buf->data(), len));
+        if (msg == nullptr)
+        {
+            cerr << "Error: Unparseable message " << f.from << " -> " << f.to << endl;
+            continue;
+        }
+        SimLink link;
+        link.node = f.to;
+        link.from = f.from;
+        myMessageHandlers.dispatch(link, *msg);
+        delete msg;
+    }
+    return count;
+}
+
+void PubSubSim::handleMessage(SimLink const & link_in, SubscribeMessage const & msg_in)
+{
+    myNodes[link_in.node].router->onSubscribe(link_in.from, msg_in);
+}
+
+void PubSubSim::handleMessage(SimLink const & link_in, PublishMessage const & msg_in)
+{
+    myNodes[link_in.node].router->onPublish(link_in.from, msg_in, myNowMs);
+}
+
+void PubSubSim::handleMessage(SimLink const & link_in, BaseMessage const & msg_in)
+{
+    // not pub/sub, ignored
+}
+
+PubSubStats PubSubSim::getTotalStats() const
+{
+    PubSubStats total;
+    for (auto i = myNodes.begin(); i != myNodes.end(); ++i)
+    {
+        PubSubStats const & s = i->router->getStats();
+        total.published += s.published;
+        total.received += s.received;
+        total.delivered += s.delivered;
+        total.duplicates += s.duplicates;
+        total.ttlExpired += s.ttlExpired;
+        total.serialized += s.serialized;
+        total.forwarded += s.forwarded;
+    }
+    return total;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "../lib/message_handlers.hpp"
+#include "../lib/pubsub.hpp"
+#include "../lib/uv_socket.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace sample
+{
+    class BaseMessage; // forward
+    class SubscribeMessage; // forward
+    class PublishMessage; // forward
+
+    /**
+     * Pub/sub routers of many nodes in one process, connected with in-memory links (no sockets).
+     * Buffers sent on a link are queued, and parsed and handled by the receiving router in order,
+     * as they would be from a connection.
+     * Topology: a ring (so it is connected), plus random links up to the given degree.
+     */
+    class PubSubSim
+    {
+    public:
+        /// Context of a delivered message: receiving node, and its link to the sending one
+        struct SimLink
+        {
+        public:
+            uint32_t node;
+            uint32_t from;
+        };
+
+        PubSubSim(int nodeCount_in, int degree_in, uint32_t seed_in);
+        int getNodeCount() const { return (int)myNodes.size(); }
+        size_t getLinkCount() const { return myLinkCount; }
+        PubSubRouter & getRouter(int node_in) { return *myNodes[node_in].router; }
+        void subscribe(int node_in, std::string const & topic_in);
+        void publish(int node_in, std::string const & topic_in, std::string const & payload_in);
+        /// Handle queued buffers until there are none left; returns the number handled
+        size_t run();
+        uint64_t getDelivered(int node_in) const { return myNodes[node_in].delivered; }
+        /// Sum of the stats of all routers
+        PubSubStats getTotalStats() const;
+        uint64_t getBytesSent() const { return myBytesSent; }
+        /// Typed handlers, registered in the constructor, see MessageHandlers
+        void handleMessage(SimLink const & link_in, SubscribeMessage const & msg_in);
+        void handleMessage(SimLink const & link_in, PublishMessage const & msg_in);
+        void handleMessage(SimLink const & link_in, BaseMessage const & msg_in);
+
+    private:
+        void connect(uint32_t a_in, uint32_t b_in);
+        void send(uint32_t from_in, uint32_t to_in, SharedBuffer const & buf_in);
+
+    private:
+        struct SimNode
+        {
+        public:
+            std::unique_ptr<PubSubRouter> router;
+            std::vector<uint32_t> neighbors;
+            uint64_t delivered;
+        };
+
+        struct InFlight
+        {
+        public:
+            uint32_t to;
+            uint32_t from;
+            SharedBuffer buf;
+        };
+
+        std::vector<SimNode> myNodes;
+        size_t myLinkCount;
+        std::deque<InFlight> myQueue;
+        // simulated time, advances with each publish
+        uint64_t myNowMs;
+        uint64_t myBytesSent;
+        std::mt19937 myRandom;
+        MessageHandlers<SimLink const> myMessageHandlers;
+    };
+}
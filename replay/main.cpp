@@ -0,0 +1,62 @@
+#include "replay_app.hpp"
+
+#include <iostream>
+
+using namespace sample;
+using namespace std;
+
+
+void usage()
+{
+    cout << "TCP LibUV Replay" << endl;
+    cout << "Usage:  tcp-libuv-replay [capture-file] [options]" << endl;
+    cout << "  -host [host]       Server host.  Default: localhost" << endl;
+    cout << "  -port [port]       Server port.  Default: 5000" << endl;
+    cout << "  -fast              Send as fast as possible, instead of original pacing" << endl;
+    cout << "  -out               Replay the sent frames (capture of a client), instead of the received ones (capture of a server)" << endl;
+    cout << "Simple example:" << endl;
+    cout << "  tcp-libuv-replay node.cap -port 5000 -fast" << endl;
+    cout << endl;
+}
+
+int main(int argn, char ** argc)
+{
+    usage();
+    if (argn < 2)
+    {
+        return 1;
+    }
+    string capturePath = argc[1];
+    string host = "localhost";
+    AppParams appParams(5000, 1);
+    bool fast = false;
+    CaptureFile::Direction dir = CaptureFile::In;
+    for (int i = 2; i < argn; ++i)
+    {
+        if (string(argc[i]) == "-host")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            host = argc[i];
+        }
+        else if (string(argc[i]) == "-port")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.listenPort = std::stoi(argc[i]);
+        }
+        else if (string(argc[i]) == "-fast")
+        {
+            fast = true;
+        }
+        else if (string(argc[i]) == "-out")
+        {
+            dir = CaptureFile::Out;
+        }
+    }
+
+    ReplayApp app(capturePath, host, fast, dir);
+    app.start(appParams);
+
+    cout << "Done." << endl;
+}
@@ -0,0 +1,263 @@
+#include "replay_app.hpp"
+
+#include "../lib/net_handler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <map>
+
+using namespace sample;
+using namespace std;
+
+
+// wait this long for missing responses after the last frame
+static const int DrainTimeoutMs = 2000;
+
+ReplayClient::ReplayClient(ReplayApp* app_in, string const & host_in, int port_in) :
+NetClientOut(app_in, host_in, port_in, 0),
+myReplayApp(app_in),
+myNextFrame(0),
+myTimer(nullptr),
+myStarted(false)
+{
+}
+
+ReplayClient::~ReplayClient()
+{
+    stopTimer();
+}
+
+void ReplayClient::addFrame(uint64_t relTimeNs_in, const char* data_in, size_t len_in)
+{
+    Frame f;
+    f.myRelTimeNs = relTimeNs_in;
+    auto buf = make_shared<vector<uint8_t>>(data_in, data_in + len_in);
+    buf->push_back('\n');
+    f.myBuf = buf;
+    // requests with a response; see ServerApp::messageReceived
+    string frame(data_in, len_in);
+    f.myExpectResponse = (frame.substr(0, 7) == "HANDSH " || frame.substr(0, 5) == "PING ");
+    myFrames.push_back(f);
+}
+
+void ReplayClient::process(Event event_in)
+{
+    if (event_in == Event::ConnectedEvent && !myStarted)
+    {
+        myStarted = true;
+        myTimer = new uv_timer_t();
+        ::uv_timer_init(NetHandler::getUvLoop(), myTimer);
+        myTimer->data = (void*)asUvSocket();
+        doRead();
+        sendDue();
+    }
+    // other events: nothing to do, reading is in progress, sending is timer-driven
+}
+
+void ReplayClient::onTimer(uv_timer_t* handle)
+{
+    if (myNextFrame >= myFrames.size())
+    {
+        // drain timeout
+        myReplayApp->responseLost(myInFlight.size());
+        myInFlight.clear();
+        closeIfDone();
+        return;
+    }
+    sendDue();
+}
+
+void ReplayClient::sendDue()
+{
+    uint64_t now = ::uv_hrtime();
+    while (myNextFrame < myFrames.size())
+    {
+        Frame const & f = myFrames[myNextFrame];
+        if (!myReplayApp->isFast() && myReplayApp->getStartTimeNs() + f.myRelTimeNs > now)
+        {
+            break;
+        }
+        if (f.myExpectResponse)
+        {
+            myInFlight.push_back(now);
+        }
+        sendBuffer(f.myBuf);
+        myReplayApp->frameSent(f.myBuf->size());
+        ++myNextFrame;
+    }
+    if (myTimer == nullptr)
+    {
+        return;
+    }
+    if (myNextFrame < myFrames.size())
+    {
+        uint64_t due = myReplayApp->getStartTimeNs() + myFrames[myNextFrame].myRelTimeNs;
+        uint64_t delayMs = (due > now) ? (due - now + 999999) / 1000000 : 0;
+        ::uv_timer_start(myTimer, UvCallbacks<ReplayClient>::on_timer, delayMs, 0);
+        return;
+    }
+    if (!myInFlight.empty())
+    {
+        ::uv_timer_start(myTimer, UvCallbacks<ReplayClient>::on_timer, DrainTimeoutMs, 0);
+        return;
+    }
+    closeIfDone();
+}
+
+void ReplayClient::onResponse(BaseMessage const & msg_in)
+{
+    if (msg_in.getType() != MessageType::HandshakeResponse && msg_in.getType() != MessageType::PingResponse)
+    {
+        // unsolicited, e.g. OtherPeer
+        return;
+    }
+    if (myInFlight.empty())
+    {
+        return;
+    }
+    myReplayApp->responseReceived(::uv_hrtime() - myInFlight.front());
+    myInFlight.pop_front();
+    closeIfDone();
+}
+
+void ReplayClient::closeIfDone()
+{
+    if (myNextFrame >= myFrames.size() && myInFlight.empty())
+    {
+        stopTimer();
+        close();
+    }
+}
+
+void ReplayClient::stopTimer()
+{
+    if (myTimer == nullptr)
+    {
+        return;
+    }
+    ::uv_timer_stop(myTimer);
+    myTimer->data = nullptr;
+    ::uv_close((uv_handle_t*)myTimer, [](uv_handle_t* handle) { delete (uv_timer_t*)handle; });
+    myTimer = nullptr;
+}
+
+
+ReplayApp::ReplayApp(string const & capturePath_in, string const & host_in, bool fast_in, CaptureFile::Direction dir_in) :
+BaseApp(),
+myCapturePath(capturePath_in),
+myHost(host_in),
+myFast(fast_in),
+myDir(dir_in),
+myStartTimeNs(0),
+myFramesSent(0),
+myBytesSent(0),
+myResponsesLost(0)
+{
+}
+
+void ReplayApp::start(AppParams const & appParams_in)
+{
+    CaptureReader reader;
+    int res = reader.open(myCapturePath);
+    if (res)
+    {
+        cerr << "Could not open capture file " << myCapturePath << " " << res << endl;
+        return;
+    }
+    // one replay connection for each captured connection
+    map<uint32_t, shared_ptr<ReplayClient>> clients;
+    uint64_t firstTimeNs = 0;
+    CaptureRecordHeader const * rec;
+    const char* data;
+    while (reader.next(rec, data))
+    {
+        if (rec->direction != (uint8_t)myDir)
+        {
+            continue;
+        }
+        if (firstTimeNs == 0)
+        {
+            firstTimeNs = rec->timeNs;
+        }
+        auto cli = clients.find(rec->connId);
+        if (cli == clients.end())
+        {
+            clients[rec->connId] = make_shared<ReplayClient>(this, myHost, appParams_in.listenPort);
+            cli = clients.find(rec->connId);
+        }
+        cli->second->addFrame(rec->timeNs - firstTimeNs, data, rec->length);
+    }
+    cout << "Capture " << myCapturePath << ": " << reader.getRecordCount() << " records, " << clients.size() << " connections to replay" << endl;
+
+    myStartTimeNs = ::uv_hrtime();
+    for (auto i = clients.begin(); i != clients.end(); ++i)
+    {
+        myClients.push_back(i->second);
+        i->second->connect();
+    }
+
+    // run the loop, until all connections are done
+    NetHandler::runLoop();
+
+    printReport(::uv_hrtime() - myStartTimeNs);
+    myClients.clear();
+}
+
+void ReplayApp::connectionClosed(NetClientBase* client_in)
+{
+    for (auto i = myClients.begin(); i != myClients.end(); ++i)
+    {
+        if (i->get() == client_in)
+        {
+            (*i)->stopTimer();
+        }
+    }
+}
+
+void ReplayApp::messageReceived(NetClientBase & client_in, BaseMessage const & msg_in)
+{
+    // all connections of the replay app are ReplayClients
+    ReplayClient & cli = static_cast<ReplayClient &>(client_in);
+    cli.onResponse(msg_in);
+}
+
+void ReplayApp::frameSent(size_t len_in)
+{
+    ++myFramesSent;
+    myBytesSent += len_in;
+}
+
+void ReplayApp::responseReceived(uint64_t latencyNs_in)
+{
+    myLatencies.push_back(latencyNs_in);
+}
+
+void ReplayApp::responseLost(size_t count_in)
+{
+    myResponsesLost += count_in;
+}
+
+void ReplayApp::printReport(uint64_t elapsedNs_in)
+{
+    double elapsedSec = (double)elapsedNs_in / 1e9;
+    cout << "Replay " << (myFast ? "(fast)" : "(original pacing)") << " done in " << elapsedSec << " s" << endl;
+    cout << "  Frames sent:   " << myFramesSent << "  bytes " << myBytesSent << endl;
+    if (elapsedSec > 0)
+    {
+        cout << "  Throughput:    " << (double)myFramesSent / elapsedSec << " msg/s  " << (double)myBytesSent / elapsedSec / 1e6 << " MB/s" << endl;
+    }
+    cout << "  Responses:     " << myLatencies.size() << "  lost " << myResponsesLost << endl;
+    if (myLatencies.empty())
+    {
+        return;
+    }
+    sort(myLatencies.begin(), myLatencies.end());
+    uint64_t sum = 0;
+    for (auto i = myLatencies.begin(); i != myLatencies.end(); ++i) sum += *i;
+    size_t n = myLatencies.size();
+    cout << "  Latency (us):  avg " << sum / n / 1000
+        << "  p50 " << myLatencies[n / 2] / 1000
+        << "  p99 " << myLatencies[std::min(n - 1, n * 99 / 100)] / 1000
+        << "  max " << myLatencies[n - 1] / 1000 << endl;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "../lib/app.hpp"
+#include "../lib/capture.hpp"
+#include "../lib/net_client.hpp"
+
+#include <uv.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sample
+{
+    class ReplayApp; // forward
+
+    /**
+     * Outgoing connection replaying the captured frames of one original connection.
+     */
+    class ReplayClient: public NetClientOut
+    {
+    public:
+        ReplayClient(ReplayApp* app_in, std::string const & host_in, int port_in);
+        virtual ~ReplayClient();
+        /// Add a frame to send, at the given time relative to replay start
+        void addFrame(uint64_t relTimeNs_in, const char* data_in, size_t len_in);
+        virtual void process(Event event_in);
+        void onTimer(uv_timer_t* handle) final;
+        void onResponse(BaseMessage const & msg_in);
+        void stopTimer();
+
+    private:
+        /// Send all frames which are due; schedule the timer for the next one
+        void sendDue();
+        void closeIfDone();
+
+    private:
+        class Frame
+        {
+        public:
+            uint64_t myRelTimeNs;
+            SharedBuffer myBuf;
+            bool myExpectResponse;
+        };
+
+        ReplayApp* myReplayApp;
+        std::vector<Frame> myFrames;
+        size_t myNextFrame;
+        // send times of requests waiting for response, in order
+        std::deque<uint64_t> myInFlight;
+        uv_timer_t* myTimer;
+        bool myStarted;
+    };
+
+    /**
+     * Replays a capture file against a server, and reports throughput and latency.
+     */
+    class ReplayApp: public BaseApp
+    {
+    public:
+        /// fast_in: send as fast as possible, instead of the original pacing
+        ReplayApp(std::string const & capturePath_in, std::string const & host_in, bool fast_in, CaptureFile::Direction dir_in);
+        /// Connect to the server (listenPort), replay the capture, return when all is done
+        virtual void start(AppParams const & appParams_in);
+        void inConnectionReceived(std::shared_ptr<NetClientBase>& client_in) { }
+        void connectionClosed(NetClientBase* client_in);
+        void messageReceived(NetClientBase & client_in, BaseMessage const & msg_in);
+        virtual std::string getName() { return "replay"; }
+        bool isFast() const { return myFast; }
+        uint64_t getStartTimeNs() const { return myStartTimeNs; }
+        void frameSent(size_t len_in);
+        void responseReceived(uint64_t latencyNs_in);
+        void responseLost(size_t count_in);
+
+    private:
+        void printReport(uint64_t elapsedNs_in);
+
+    private:
+        std::string myCapturePath;
+        std::string myHost;
+        bool myFast;
+        CaptureFile::Direction myDir;
+        uint64_t myStartTimeNs;
+        std::vector<std::shared_ptr<ReplayClient>> myClients;
+        uint64_t myFramesSent;
+        uint64_t myBytesSent;
+        uint64_t myResponsesLost;
+        std::vector<uint64_t> myLatencies;
+    };
+}
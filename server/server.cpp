@@ -1,19 +1,167 @@
 #include "../lib/app.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <string>
 
 using namespace sample;
 using namespace std;
 
-int main()
+int main(int argn, char ** argc)
 {
     cout << "TCP LibUV Server" << endl;
 
+    AppParams appParams(5000, 5);
+    for (int i = 0; i < argn; ++i)
+    {
+        if (string(argc[i]) == "-capture")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.captureFile = argc[i];
+        }
+        else if (string(argc[i]) == "-capture-sample")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.captureSampleEvery = std::max(std::stoi(argc[i]), 1);
+        }
+        else if (string(argc[i]) == "-iobackend")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.ioBackend = argc[i];
+        }
+        else if (string(argc[i]) == "-loopcpus")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.loopCpus = argc[i];
+        }
+        else if (string(argc[i]) == "-workercpus")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.workerCpus = argc[i];
+        }
+        else if (string(argc[i]) == "-threadpool")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.threadpoolSize = std::max(std::stoi(argc[i]), 0);
+        }
+        else if (string(argc[i]) == "-ratemsgs")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.rateLimitMessages = std::max(std::stod(argc[i]), 0.0);
+        }
+        else if (string(argc[i]) == "-ratebytes")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.rateLimitBytes = std::max(std::stod(argc[i]), 0.0);
+        }
+        else if (string(argc[i]) == "-rateclass")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.rateLimitClasses = argc[i];
+        }
+        else if (string(argc[i]) == "-rateaction")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.rateLimitAction = argc[i];
+        }
+        else if (string(argc[i]) == "-rateburst")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.rateLimitBurstMs = std::max(std::stoi(argc[i]), 1);
+        }
+        else if (string(argc[i]) == "-sendsched")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.sendScheduling = argc[i];
+        }
+        else if (string(argc[i]) == "-sendwindow")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.sendWindowBytes = (size_t)std::stoul(argc[i]);
+        }
+        else if (string(argc[i]) == "-trace")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.traceFile = argc[i];
+        }
+        else if (string(argc[i]) == "-stallms")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.loopStallMs = std::max(std::stoi(argc[i]), 0);
+        }
+        else if (string(argc[i]) == "-tracesize")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.traceEvents = (size_t)std::stoul(argc[i]);
+        }
+        else if (string(argc[i]) == "-readbufmin")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.readBufferMin = (size_t)std::stoul(argc[i]);
+        }
+        else if (string(argc[i]) == "-readbufmax")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.readBufferMax = (size_t)std::stoul(argc[i]);
+        }
+        else if (string(argc[i]) == "-reqtimeout")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.requestTimeoutMs = std::stoi(argc[i]);
+        }
+        else if (string(argc[i]) == "-reqretries")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.requestRetries = std::stoi(argc[i]);
+        }
+        else if (string(argc[i]) == "-reqcloseafter")
+        {
+            if (i + 1 >= argn) break;
+            ++i;
+            appParams.requestCloseAfter = std::stoi(argc[i]);
+        }
+    }
+
+    ServerApp::applyConnectionParams(appParams);
     ServerApp app;
-    app.start(AppParams(5000, 5));
+    app.start(appParams);
 
-    cout << "Press Enter to exit ...";
-    cin.get();
+    cout << "Press Enter to exit, s + Enter to print stats, trace <file> + Enter to write the trace ..." << endl;
+    string line;
+    while (getline(cin, line))
+    {
+        if (line == "s")
+        {
+            app.printStats();
+            continue;
+        }
+        if (line.substr(0, 6) == "trace " && line.length() > 6)
+        {
+            ServerApp::writeTrace(line.substr(6));
+            continue;
+        }
+        break;
+    }
     cout << endl;
 
     app.stop();